@@ -0,0 +1,640 @@
+/******************************************************************************
+* Allocator benchmark
+*
+* Measures throughput, latency percentiles and memory overhead of the
+* allocators in fp_allocator.h against malloc.
+*
+* Build (Linux):   g++ -O2 -pthread bench/bench_allocator.cpp -o bench_allocator
+* Build (Windows): cl /O2 bench\bench_allocator.cpp
+*
+* Usage: bench_allocator [--quick]
+*
+* Every result is printed as a single JSON object per line to stdout, so the
+* output can be collected and compared between revisions.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#include "../src/fp_core.h"
+#include "../src/fp_allocator.h"
+
+#if defined(_WIN32)
+#include "../src/fp_win32.h"
+#else
+#include "../src/fp_linux.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+// Latency is measured over small batches of operations. Reading the timer
+// for every single arena allocation would mostly measure the timer itself.
+static const u64 LATENCY_BATCH = 16;
+
+static u64 g_pageSize;
+static double g_nanosecondsPerTick;
+
+/**
+ * Allocator that forwards to a base allocator and tracks how many bytes are
+ * currently obtained from it. This is used to determine the memory overhead.
+ */
+struct CountingAllocator : Allocator
+{
+    Allocator* base;
+    u64 granularity;
+    u64 current;
+    u64 peak;
+};
+
+static u64 roundUp(u64 value, u64 granularity)
+{
+    return (value + granularity - 1) / granularity * granularity;
+}
+
+static CountingAllocator createCountingAllocator(Allocator* base, u64 granularity)
+{
+    CountingAllocator result = {};
+    result.base = base;
+    result.granularity = granularity;
+
+    result.allocateFunction = +[](Allocator* context, u64 size) -> void*
+    {
+        CountingAllocator* allocator = (CountingAllocator*)context;
+
+        void* memory = allocator->base->allocate(size);
+        if (memory)
+        {
+            allocator->current += roundUp(size, allocator->granularity);
+            if (allocator->current > allocator->peak)
+            {
+                allocator->peak = allocator->current;
+            }
+        }
+        return memory;
+    };
+    result.freeFunction = +[](Allocator* context, void* data, u64 size)
+    {
+        CountingAllocator* allocator = (CountingAllocator*)context;
+
+        allocator->base->free(data, size);
+        allocator->current -= roundUp(size, allocator->granularity);
+    };
+    return result;
+}
+
+/**
+ * malloc wrapped into the Allocator interface.
+ *
+ * The memory is counted with malloc_usable_size() plus the chunk header where
+ * available, otherwise only the requested size is counted.
+ */
+struct MallocAllocator : Allocator
+{
+    u64 current;
+    u64 peak;
+};
+
+static u64 mallocFootprint(void* data, u64 size)
+{
+#if defined(__GLIBC__)
+    return malloc_usable_size(data) + sizeof(size_t);
+#else
+    return size;
+#endif
+}
+
+static MallocAllocator createMallocAllocator()
+{
+    MallocAllocator result = {};
+    result.allocateFunction = +[](Allocator* context, u64 size) -> void*
+    {
+        MallocAllocator* allocator = (MallocAllocator*)context;
+
+        void* memory = malloc(size);
+        if (memory)
+        {
+            allocator->current += mallocFootprint(memory, size);
+            if (allocator->current > allocator->peak)
+            {
+                allocator->peak = allocator->current;
+            }
+        }
+        return memory;
+    };
+    result.freeFunction = +[](Allocator* context, void* data, u64 size)
+    {
+        MallocAllocator* allocator = (MallocAllocator*)context;
+
+        allocator->current -= mallocFootprint(data, size);
+        free(data);
+    };
+    return result;
+}
+
+enum SubjectKind
+{
+    Subject_Malloc,
+    Subject_Page,
+    Subject_Arena,
+    Subject_DynamicArena,
+    Subject_ArenaWithFallback,
+};
+
+static const char* SUBJECT_NAMES[] = {
+    "malloc",
+    "page",
+    "arena",
+    "dynamic_arena",
+    "arena_with_fallback",
+};
+
+/**
+ * An allocator under test together with the state needed to reset and destroy
+ * it. Each benchmark thread owns its own subject.
+ */
+struct Subject
+{
+    SubjectKind kind;
+    u64 arenaSize;
+
+    Allocator pageAllocator;
+    CountingAllocator counting;
+    MallocAllocator mallocAllocator;
+
+    ArenaAllocator arena;
+    DynamicArenaAllocator dynamicArena;
+    ArenaWithFallbackAllocator arenaWithFallback;
+
+    u64 arenaPeakUsed;
+
+    Allocator* allocator;
+};
+
+// Capacity of the fixed ArenaAllocator, it has to hold an entire workload
+static const u64 FIXED_ARENA_CAPACITY = 256 * MB;
+
+static void initSubject(Subject* subject, SubjectKind kind, u64 arenaSize)
+{
+    *subject = {};
+    subject->kind = kind;
+    subject->arenaSize = arenaSize;
+    subject->pageAllocator = createPageAllocator();
+    subject->counting = createCountingAllocator(&subject->pageAllocator, g_pageSize);
+
+    switch (kind)
+    {
+    case Subject_Malloc:
+        subject->mallocAllocator = createMallocAllocator();
+        subject->allocator = &subject->mallocAllocator;
+        break;
+
+    case Subject_Page:
+        subject->allocator = &subject->counting;
+        break;
+
+    case Subject_Arena:
+    {
+        // Memory is reserved up front, but pages are only touched when used
+        void* memory = subject->pageAllocator.allocate(FIXED_ARENA_CAPACITY);
+        subject->arena = createArenaAllocator(memory, FIXED_ARENA_CAPACITY);
+        subject->allocator = &subject->arena;
+    } break;
+
+    case Subject_DynamicArena:
+        subject->dynamicArena = createDynamicArenaAllocator(&subject->counting, arenaSize);
+        subject->allocator = &subject->dynamicArena;
+        break;
+
+    case Subject_ArenaWithFallback:
+        subject->arenaWithFallback = createArenaWithFallbackAllocator(&subject->counting, arenaSize);
+        subject->allocator = &subject->arenaWithFallback;
+        break;
+    }
+}
+
+// Bulk free at the end of a frame. Individual frees were already issued.
+static void resetSubject(Subject* subject)
+{
+    switch (subject->kind)
+    {
+    case Subject_Arena:
+        if (subject->arena.used > subject->arenaPeakUsed)
+        {
+            subject->arenaPeakUsed = subject->arena.used;
+        }
+        subject->arena.reset();
+        break;
+
+    case Subject_DynamicArena:
+        subject->dynamicArena.reset();
+        break;
+
+    case Subject_ArenaWithFallback:
+        subject->arenaWithFallback.reset();
+        break;
+
+    default:
+        break;
+    }
+}
+
+// Bytes obtained from the operating system at peak
+static u64 subjectPeakBytes(Subject* subject)
+{
+    switch (subject->kind)
+    {
+    case Subject_Malloc:
+        return subject->mallocAllocator.peak;
+
+    case Subject_Arena:
+    {
+        // Only the touched pages of the fixed arena are resident
+        u64 used = subject->arena.used > subject->arenaPeakUsed ? subject->arena.used : subject->arenaPeakUsed;
+        return roundUp(used, g_pageSize);
+    }
+
+    default:
+        return subject->counting.peak;
+    }
+}
+
+static void destroySubject(Subject* subject)
+{
+    switch (subject->kind)
+    {
+    case Subject_Arena:
+        subject->pageAllocator.free(subject->arena.data, subject->arena.size);
+        break;
+
+    case Subject_DynamicArena:
+    case Subject_ArenaWithFallback:
+    {
+        DynamicArenaAllocator* dynamicArena = subject->kind == Subject_DynamicArena
+            ? &subject->dynamicArena
+            : &subject->arenaWithFallback.arena;
+        dynamicArena->reset();
+        if (dynamicArena->current)
+        {
+            subject->counting.free(dynamicArena->current->data, dynamicArena->current->size);
+        }
+    } break;
+
+    default:
+        break;
+    }
+}
+
+enum WorkloadKind
+{
+    Workload_Bump,
+    Workload_FrameReset,
+    Workload_MixedSizes,
+};
+
+static const char* WORKLOAD_NAMES[] = {
+    "bump",
+    "frame_reset",
+    "mixed_sizes",
+};
+
+struct Workload
+{
+    WorkloadKind kind;
+    u64 frames;
+    u64 allocationsPerFrame;
+    u64 seed;
+};
+
+/**
+ * Small allocations dominate, with an occasional large one that exceeds
+ * small arena sizes. This resembles command and vertex data in the renderer.
+ */
+static u64 mixedSize(u64* state)
+{
+    // xorshift64
+    u64 x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+
+    u64 bucket = x % 100;
+    if (bucket < 60) return 16 + (x >> 8) % 112;      // 16 - 127 bytes
+    if (bucket < 90) return 128 + (x >> 8) % 896;     // 128 - 1023 bytes
+    if (bucket < 99) return 1024 + (x >> 8) % 7168;   // 1 - 8 KB
+    return 16 * KB + (x >> 8) % (48 * KB);            // 16 - 64 KB
+}
+
+struct Allocation
+{
+    void* data;
+    u64 size;
+};
+
+struct RunResult
+{
+    u64 operations;
+    u64 failed;
+    u64 ticks;
+    u64 requestedPeak;
+    u64 reservedPeak;
+
+    // Latency of each batch in ticks
+    u64* batchTicks;
+    u64 batchCount;
+};
+
+static void runWorkload(Subject* subject, Workload* workload, RunResult* result)
+{
+    Allocator* allocator = subject->allocator;
+
+    u64 perFrame = workload->allocationsPerFrame;
+    Allocation* allocations = (Allocation*)calloc(perFrame, sizeof(Allocation));
+
+    u64 batchesPerFrame = (perFrame + LATENCY_BATCH - 1) / LATENCY_BATCH;
+    result->batchTicks = (u64*)calloc(workload->frames * batchesPerFrame, sizeof(u64));
+    result->batchCount = 0;
+
+    u64 rng = workload->seed;
+
+    for (u64 frame = 0; frame < workload->frames; ++frame)
+    {
+        // Sizes are determined before timing, so the RNG is not measured
+        u64 requested = 0;
+        for (u64 i = 0; i < perFrame; ++i)
+        {
+            u64 size = workload->kind == Workload_MixedSizes ? mixedSize(&rng) : 32;
+            allocations[i].size = size;
+            requested += size;
+        }
+        if (requested > result->requestedPeak)
+        {
+            result->requestedPeak = requested;
+        }
+
+        u64 frameStart = getPerformanceCounter();
+
+        for (u64 begin = 0; begin < perFrame; begin += LATENCY_BATCH)
+        {
+            u64 end = begin + LATENCY_BATCH < perFrame ? begin + LATENCY_BATCH : perFrame;
+
+            u64 batchStart = getPerformanceCounter();
+            for (u64 i = begin; i < end; ++i)
+            {
+                void* data = allocator->allocate(allocations[i].size);
+                allocations[i].data = data;
+                if (data)
+                {
+                    // Touch the memory, otherwise lazy page commits are not measured
+                    *(volatile u8*)data = (u8)i;
+                }
+            }
+            result->batchTicks[result->batchCount] = getPerformanceCounter() - batchStart;
+            result->batchCount += 1;
+        }
+
+        if (workload->kind != Workload_Bump)
+        {
+            for (u64 i = 0; i < perFrame; ++i)
+            {
+                if (allocations[i].data)
+                {
+                    allocator->free(allocations[i].data, allocations[i].size);
+                }
+                else
+                {
+                    result->failed += 1;
+                }
+            }
+            resetSubject(subject);
+        }
+        else
+        {
+            for (u64 i = 0; i < perFrame; ++i)
+            {
+                if (!allocations[i].data)
+                {
+                    result->failed += 1;
+                }
+            }
+        }
+
+        result->ticks += getPerformanceCounter() - frameStart;
+        result->operations += perFrame;
+    }
+
+    result->reservedPeak = subjectPeakBytes(subject);
+
+    // The bump workload never frees, release everything outside the timing
+    if (workload->kind == Workload_Bump && subject->kind <= Subject_Page)
+    {
+        for (u64 i = 0; i < perFrame; ++i)
+        {
+            if (allocations[i].data)
+            {
+                allocator->free(allocations[i].data, allocations[i].size);
+            }
+        }
+    }
+
+    free(allocations);
+}
+
+static int compareU64(const void* a, const void* b)
+{
+    u64 left = *(const u64*)a;
+    u64 right = *(const u64*)b;
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+static double percentileNanoseconds(u64* sortedTicks, u64 count, double percentile)
+{
+    if (count == 0)
+    {
+        return 0.0;
+    }
+    u64 index = (u64)(percentile * (count - 1));
+    return sortedTicks[index] * g_nanosecondsPerTick / LATENCY_BATCH;
+}
+
+static void printResult(Subject* subject, Workload* workload, u32 threadCount, RunResult* results)
+{
+    RunResult total = {};
+    u64 maxTicks = 0;
+    for (u32 t = 0; t < threadCount; ++t)
+    {
+        total.operations += results[t].operations;
+        total.failed += results[t].failed;
+        total.requestedPeak += results[t].requestedPeak;
+        total.reservedPeak += results[t].reservedPeak;
+        total.batchCount += results[t].batchCount;
+        if (results[t].ticks > maxTicks)
+        {
+            maxTicks = results[t].ticks;
+        }
+    }
+
+    u64* allBatches = (u64*)malloc((total.batchCount + 1) * sizeof(u64));
+    u64 offset = 0;
+    for (u32 t = 0; t < threadCount; ++t)
+    {
+        memcpy(allBatches + offset, results[t].batchTicks, results[t].batchCount * sizeof(u64));
+        offset += results[t].batchCount;
+    }
+    qsort(allBatches, total.batchCount, sizeof(u64), compareU64);
+
+    // Threads run concurrently, so the slowest thread determines the wall time
+    double seconds = maxTicks * g_nanosecondsPerTick * 1e-9;
+    double opsPerSecond = seconds > 0.0 ? total.operations / seconds : 0.0;
+    double overhead = total.requestedPeak > 0 ? (double)total.reservedPeak / total.requestedPeak : 0.0;
+
+    printf("{\"benchmark\":\"allocator\",\"workload\":\"%s\",\"allocator\":\"%s\",\"arena_size\":%llu,"
+        "\"threads\":%u,\"operations\":%llu,\"failed\":%llu,\"seconds\":%.6f,\"ops_per_sec\":%.0f,"
+        "\"p50_ns\":%.2f,\"p90_ns\":%.2f,\"p99_ns\":%.2f,\"p999_ns\":%.2f,\"max_ns\":%.2f,"
+        "\"requested_bytes\":%llu,\"reserved_bytes\":%llu,\"overhead\":%.3f}\n",
+        WORKLOAD_NAMES[workload->kind], SUBJECT_NAMES[subject->kind], (unsigned long long)subject->arenaSize,
+        threadCount, (unsigned long long)total.operations, (unsigned long long)total.failed, seconds, opsPerSecond,
+        percentileNanoseconds(allBatches, total.batchCount, 0.50),
+        percentileNanoseconds(allBatches, total.batchCount, 0.90),
+        percentileNanoseconds(allBatches, total.batchCount, 0.99),
+        percentileNanoseconds(allBatches, total.batchCount, 0.999),
+        percentileNanoseconds(allBatches, total.batchCount, 1.0),
+        (unsigned long long)total.requestedPeak, (unsigned long long)total.reservedPeak, overhead);
+    fflush(stdout);
+
+    free(allBatches);
+}
+
+struct ThreadWork
+{
+    SubjectKind kind;
+    u64 arenaSize;
+    Workload workload;
+    Subject subject;
+    RunResult result;
+};
+
+static void threadWork(void* parameter)
+{
+    ThreadWork* work = (ThreadWork*)parameter;
+
+    initSubject(&work->subject, work->kind, work->arenaSize);
+    runWorkload(&work->subject, &work->workload, &work->result);
+    destroySubject(&work->subject);
+}
+
+static void runBenchmark(SubjectKind kind, u64 arenaSize, Workload workload, u32 threadCount)
+{
+    // The page allocator issues a system call per allocation, keep it short
+    if (kind == Subject_Page)
+    {
+        workload.frames = workload.frames / 16 > 0 ? workload.frames / 16 : 1;
+        workload.allocationsPerFrame = workload.allocationsPerFrame / 16 > 0 ? workload.allocationsPerFrame / 16 : 1;
+    }
+
+    ThreadWork* works = (ThreadWork*)calloc(threadCount, sizeof(ThreadWork));
+    Thread* threads = (Thread*)calloc(threadCount, sizeof(Thread));
+    RunResult* results = (RunResult*)calloc(threadCount, sizeof(RunResult));
+
+    for (u32 t = 0; t < threadCount; ++t)
+    {
+        works[t].kind = kind;
+        works[t].arenaSize = arenaSize;
+        works[t].workload = workload;
+        works[t].workload.seed = workload.seed + t;
+    }
+
+    if (threadCount == 1)
+    {
+        threadWork(&works[0]);
+    }
+    else
+    {
+        for (u32 t = 0; t < threadCount; ++t)
+        {
+            startThread(&threads[t], &threadWork, &works[t]);
+        }
+        for (u32 t = 0; t < threadCount; ++t)
+        {
+            joinThread(&threads[t]);
+        }
+    }
+
+    for (u32 t = 0; t < threadCount; ++t)
+    {
+        results[t] = works[t].result;
+    }
+
+    Subject description = {};
+    description.kind = kind;
+    description.arenaSize = arenaSize;
+    printResult(&description, &workload, threadCount, results);
+
+    for (u32 t = 0; t < threadCount; ++t)
+    {
+        free(works[t].result.batchTicks);
+    }
+    free(results);
+    free(threads);
+    free(works);
+}
+
+static void runAllSubjects(Workload workload, u32 threadCount)
+{
+    static const u64 ARENA_SIZES[] = { 4 * KB, 64 * KB, 1 * MB };
+
+    runBenchmark(Subject_Malloc, 0, workload, threadCount);
+    runBenchmark(Subject_Page, 0, workload, threadCount);
+    runBenchmark(Subject_Arena, FIXED_ARENA_CAPACITY, workload, threadCount);
+    for (u64 arenaSize : ARENA_SIZES)
+    {
+        runBenchmark(Subject_DynamicArena, arenaSize, workload, threadCount);
+    }
+    for (u64 arenaSize : ARENA_SIZES)
+    {
+        runBenchmark(Subject_ArenaWithFallback, arenaSize, workload, threadCount);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    u64 scale = quick ? 16 : 1;
+
+    g_pageSize = getPageSize();
+    g_nanosecondsPerTick = 1e9 / (double)getPerformanceFrequency();
+
+    Workload bump = {};
+    bump.kind = Workload_Bump;
+    bump.frames = 1;
+    bump.allocationsPerFrame = 1000000 / scale;
+    bump.seed = 0x9E3779B97F4A7C15ULL;
+
+    Workload frameReset = {};
+    frameReset.kind = Workload_FrameReset;
+    frameReset.frames = 200 / scale;
+    frameReset.allocationsPerFrame = 10000;
+    frameReset.seed = 0x9E3779B97F4A7C15ULL;
+
+    Workload mixed = frameReset;
+    mixed.kind = Workload_MixedSizes;
+
+    runAllSubjects(bump, 1);
+    runAllSubjects(frameReset, 1);
+    runAllSubjects(mixed, 1);
+
+    // Each thread owns its allocator, malloc and the page allocator are shared
+    u32 threadCount = getProcessorCount();
+    if (threadCount < 2) threadCount = 2;
+    if (threadCount > 8) threadCount = 8;
+    runAllSubjects(frameReset, threadCount);
+    runAllSubjects(mixed, threadCount);
+
+    return 0;
+}
@@ -0,0 +1,169 @@
+/******************************************************************************
+* Clipping benchmark
+*
+* Records a UI of scrolled list panels, each inside its own clip rect, and
+* renders it once with clipped rectangles trimmed on the CPU and once with
+* the hardware scissor for everything inside a clip rect. Reports the time to
+* record the commands, the render time, the state batches of both modes and
+* the draws saved by trimming. Only the rounded row backgrounds that cross a
+* panel edge still need the scissor when trimming.
+*
+* Runs headless, e.g. on Mesa llvmpipe.
+*
+* Build: g++ -O2 -mavx2 -pthread bench/bench_clipping.cpp -lEGL -lGL -o bench_clipping
+* Usage: bench_clipping [--quick]
+*
+* Every result is printed as a single JSON object per line to stdout.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#include "../src/fp_core.h"
+#include "../src/fp_allocator.h"
+#include "../src/fp_egl.h"
+#include "../src/fp_renderer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int WIDTH = 1280;
+static const int HEIGHT = 720;
+static const int ROWS_PER_PANEL = 40;
+
+static int compareU64(const void* a, const void* b) {
+    u64 left = *(const u64*)a;
+    u64 right = *(const u64*)b;
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+static double medianSeconds(u64* ticks, int count) {
+    qsort(ticks, count, sizeof(u64), compareU64);
+    return (double)ticks[count / 2] / (double)getPerformanceFrequency();
+}
+
+// Panels on a grid, their rows are scrolled by a different amount each
+static void fillPanels(RenderCommandBuffer* commands, int panelCount) {
+    int columns = 1;
+    while (columns * columns < panelCount) {
+        columns += 1;
+    }
+    float panelWidth = (float)WIDTH / columns;
+    float panelHeight = (float)HEIGHT / ((panelCount + columns - 1) / columns);
+
+    for (int panel = 0; panel < panelCount; ++panel) {
+        float panelX = panelWidth * (panel % columns);
+        float panelY = panelHeight * (panel / columns);
+        commands->pushClip(panelX + 2.0f, panelY + 2.0f, panelWidth - 4.0f, panelHeight - 4.0f);
+
+        float scroll = (float)(panel * 7 % 23);
+        for (int row = 0; row < ROWS_PER_PANEL; ++row) {
+            float rowY = panelY - scroll + 20.0f * row;
+
+            RenderCommandRoundedRect background = {};
+            background.type = Render_Rectangle;
+            background.x = panelX + 4.0f;
+            background.y = rowY;
+            background.width = panelWidth - 8.0f;
+            background.height = 18.0f;
+            background.radius = 4.0f;
+            background.color = { 0.2f, 0.2f + 0.01f * row, 0.3f, 1.0f };
+            commands->push(&background);
+
+            RenderCommandRectangle bar = {};
+            bar.type = Render_Rectangle;
+            bar.layer = 1;
+            bar.x = panelX + 8.0f;
+            bar.y = rowY + 5.0f;
+            bar.width = (float)(row * 13 % 200) + 20.0f;
+            bar.height = 8.0f;
+            bar.color = { 0.9f, 0.6f, 0.1f, 1.0f };
+            commands->push(&bar);
+        }
+        commands->popClip();
+    }
+}
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    int frameCount = quick ? 5 : 30;
+    int panelCounts[] = { 4, 16, 64 };
+    int sizeCount = quick ? 2 : 3;
+
+    HeadlessContext headless = {};
+    if (!gl_createHeadlessContext(&headless)) {
+        return 1;
+    }
+    defer{ gl_destroyHeadlessContext(&headless); };
+
+    OffscreenTarget target = {};
+    if (!gl_createOffscreenTarget(&target, WIDTH, HEIGHT)) {
+        fprintf(stderr, "Offscreen framebuffer is incomplete\n");
+        return 1;
+    }
+
+    Allocator pageAllocator = createPageAllocator();
+    int renderMemorySize = 16 * MB;
+    void* renderMemory = pageAllocator.allocate(renderMemorySize);
+    defer{ pageAllocator.free(renderMemory, renderMemorySize); };
+
+    Renderer renderer = {};
+    renderer.setup(renderMemory, renderMemorySize);
+    defer{ renderer.commands.destroy(); };
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glViewport(0, 0, WIDTH, HEIGHT);
+
+    float projection[16] = {
+        2.0f / WIDTH, 0.0f,  0.0f, -1.0f,
+        0.0f, 2.0f / HEIGHT, 0.0f, -1.0f,
+        0.0f, 0.0f,                1.0f, 0.0f,
+        0.0f, 0.0f,                0.0f, 1.0f,
+    };
+    renderer.setProjection(projection);
+
+    u64 recordTicks[64];
+    u64 renderTicks[64];
+    for (int sizeIndex = 0; sizeIndex < sizeCount; ++sizeIndex) {
+        int panelCount = panelCounts[sizeIndex];
+        u32 scissorOnlyBatches = 0;
+        // Everything inside a clip rect with the scissor first, then trimmed
+        for (int mode = 0; mode < 2; ++mode) {
+            bool trim = mode == 1;
+            ClipStats clipStats = {};
+            for (int frame = 0; frame < frameCount; ++frame) {
+                renderer.beginFrame();
+                renderer.commands.useClipTrimming = trim;
+                u64 start = getPerformanceCounter();
+                fillPanels(&renderer.commands, panelCount);
+                recordTicks[frame] = getPerformanceCounter() - start;
+                clipStats = renderer.commands.clipStats;
+
+                glClear(GL_COLOR_BUFFER_BIT);
+                start = getPerformanceCounter();
+                renderer.render();
+                glFinish();
+                renderTicks[frame] = getPerformanceCounter() - start;
+                renderer.endFrame();
+            }
+
+            u32 batches = renderer.batchCount;
+            scissorOnlyBatches = trim ? scissorOnlyBatches : batches;
+            double recordSeconds = medianSeconds(recordTicks, frameCount);
+            double renderSeconds = medianSeconds(renderTicks, frameCount);
+            printf("{\"benchmark\":\"clipping\",\"mode\":\"%s\",\"panels\":%d,\"record_ms\":%.3f,\"render_ms\":%.3f,"
+                "\"batches\":%u,\"scissor_batches\":%u,\"draws_saved\":%d,\"trimmed\":%u,\"culled\":%u,\"scissored\":%u}\n",
+                trim ? "trim" : "scissor_only", panelCount, recordSeconds * 1000.0, renderSeconds * 1000.0,
+                batches, renderer.scissorBatchCount, (int)scissorOnlyBatches - (int)batches,
+                clipStats.trimmed, clipStats.culled, clipStats.scissored);
+            fflush(stdout);
+        }
+    }
+    renderer.commands.useClipTrimming = true;
+
+    renderer.framePacer.destroy();
+    return 0;
+}
@@ -0,0 +1,154 @@
+/******************************************************************************
+* Command buffer benchmark
+*
+* Records up to a million rectangles per frame into the renderer, whose
+* first command chunk only holds a fraction of them, so the buffer grows by
+* chunks in the first frame and reuses them afterwards. The temporary memory
+* is too small to sort all rectangles at once, so they are drawn in several
+* segments, see Renderer::renderRectSegments().
+*
+* Reports the time to record the commands, the time of render(), the number
+* of chunks and segments and the commands that were dropped, which should
+* be none.
+*
+* Runs headless, e.g. on Mesa llvmpipe.
+*
+* Build: g++ -O2 -mavx2 -pthread bench/bench_command_buffer.cpp -lEGL -lGL -o bench_command_buffer
+* Usage: bench_command_buffer [--quick]
+*
+* Every result is printed as a single JSON object per line to stdout.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#include "../src/fp_core.h"
+#include "../src/fp_allocator.h"
+#include "../src/fp_egl.h"
+#include "../src/fp_renderer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int WIDTH = 1280;
+static const int HEIGHT = 720;
+
+static int compareU64(const void* a, const void* b) {
+    u64 left = *(const u64*)a;
+    u64 right = *(const u64*)b;
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+static double medianSeconds(u64* ticks, int count) {
+    qsort(ticks, count, sizeof(u64), compareU64);
+    return (double)ticks[count / 2] / (double)getPerformanceFrequency();
+}
+
+// Small rectangles on four layers, every eighth one translucent
+static void fillScene(RenderCommandBuffer* commands, int rectCount) {
+    RenderCommandRectangle rect = {};
+    rect.type = Render_Rectangle;
+
+    u32 state = 0x9E3779B9u;
+    for (int i = 0; i < rectCount; ++i) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        rect.layer = (u8)(state & 3);
+        rect.x = (float)(state % WIDTH);
+        rect.y = (float)((state >> 11) % HEIGHT);
+        rect.width = (float)(2 + (state >> 3) % 8);
+        rect.height = (float)(2 + (state >> 7) % 8);
+        float alpha = (i & 7) == 0 ? 0.5f : 1.0f;
+        rect.color = { (state & 0xFF) / 255.0f, ((state >> 8) & 0xFF) / 255.0f, ((state >> 16) & 0xFF) / 255.0f, alpha };
+        commands->push(&rect);
+    }
+}
+
+static int countChunks(RenderCommandBuffer* commands) {
+    int count = 0;
+    for (RenderCommandChunk* chunk = commands->chunks; chunk; chunk = chunk->next) {
+        count += 1;
+    }
+    return count;
+}
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    int frameCount = quick ? 3 : 10;
+    int rectCounts[] = { 100000, 1000000 };
+    int sizeCount = quick ? 1 : 2;
+
+    HeadlessContext headless = {};
+    if (!gl_createHeadlessContext(&headless)) {
+        return 1;
+    }
+    defer{ gl_destroyHeadlessContext(&headless); };
+
+    OffscreenTarget target = {};
+    if (!gl_createOffscreenTarget(&target, WIDTH, HEIGHT)) {
+        fprintf(stderr, "Offscreen framebuffer is incomplete\n");
+        return 1;
+    }
+
+    // A first chunk of 2 MB, the rest of the commands are in grown chunks
+    Allocator pageAllocator = createPageAllocator();
+    int renderMemorySize = 4 * MB;
+    void* renderMemory = pageAllocator.allocate(renderMemorySize);
+    defer{ pageAllocator.free(renderMemory, renderMemorySize); };
+
+    Renderer renderer = {};
+    renderer.setup(renderMemory, renderMemorySize);
+    defer{ renderer.commands.destroy(); };
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glViewport(0, 0, WIDTH, HEIGHT);
+
+    float projection[16] = {
+        2.0f / WIDTH, 0.0f,  0.0f, -1.0f,
+        0.0f, 2.0f / HEIGHT, 0.0f, -1.0f,
+        0.0f, 0.0f,                1.0f, 0.0f,
+        0.0f, 0.0f,                0.0f, 1.0f,
+    };
+    renderer.setProjection(projection);
+
+    bool dropped = false;
+    u64 recordTicks[64];
+    u64 renderTicks[64];
+    for (int sizeIndex = 0; sizeIndex < sizeCount; ++sizeIndex) {
+        int rectCount = rectCounts[sizeIndex];
+        u64 droppedCount = 0;
+        for (int frame = 0; frame < frameCount; ++frame) {
+            renderer.beginFrame();
+            u64 start = getPerformanceCounter();
+            fillScene(&renderer.commands, rectCount);
+            recordTicks[frame] = getPerformanceCounter() - start;
+            droppedCount += renderer.commands.droppedCount;
+
+            glClear(GL_COLOR_BUFFER_BIT);
+            start = getPerformanceCounter();
+            renderer.render();
+            glFinish();
+            renderTicks[frame] = getPerformanceCounter() - start;
+            renderer.endFrame();
+        }
+
+        // The first frame allocates the chunks, so its record time is an outlier
+        double recordSeconds = medianSeconds(recordTicks, frameCount);
+        double renderSeconds = medianSeconds(renderTicks, frameCount);
+        printf("{\"benchmark\":\"command_buffer\",\"rects\":%d,\"record_ms\":%.3f,\"render_ms\":%.3f,"
+            "\"rects_per_sec\":%.0f,\"chunks\":%d,\"segments\":%u,\"batches\":%u,\"dropped\":%llu}\n",
+            rectCount, recordSeconds * 1000.0, renderSeconds * 1000.0, rectCount / (recordSeconds + renderSeconds),
+            countChunks(&renderer.commands), renderer.rectSegmentCount, renderer.batchCount,
+            (unsigned long long)droppedCount);
+        fflush(stdout);
+        dropped |= droppedCount > 0;
+    }
+
+    renderer.framePacer.destroy();
+    return dropped ? 1 : 0;
+}
@@ -0,0 +1,210 @@
+/******************************************************************************
+* Command sort benchmark
+*
+* Sorts 1M rectangle sort keys per frame by layer and, as a reference, with
+* qsort on the whole key, then merges batch neighbors and builds the state
+* batches. The keys carry what a real frame has: a layer, translucency and a
+* scissor for some of the rectangles, either in runs like the contents of a
+* panel or mixed at random. The rectangles are laid out on a grid, so
+* neighbors in submission order rarely overlap, or placed at random with
+* large sizes, where overlaps keep many of them from merging.
+*
+* Reports the batches before and after mergeBatchNeighbors().
+*
+* Build (Linux):   g++ -O2 -pthread bench/bench_command_sort.cpp -o bench_command_sort
+* Build (Windows): cl /O2 bench\bench_command_sort.cpp
+*
+* Every result is printed as a single JSON object per line to stdout.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#include "../src/fp_core.h"
+#include "../src/fp_allocator.h"
+
+#if defined(_WIN32)
+#include "../src/fp_win32.h"
+#else
+#include "../src/fp_linux.h"
+#endif
+
+#include "../src/fp_command_sort.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static const int FRAMES = 15;
+static const u64 KEY_COUNT = 1000000;
+static const int SCREEN_WIDTH = 1920;
+static const int SCREEN_HEIGHT = 1080;
+static const int GRID_CELL = 16;
+
+struct KeyDistribution {
+    const char* name;
+    u32 layers;
+    // Scissored rectangles per 100 and the scissor rects they are spread over
+    u32 scissoredPercent;
+    u32 scissors;
+    // Average run of rectangles in submission order that share a scissor, like the contents of a panel
+    u32 scissorRun;
+    // Translucent rectangles per 100
+    u32 translucentPercent;
+    // Random positions and sizes up to 400 pixels instead of the grid
+    bool scattered;
+};
+
+static void fillEntries(SortEntry* entries, RenderCommandRectangle* rects, u64 count, KeyDistribution* distribution) {
+    u64 columns = SCREEN_WIDTH / GRID_CELL;
+    u64 cells = columns * (SCREEN_HEIGHT / GRID_CELL);
+    u64 state = 0x2545F4914F6CDD1DULL;
+    u8 scissor = 0;
+    for (u64 i = 0; i < count; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        RenderCommandRectangle* rect = &rects[i];
+        *rect = {};
+        rect->type = Render_Rectangle;
+        rect->layer = (u8)(state % distribution->layers);
+        if (distribution->scattered) {
+            rect->x = (float)((state >> 8) % SCREEN_WIDTH);
+            rect->y = (float)((state >> 20) % SCREEN_HEIGHT);
+            rect->width = (float)(8 + (state >> 32) % 400);
+            rect->height = (float)(8 + (state >> 44) % 400);
+        }
+        else {
+            // One cell after the other, the grid only repeats after thousands of rectangles
+            u64 cell = i % cells;
+            rect->x = (float)(cell % columns * GRID_CELL);
+            rect->y = (float)(cell / columns * GRID_CELL);
+            rect->width = GRID_CELL - 4.0f;
+            rect->height = GRID_CELL - 4.0f;
+        }
+        bool translucent = (state >> 52) % 100 < distribution->translucentPercent;
+        rect->packedColor = translucent ? 0x80FFFFFF : 0xFFFFFFFF;
+        if (i == 0 || (state >> 40) % distribution->scissorRun == 0) {
+            bool scissored = (state >> 48) % 100 < distribution->scissoredPercent;
+            scissor = scissored ? (u8)(1 + (state >> 24) % distribution->scissors) : 0;
+        }
+        rect->scissor = scissor;
+
+        entries[i].key = makeRectangleSortKey(rect, (u32)i, 0);
+        entries[i].command = rect;
+    }
+}
+
+static int compareEntries(const void* a, const void* b) {
+    u64 left = ((const SortEntry*)a)->key;
+    u64 right = ((const SortEntry*)b)->key;
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+static int compareU64(const void* a, const void* b) {
+    u64 left = *(const u64*)a;
+    u64 right = *(const u64*)b;
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+static u64 medianTicks(u64* ticks, int count) {
+    qsort(ticks, count, sizeof(u64), compareU64);
+    return ticks[count / 2];
+}
+
+static void printResult(const char* step, KeyDistribution* distribution, u64 ticks) {
+    double seconds = (double)ticks / (double)getPerformanceFrequency();
+    double keysPerSecond = seconds > 0.0 ? KEY_COUNT / seconds : 0.0;
+
+    printf("{\"benchmark\":\"command_sort\",\"step\":\"%s\",\"distribution\":\"%s\",\"keys\":%llu,"
+        "\"ms_per_frame\":%.3f,\"keys_per_sec\":%.0f}\n",
+        step, distribution->name, (unsigned long long)KEY_COUNT, seconds * 1000.0, keysPerSecond);
+    fflush(stdout);
+}
+
+int main() {
+    KeyDistribution distributions[] = {
+        { "rects_only", 1, 0, 1, 1, 0, false },
+        { "ui", 4, 25, 8, 16, 30, false },
+        { "mixed_scissors", 4, 25, 8, 1, 30, false },
+        { "scattered", 4, 25, 8, 16, 30, true },
+    };
+
+    Allocator pageAllocator = createPageAllocator();
+
+    u64 entryBytes = KEY_COUNT * sizeof(SortEntry);
+    u64 rectBytes = KEY_COUNT * sizeof(RenderCommandRectangle);
+    u64 scratchBytes = entryBytes + 64;
+    SortEntry* input = (SortEntry*)pageAllocator.allocate(entryBytes);
+    SortEntry* sortedEntries = (SortEntry*)pageAllocator.allocate(entryBytes);
+    SortEntry* qsorted = (SortEntry*)pageAllocator.allocate(entryBytes);
+    RenderCommandRectangle* rects = (RenderCommandRectangle*)pageAllocator.allocate(rectBytes);
+    RenderBatch* batches = (RenderBatch*)pageAllocator.allocate(KEY_COUNT * sizeof(RenderBatch));
+    ArenaAllocator scratch = createArenaAllocator(pageAllocator.allocate(scratchBytes), scratchBytes);
+
+    bool allMatch = true;
+    for (KeyDistribution& distribution : distributions) {
+        fillEntries(input, rects, KEY_COUNT, &distribution);
+
+        // Keys are unique because of the depth bits, so both sorts must agree exactly
+        for (u64 i = 0; i < KEY_COUNT; ++i) {
+            sortedEntries[i] = input[i];
+            qsorted[i] = input[i];
+        }
+        scratch.reset();
+        sortEntriesByLayer(sortedEntries, KEY_COUNT, &scratch);
+        u64 qsortStart = getPerformanceCounter();
+        qsort(qsorted, KEY_COUNT, sizeof(SortEntry), compareEntries);
+        u64 qsortTicks = getPerformanceCounter() - qsortStart;
+        bool matches = true;
+        for (u64 i = 0; i < KEY_COUNT; ++i) {
+            matches = matches && sortedEntries[i].key == qsorted[i].key && sortedEntries[i].command == qsorted[i].command;
+        }
+        allMatch = allMatch && matches;
+
+        u64 sortTicks[FRAMES];
+        u64 mergeTicks[FRAMES];
+        u64 batchTicks[FRAMES];
+        u32 unmergedBatchCount = 0;
+        u32 batchCount = 0;
+        for (int frame = 0; frame < FRAMES; ++frame) {
+            for (u64 i = 0; i < KEY_COUNT; ++i) {
+                sortedEntries[i] = input[i];
+            }
+
+            scratch.reset();
+            u64 start = getPerformanceCounter();
+            sortEntriesByLayer(sortedEntries, KEY_COUNT, &scratch);
+            u64 sorted = getPerformanceCounter();
+            unmergedBatchCount = buildRenderBatches(sortedEntries, KEY_COUNT, batches);
+
+            u64 mergeStart = getPerformanceCounter();
+            mergeBatchNeighbors(sortedEntries, KEY_COUNT);
+            u64 merged = getPerformanceCounter();
+            batchCount = buildRenderBatches(sortedEntries, KEY_COUNT, batches);
+            u64 end = getPerformanceCounter();
+
+            sortTicks[frame] = sorted - start;
+            mergeTicks[frame] = merged - mergeStart;
+            batchTicks[frame] = end - merged;
+        }
+
+        printResult("sort_by_layer", &distribution, medianTicks(sortTicks, FRAMES));
+        printResult("qsort", &distribution, qsortTicks);
+        printResult("merge_neighbors", &distribution, medianTicks(mergeTicks, FRAMES));
+        printResult("build_batches", &distribution, medianTicks(batchTicks, FRAMES));
+        printf("{\"benchmark\":\"command_sort\",\"distribution\":\"%s\",\"batches_before_merge\":%u,"
+            "\"batches\":%u,\"matches_qsort\":%s}\n",
+            distribution.name, unmergedBatchCount, batchCount, matches ? "true" : "false");
+        fflush(stdout);
+    }
+
+    pageAllocator.free(scratch.data, scratchBytes);
+    pageAllocator.free(batches, KEY_COUNT * sizeof(RenderBatch));
+    pageAllocator.free(rects, rectBytes);
+    pageAllocator.free(qsorted, entryBytes);
+    pageAllocator.free(sortedEntries, entryBytes);
+    pageAllocator.free(input, entryBytes);
+
+    return allMatch ? 0 : 1;
+}
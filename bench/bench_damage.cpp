@@ -0,0 +1,199 @@
+/******************************************************************************
+* Damage tracking benchmark
+*
+* Renders a kiosk-like screen where only a little changes per frame: a grid
+* of static tiles, a seven segment clock that ticks every fourth frame and a
+* progress bar that grows, except in every fourth frame which does not
+* change at all. For a while, a notification is inserted between the tiles.
+*
+* The frames are rendered once with full redraws and once with damage
+* tracking. Reports the frame times, the fraction of pixels redrawn and the
+* skipped frames. The last frame of both modes has to match exactly.
+*
+* Runs headless, e.g. on Mesa llvmpipe.
+*
+* Build: g++ -O2 -mavx2 -pthread bench/bench_damage.cpp -lEGL -lGL -o bench_damage
+* Usage: bench_damage [--quick]
+*
+* Every result is printed as a single JSON object per line to stdout.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#include "../src/fp_core.h"
+#include "../src/fp_allocator.h"
+#include "../src/fp_egl.h"
+#include "../src/fp_renderer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int WIDTH = 1280;
+static const int HEIGHT = 720;
+static const int TILE_COLUMNS = 40;
+static const int TILE_ROWS = 20;
+static const int MAX_FRAMES = 256;
+
+static int compareU64(const void* a, const void* b) {
+    u64 left = *(const u64*)a;
+    u64 right = *(const u64*)b;
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+static double medianSeconds(u64* ticks, int count) {
+    qsort(ticks, count, sizeof(u64), compareU64);
+    return (double)ticks[count / 2] / (double)getPerformanceFrequency();
+}
+
+static void pushRect(RenderCommandBuffer* commands, float x, float y, float width, float height, Color color, u8 layer) {
+    RenderCommandRectangle rect = {};
+    rect.type = Render_Rectangle;
+    rect.layer = layer;
+    rect.x = x;
+    rect.y = y;
+    rect.width = width;
+    rect.height = height;
+    rect.color = color;
+    commands->push(&rect);
+}
+
+// Segments a to g of a seven segment digit, bit 0 is segment a
+static const u8 DIGIT_SEGMENTS[10] = { 0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07, 0x7F, 0x6F };
+
+static void pushDigit(RenderCommandBuffer* commands, float x, float y, int digit) {
+    // Position and size of each segment in a 24x40 cell, y grows upwards
+    static const float segments[7][4] = {
+        { 4, 36, 16, 4 }, { 20, 20, 4, 16 }, { 20, 4, 4, 16 }, { 4, 0, 16, 4 },
+        { 0, 4, 4, 16 }, { 0, 20, 4, 16 }, { 4, 18, 16, 4 },
+    };
+    for (int i = 0; i < 7; ++i) {
+        if (DIGIT_SEGMENTS[digit] & (1 << i)) {
+            pushRect(commands, x + segments[i][0], y + segments[i][1], segments[i][2], segments[i][3], { 0.2f, 1.0f, 0.4f, 1.0f }, 2);
+        }
+    }
+}
+
+// Every fourth frame repeats the previous one
+static void fillFrame(RenderCommandBuffer* commands, int frame) {
+    int step = frame - frame / 4;
+    float tileWidth = (float)WIDTH / TILE_COLUMNS;
+    float tileHeight = (float)(HEIGHT - 80) / TILE_ROWS;
+
+    pushRect(commands, 0.0f, 0.0f, (float)WIDTH, (float)HEIGHT, { 0.08f, 0.08f, 0.1f, 1.0f }, 0);
+    for (int row = 0; row < TILE_ROWS; ++row) {
+        for (int column = 0; column < TILE_COLUMNS; ++column) {
+            float x = column * tileWidth;
+            float y = row * tileHeight;
+            pushRect(commands, x + 2.0f, y + 2.0f, tileWidth - 4.0f, tileHeight - 4.0f, { 0.2f, 0.25f + 0.02f * (column % 8), 0.4f, 1.0f }, 1);
+            pushRect(commands, x + 4.0f, y + 4.0f, tileWidth - 8.0f, 3.0f, { 1.0f, 1.0f, 1.0f, 0.5f }, 2);
+
+            // Shown between the tiles, so the commands after it shift
+            bool notification = frame >= 10 && frame < 20;
+            if (notification && row == TILE_ROWS / 2 && column == TILE_COLUMNS / 2) {
+                pushRect(commands, x - 100.0f, y, 200.0f, 40.0f, { 0.9f, 0.3f, 0.2f, 0.9f }, 3);
+            }
+        }
+    }
+
+    int seconds = step / 3;
+    int digits[4] = { seconds / 600 % 6, seconds / 60 % 10, seconds / 10 % 6, seconds % 10 };
+    for (int i = 0; i < 4; ++i) {
+        pushDigit(commands, WIDTH - 160.0f + 32.0f * i + (i >= 2 ? 8.0f : 0.0f), HEIGHT - 60.0f, digits[i]);
+    }
+
+    float progress = (float)(step % 200) / 200.0f;
+    pushRect(commands, 20.0f, HEIGHT - 40.0f, 800.0f, 12.0f, { 0.3f, 0.3f, 0.3f, 1.0f }, 1);
+    pushRect(commands, 20.0f, HEIGHT - 40.0f, 800.0f * progress, 12.0f, { 0.2f, 0.6f, 1.0f, 1.0f }, 2);
+}
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    int frameCount = quick ? 32 : 120;
+
+    HeadlessContext headless = {};
+    if (!gl_createHeadlessContext(&headless)) {
+        return 1;
+    }
+    defer{ gl_destroyHeadlessContext(&headless); };
+
+    OffscreenTarget target = {};
+    if (!gl_createOffscreenTarget(&target, WIDTH, HEIGHT)) {
+        fprintf(stderr, "Offscreen framebuffer is incomplete\n");
+        return 1;
+    }
+
+    Allocator pageAllocator = createPageAllocator();
+    int renderMemorySize = 16 * MB;
+    void* renderMemory = pageAllocator.allocate(renderMemorySize);
+    defer{ pageAllocator.free(renderMemory, renderMemorySize); };
+
+    Renderer renderer = {};
+    renderer.setup(renderMemory, renderMemorySize);
+    defer{ renderer.damage.destroy(); };
+    defer{ renderer.destroyDamageCache(); };
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glViewport(0, 0, WIDTH, HEIGHT);
+
+    float projection[16] = {
+        2.0f / WIDTH, 0.0f,  0.0f, -1.0f,
+        0.0f, 2.0f / HEIGHT, 0.0f, -1.0f,
+        0.0f, 0.0f,                1.0f, 0.0f,
+        0.0f, 0.0f,                0.0f, 1.0f,
+    };
+    renderer.setProjection(projection);
+
+    u64 pixelBytes = 4ULL * WIDTH * HEIGHT;
+    u8* fullPixels = (u8*)malloc(pixelBytes);
+    u8* damagedPixels = (u8*)malloc(pixelBytes);
+    defer{ free(fullPixels); free(damagedPixels); };
+
+    // The last frame changes the progress bar, so it is not skipped and both modes draw it
+    frameCount -= frameCount % 4 == 0 ? 1 : 0;
+
+    u64 frameTicks[MAX_FRAMES];
+    for (int mode = 0; mode < 2; ++mode) {
+        bool tracking = mode == 1;
+        renderer.useDamageTracking = tracking;
+        renderer.damage.stats = {};
+        renderer.damage.invalidate();
+        u32 skipped = 0;
+        for (int frame = 0; frame < frameCount; ++frame) {
+            u64 start = getPerformanceCounter();
+            renderer.beginFrame();
+            fillFrame(&renderer.commands, frame);
+            // With damage tracking, the cache is copied over the whole target
+            if (!tracking) {
+                glClear(GL_COLOR_BUFFER_BIT);
+            }
+            renderer.render();
+            glFinish();
+            renderer.endFrame();
+            frameTicks[frame] = getPerformanceCounter() - start;
+            skipped += renderer.frameSkipped ? 1 : 0;
+        }
+        glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, tracking ? damagedPixels : fullPixels);
+
+        DamageStats stats = renderer.damage.stats;
+        double seconds = medianSeconds(frameTicks, frameCount);
+        printf("{\"benchmark\":\"damage\",\"mode\":\"%s\",\"frames\":%d,\"frame_ms\":%.3f,\"redrawn_fraction\":%.4f,"
+            "\"skipped_frames\":%u,\"full_frames\":%llu}\n",
+            tracking ? "damage" : "full", frameCount, seconds * 1000.0, tracking ? stats.redrawnFraction() : 1.0,
+            skipped, (unsigned long long)stats.fullFrames);
+        fflush(stdout);
+    }
+    renderer.useDamageTracking = false;
+
+    u64 mismatches = 0;
+    for (u64 i = 0; i < pixelBytes; i += 4) {
+        mismatches += memcmp(fullPixels + i, damagedPixels + i, 4) != 0 ? 1 : 0;
+    }
+    printf("{\"benchmark\":\"damage\",\"mismatching_pixels\":%llu}\n", (unsigned long long)mismatches);
+
+    renderer.framePacer.destroy();
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,157 @@
+/******************************************************************************
+* Frame pacing benchmark
+*
+* Renders the same scene offscreen with glFinish() after every frame and with
+* 1 to MAX_FRAMES_IN_FLIGHT frames in flight. Reports the frame rate together
+* with the average CPU and GPU wait time, which helps to choose the number of
+* frames in flight. Runs headless, e.g. on Mesa llvmpipe.
+*
+* Build: g++ -O2 -mavx2 -pthread bench/bench_frame_pacing.cpp -lEGL -lGL -o bench_frame_pacing
+* Usage: bench_frame_pacing [--quick]
+*
+* Every result is printed as a single JSON object per line to stdout.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#include "../src/fp_core.h"
+#include "../src/fp_allocator.h"
+#include "../src/fp_egl.h"
+#include "../src/fp_renderer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const int WIDTH = 1280;
+static const int HEIGHT = 720;
+
+static void fillScene(RenderCommandBuffer* commands, int rectCount, int frame) {
+    RenderCommandRectangle rect = {};
+    rect.type = Render_Rectangle;
+
+    u32 state = 0x9E3779B9u ^ (u32)frame;
+    for (int i = 0; i < rectCount; ++i) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        rect.x = (float)(state % WIDTH);
+        rect.y = (float)((state >> 11) % HEIGHT);
+        rect.width = (float)(8 + (state >> 3) % 64);
+        rect.height = (float)(8 + (state >> 7) % 64);
+        rect.color = { (state & 0xFF) / 255.0f, ((state >> 8) & 0xFF) / 255.0f, ((state >> 16) & 0xFF) / 255.0f, 0.5f };
+        commands->push(&rect);
+    }
+}
+
+struct PacingResult {
+    double seconds;
+    double cpuWaitMs;
+    double gpuWaitMs;
+    double gpuFrameMs;
+};
+
+/**
+ * Renders frameCount frames. A framesInFlight of 0 calls glFinish() after each frame,
+ * which is how the renderer synchronized before frame pacing.
+ */
+static PacingResult runFrames(Renderer* renderer, int framesInFlight, int frameCount, int rectCount) {
+    float projection[16] = {
+        2.0f / WIDTH, 0.0f,  0.0f, -1.0f,
+        0.0f, 2.0f / HEIGHT, 0.0f, -1.0f,
+        0.0f, 0.0f,                1.0f, 0.0f,
+        0.0f, 0.0f,                0.0f, 1.0f,
+    };
+
+    renderer->framePacer.framesInFlight = framesInFlight > 0 ? framesInFlight : 1;
+
+    PacingResult result = {};
+    u64 gpuSamples = 0;
+    u64 lastGpuFrame = ~0ULL;
+    u64 start = getPerformanceCounter();
+    for (int frame = 0; frame < frameCount; ++frame) {
+        renderer->beginFrame();
+        fillScene(&renderer->commands, rectCount, frame);
+
+        glViewport(0, 0, WIDTH, HEIGHT);
+        glClear(GL_COLOR_BUFFER_BIT);
+        renderer->setProjection(projection);
+        renderer->render();
+        renderer->endFrame();
+
+        if (framesInFlight == 0) {
+            glFinish();
+        }
+
+        FrameStats* stats = &renderer->framePacer.stats;
+        result.cpuWaitMs += stats->cpuWaitMs;
+        if (stats->gpuFrame != lastGpuFrame) {
+            lastGpuFrame = stats->gpuFrame;
+            result.gpuWaitMs += stats->gpuWaitMs;
+            result.gpuFrameMs += stats->gpuFrameMs;
+            gpuSamples += 1;
+        }
+    }
+    glFinish();
+    result.seconds = (double)(getPerformanceCounter() - start) / (double)getPerformanceFrequency();
+
+    result.cpuWaitMs /= frameCount;
+    if (gpuSamples > 0) {
+        result.gpuWaitMs /= gpuSamples;
+        result.gpuFrameMs /= gpuSamples;
+    }
+    return result;
+}
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    int frameCount = quick ? 60 : 300;
+    int rectCount = quick ? 5000 : 20000;
+
+    HeadlessContext headless = {};
+    if (!gl_createHeadlessContext(&headless)) {
+        return 1;
+    }
+    defer{ gl_destroyHeadlessContext(&headless); };
+
+    OffscreenTarget target = {};
+    if (!gl_createOffscreenTarget(&target, WIDTH, HEIGHT)) {
+        fprintf(stderr, "Offscreen framebuffer is incomplete\n");
+        return 1;
+    }
+
+    Allocator pageAllocator = createPageAllocator();
+    int renderMemorySize = 4 * MB;
+    void* renderMemory = pageAllocator.allocate(renderMemorySize);
+    defer{ pageAllocator.free(renderMemory, renderMemorySize); };
+
+    Renderer renderer = {};
+    renderer.setup(renderMemory, renderMemorySize);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    // Warm up, so buffer growth and shader compilation are not measured
+    runFrames(&renderer, 1, 10, rectCount);
+
+    for (int framesInFlight = 0; framesInFlight <= MAX_FRAMES_IN_FLIGHT; ++framesInFlight) {
+        PacingResult result = runFrames(&renderer, framesInFlight, frameCount, rectCount);
+
+        char mode[32];
+        if (framesInFlight == 0) {
+            snprintf(mode, sizeof(mode), "finish");
+        } else {
+            snprintf(mode, sizeof(mode), "in_flight_%d", framesInFlight);
+        }
+        printf("{\"benchmark\":\"frame_pacing\",\"mode\":\"%s\",\"frames\":%d,\"rects\":%d,\"fps\":%.1f,"
+            "\"cpu_wait_ms\":%.3f,\"gpu_wait_ms\":%.3f,\"gpu_frame_ms\":%.3f}\n",
+            mode, frameCount, rectCount, frameCount / result.seconds,
+            result.cpuWaitMs, result.gpuWaitMs, result.gpuFrameMs);
+        fflush(stdout);
+    }
+
+    renderer.framePacer.destroy();
+    return 0;
+}
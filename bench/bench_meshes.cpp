@@ -0,0 +1,156 @@
+/******************************************************************************
+* Mesh benchmark
+*
+* Measures the CPU time to submit many small meshes, with one draw call per
+* mesh and with one glMultiDrawElementsIndirect per pool, without frustum
+* culling and with culling on the CPU or in a compute shader. The submit time
+* includes writing the indirect commands and instances. The meshes cover four
+* times the view, so about three quarters are culled.
+*
+* Runs headless, e.g. on Mesa llvmpipe. The GPU time is not measured, but
+* software drivers transform the vertices inside the draw calls, which then
+* dominates both paths.
+*
+* Build: g++ -O2 -mavx2 -pthread bench/bench_meshes.cpp -lEGL -lGL -o bench_meshes
+* Usage: bench_meshes [--quick]
+*
+* Every result is printed as a single JSON object per line to stdout.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#include "../src/fp_core.h"
+#include "../src/fp_allocator.h"
+#include "../src/fp_egl.h"
+#include "../src/fp_renderer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int WIDTH = 640;
+static const int HEIGHT = 480;
+
+// A tetrahedron, the draw calls dominate and not the triangles
+static MeshHandle uploadTetrahedron(MeshStore* meshes) {
+    MeshVertex vertices[4] = {
+        { {  1.0f,  1.0f,  1.0f }, {  1.0f,  1.0f,  1.0f } },
+        { { -1.0f, -1.0f,  1.0f }, { -1.0f, -1.0f,  1.0f } },
+        { { -1.0f,  1.0f, -1.0f }, { -1.0f,  1.0f, -1.0f } },
+        { {  1.0f, -1.0f, -1.0f }, {  1.0f, -1.0f, -1.0f } },
+    };
+    u32 indices[12] = { 0, 1, 3, 0, 2, 1, 0, 3, 2, 1, 2, 3 };
+    return meshes->upload(vertices, 4, indices, 12);
+}
+
+// Meshes on a square grid, twice as wide and high as the view
+static void fillMeshes(RenderCommandBuffer* commands, MeshHandle mesh, int meshCount) {
+    int side = 1;
+    while (side * side < meshCount) {
+        side += 1;
+    }
+    float spacing = 4.0f / side;
+
+    RenderCommandMesh command = {};
+    command.mesh = mesh;
+    for (int i = 0; i < meshCount; ++i) {
+        float scale = 0.4f * spacing;
+        float transform[16] = {
+            scale, 0.0f,  0.0f,  -2.0f + spacing * (i % side + 0.5f),
+            0.0f,  scale, 0.0f,  -2.0f + spacing * (i / side + 0.5f),
+            0.0f,  0.0f,  scale, 0.0f,
+            0.0f,  0.0f,  0.0f,  1.0f,
+        };
+        memcpy(command.transform, transform, sizeof(transform));
+        command.color = { (float)(i % 7) / 6.0f, 0.5f, (float)(i % 5) / 4.0f, 1.0f };
+        commands->push(&command);
+    }
+}
+
+static int compareU64(const void* a, const void* b) {
+    u64 left = *(const u64*)a;
+    u64 right = *(const u64*)b;
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+static double medianSeconds(u64* ticks, int count) {
+    qsort(ticks, count, sizeof(u64), compareU64);
+    return (double)ticks[count / 2] / (double)getPerformanceFrequency();
+}
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    int frameCount = quick ? 5 : 20;
+    int meshCounts[] = { 1000, 10000, 50000 };
+    int sizeCount = quick ? 2 : 3;
+
+    HeadlessContext headless = {};
+    if (!gl_createHeadlessContext(&headless)) {
+        return 1;
+    }
+    defer{ gl_destroyHeadlessContext(&headless); };
+
+    OffscreenTarget target = {};
+    if (!gl_createOffscreenTarget(&target, WIDTH, HEIGHT)) {
+        fprintf(stderr, "Offscreen framebuffer is incomplete\n");
+        return 1;
+    }
+
+    Allocator pageAllocator = createPageAllocator();
+    int renderMemorySize = 64 * MB;
+    void* renderMemory = pageAllocator.allocate(renderMemorySize);
+    defer{ pageAllocator.free(renderMemory, renderMemorySize); };
+
+    Renderer renderer = {};
+    renderer.setup(renderMemory, renderMemorySize);
+    MeshHandle mesh = uploadTetrahedron(&renderer.meshes);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glViewport(0, 0, WIDTH, HEIGHT);
+
+    float viewProjection[16] = {
+        1.0f, 0.0f, 0.0f,  0.0f,
+        0.0f, 1.0f, 0.0f,  0.0f,
+        0.0f, 0.0f, -0.5f, 0.0f,
+        0.0f, 0.0f, 0.0f,  1.0f,
+    };
+    renderer.setViewProjection(viewProjection);
+
+    const char* pathNames[] = { "single", "multi_draw", "multi_draw_cpu_cull", "multi_draw_gpu_cull" };
+    u64 submitTicks[64];
+    for (int sizeIndex = 0; sizeIndex < sizeCount; ++sizeIndex) {
+        int meshCount = meshCounts[sizeIndex];
+        // Single draws, then multi-draw without culling, with CPU and with GPU culling
+        for (int path = 0; path < 4; ++path) {
+            if (path == 3 && !renderer.gpuMeshCullingSupported) {
+                break;
+            }
+            renderer.useMeshMultiDraw = path > 0;
+            renderer.meshCulling = path == 3 ? MeshCulling_Gpu : (path == 2 ? MeshCulling_Cpu : MeshCulling_None);
+            for (int frame = 0; frame < frameCount; ++frame) {
+                renderer.beginFrame();
+                fillMeshes(&renderer.commands, mesh, meshCount);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                renderer.render();
+                submitTicks[frame] = renderer.timings.meshSubmitTicks;
+                renderer.endFrame();
+            }
+            glFinish();
+
+            double seconds = medianSeconds(submitTicks, frameCount);
+            u32 draws = renderer.meshDrawCount;
+            u32 calls = renderer.meshDrawCalls;
+            printf("{\"benchmark\":\"meshes\",\"path\":\"%s\",\"meshes\":%d,\"draw_calls\":%u,\"draws_per_call\":%.1f,"
+                "\"submit_ms\":%.3f,\"meshes_per_sec\":%.0f}\n",
+                pathNames[path], meshCount, calls, calls ? (double)draws / calls : 0.0,
+                seconds * 1000.0, meshCount / seconds);
+            fflush(stdout);
+        }
+    }
+
+    renderer.framePacer.destroy();
+    return 0;
+}
@@ -0,0 +1,212 @@
+/******************************************************************************
+* Profiler benchmark
+*
+* Measures the cost of an empty CPU zone, on one thread and on all worker
+* threads of a job system at once, against the same loop without a profiler.
+* The budget is 50 ns per zone.
+*
+* Then renders frames with the instrumented renderer, writes them to a
+* Chrome trace and reports the rolling statistics of every zone. GPU zones
+* only show up after PROFILE_GPU_FRAMES frames.
+*
+* Runs headless, e.g. on Mesa llvmpipe.
+*
+* Build: g++ -O2 -mavx2 -pthread bench/bench_profiler.cpp -lEGL -lGL -o bench_profiler
+* Usage: bench_profiler [--quick]
+*
+* Every result is printed as a single JSON object per line to stdout.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#include "../src/fp_core.h"
+#include "../src/fp_allocator.h"
+#include "../src/fp_egl.h"
+#include "../src/fp_profiler.h"
+#include "../src/fp_renderer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+static const int WIDTH = 1280;
+static const int HEIGHT = 720;
+static const double ZONE_BUDGET_NS = 50.0;
+
+// Stays below the events per thread, so no zone is dropped
+static const int ZONES_PER_FRAME = 1000;
+
+static int compareU64(const void* a, const void* b) {
+    u64 left = *(const u64*)a;
+    u64 right = *(const u64*)b;
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+static double medianSeconds(u64* ticks, int count) {
+    qsort(ticks, count, sizeof(u64), compareU64);
+    return (double)ticks[count / 2] / (double)getPerformanceFrequency();
+}
+
+static void recordZones(void* data, int index) {
+    for (int i = 0; i < ZONES_PER_FRAME; ++i) {
+        PROFILE_ZONE("empty");
+    }
+}
+
+// Median time of ZONES_PER_FRAME zones on each of jobCount jobs
+static double measureZones(Profiler* profiler, JobSystem* jobs, int jobCount, int frameCount) {
+    u64 ticks[256];
+    for (int frame = 0; frame < frameCount; ++frame) {
+        profiler->beginFrame();
+        u64 start = getPerformanceCounter();
+        if (jobs) {
+            jobs->run(&recordZones, nullptr, jobCount);
+        }
+        else {
+            recordZones(nullptr, 0);
+        }
+        ticks[frame] = getPerformanceCounter() - start;
+        profiler->endFrame();
+    }
+    return medianSeconds(ticks, frameCount);
+}
+
+static void printOverhead(const char* mode, int threads, double seconds, double baselineSeconds, int zonesPerThread) {
+    double nsPerZone = (seconds - baselineSeconds) * 1e9 / zonesPerThread;
+    printf("{\"benchmark\":\"profiler\",\"mode\":\"%s\",\"threads\":%d,\"ns_per_zone\":%.1f,\"within_budget\":%s}\n",
+        mode, threads, nsPerZone, nsPerZone < ZONE_BUDGET_NS ? "true" : "false");
+    fflush(stdout);
+}
+
+static void fillScene(RenderCommandBuffer* commands, int rectCount, int frame) {
+    RenderCommandRectangle rect = {};
+    rect.type = Render_Rectangle;
+
+    u32 state = 0x9E3779B9u ^ (u32)frame;
+    for (int i = 0; i < rectCount; ++i) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        rect.x = (float)(state % WIDTH);
+        rect.y = (float)((state >> 11) % HEIGHT);
+        rect.width = (float)(8 + (state >> 3) % 64);
+        rect.height = (float)(8 + (state >> 7) % 64);
+        rect.color = { (state & 0xFF) / 255.0f, ((state >> 8) & 0xFF) / 255.0f, ((state >> 16) & 0xFF) / 255.0f, 0.5f };
+        commands->push(&rect);
+    }
+}
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    int frameCount = quick ? 50 : 200;
+    int rectCount = quick ? 10000 : 50000;
+
+    HeadlessContext headless = {};
+    if (!gl_createHeadlessContext(&headless)) {
+        return 1;
+    }
+    defer{ gl_destroyHeadlessContext(&headless); };
+
+    OffscreenTarget target = {};
+    if (!gl_createOffscreenTarget(&target, WIDTH, HEIGHT)) {
+        fprintf(stderr, "Offscreen framebuffer is incomplete\n");
+        return 1;
+    }
+
+    Allocator pageAllocator = createPageAllocator();
+    u64 profileMemorySize = 4 * MB;
+    void* profileMemory = pageAllocator.allocate(profileMemorySize);
+    defer{ pageAllocator.free(profileMemory, profileMemorySize); };
+
+    static Profiler profiler = {};
+    profiler.create(profileMemory, profileMemorySize);
+    defer{ profiler.destroy(); };
+
+    JobSystem jobs = {};
+    jobs.create(getProcessorCount() - 1);
+    defer{ jobs.destroy(); };
+    int jobCount = jobs.threadCount + 1;
+
+    // The zones still read the counter without a profiler, which is the baseline
+    g_profiler = nullptr;
+    double baseline = measureZones(&profiler, nullptr, 1, frameCount);
+    double baselineJobs = measureZones(&profiler, &jobs, jobCount, frameCount);
+    g_profiler = &profiler;
+    double single = measureZones(&profiler, nullptr, 1, frameCount);
+    double parallel = measureZones(&profiler, &jobs, jobCount, frameCount);
+    printOverhead("single_thread", 1, single, baseline, ZONES_PER_FRAME);
+    // Jobs may end up on fewer threads, so this is the time per zone of the slowest thread at worst
+    printOverhead("job_system", jobCount, parallel, baselineJobs, ZONES_PER_FRAME);
+
+    int renderMemorySize = 16 * MB;
+    void* renderMemory = pageAllocator.allocate(renderMemorySize);
+    defer{ pageAllocator.free(renderMemory, renderMemorySize); };
+
+    Renderer renderer = {};
+    renderer.setup(renderMemory, renderMemorySize);
+    renderer.jobSystem = &jobs;
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glViewport(0, 0, WIDTH, HEIGHT);
+
+    float projection[16] = {
+        2.0f / WIDTH, 0.0f,  0.0f, -1.0f,
+        0.0f, 2.0f / HEIGHT, 0.0f, -1.0f,
+        0.0f, 0.0f,                1.0f, 0.0f,
+        0.0f, 0.0f,                0.0f, 1.0f,
+    };
+    renderer.setProjection(projection);
+
+    char tracePath[256];
+    snprintf(tracePath, sizeof(tracePath), "/tmp/bench_profiler_%d.json", (int)getpid());
+    wchar_t wideTracePath[256];
+    swprintf(wideTracePath, 256, L"%s", tracePath);
+    profiler.startTrace(wideTracePath);
+
+    for (int frame = 0; frame < frameCount; ++frame) {
+        profiler.beginFrame();
+        renderer.beginFrame();
+        {
+            PROFILE_ZONE("fill commands");
+            fillScene(&renderer.commands, rectCount, frame);
+        }
+        glClear(GL_COLOR_BUFFER_BIT);
+        renderer.render();
+        renderer.endFrame();
+        profiler.endFrame();
+    }
+    profiler.stopTrace();
+
+    FILE* trace = fopen(tracePath, "rb");
+    long traceBytes = 0;
+    if (trace) {
+        fseek(trace, 0, SEEK_END);
+        traceBytes = ftell(trace);
+        fclose(trace);
+    }
+    remove(tracePath);
+    printf("{\"benchmark\":\"profiler\",\"trace_bytes\":%ld,\"dropped_events\":%llu,\"dropped_gpu_frames\":%llu}\n",
+        traceBytes, (unsigned long long)profiler.counters.droppedEvents,
+        (unsigned long long)profiler.counters.droppedGpuFrames);
+
+    ProfileZoneStats stats[MAX_PROFILE_ZONES];
+    int zoneCount = profiler.getZoneStats(stats, MAX_PROFILE_ZONES);
+    bool gpuZones = false;
+    for (int i = 0; i < zoneCount; ++i) {
+        gpuZones |= stats[i].gpu;
+        printf("{\"benchmark\":\"profiler\",\"zone\":\"%s\",\"gpu\":%s,\"calls\":%u,\"last_ms\":%.3f,\"average_ms\":%.3f,"
+            "\"min_ms\":%.3f,\"max_ms\":%.3f}\n",
+            stats[i].name, stats[i].gpu ? "true" : "false", stats[i].calls, stats[i].lastMs, stats[i].averageMs,
+            stats[i].minMs, stats[i].maxMs);
+    }
+    fflush(stdout);
+
+    renderer.framePacer.destroy();
+    g_profiler = nullptr;
+    return traceBytes > 0 && (gpuZones || !profiler.gpuTimestamps) ? 0 : 1;
+}
@@ -0,0 +1,222 @@
+/******************************************************************************
+* Render graph benchmark
+*
+* Builds a frame of post processing passes as a render graph every frame: a
+* scene of rectangles, followed by chains that scale it down to an eighth and
+* back up to half the size, each chain starting from the result of the
+* previous one, and a composite into the offscreen target. A debug view that
+* nothing reads is culled. The scaling passes are blits with linear filtering.
+*
+* The frames are rendered once with aliasing, where targets with disjoint
+* lifetimes share textures, and once with a texture for every target. Reports
+* the time to build and compile the graph, the render time and the texture
+* memory of both modes. Both modes have to produce exactly the same pixels.
+*
+* Runs headless, e.g. on Mesa llvmpipe.
+*
+* Build: g++ -O2 -mavx2 -pthread bench/bench_render_graph.cpp -lEGL -lGL -o bench_render_graph
+* Usage: bench_render_graph [--quick]
+*
+* Every result is printed as a single JSON object per line to stdout.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#include "../src/fp_core.h"
+#include "../src/fp_allocator.h"
+#include "../src/fp_egl.h"
+#include "../src/fp_renderer.h"
+#include "../src/fp_render_graph.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int WIDTH = 1280;
+static const int HEIGHT = 720;
+static const int MAX_CHAINS = 8;
+// Scale of the targets in a chain, as a divisor of the size
+static const int CHAIN_DIVISORS[] = { 2, 4, 8, 4, 2 };
+static const int CHAIN_LENGTH = sizeof(CHAIN_DIVISORS) / sizeof(CHAIN_DIVISORS[0]);
+
+static int compareU64(const void* a, const void* b) {
+    u64 left = *(const u64*)a;
+    u64 right = *(const u64*)b;
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+static double medianSeconds(u64* ticks, int count) {
+    qsort(ticks, count, sizeof(u64), compareU64);
+    return (double)ticks[count / 2] / (double)getPerformanceFrequency();
+}
+
+static void fillScene(RenderCommandBuffer* commands) {
+    for (int i = 0; i < 400; ++i) {
+        RenderCommandRectangle rect = {};
+        rect.type = Render_Rectangle;
+        rect.layer = (u8)(i % 4);
+        rect.x = (float)(i * 97 % (WIDTH - 80));
+        rect.y = (float)(i * 61 % (HEIGHT - 80));
+        rect.width = 20.0f + (float)(i * 13 % 60);
+        rect.height = 20.0f + (float)(i * 29 % 60);
+        rect.color = { (float)(i % 7) / 6.0f, (float)(i % 5) / 4.0f, (float)(i % 3) / 2.0f, 1.0f };
+        commands->push(&rect);
+    }
+}
+
+struct ScalePass {
+    GLRenderBackend* backend;
+    RenderResource source;
+};
+
+static void drawScene(RenderGraph* graph, RenderGraphPass* pass, void* data) {
+    Renderer* renderer = (Renderer*)data;
+    renderer->render();
+}
+
+static void scaleFrom(RenderGraph* graph, RenderGraphPass* pass, void* data) {
+    ScalePass* scale = (ScalePass*)data;
+    scale->backend->blitFrom(graph, scale->source);
+}
+
+static void emptyPass(RenderGraph* graph, RenderGraphPass* pass, void* data) {
+}
+
+static void buildFrame(RenderGraph* graph, GLRenderBackend* backend, Renderer* renderer, OffscreenTarget* target,
+    int chainCount, ScalePass* scalePasses) {
+    graph->reset();
+    RenderResource output = graph->importTarget("output", { WIDTH, HEIGHT, RenderFormat_RGBA8 }, target->framebuffer);
+    RenderResource scene = graph->createTarget("scene", { WIDTH, HEIGHT, RenderFormat_RGBA8 });
+    int scenePass = graph->addPass("scene", &drawScene, renderer);
+    scene = graph->clear(scenePass, scene, BLACK);
+
+    RenderResource debug = graph->createTarget("debug", { WIDTH, HEIGHT, RenderFormat_RGBA8 });
+    int debugPass = graph->addPass("debug", &emptyPass, nullptr);
+    graph->read(debugPass, scene);
+    graph->clear(debugPass, debug, {});
+
+    RenderResource source = scene;
+    for (int chain = 0; chain < chainCount; ++chain) {
+        for (int step = 0; step < CHAIN_LENGTH; ++step) {
+            int divisor = CHAIN_DIVISORS[step];
+            RenderResource scaled = graph->createTarget("scaled", { WIDTH / divisor, HEIGHT / divisor, RenderFormat_RGBA8 });
+            ScalePass* scale = &scalePasses[chain * CHAIN_LENGTH + step];
+            *scale = { backend, source };
+            int pass = graph->addPass("scale", &scaleFrom, scale);
+            graph->read(pass, source);
+            source = graph->write(pass, scaled);
+        }
+    }
+
+    ScalePass* composite = &scalePasses[chainCount * CHAIN_LENGTH];
+    *composite = { backend, source };
+    int compositePass = graph->addPass("composite", &scaleFrom, composite);
+    graph->read(compositePass, source);
+    graph->write(compositePass, output);
+}
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    int frameCount = quick ? 5 : 30;
+    int chainCounts[] = { 1, 2, 4, 8 };
+    int sizeCount = quick ? 2 : 4;
+
+    HeadlessContext headless = {};
+    if (!gl_createHeadlessContext(&headless)) {
+        return 1;
+    }
+    defer{ gl_destroyHeadlessContext(&headless); };
+
+    OffscreenTarget target = {};
+    if (!gl_createOffscreenTarget(&target, WIDTH, HEIGHT)) {
+        fprintf(stderr, "Offscreen framebuffer is incomplete\n");
+        return 1;
+    }
+
+    Allocator pageAllocator = createPageAllocator();
+    int renderMemorySize = 16 * MB;
+    void* renderMemory = pageAllocator.allocate(renderMemorySize);
+    defer{ pageAllocator.free(renderMemory, renderMemorySize); };
+
+    Renderer renderer = {};
+    renderer.setup(renderMemory, renderMemorySize);
+    defer{ renderer.commands.destroy(); };
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    float projection[16] = {
+        2.0f / WIDTH, 0.0f,  0.0f, -1.0f,
+        0.0f, 2.0f / HEIGHT, 0.0f, -1.0f,
+        0.0f, 0.0f,                1.0f, 0.0f,
+        0.0f, 0.0f,                0.0f, 1.0f,
+    };
+    renderer.setProjection(projection);
+
+    RenderGraph* graph = (RenderGraph*)malloc(sizeof(RenderGraph));
+    graph->create();
+    defer{ free(graph); };
+    ScalePass scalePasses[MAX_CHAINS * CHAIN_LENGTH + 1];
+
+    u64 pixelBytes = 4ULL * WIDTH * HEIGHT;
+    u8* aliasedPixels = (u8*)malloc(pixelBytes);
+    u8* separatePixels = (u8*)malloc(pixelBytes);
+    defer{ free(aliasedPixels); free(separatePixels); };
+
+    u64 compileTicks[64];
+    u64 renderTicks[64];
+    u64 totalMismatches = 0;
+    for (int sizeIndex = 0; sizeIndex < sizeCount; ++sizeIndex) {
+        int chainCount = chainCounts[sizeIndex];
+        // A texture for every target first, then aliased
+        for (int mode = 0; mode < 2; ++mode) {
+            bool aliasing = mode == 1;
+            graph->useAliasing = aliasing;
+            GLRenderBackend backend = createGLRenderBackend();
+            for (int frame = 0; frame < frameCount; ++frame) {
+                renderer.beginFrame();
+                fillScene(&renderer.commands);
+
+                u64 start = getPerformanceCounter();
+                buildFrame(graph, &backend, &renderer, &target, chainCount, scalePasses);
+                bool compiled = graph->compile();
+                compileTicks[frame] = getPerformanceCounter() - start;
+                if (!compiled) {
+                    return 1;
+                }
+
+                start = getPerformanceCounter();
+                graph->execute(&backend);
+                glFinish();
+                renderTicks[frame] = getPerformanceCounter() - start;
+                renderer.endFrame();
+            }
+            glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+            glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, aliasing ? aliasedPixels : separatePixels);
+
+            RenderGraphStats stats = graph->stats;
+            u64 textureBytes = backend.textureBytes;
+            backend.destroy();
+            double compileSeconds = medianSeconds(compileTicks, frameCount);
+            double renderSeconds = medianSeconds(renderTicks, frameCount);
+            printf("{\"benchmark\":\"render_graph\",\"mode\":\"%s\",\"chains\":%d,\"passes\":%u,\"culled\":%u,"
+                "\"compile_us\":%.2f,\"render_ms\":%.3f,\"targets\":%u,\"textures\":%u,\"texture_bytes\":%llu,\"transient_bytes\":%llu}\n",
+                aliasing ? "aliased" : "separate", chainCount, stats.passes, stats.culledPasses,
+                compileSeconds * 1000000.0, renderSeconds * 1000.0, stats.transientTargets, stats.physicalTargets,
+                (unsigned long long)textureBytes, (unsigned long long)stats.transientBytes);
+            fflush(stdout);
+        }
+
+        u64 mismatches = 0;
+        for (u64 i = 0; i < pixelBytes; i += 4) {
+            mismatches += memcmp(aliasedPixels + i, separatePixels + i, 4) != 0 ? 1 : 0;
+        }
+        printf("{\"benchmark\":\"render_graph\",\"chains\":%d,\"mismatching_pixels\":%llu}\n", chainCount, (unsigned long long)mismatches);
+        totalMismatches += mismatches;
+    }
+    graph->useAliasing = true;
+
+    renderer.framePacer.destroy();
+    return totalMismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+/******************************************************************************
+* Software renderer benchmark
+*
+* Renders 1920x1080 frames with the tile based software renderer for a few
+* typical scenes and reports the throughput in written Mpixels/s, with one
+* thread and with all processors.
+*
+* Build (Linux):   g++ -O2 -mavx2 -pthread bench/bench_software_renderer.cpp -o bench_software_renderer
+* Build (Windows): cl /O2 /arch:AVX2 bench\bench_software_renderer.cpp
+* Usage: bench_software_renderer [--quick]
+*
+* Every result is printed as a single JSON object per line to stdout.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#include "../src/fp_core.h"
+#include "../src/fp_allocator.h"
+
+#if defined(_WIN32)
+#include "../src/fp_win32.h"
+#else
+#include "../src/fp_linux.h"
+#endif
+
+#include "../src/fp_jobs.h"
+#include "../src/fp_software_renderer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int WIDTH = 1920;
+static const int HEIGHT = 1080;
+
+struct SceneDescription {
+    const char* name;
+    u64 rectCount;
+    int maxSize;
+    // Translucent rectangles per 100
+    u32 translucentPercent;
+};
+
+static void fillScene(RenderCommandBuffer* commands, SceneDescription* scene) {
+    RenderCommandRectangle rect = {};
+    rect.type = Render_Rectangle;
+
+    u64 state = 0x2545F4914F6CDD1DULL;
+    for (u64 i = 0; i < scene->rectCount; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        bool translucent = (state >> 48) % 100 < scene->translucentPercent;
+        rect.x = (float)(state % WIDTH);
+        rect.y = (float)((state >> 16) % HEIGHT);
+        rect.width = (float)(1 + (state >> 32) % scene->maxSize);
+        rect.height = (float)(1 + (state >> 40) % scene->maxSize);
+        rect.color = {
+            (state & 0xFF) / 255.0f, ((state >> 8) & 0xFF) / 255.0f, ((state >> 24) & 0xFF) / 255.0f,
+            translucent ? 0.5f : 1.0f
+        };
+        commands->push(&rect);
+    }
+}
+
+static int compareU64(const void* a, const void* b) {
+    u64 left = *(const u64*)a;
+    u64 right = *(const u64*)b;
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+static u64 medianTicks(u64* ticks, int count) {
+    qsort(ticks, count, sizeof(u64), compareU64);
+    return ticks[count / 2];
+}
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    int frameCount = quick ? 5 : 15;
+
+    SceneDescription scenes[] = {
+        { "fullscreen_layers", 32, 4 * WIDTH, 0 },
+        { "ui_panels", 2000, 400, 30 },
+        { "small_rects", quick ? 50000ULL : 200000ULL, 16, 10 },
+        { "translucent", 1000, 600, 100 },
+    };
+
+    Allocator pageAllocator = createPageAllocator();
+
+    u64 commandMemorySize = 64 * MB;
+    u64 softwareMemorySize = 128 * MB;
+    u64 pixelBytes = (u64)WIDTH * HEIGHT * sizeof(u32);
+    void* commandMemory = pageAllocator.allocate(commandMemorySize);
+    void* softwareMemory = pageAllocator.allocate(softwareMemorySize);
+    u32* pixels = (u32*)pageAllocator.allocate(pixelBytes);
+
+    RenderCommandBuffer commands = {};
+    commands.create(commandMemory, commandMemorySize, &pageAllocator);
+    RenderCommandBuffer* buffers[] = { &commands };
+
+    SoftwareFramebuffer framebuffer = { pixels, WIDTH, HEIGHT };
+    float projection[16] = {
+        2.0f / WIDTH, 0.0f,  0.0f, -1.0f,
+        0.0f, 2.0f / HEIGHT, 0.0f, -1.0f,
+        0.0f, 0.0f,                1.0f, 0.0f,
+        0.0f, 0.0f,                0.0f, 1.0f,
+    };
+
+    int processorCount = getProcessorCount();
+    JobSystem jobs = {};
+    jobs.create(processorCount - 1);
+
+    for (SceneDescription& scene : scenes) {
+        commands.reset();
+        fillScene(&commands, &scene);
+
+        int threadCounts[] = { 1, processorCount };
+        int threadCountVariants = processorCount > 1 ? 2 : 1;
+        for (int variant = 0; variant < threadCountVariants; ++variant) {
+            SoftwareRenderer software = {};
+            software.setup(softwareMemory, softwareMemorySize);
+            software.setProjection(projection);
+            software.jobSystem = threadCounts[variant] > 1 ? &jobs : nullptr;
+
+            u64 ticks[32];
+            for (int frame = 0; frame < frameCount; ++frame) {
+                u64 start = getPerformanceCounter();
+                clearFramebuffer(&framebuffer, { 0.0f, 0.0f, 0.0f, 1.0f });
+                software.render(buffers, 1, &framebuffer);
+                ticks[frame] = getPerformanceCounter() - start;
+            }
+
+            double seconds = (double)medianTicks(ticks, frameCount) / (double)getPerformanceFrequency();
+            u64 pixelsWritten = software.pixelsWritten + (u64)WIDTH * HEIGHT;
+            printf("{\"benchmark\":\"software_renderer\",\"scene\":\"%s\",\"rects\":%llu,\"threads\":%d,"
+                "\"ms_per_frame\":%.3f,\"mpixels_per_sec\":%.1f,\"overdraw\":%.2f}\n",
+                scene.name, (unsigned long long)scene.rectCount, threadCounts[variant], seconds * 1000.0,
+                pixelsWritten / seconds / 1e6, (double)software.pixelsWritten / ((double)WIDTH * HEIGHT));
+            fflush(stdout);
+        }
+    }
+
+    jobs.destroy();
+    pageAllocator.free(pixels, pixelBytes);
+    pageAllocator.free(softwareMemory, softwareMemorySize);
+    pageAllocator.free(commandMemory, commandMemorySize);
+
+    return 0;
+}
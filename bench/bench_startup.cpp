@@ -0,0 +1,96 @@
+/******************************************************************************
+* Startup benchmark
+*
+* Measures Renderer::setup() twice in one process: first with an empty
+* program binary cache, where all shaders are compiled, then with the
+* binaries written by the first run. Reports the time of each program from
+* being added until it was seen linked, and the time setup() spent waiting
+* for the compiles.
+*
+* Mesa only offers program binaries while its own shader cache is enabled,
+* so the first run may already profit from earlier runs through that cache.
+*
+* Runs headless, e.g. on Mesa llvmpipe.
+*
+* Build: g++ -O2 -mavx2 -pthread bench/bench_startup.cpp -lEGL -lGL -o bench_startup
+* Usage: bench_startup
+*
+* Every result is printed as a single JSON object per line to stdout.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#include "../src/fp_core.h"
+#include "../src/fp_allocator.h"
+#include "../src/fp_egl.h"
+#include "../src/fp_renderer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+static double toMilliseconds(u64 ticks) {
+    return 1000.0 * (double)ticks / (double)getPerformanceFrequency();
+}
+
+static void printPrograms(const char* run, ShaderCache* cache, u64 setupTicks) {
+    for (int i = 0; i < cache->count; ++i) {
+        ShaderProgramEntry* entry = &cache->entries[i];
+        printf("{\"benchmark\":\"startup\",\"run\":\"%s\",\"program\":\"%s\",\"ms\":%.3f,\"from_cache\":%s}\n",
+            run, entry->name, toMilliseconds(entry->compileTicks), entry->fromCache ? "true" : "false");
+    }
+    printf("{\"benchmark\":\"startup\",\"run\":\"%s\",\"setup_ms\":%.3f,\"wait_ms\":%.3f,\"cache_hits\":%u,"
+        "\"cache_misses\":%u,\"parallel_compile\":%s}\n",
+        run, toMilliseconds(setupTicks), toMilliseconds(cache->stats.finishTicks), cache->stats.cacheHits,
+        cache->stats.cacheMisses, cache->parallelCompile ? "true" : "false");
+    fflush(stdout);
+}
+
+// Deletes the cache files, so the next run starts cold again
+static void removeCacheFiles(ShaderCache* cache) {
+    for (int i = 0; i < cache->count; ++i) {
+        wchar_t path[512];
+        char narrowPath[1024];
+        if (cache->pathPrefix && cache->buildPath(cache->entries[i].hash, path, 512)
+            && wcstombs(narrowPath, path, sizeof(narrowPath)) < sizeof(narrowPath)) {
+            remove(narrowPath);
+        }
+    }
+}
+
+int main() {
+    HeadlessContext headless = {};
+    if (!gl_createHeadlessContext(&headless)) {
+        return 1;
+    }
+    defer{ gl_destroyHeadlessContext(&headless); };
+
+    wchar_t cachePrefix[128];
+    swprintf(cachePrefix, 128, L"/tmp/bench_startup_%d_", (int)getpid());
+
+    Allocator pageAllocator = createPageAllocator();
+    int renderMemorySize = 1 * MB;
+    void* renderMemory = pageAllocator.allocate(2 * renderMemorySize);
+    defer{ pageAllocator.free(renderMemory, 2 * renderMemorySize); };
+
+    static Renderer cold = {};
+    cold.shaderCachePath = cachePrefix;
+    u64 start = getPerformanceCounter();
+    cold.setup(renderMemory, renderMemorySize);
+    printPrograms("cold", &cold.shaderCache, getPerformanceCounter() - start);
+
+    static Renderer warm = {};
+    warm.shaderCachePath = cachePrefix;
+    start = getPerformanceCounter();
+    warm.setup((u8*)renderMemory + renderMemorySize, renderMemorySize);
+    printPrograms("warm", &warm.shaderCache, getPerformanceCounter() - start);
+
+    removeCacheFiles(&cold.shaderCache);
+    cold.framePacer.destroy();
+    warm.framePacer.destroy();
+
+    bool allCached = warm.shaderCache.stats.cacheMisses == 0 || !warm.shaderCache.pathPrefix;
+    return allCached ? 0 : 1;
+}
@@ -0,0 +1,178 @@
+/******************************************************************************
+* Text benchmark
+*
+* Measures the throughput of the text path in glyphs per second:
+*
+* - rasterize: glyphs rasterized into the atlas on first use, cold cache
+* - layout: text commands laid out into glyph rectangles, warm cache
+* - emission: glyph rectangles sorted and written as instances by render()
+*
+* Runs headless, e.g. on Mesa llvmpipe.
+*
+* Build: g++ -O2 -mavx2 -pthread bench/bench_text.cpp -lEGL -lGL -o bench_text
+* Usage: bench_text [--quick] [font.ttf]
+*
+* Every result is printed as a single JSON object per line to stdout.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#include "../src/fp_core.h"
+#include "../src/fp_allocator.h"
+#include "../src/fp_egl.h"
+#include "../src/fp_renderer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int WIDTH = 1920;
+static const int HEIGHT = 1080;
+static const char* DEFAULT_FONT = "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf";
+
+static char const* const SAMPLE_TEXT =
+    "Frame 1234: 16.6 ms cpu, 4.2 ms gpu, 20000 rects in 3 batches (instanced, culled 512)";
+
+static void fillText(RenderCommandBuffer* commands, int lineCount, float size) {
+    RenderCommandText text = {};
+    text.size = size;
+    text.color = { 0.9f, 0.9f, 0.9f, 1.0f };
+    u32 length = (u32)strlen(SAMPLE_TEXT);
+    for (int i = 0; i < lineCount; ++i) {
+        text.x = (float)(i % 3) * 640.0f;
+        text.y = (float)(HEIGHT - 20 - (i / 3) % 60 * 18);
+        commands->push(&text, SAMPLE_TEXT, length);
+    }
+}
+
+static int compareU64(const void* a, const void* b) {
+    u64 left = *(const u64*)a;
+    u64 right = *(const u64*)b;
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+static double medianSeconds(u64* ticks, int count) {
+    qsort(ticks, count, sizeof(u64), compareU64);
+    return (double)ticks[count / 2] / (double)getPerformanceFrequency();
+}
+
+static void printResult(const char* phase, u64 glyphs, double seconds) {
+    printf("{\"benchmark\":\"text\",\"phase\":\"%s\",\"glyphs\":%llu,\"ms\":%.3f,\"glyphs_per_sec\":%.0f}\n",
+        phase, (unsigned long long)glyphs, seconds * 1000.0, glyphs / seconds);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    bool quick = false;
+    const char* fontPath = DEFAULT_FONT;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+        }
+        else {
+            fontPath = argv[i];
+        }
+    }
+    int frameCount = quick ? 5 : 20;
+    int lineCount = quick ? 200 : 1000;
+
+    FILE* file = fopen(fontPath, "rb");
+    if (!file) {
+        fprintf(stderr, "Could not open %s\n", fontPath);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    long fontSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    u8* fontData = (u8*)malloc(fontSize);
+    bool fontRead = fread(fontData, 1, fontSize, file) == (size_t)fontSize;
+    fclose(file);
+    defer{ free(fontData); };
+
+    TrueTypeFont font = {};
+    if (!fontRead || !initTrueTypeFont(&font, fontData, fontSize)) {
+        fprintf(stderr, "%s is not a supported TrueType font\n", fontPath);
+        return 1;
+    }
+
+    HeadlessContext headless = {};
+    if (!gl_createHeadlessContext(&headless)) {
+        return 1;
+    }
+    defer{ gl_destroyHeadlessContext(&headless); };
+
+    OffscreenTarget target = {};
+    if (!gl_createOffscreenTarget(&target, WIDTH, HEIGHT)) {
+        fprintf(stderr, "Offscreen framebuffer is incomplete\n");
+        return 1;
+    }
+
+    Allocator pageAllocator = createPageAllocator();
+    int renderMemorySize = 256 * MB;
+    void* renderMemory = pageAllocator.allocate(renderMemorySize);
+    defer{ pageAllocator.free(renderMemory, renderMemorySize); };
+
+    Renderer renderer = {};
+    renderer.setup(renderMemory, renderMemorySize);
+    renderer.glyphCache.setFont(&font);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glViewport(0, 0, WIDTH, HEIGHT);
+
+    float projection[16] = {
+        2.0f / WIDTH, 0.0f,  0.0f, -1.0f,
+        0.0f, 2.0f / HEIGHT, 0.0f, -1.0f,
+        0.0f, 0.0f,                1.0f, 0.0f,
+        0.0f, 0.0f,                0.0f, 1.0f,
+    };
+    renderer.setProjection(projection);
+
+    RenderCommandBuffer* buffers[1 + MAX_THREAD_COMMAND_BUFFERS];
+    int bufferCount = renderer.collectCommandBuffers(buffers);
+
+    // Every size is rasterized once, all later uses hit the cache
+    {
+        u64 glyphsBefore = renderer.glyphCache.stats.rasterizedGlyphs;
+        u64 start = getPerformanceCounter();
+        for (int size = 8; size <= 64; size += 2) {
+            renderer.beginFrame();
+            fillText(&renderer.commands, 1, (float)size);
+            layoutTextCommands(buffers, bufferCount, &renderer.glyphCache, &renderer.temporaryRenderBuffer);
+        }
+        double seconds = (double)(getPerformanceCounter() - start) / (double)getPerformanceFrequency();
+        printResult("rasterize", renderer.glyphCache.stats.rasterizedGlyphs - glyphsBefore, seconds);
+    }
+
+    u64 layoutTicks[64];
+    u64 emissionTicks[64];
+    u64 glyphCount = 0;
+    for (int frame = 0; frame < frameCount; ++frame) {
+        renderer.beginFrame();
+        fillText(&renderer.commands, lineCount, 14.0f);
+
+        u64 start = getPerformanceCounter();
+        layoutTextCommands(buffers, bufferCount, &renderer.glyphCache, &renderer.temporaryRenderBuffer);
+        layoutTicks[frame] = getPerformanceCounter() - start;
+        glyphCount = renderer.commands.rectCount;
+
+        // render() lays out the text again, only the following phases are counted
+        glClear(GL_COLOR_BUFFER_BIT);
+        renderer.render();
+        emissionTicks[frame] = renderer.timings.uploadTicks;
+        renderer.endFrame();
+    }
+    glFinish();
+
+    printResult("layout", glyphCount, medianSeconds(layoutTicks, frameCount));
+    printResult("emission", glyphCount, medianSeconds(emissionTicks, frameCount));
+
+    AtlasStats atlasStats = renderer.atlas.stats;
+    printf("{\"benchmark\":\"text\",\"phase\":\"atlas\",\"uploads\":%llu,\"uploaded_bytes\":%llu,\"batches\":%u}\n",
+        (unsigned long long)atlasStats.uploads, (unsigned long long)atlasStats.uploadedBytes, renderer.batchCount);
+
+    renderer.framePacer.destroy();
+    return 0;
+}
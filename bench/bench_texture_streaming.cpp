@@ -0,0 +1,288 @@
+/******************************************************************************
+* Texture streaming benchmark
+*
+* Renders frames of rectangles while large mipmapped textures are uploaded,
+* in three modes:
+*
+* none:     no uploads, the baseline frame time
+* sync:     all levels decoded and uploaded with glTextureSubImage2D from
+*           client memory in the first frame
+* streamed: decoded into the upload ring by the job system and uploaded
+*           within the frame budget of the renderer's TextureStreamer
+*
+* Reports the upload throughput, the median and worst frame time and how
+* many frames the textures took to arrive. The streamed textures are read
+* back and compared against the decoder.
+*
+* Runs headless, e.g. on Mesa llvmpipe.
+*
+* Build: g++ -O2 -mavx2 -pthread bench/bench_texture_streaming.cpp -lEGL -lGL -o bench_texture_streaming
+* Usage: bench_texture_streaming [--quick]
+*
+* Every result is printed as a single JSON object per line to stdout.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#include "../src/fp_core.h"
+#include "../src/fp_allocator.h"
+#include "../src/fp_egl.h"
+#include "../src/fp_renderer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int WIDTH = 1280;
+static const int HEIGHT = 720;
+static const int RECTS_PER_FRAME = 2000;
+static const int MAX_FRAMES = 512;
+
+static int compareU64(const void* a, const void* b) {
+    u64 left = *(const u64*)a;
+    u64 right = *(const u64*)b;
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+static double medianSeconds(u64* ticks, int count) {
+    qsort(ticks, count, sizeof(u64), compareU64);
+    return (double)ticks[count / 2] / (double)getPerformanceFrequency();
+}
+
+static double maxSeconds(u64* ticks, int count) {
+    u64 result = 0;
+    for (int i = 0; i < count; ++i) {
+        result = ticks[i] > result ? ticks[i] : result;
+    }
+    return (double)result / (double)getPerformanceFrequency();
+}
+
+// Stands in for an image decoder, every texel depends on the texture, level and position
+static u32 decodeTexel(u32 seed, int level, int x, int y) {
+    u32 state = seed ^ ((u32)level * 0x9E3779B9u) ^ ((u32)x * 0x85EBCA6Bu) ^ ((u32)y * 0xC2B2AE35u);
+    state ^= state >> 16;
+    state *= 0x7FEB352Du;
+    state ^= state >> 15;
+    state *= 0x846CA68Bu;
+    state ^= state >> 16;
+    return state | 0xFF000000u;
+}
+
+static void decodeImage(void* data, int level, int firstRow, int rowCount, int levelWidth, u32* texels) {
+    u32 seed = *(u32*)data;
+    for (int row = 0; row < rowCount; ++row) {
+        for (int x = 0; x < levelWidth; ++x) {
+            texels[(u64)row * levelWidth + x] = decodeTexel(seed, level, x, firstRow + row);
+        }
+    }
+}
+
+static void fillScene(RenderCommandBuffer* commands, int frame) {
+    RenderCommandRectangle rect = {};
+    rect.type = Render_Rectangle;
+
+    u32 state = 0x9E3779B9u ^ (u32)frame;
+    for (int i = 0; i < RECTS_PER_FRAME; ++i) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        rect.x = (float)(state % WIDTH);
+        rect.y = (float)((state >> 11) % HEIGHT);
+        rect.width = (float)(4 + (state >> 3) % 32);
+        rect.height = (float)(4 + (state >> 7) % 32);
+        rect.color = { (state & 0xFF) / 255.0f, ((state >> 8) & 0xFF) / 255.0f, ((state >> 16) & 0xFF) / 255.0f, 1.0f };
+        commands->push(&rect);
+    }
+}
+
+static u64 mipChainBytes(int size) {
+    u64 bytes = 0;
+    for (int level = 0; (size >> level) > 0; ++level) {
+        bytes += (u64)(size >> level) * (size >> level) * sizeof(u32);
+    }
+    return bytes;
+}
+
+// Compares the finest, a middle and the coarsest level against the decoder
+static bool verifyTexture(StreamedTexture* texture, u32 seed, u32* scratch) {
+    int levels[] = { 0, texture->levelCount / 2, texture->levelCount - 1 };
+    for (int level : levels) {
+        int levelWidth = mipLevelSize(texture->width, level);
+        int levelHeight = mipLevelSize(texture->height, level);
+        u64 bytes = (u64)levelWidth * levelHeight * sizeof(u32);
+        glGetTextureImage(texture->texture, level, GL_RGBA, GL_UNSIGNED_BYTE, (GLsizei)bytes, scratch);
+        for (int y = 0; y < levelHeight; ++y) {
+            for (int x = 0; x < levelWidth; ++x) {
+                if (scratch[(u64)y * levelWidth + x] != decodeTexel(seed, level, x, y)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static void printResult(const char* mode, int textureCount, int textureSize, u64 bytes, double uploadSeconds,
+    u64* frameTicks, int frameCount, double baselineSeconds, int framesToFirstLevel, int framesToComplete, u64 ringFullUpdates) {
+    double median = medianSeconds(frameTicks, frameCount);
+    double worst = maxSeconds(frameTicks, frameCount);
+    double megabytes = (double)bytes / (double)MB;
+    printf("{\"benchmark\":\"texture_streaming\",\"mode\":\"%s\",\"textures\":%d,\"size\":%d,\"upload_mb\":%.1f,"
+        "\"upload_mb_per_sec\":%.1f,\"frame_ms_p50\":%.3f,\"frame_ms_max\":%.3f,\"frame_impact_ms\":%.3f,"
+        "\"frames_to_first_level\":%d,\"frames_to_complete\":%d,\"ring_full_updates\":%llu}\n",
+        mode, textureCount, textureSize, megabytes, uploadSeconds > 0.0 ? megabytes / uploadSeconds : 0.0,
+        median * 1000.0, worst * 1000.0, (worst - baselineSeconds) * 1000.0, framesToFirstLevel, framesToComplete,
+        (unsigned long long)ringFullUpdates);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    int textureCount = quick ? 4 : 8;
+    int textureSize = quick ? 1024 : 2048;
+    int frameCount = quick ? 10 : 30;
+
+    HeadlessContext headless = {};
+    if (!gl_createHeadlessContext(&headless)) {
+        return 1;
+    }
+    defer{ gl_destroyHeadlessContext(&headless); };
+
+    OffscreenTarget target = {};
+    if (!gl_createOffscreenTarget(&target, WIDTH, HEIGHT)) {
+        fprintf(stderr, "Offscreen framebuffer is incomplete\n");
+        return 1;
+    }
+
+    Allocator pageAllocator = createPageAllocator();
+    int renderMemorySize = 16 * MB;
+    void* renderMemory = pageAllocator.allocate(renderMemorySize);
+    defer{ pageAllocator.free(renderMemory, renderMemorySize); };
+
+    // Holds one level for the synchronous uploads and the read back
+    u64 scratchSize = (u64)textureSize * textureSize * sizeof(u32);
+    u32* scratch = (u32*)pageAllocator.allocate(scratchSize);
+    defer{ pageAllocator.free(scratch, scratchSize); };
+
+    JobSystem jobs = {};
+    jobs.create(getProcessorCount() - 1);
+    defer{ jobs.destroy(); };
+
+    Renderer renderer = {};
+    renderer.setup(renderMemory, renderMemorySize);
+    renderer.jobSystem = &jobs;
+    defer{ renderer.textureStreamer.destroy(); };
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glViewport(0, 0, WIDTH, HEIGHT);
+
+    float projection[16] = {
+        2.0f / WIDTH, 0.0f,  0.0f, -1.0f,
+        0.0f, 2.0f / HEIGHT, 0.0f, -1.0f,
+        0.0f, 0.0f,                1.0f, 0.0f,
+        0.0f, 0.0f,                0.0f, 1.0f,
+    };
+    renderer.setProjection(projection);
+
+    u32 seeds[MAX_STREAMED_TEXTURES];
+    for (int i = 0; i < textureCount; ++i) {
+        seeds[i] = 0x1234567u * (u32)(i + 1);
+    }
+    u64 totalBytes = textureCount * mipChainBytes(textureSize);
+
+    u64 frameTicks[MAX_FRAMES];
+    for (int frame = 0; frame < frameCount; ++frame) {
+        u64 start = getPerformanceCounter();
+        renderer.beginFrame();
+        fillScene(&renderer.commands, frame);
+        glClear(GL_COLOR_BUFFER_BIT);
+        renderer.render();
+        glFinish();
+        renderer.endFrame();
+        frameTicks[frame] = getPerformanceCounter() - start;
+    }
+    double baseline = medianSeconds(frameTicks, frameCount);
+    printResult("none", 0, 0, 0, 0.0, frameTicks, frameCount, baseline, 0, 0, 0);
+
+    // Everything in the first frame, the way the texture atlas uploads its images
+    unsigned int syncTextures[MAX_STREAMED_TEXTURES];
+    u64 syncUploadTicks = 0;
+    for (int frame = 0; frame < frameCount; ++frame) {
+        u64 start = getPerformanceCounter();
+        renderer.beginFrame();
+        if (frame == 0) {
+            for (int i = 0; i < textureCount; ++i) {
+                int levelCount = 1;
+                while ((textureSize >> levelCount) > 0) {
+                    levelCount += 1;
+                }
+                glCreateTextures(GL_TEXTURE_2D, 1, &syncTextures[i]);
+                glTextureStorage2D(syncTextures[i], levelCount, GL_RGBA8, textureSize, textureSize);
+                for (int level = 0; level < levelCount; ++level) {
+                    int levelSize = mipLevelSize(textureSize, level);
+                    decodeImage(&seeds[i], level, 0, levelSize, levelSize, scratch);
+                    glTextureSubImage2D(syncTextures[i], level, 0, 0, levelSize, levelSize, GL_RGBA, GL_UNSIGNED_BYTE, scratch);
+                }
+            }
+            syncUploadTicks = getPerformanceCounter() - start;
+        }
+        fillScene(&renderer.commands, frame);
+        glClear(GL_COLOR_BUFFER_BIT);
+        renderer.render();
+        glFinish();
+        renderer.endFrame();
+        frameTicks[frame] = getPerformanceCounter() - start;
+    }
+    glDeleteTextures(textureCount, syncTextures);
+    printResult("sync", textureCount, textureSize, totalBytes, (double)syncUploadTicks / (double)getPerformanceFrequency(),
+        frameTicks, frameCount, baseline, 1, 1, 0);
+
+    TextureStreamer* streamer = &renderer.textureStreamer;
+    StreamedTexture* textures[MAX_STREAMED_TEXTURES];
+    for (int i = 0; i < textureCount; ++i) {
+        textures[i] = streamer->stream(textureSize, textureSize, &decodeImage, &seeds[i]);
+        if (!textures[i]) {
+            fprintf(stderr, "Failed to stream texture %d\n", i);
+            return 1;
+        }
+    }
+
+    int framesToFirstLevel = 0;
+    int framesToComplete = 0;
+    int streamedFrames = 0;
+    while (streamedFrames < MAX_FRAMES && (framesToComplete == 0 || streamedFrames < framesToComplete + frameCount)) {
+        u64 start = getPerformanceCounter();
+        renderer.beginFrame();
+        fillScene(&renderer.commands, streamedFrames);
+        glClear(GL_COLOR_BUFFER_BIT);
+        renderer.render();
+        glFinish();
+        renderer.endFrame();
+        frameTicks[streamedFrames++] = getPerformanceCounter() - start;
+
+        bool allResident = true;
+        bool allComplete = true;
+        for (int i = 0; i < textureCount; ++i) {
+            allResident &= textures[i]->residentLevel < textures[i]->levelCount;
+            allComplete &= streamer->isComplete(textures[i]);
+        }
+        framesToFirstLevel = framesToFirstLevel == 0 && allResident ? streamedFrames : framesToFirstLevel;
+        framesToComplete = framesToComplete == 0 && allComplete ? streamedFrames : framesToComplete;
+    }
+    printResult("streamed", textureCount, textureSize, streamer->stats.uploadedBytes,
+        (double)streamer->stats.updateTicks / (double)getPerformanceFrequency(), frameTicks, streamedFrames, baseline,
+        framesToFirstLevel, framesToComplete, streamer->stats.ringFullUpdates);
+
+    bool matches = framesToComplete > 0 && streamer->stats.uploadedBytes == totalBytes;
+    for (int i = 0; i < textureCount && matches; ++i) {
+        matches = verifyTexture(textures[i], seeds[i], scratch);
+    }
+    printf("{\"benchmark\":\"texture_streaming\",\"matches_decoder\":%s}\n", matches ? "true" : "false");
+
+    renderer.framePacer.destroy();
+    return matches ? 0 : 1;
+}
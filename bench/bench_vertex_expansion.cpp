@@ -0,0 +1,177 @@
+/******************************************************************************
+* Vertex expansion benchmark
+*
+* Compares the scalar vertex expansion of sorted rectangle commands against
+* the SoA gather plus AVX2 expansion for 10k to 1M rectangles. Both write
+* into ordinary cached memory and into a persistently mapped GL buffer, like
+* the streaming buffer of the renderer, where the non-temporal stores of the
+* AVX2 kernel are meant to pay off.
+*
+* Runs headless, e.g. on Mesa llvmpipe. There the mapped buffer is plain
+* system memory, a discrete GPU maps it write-combined.
+*
+* Build: g++ -O2 -mavx2 -pthread bench/bench_vertex_expansion.cpp -lEGL -lGL -o bench_vertex_expansion
+*
+* Every result is printed as a single JSON object per line to stdout.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#include "../src/fp_core.h"
+#include "../src/fp_allocator.h"
+#include "../src/fp_egl.h"
+#include "../src/fp_render_commands.h"
+#include "../src/fp_vertex_expansion.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int ITERATIONS = 15;
+
+static void fillRects(RenderCommandBuffer* commands, u64 count) {
+    RenderCommandRectangle rect = {};
+    rect.type = Render_Rectangle;
+
+    u64 state = 0x2545F4914F6CDD1DULL;
+    for (u64 i = 0; i < count; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        rect.x = (float)(state % 1920);
+        rect.y = (float)((state >> 16) % 1080);
+        rect.width = (float)(1 + (state >> 32) % 200);
+        rect.height = (float)(1 + (state >> 40) % 200);
+        rect.color = { (state & 0xFF) / 255.0f, ((state >> 8) & 0xFF) / 255.0f, ((state >> 24) & 0xFF) / 255.0f, 1.0f };
+        commands->push(&rect);
+    }
+}
+
+static int compareU64(const void* a, const void* b) {
+    u64 left = *(const u64*)a;
+    u64 right = *(const u64*)b;
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+static u64 medianTicks(u64* ticks, int count) {
+    qsort(ticks, count, sizeof(u64), compareU64);
+    return ticks[count / 2];
+}
+
+static void printResult(const char* kernel, const char* target, u64 rectCount, u64 ticks, bool matches) {
+    double seconds = (double)ticks / (double)getPerformanceFrequency();
+    double rectsPerSecond = seconds > 0.0 ? rectCount / seconds : 0.0;
+    double bytesPerSecond = rectsPerSecond * sizeof(ExpandedRect);
+
+    printf("{\"benchmark\":\"vertex_expansion\",\"kernel\":\"%s\",\"target\":\"%s\",\"rects\":%llu,\"seconds\":%.6f,"
+        "\"rects_per_sec\":%.0f,\"output_gb_per_sec\":%.3f,\"matches_scalar\":%s}\n",
+        kernel, target, (unsigned long long)rectCount, seconds, rectsPerSecond, bytesPerSecond * 1e-9,
+        matches ? "true" : "false");
+    fflush(stdout);
+}
+
+// Expands the entries with both kernels into the target, the AVX2 result is left in it
+static void measureKernels(SortEntry* entries, u64 rectCount, ExpandedRect* target, ArenaAllocator* scratch,
+                           u64* scalarTicks, u64* gatherTicks, u64* simdTicks) {
+    for (int iteration = 0; iteration < ITERATIONS; ++iteration) {
+        u64 start = getPerformanceCounter();
+        expandRects(entries, rectCount, target);
+        scalarTicks[iteration] = getPerformanceCounter() - start;
+
+        scratch->reset();
+        start = getPerformanceCounter();
+        RectBatch batch = gatherRectBatch(entries, rectCount, scratch);
+        u64 gathered = getPerformanceCounter();
+        expandRectBatchAvx2(&batch, target);
+        u64 end = getPerformanceCounter();
+
+        gatherTicks[iteration] = gathered - start;
+        simdTicks[iteration] = end - start;
+    }
+}
+
+int main() {
+    static const u64 RECT_COUNTS[] = { 10000, 100000, 1000000 };
+
+    HeadlessContext headless = {};
+    if (!gl_createHeadlessContext(&headless)) {
+        return 1;
+    }
+    defer{ gl_destroyHeadlessContext(&headless); };
+
+    Allocator pageAllocator = createPageAllocator();
+
+    bool allMatch = true;
+    for (u64 rectCount : RECT_COUNTS) {
+        // All commands fit into the first chunk
+        u64 commandBytes = sizeof(RenderCommandChunk) + rectCount * sizeof(RenderCommandRectangle);
+        u64 entryBytes = rectCount * sizeof(SortEntry);
+        u64 vertexBytes = rectCount * sizeof(ExpandedRect);
+        u64 scratchBytes = rectCount * RECT_BATCH_ARRAYS * sizeof(float) + 64;
+
+        void* commandMemory = pageAllocator.allocate(commandBytes);
+        RenderCommandBuffer commands = {};
+        commands.create(commandMemory, commandBytes, nullptr);
+        fillRects(&commands, rectCount);
+
+        SortEntry* entries = (SortEntry*)pageAllocator.allocate(entryBytes);
+        u64 entryCount = 0;
+        for (RenderCommand* command = commands.chunks->first(); command < commands.chunks->onePastLast(); command = nextRenderCommand(command)) {
+            entries[entryCount].key = 0;
+            entries[entryCount].command = command;
+            entryCount += 1;
+        }
+
+        // Page allocations are aligned, which the streaming stores require
+        ExpandedRect* scalarVertices = (ExpandedRect*)pageAllocator.allocate(vertexBytes);
+        ExpandedRect* cachedVertices = (ExpandedRect*)pageAllocator.allocate(vertexBytes);
+        ExpandedRect* readbackVertices = (ExpandedRect*)pageAllocator.allocate(vertexBytes);
+        ArenaAllocator scratch = createArenaAllocator(pageAllocator.allocate(scratchBytes), scratchBytes);
+
+        // Mapped like the streaming buffer of the renderer
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        GLuint buffer = 0;
+        glCreateBuffers(1, &buffer);
+        glNamedBufferStorage(buffer, vertexBytes, nullptr, flags);
+        ExpandedRect* mappedVertices = (ExpandedRect*)glMapNamedBufferRange(buffer, 0, vertexBytes, flags);
+        if (!mappedVertices) {
+            fprintf(stderr, "Failed to map the vertex buffer\n");
+            return 1;
+        }
+
+        // Touch all pages once, so page faults are not measured
+        memset(cachedVertices, 0, vertexBytes);
+        memset(mappedVertices, 0, vertexBytes);
+        memset(scratch.data, 0, scratchBytes);
+        expandRects(entries, rectCount, scalarVertices);
+
+        u64 scalarTicks[ITERATIONS];
+        u64 simdTicks[ITERATIONS];
+        u64 gatherTicks[ITERATIONS];
+        measureKernels(entries, rectCount, cachedVertices, &scratch, scalarTicks, gatherTicks, simdTicks);
+        bool cachedMatches = memcmp(scalarVertices, cachedVertices, vertexBytes) == 0;
+        printResult("scalar", "cached", rectCount, medianTicks(scalarTicks, ITERATIONS), true);
+        printResult("soa_gather", "cached", rectCount, medianTicks(gatherTicks, ITERATIONS), true);
+        printResult("soa_gather_avx2_stream", "cached", rectCount, medianTicks(simdTicks, ITERATIONS), cachedMatches);
+
+        measureKernels(entries, rectCount, mappedVertices, &scratch, scalarTicks, gatherTicks, simdTicks);
+        glGetNamedBufferSubData(buffer, 0, vertexBytes, readbackVertices);
+        bool mappedMatches = memcmp(scalarVertices, readbackVertices, vertexBytes) == 0;
+        printResult("scalar", "mapped", rectCount, medianTicks(scalarTicks, ITERATIONS), true);
+        printResult("soa_gather_avx2_stream", "mapped", rectCount, medianTicks(simdTicks, ITERATIONS), mappedMatches);
+        allMatch = allMatch && cachedMatches && mappedMatches;
+
+        // Deleting the buffer also unmaps it
+        glDeleteBuffers(1, &buffer);
+        pageAllocator.free(scratch.data, scratchBytes);
+        pageAllocator.free(readbackVertices, vertexBytes);
+        pageAllocator.free(cachedVertices, vertexBytes);
+        pageAllocator.free(scalarVertices, vertexBytes);
+        pageAllocator.free(entries, entryBytes);
+        pageAllocator.free(commandMemory, commandBytes);
+    }
+
+    return allMatch ? 0 : 1;
+}
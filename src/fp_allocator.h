@@ -79,6 +79,7 @@ struct OwningAllocator : Allocator
  * This allocator needs to be implemented by each OS separately.
  * 
  * Windows: Implemented via VirtualAlloc
+ * Linux:   Implemented via mmap
  */ 
 Allocator createPageAllocator();
 
@@ -0,0 +1,230 @@
+/******************************************************************************
+* Command sorting
+*
+* Every command gets a 64 bit sort key which encodes its draw order and the
+* state it needs.
+*
+* Key layout, most significant bits first:
+*
+* layer (8) | depth (32) | translucent (1) | shader (7) | scissor (16)
+*
+* Layers are drawn in ascending order. Within a layer, commands are drawn in
+* submission order, the depth, since rectangles are drawn without a depth
+* test and later ones have to end up on top. Keys are created in submission
+* order, so sortEntriesByLayer() only has to sort by the layer. All rectangles sample the same
+* texture atlas, so the only state is the hardware scissor of clipped shapes,
+* see makeScissorKey(). Opaque and translucent rectangles share batches,
+* blending gives the same result for an alpha of 1.
+*
+* To get fewer batches, mergeBatchNeighbors() moves a command forward to the
+* batch before it if it has the same state and does not overlap any of the
+* commands it skips. Their order does not change the pixels then.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_core.h"
+#include "fp_allocator.h"
+#include "fp_render_commands.h"
+
+static const u64 SORT_KEY_TRANSLUCENT_BIT = 1ULL << 23;
+// Commands that mergeBatchNeighbors() looks at after a state change
+static const u64 BATCH_MERGE_LOOKAHEAD = 32;
+
+enum RenderShader {
+    Shader_Rectangle = 0,
+};
+
+struct SortEntry {
+    u64 key;
+    RenderCommand* command;
+};
+
+static u64 makeSortKey(u32 layer, bool translucent, u32 shader, u32 scissor, u32 depth) {
+    return ((u64)(layer & 0xFF) << 56) | ((u64)depth << 24) | (translucent ? SORT_KEY_TRANSLUCENT_BIT : 0)
+        | ((u64)(shader & 0x7F) << 16) | (scissor & 0xFFFF);
+}
+
+/**
+ * Scissor rects are numbered per command buffer, so the key combines the
+ * index of the buffer (upper 8 bits) with the scissor of the command (lower
+ * 8 bits). 0 draws without scissor.
+ */
+static u32 makeScissorKey(u32 buffer, RenderCommand* command) {
+    return command->scissor ? (buffer << 8) | command->scissor : 0;
+}
+
+static ClipRect* findScissorRect(RenderCommandBuffer** buffers, u32 scissorKey) {
+    return &buffers[scissorKey >> 8]->scissorRects[(scissorKey & 0xFF) - 1];
+}
+
+/**
+ * See isTranslucentRect() for which rectangles are translucent.
+ * buffer is the index of the command buffer of the rectangle, in draw order.
+ */
+static u64 makeRectangleSortKey(RenderCommandRectangle* rect, u32 depth, u32 buffer) {
+    return makeSortKey(rect->layer, isTranslucentRect(rect), Shader_Rectangle, makeScissorKey(buffer, rect), depth);
+}
+
+// The layer, commands are never moved between classes
+static const u32 SORT_KEY_CLASS_COUNT = 256;
+
+static u32 sortKeyClass(u64 key) {
+    return (u32)(key >> 56);
+}
+
+static bool sortKeyTranslucent(u64 key) {
+    return (key & SORT_KEY_TRANSLUCENT_BIT) != 0;
+}
+
+static u32 sortKeyShader(u64 key) {
+    return (key >> 16) & 0x7F;
+}
+
+static u32 sortKeyScissor(u64 key) {
+    return key & 0xFFFF;
+}
+
+// Everything in the key that requires a state change: shader and scissor
+static u64 sortKeyState(u64 key) {
+    return key & 0x7FFFFF;
+}
+
+/**
+ * Stable counting sort of the entries by layer, the top byte of the key.
+ *
+ * The entries have to be in submission order, as buildSortKeys() and
+ * gatherRectSegment() produce them. The depth then already orders the
+ * commands of a layer, so sorting by the layer alone orders the whole key.
+ * Nothing is moved if all entries share one layer, which is the case for
+ * every segment of renderRectSegments(). The scratch buffer for the copy is
+ * taken from the allocator. Returns false if the allocation fails, the
+ * entries are unchanged in that case.
+ */
+static bool sortEntriesByLayer(SortEntry* entries, u64 count, Allocator* scratch) {
+    if (count < 2) {
+        return true;
+    }
+
+    u32 histogram[256];
+    for (int i = 0; i < 256; ++i) {
+        histogram[i] = 0;
+    }
+    for (u64 i = 0; i < count; ++i) {
+        histogram[sortKeyClass(entries[i].key)] += 1;
+    }
+    if (histogram[sortKeyClass(entries[0].key)] == count) {
+        return true;
+    }
+
+    SortEntry* buffer = scratch->allocateArray<SortEntry>(count);
+    if (!buffer) {
+        return false;
+    }
+
+    // Exclusive prefix sum turns the counts into target offsets
+    u32 offset = 0;
+    for (int layer = 0; layer < 256; ++layer) {
+        u32 layerCount = histogram[layer];
+        histogram[layer] = offset;
+        offset += layerCount;
+    }
+
+    for (u64 i = 0; i < count; ++i) {
+        buffer[histogram[sortKeyClass(entries[i].key)]++] = entries[i];
+    }
+    for (u64 i = 0; i < count; ++i) {
+        entries[i] = buffer[i];
+    }
+
+    scratch->free(buffer, count * sizeof(SortEntry));
+    return true;
+}
+
+static bool rectsOverlap(RenderCommandRectangle* a, RenderCommandRectangle* b) {
+    float aMinX = a->width < 0.0f ? a->x + a->width : a->x;
+    float aMinY = a->height < 0.0f ? a->y + a->height : a->y;
+    float bMinX = b->width < 0.0f ? b->x + b->width : b->x;
+    float bMinY = b->height < 0.0f ? b->y + b->height : b->y;
+    float aWidth = a->width < 0.0f ? -a->width : a->width;
+    float aHeight = a->height < 0.0f ? -a->height : a->height;
+    float bWidth = b->width < 0.0f ? -b->width : b->width;
+    float bHeight = b->height < 0.0f ? -b->height : b->height;
+    return aMinX < bMinX + bWidth && bMinX < aMinX + aWidth && aMinY < bMinY + bHeight && bMinY < aMinY + aHeight;
+}
+
+/**
+ * Moves sorted entries forward to join the batch before them, where the
+ * state changes. Within BATCH_MERGE_LOOKAHEAD entries, the first one of the
+ * same layer and state is moved if its bounds do not overlap any of the
+ * entries it skips, which keep their order. Nothing that overlaps is
+ * reordered, so the pixels are the same as in submission order.
+ */
+static void mergeBatchNeighbors(SortEntry* entries, u64 count) {
+    for (u64 i = 1; i < count; ++i) {
+        u64 key = entries[i - 1].key;
+        if (sortKeyState(entries[i].key) == sortKeyState(key)) {
+            continue;
+        }
+
+        u64 end = count - i < BATCH_MERGE_LOOKAHEAD ? count : i + BATCH_MERGE_LOOKAHEAD;
+        for (u64 j = i + 1; j < end && sortKeyClass(entries[j].key) == sortKeyClass(key); ++j) {
+            if (sortKeyState(entries[j].key) != sortKeyState(key)) {
+                continue;
+            }
+
+            RenderCommandRectangle* candidate = (RenderCommandRectangle*)entries[j].command;
+            bool blocked = false;
+            for (u64 k = i; k < j && !blocked; ++k) {
+                blocked = rectsOverlap(candidate, (RenderCommandRectangle*)entries[k].command);
+            }
+            if (blocked) {
+                // Only the first entry with the state is tried, to keep this linear
+                break;
+            }
+
+            SortEntry moved = entries[j];
+            for (u64 k = j; k > i; --k) {
+                entries[k] = entries[k - 1];
+            }
+            entries[i] = moved;
+            break;
+        }
+    }
+}
+
+/**
+ * Consecutive sorted entries which can be drawn without a state change.
+ */
+struct RenderBatch {
+    u64 key;
+    u32 first;
+    u32 count;
+    // Some of the entries are translucent
+    bool blended;
+};
+
+/**
+ * Splits sorted entries into batches at every state change.
+ *
+ * batches needs space for count batches in the worst case. Returns the number of batches.
+ */
+static u32 buildRenderBatches(SortEntry* entries, u64 count, RenderBatch* batches) {
+    u32 batchCount = 0;
+    for (u64 i = 0; i < count; ++i) {
+        u64 key = entries[i].key;
+        if (batchCount == 0 || sortKeyState(batches[batchCount - 1].key) != sortKeyState(key)) {
+            RenderBatch* batch = &batches[batchCount++];
+            batch->key = key;
+            batch->first = (u32)i;
+            batch->count = 0;
+            batch->blended = false;
+        }
+        batches[batchCount - 1].count += 1;
+        batches[batchCount - 1].blended |= sortKeyTranslucent(key);
+    }
+    return batchCount;
+}
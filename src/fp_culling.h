@@ -0,0 +1,235 @@
+/******************************************************************************
+* Culling
+*
+* Removes rectangles that cannot contribute to the image before any vertex
+* data is generated:
+*
+* Viewport culling tests the bounds of 8 rectangles at a time with AVX2.
+* It does not depend on the draw order and runs before sorting.
+*
+* Occlusion culling walks the sorted commands back to front and tracks which
+* tiles of a coarse grid are already fully covered by opaque rectangles drawn
+* later. A rectangle is dropped if all tiles it touches are covered.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_core.h"
+#include "fp_allocator.h"
+#include "fp_command_sort.h"
+#include "fp_render_commands.h"
+#include "fp_math.h"
+
+#include <immintrin.h>
+
+// Number of tiles per axis of the occlusion grid, each row is one bit mask
+static const int OCCLUSION_GRID_SIZE = 64;
+
+struct CullStats {
+    u64 inputCommands;
+    u64 viewportCulled;
+    u64 occlusionCulled;
+};
+
+// Visible area in the coordinates of the commands
+struct CullRect {
+    float minX;
+    float minY;
+    float maxX;
+    float maxY;
+};
+
+/**
+ * Bounds of the unsorted commands as structure of arrays, in the same order as
+ * the sort entries. The arrays are padded to a multiple of 8 elements.
+ */
+struct CullBounds {
+    float* minX;
+    float* minY;
+    float* maxX;
+    float* maxY;
+};
+
+static CullBounds allocateCullBounds(u64 count, Allocator* allocator) {
+    CullBounds bounds = {};
+
+    u64 capacity = (count + 7ULL) & ~7ULL;
+    float* data = allocator->allocateArray<float>(4 * capacity);
+    if (!data) {
+        return bounds;
+    }
+    bounds.minX = data;
+    bounds.minY = data + 1 * capacity;
+    bounds.maxX = data + 2 * capacity;
+    bounds.maxY = data + 3 * capacity;
+
+    // The padding is tested but its result is masked out
+    for (u64 i = count; i < capacity; ++i) {
+        bounds.minX[i] = bounds.minY[i] = bounds.maxX[i] = bounds.maxY[i] = 0.0f;
+    }
+    return bounds;
+}
+
+static void storeCullBounds(CullBounds* bounds, u64 i, RenderCommandRectangle* rect) {
+    float x0 = rect->x;
+    float x1 = rect->x + rect->width;
+    float y0 = rect->y;
+    float y1 = rect->y + rect->height;
+    bounds->minX[i] = x0 < x1 ? x0 : x1;
+    bounds->maxX[i] = x0 < x1 ? x1 : x0;
+    bounds->minY[i] = y0 < y1 ? y0 : y1;
+    bounds->maxY[i] = y0 < y1 ? y1 : y0;
+}
+
+/**
+ * Removes the entries whose bounds do not overlap the viewport. The order of the
+ * remaining entries is kept. Returns the number of remaining entries.
+ */
+static u64 cullOutsideViewport(SortEntry* entries, CullBounds* bounds, u64 count, CullRect viewport) {
+    __m256 viewMinX = _mm256_set1_ps(viewport.minX);
+    __m256 viewMinY = _mm256_set1_ps(viewport.minY);
+    __m256 viewMaxX = _mm256_set1_ps(viewport.maxX);
+    __m256 viewMaxY = _mm256_set1_ps(viewport.maxY);
+
+    u64 visibleCount = 0;
+    for (u64 i = 0; i < count; i += 8) {
+        __m256 left = _mm256_cmp_ps(_mm256_loadu_ps(bounds->maxX + i), viewMinX, _CMP_GT_OQ);
+        __m256 right = _mm256_cmp_ps(_mm256_loadu_ps(bounds->minX + i), viewMaxX, _CMP_LT_OQ);
+        __m256 top = _mm256_cmp_ps(_mm256_loadu_ps(bounds->maxY + i), viewMinY, _CMP_GT_OQ);
+        __m256 bottom = _mm256_cmp_ps(_mm256_loadu_ps(bounds->minY + i), viewMaxY, _CMP_LT_OQ);
+        __m256 visible = _mm256_and_ps(_mm256_and_ps(left, right), _mm256_and_ps(top, bottom));
+
+        u32 mask = (u32)_mm256_movemask_ps(visible);
+        u64 remaining = count - i;
+        if (remaining < 8) {
+            mask &= (1u << remaining) - 1;
+        }
+
+        // Fast path for groups that are completely visible, which is the common case
+        if (mask == 0xFF && visibleCount == i) {
+            visibleCount += 8;
+            continue;
+        }
+        for (int lane = 0; lane < 8; ++lane) {
+            if (mask & (1u << lane)) {
+                entries[visibleCount++] = entries[i + lane];
+            }
+        }
+    }
+    return visibleCount;
+}
+
+/**
+ * Coarse coverage grid over the viewport. Bit x of rows[y] is set if tile
+ * (x, y) is completely covered by an opaque rectangle.
+ */
+struct OcclusionGrid {
+    u64 rows[OCCLUSION_GRID_SIZE];
+    CullRect viewport;
+    float tilesPerUnitX;
+    float tilesPerUnitY;
+
+    void reset(CullRect visibleArea) {
+        for (int y = 0; y < OCCLUSION_GRID_SIZE; ++y) {
+            rows[y] = 0;
+        }
+        viewport = visibleArea;
+        tilesPerUnitX = OCCLUSION_GRID_SIZE / (viewport.maxX - viewport.minX);
+        tilesPerUnitY = OCCLUSION_GRID_SIZE / (viewport.maxY - viewport.minY);
+    }
+
+    static int clampTile(float tile) {
+        return tile < 0.0f ? 0 : (tile > OCCLUSION_GRID_SIZE ? OCCLUSION_GRID_SIZE : (int)tile);
+    }
+
+    static int floorTile(float tile) {
+        return clampTile(floorFloat(tile));
+    }
+
+    static int ceilTile(float tile) {
+        return clampTile(ceilFloat(tile));
+    }
+
+    // Bit mask for the tiles [first, onePastLast)
+    static u64 tileMask(int first, int onePastLast) {
+        if (first >= onePastLast) {
+            return 0;
+        }
+        u64 upper = onePastLast == 64 ? ~0ULL : (1ULL << onePastLast) - 1;
+        return upper & ~((1ULL << first) - 1);
+    }
+
+    // True if every tile touched by the bounds is covered
+    bool covers(float minX, float minY, float maxX, float maxY) {
+        int x0 = floorTile((minX - viewport.minX) * tilesPerUnitX);
+        int x1 = ceilTile((maxX - viewport.minX) * tilesPerUnitX);
+        int y0 = floorTile((minY - viewport.minY) * tilesPerUnitY);
+        int y1 = ceilTile((maxY - viewport.minY) * tilesPerUnitY);
+
+        u64 mask = tileMask(x0, x1);
+        for (int y = y0; y < y1; ++y) {
+            if ((rows[y] & mask) != mask) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Marks the tiles which lie completely inside the bounds
+    void cover(float minX, float minY, float maxX, float maxY) {
+        int x0 = ceilTile((minX - viewport.minX) * tilesPerUnitX);
+        int x1 = floorTile((maxX - viewport.minX) * tilesPerUnitX);
+        int y0 = ceilTile((minY - viewport.minY) * tilesPerUnitY);
+        int y1 = floorTile((maxY - viewport.minY) * tilesPerUnitY);
+
+        u64 mask = tileMask(x0, x1);
+        for (int y = y0; y < y1; ++y) {
+            rows[y] |= mask;
+        }
+    }
+};
+
+/**
+ * Removes sorted entries which are hidden behind opaque rectangles drawn after
+ * them. Only translucent entries are blended, opaque entries overwrite the
+ * tiles they cover completely. Returns the number of remaining entries.
+ */
+static u64 cullOccluded(SortEntry* entries, u64 count, OcclusionGrid* grid) {
+    // Walk back to front and mark hidden entries by clearing their command
+    u64 hiddenCount = 0;
+    for (u64 i = count; i-- > 0;) {
+        RenderCommandRectangle* rect = (RenderCommandRectangle*)entries[i].command;
+        float x0 = rect->x;
+        float x1 = rect->x + rect->width;
+        float y0 = rect->y;
+        float y1 = rect->y + rect->height;
+        float minX = x0 < x1 ? x0 : x1;
+        float maxX = x0 < x1 ? x1 : x0;
+        float minY = y0 < y1 ? y0 : y1;
+        float maxY = y0 < y1 ? y1 : y0;
+
+        if (grid->covers(minX, minY, maxX, maxY)) {
+            entries[i].command = nullptr;
+            hiddenCount += 1;
+        }
+        else if (!sortKeyTranslucent(entries[i].key) && !sortKeyScissor(entries[i].key)) {
+            // Scissored rectangles may only cover a part of their bounds
+            grid->cover(minX, minY, maxX, maxY);
+        }
+    }
+
+    if (hiddenCount == 0) {
+        return count;
+    }
+
+    u64 visibleCount = 0;
+    for (u64 i = 0; i < count; ++i) {
+        if (entries[i].command) {
+            entries[visibleCount++] = entries[i];
+        }
+    }
+    return visibleCount;
+}
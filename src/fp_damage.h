@@ -0,0 +1,415 @@
+/******************************************************************************
+* Damage tracking
+*
+* Finds the pixels that may have changed since the last frame, so a mostly
+* static frame only redraws a few small regions, or nothing at all.
+*
+* Every rectangle of a frame, including the glyphs of text, becomes a damage
+* item: a hash of everything that affects its pixels, and its bounds. The
+* items of two frames are matched in submission order with a small lookahead,
+* so an inserted or removed command only damages itself. Every item without
+* a match damages its bounds. Matched items keep their relative order, so a
+* pixel covered only by matched items is drawn exactly as before.
+*
+* Changed meshes, a changed projection or viewport and evicted atlas shelves
+* damage the whole frame.
+*
+* The damaged pixels are kept as a few disjoint rectangles. Overlapping ones
+* are merged, and once there are too many, a new rectangle is merged into the
+* one that grows the least.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_core.h"
+#include "fp_allocator.h"
+#include "fp_render_commands.h"
+#include "fp_command_sort.h"
+#include "fp_math.h"
+
+static const int MAX_DAMAGE_RECTS = 8;
+// Commands in one frame that an item is searched for in the other one
+static const u64 DAMAGE_LOOKAHEAD = 32;
+// Damage items of the first allocation, the arrays grow when a frame has more
+static const u64 DAMAGE_INITIAL_ITEMS = 4096;
+
+// Pixels of the framebuffer, maxX and maxY are exclusive
+struct DamageRect {
+    int minX;
+    int minY;
+    int maxX;
+    int maxY;
+};
+
+struct DamageItem {
+    u64 hash;
+    // In the units of the projection, clipped to the scissor rect
+    float minX;
+    float minY;
+    float maxX;
+    float maxY;
+};
+
+struct DamageStats {
+    u64 frames;
+    // Frames without any damage, nothing had to be drawn
+    u64 skippedFrames;
+    u64 fullFrames;
+    u64 redrawnPixels;
+    u64 totalPixels;
+
+    double redrawnFraction() {
+        return totalPixels > 0 ? (double)redrawnPixels / (double)totalPixels : 0.0;
+    }
+};
+
+static u64 mixDamageHash(u64 hash, u64 value) {
+    hash += value * 0xC2B2AE3D27D4EB4FULL;
+    hash = (hash << 31) | (hash >> 33);
+    return hash * 0x9E3779B185EBCA87ULL;
+}
+
+static u64 mixDamageFloats(u64 hash, const float* values, int count) {
+    for (int i = 0; i < count; ++i) {
+        FloatBits bits = { values[i] };
+        hash = mixDamageHash(hash, bits.u);
+    }
+    return hash;
+}
+
+/**
+ * Bounds of an area in pixels of the viewport, clamped to it. Transforms all
+ * four corners, so it also works for flipped projections.
+ */
+static void projectToPixels(const float* m, const int* viewport, float minX, float minY, float maxX, float maxY, float* pixels) {
+    for (int corner = 0; corner < 4; ++corner) {
+        float x = corner & 1 ? maxX : minX;
+        float y = corner & 2 ? maxY : minY;
+        float w = m[12] * x + m[13] * y + m[15];
+        float pixelX = viewport[0] + 0.5f * viewport[2] * ((m[0] * x + m[1] * y + m[3]) / w + 1.0f);
+        float pixelY = viewport[1] + 0.5f * viewport[3] * ((m[4] * x + m[5] * y + m[7]) / w + 1.0f);
+        pixels[0] = corner == 0 || pixelX < pixels[0] ? pixelX : pixels[0];
+        pixels[1] = corner == 0 || pixelY < pixels[1] ? pixelY : pixels[1];
+        pixels[2] = corner == 0 || pixelX > pixels[2] ? pixelX : pixels[2];
+        pixels[3] = corner == 0 || pixelY > pixels[3] ? pixelY : pixels[3];
+    }
+
+    // Also keeps huge areas in the range of int
+    float viewportMaxX = (float)(viewport[0] + viewport[2]);
+    float viewportMaxY = (float)(viewport[1] + viewport[3]);
+    pixels[0] = pixels[0] > viewport[0] ? pixels[0] : viewport[0];
+    pixels[1] = pixels[1] > viewport[1] ? pixels[1] : viewport[1];
+    pixels[2] = pixels[2] < viewportMaxX ? pixels[2] : viewportMaxX;
+    pixels[3] = pixels[3] < viewportMaxY ? pixels[3] : viewportMaxY;
+}
+
+static u64 damageRectArea(DamageRect* rect) {
+    return (u64)(rect->maxX - rect->minX) * (u64)(rect->maxY - rect->minY);
+}
+
+static DamageRect unionDamageRects(DamageRect* a, DamageRect* b) {
+    DamageRect result = {};
+    result.minX = a->minX < b->minX ? a->minX : b->minX;
+    result.minY = a->minY < b->minY ? a->minY : b->minY;
+    result.maxX = a->maxX > b->maxX ? a->maxX : b->maxX;
+    result.maxY = a->maxY > b->maxY ? a->maxY : b->maxY;
+    return result;
+}
+
+static bool damageRectsOverlap(DamageRect* a, DamageRect* b) {
+    return a->minX < b->maxX && b->minX < a->maxX && a->minY < b->maxY && b->minY < a->maxY;
+}
+
+struct DamageTracker {
+    Allocator* allocator;
+
+    // Items of the previous and the current frame, swapped by update()
+    DamageItem* items[2];
+    u64 itemCounts[2];
+    u64 itemCapacities[2];
+    int current;
+
+    // Everything else the pixels of the previous frame depend on
+    float projection[16];
+    int viewport[4];
+    u64 meshHash;
+    u64 atlasEvictions;
+    // Without a previous frame, or after invalidate(), the whole frame is damaged
+    bool valid;
+
+    DamageRect rects[MAX_DAMAGE_RECTS];
+    int rectCount;
+    bool fullDamage;
+
+    DamageStats stats;
+
+    void create(Allocator* itemAllocator) {
+        allocator = itemAllocator;
+        current = 0;
+        valid = false;
+        stats = {};
+        for (int i = 0; i < 2; ++i) {
+            itemCapacities[i] = DAMAGE_INITIAL_ITEMS;
+            items[i] = (DamageItem*)allocator->allocate(itemCapacities[i] * sizeof(DamageItem));
+            itemCounts[i] = 0;
+        }
+    }
+
+    void destroy() {
+        for (int i = 0; i < 2; ++i) {
+            allocator->free(items[i], itemCapacities[i] * sizeof(DamageItem));
+            items[i] = nullptr;
+            itemCapacities[i] = 0;
+        }
+    }
+
+    // The next update() damages the whole frame, e.g. after the target lost its content
+    void invalidate() {
+        valid = false;
+    }
+
+    // Returns false if the item does not fit and the frame has to be damaged completely
+    bool addItem(DamageItem* item) {
+        u64 count = itemCounts[current];
+        if (count == itemCapacities[current]) {
+            u64 newCapacity = 2 * itemCapacities[current];
+            DamageItem* newItems = (DamageItem*)allocator->allocate(newCapacity * sizeof(DamageItem));
+            if (!newItems) {
+                return false;
+            }
+            for (u64 i = 0; i < count; ++i) {
+                newItems[i] = items[current][i];
+            }
+            allocator->free(items[current], itemCapacities[current] * sizeof(DamageItem));
+            items[current] = newItems;
+            itemCapacities[current] = newCapacity;
+        }
+        items[current][count] = *item;
+        itemCounts[current] = count + 1;
+        return true;
+    }
+
+    void damageAll() {
+        fullDamage = true;
+        rects[0] = { viewport[0], viewport[1], viewport[0] + viewport[2], viewport[1] + viewport[3] };
+        rectCount = 1;
+    }
+
+    void addDamage(DamageRect rect) {
+        if (fullDamage || rect.minX >= rect.maxX || rect.minY >= rect.maxY) {
+            return;
+        }
+
+        // Merging may make the rectangle overlap others it did not touch before
+        bool merged = true;
+        while (merged) {
+            merged = false;
+            for (int i = 0; i < rectCount; ++i) {
+                if (damageRectsOverlap(&rects[i], &rect)) {
+                    rect = unionDamageRects(&rects[i], &rect);
+                    rects[i] = rects[--rectCount];
+                    merged = true;
+                    break;
+                }
+            }
+        }
+
+        if (rectCount == MAX_DAMAGE_RECTS) {
+            int best = 0;
+            u64 bestGrowth = ~0ULL;
+            for (int i = 0; i < rectCount; ++i) {
+                DamageRect joined = unionDamageRects(&rects[i], &rect);
+                u64 growth = damageRectArea(&joined) - damageRectArea(&rects[i]);
+                if (growth < bestGrowth) {
+                    best = i;
+                    bestGrowth = growth;
+                }
+            }
+            rect = unionDamageRects(&rects[best], &rect);
+            rects[best] = rects[--rectCount];
+            addDamage(rect);
+            return;
+        }
+        rects[rectCount++] = rect;
+    }
+
+    // Pixels whose center may be covered by the item, with a pixel of margin for the antialiased shape edges
+    void addDamage(DamageItem* item) {
+        float pixels[4];
+        projectToPixels(projection, viewport, item->minX, item->minY, item->maxX, item->maxY, pixels);
+        DamageRect rect = {};
+        rect.minX = (int)floorFloat(pixels[0]) - 1;
+        rect.minY = (int)floorFloat(pixels[1]) - 1;
+        rect.maxX = (int)ceilFloat(pixels[2]) + 1;
+        rect.maxY = (int)ceilFloat(pixels[3]) + 1;
+        rect.minX = rect.minX > viewport[0] ? rect.minX : viewport[0];
+        rect.minY = rect.minY > viewport[1] ? rect.minY : viewport[1];
+        rect.maxX = rect.maxX < viewport[0] + viewport[2] ? rect.maxX : viewport[0] + viewport[2];
+        rect.maxY = rect.maxY < viewport[1] + viewport[3] ? rect.maxY : viewport[1] + viewport[3];
+        addDamage(rect);
+    }
+
+    /**
+     * Collects the items of the current frame and matches them against the
+     * previous frame. Text has to be laid out already. Returns the number of
+     * damaged rectangles in rects, 0 if the frame looks exactly like the last one.
+     */
+    int update(RenderCommandBuffer** buffers, int bufferCount, const float* frameProjection, const float* viewProjection,
+        const int* frameViewport, u64 frameAtlasEvictions) {
+        int previous = current;
+        current = 1 - current;
+        itemCounts[current] = 0;
+        rectCount = 0;
+        fullDamage = false;
+
+        bool sameTarget = valid && frameAtlasEvictions == atlasEvictions;
+        for (int i = 0; i < 16; ++i) {
+            sameTarget = sameTarget && frameProjection[i] == projection[i];
+            projection[i] = frameProjection[i];
+        }
+        for (int i = 0; i < 4; ++i) {
+            sameTarget = sameTarget && frameViewport[i] == viewport[i];
+            viewport[i] = frameViewport[i];
+        }
+        atlasEvictions = frameAtlasEvictions;
+
+        u64 frameMeshHash = mixDamageFloats(0, viewProjection, 16);
+        bool complete = true;
+        for (int i = 0; i < bufferCount; ++i) {
+            for (RenderCommandChunk* chunk = buffers[i]->chunks; chunk; chunk = chunk->next) {
+                for (RenderCommand* command = chunk->first(); command < chunk->onePastLast(); command = nextRenderCommand(command)) {
+                    if (command->type == Render_Mesh) {
+                        RenderCommandMesh* mesh = (RenderCommandMesh*)command;
+                        frameMeshHash = mixDamageHash(frameMeshHash, mesh->mesh.index | ((u64)mesh->layer << 32));
+                        frameMeshHash = mixDamageFloats(frameMeshHash, mesh->transform, 16);
+                        frameMeshHash = mixDamageFloats(frameMeshHash, mesh->color.color, 4);
+                        continue;
+                    }
+
+                    u32 count = 0;
+                    u64 stride = 0;
+                    RenderCommandRectangle* rect = getCommandRects(command, &count, &stride);
+                    for (u32 j = 0; j < count; ++j) {
+                        DamageItem item = makeItem(rect, buffers, i);
+                        complete = complete && addItem(&item);
+                        rect = (RenderCommandRectangle*)((u8*)rect + stride);
+                    }
+                }
+            }
+        }
+        sameTarget = sameTarget && complete && frameMeshHash == meshHash;
+        meshHash = frameMeshHash;
+        valid = complete;
+
+        if (!sameTarget) {
+            damageAll();
+        }
+        else {
+            diffItems(items[previous], itemCounts[previous], items[current], itemCounts[current]);
+        }
+
+        u64 damagedPixels = 0;
+        for (int i = 0; i < rectCount; ++i) {
+            damagedPixels += damageRectArea(&rects[i]);
+        }
+        // Most of the frame changed, one rectangle is cheaper to draw
+        u64 totalPixels = (u64)viewport[2] * (u64)viewport[3];
+        if (!fullDamage && 4 * damagedPixels > 3 * totalPixels) {
+            damageAll();
+            damagedPixels = totalPixels;
+        }
+
+        stats.frames += 1;
+        stats.skippedFrames += rectCount == 0 ? 1 : 0;
+        stats.fullFrames += fullDamage ? 1 : 0;
+        stats.redrawnPixels += damagedPixels;
+        stats.totalPixels += totalPixels;
+        return rectCount;
+    }
+
+    DamageItem makeItem(RenderCommandRectangle* rect, RenderCommandBuffer** buffers, u32 buffer) {
+        DamageItem item = {};
+        item.minX = rect->x;
+        item.minY = rect->y;
+        item.maxX = rect->x + rect->width;
+        item.maxY = rect->y + rect->height;
+
+        u32 uv0, uv1, shape;
+        getRectParams(rect, &uv0, &uv1, &shape);
+        u64 hash = mixDamageHash(rect->type | ((u64)rect->layer << 8), rect->packedColor);
+        hash = mixDamageFloats(hash, &rect->x, 4);
+        hash = mixDamageHash(hash, (u64)uv0 | ((u64)uv1 << 32));
+        hash = mixDamageHash(hash, shape);
+        if (rect->type == Render_TexturedRect) {
+            hash = mixDamageHash(hash, ((RenderCommandTexturedRect*)rect)->opaqueTexture);
+        }
+
+        // The scissor index is per frame, the clip rect itself is what matters
+        if (rect->scissor) {
+            ClipRect* clip = findScissorRect(buffers, makeScissorKey(buffer, rect));
+            hash = mixDamageFloats(hash, &clip->minX, 4);
+            item.minX = item.minX > clip->minX ? item.minX : clip->minX;
+            item.minY = item.minY > clip->minY ? item.minY : clip->minY;
+            item.maxX = item.maxX < clip->maxX ? item.maxX : clip->maxX;
+            item.maxY = item.maxY < clip->maxY ? item.maxY : clip->maxY;
+        }
+        item.hash = hash;
+        return item;
+    }
+
+    /**
+     * Matches the items in order. On a mismatch, the next DAMAGE_LOOKAHEAD items
+     * of both frames are searched for the other item: a hit skips the items
+     * in between as inserted or removed, otherwise both items changed.
+     */
+    void diffItems(DamageItem* oldItems, u64 oldCount, DamageItem* newItems, u64 newCount) {
+        u64 i = 0;
+        u64 j = 0;
+        while (i < oldCount && j < newCount) {
+            if (oldItems[i].hash == newItems[j].hash) {
+                i += 1;
+                j += 1;
+                continue;
+            }
+
+            u64 removed = 0;
+            for (u64 k = 1; k <= DAMAGE_LOOKAHEAD && i + k < oldCount; ++k) {
+                if (oldItems[i + k].hash == newItems[j].hash) {
+                    removed = k;
+                    break;
+                }
+            }
+            u64 inserted = 0;
+            for (u64 k = 1; k <= DAMAGE_LOOKAHEAD && j + k < newCount; ++k) {
+                if (newItems[j + k].hash == oldItems[i].hash) {
+                    inserted = k;
+                    break;
+                }
+            }
+
+            if (removed && (!inserted || removed <= inserted)) {
+                for (u64 k = 0; k < removed; ++k) {
+                    addDamage(&oldItems[i++]);
+                }
+            }
+            else if (inserted) {
+                for (u64 k = 0; k < inserted; ++k) {
+                    addDamage(&newItems[j++]);
+                }
+            }
+            else {
+                addDamage(&oldItems[i++]);
+                addDamage(&newItems[j++]);
+            }
+        }
+        while (i < oldCount) {
+            addDamage(&oldItems[i++]);
+        }
+        while (j < newCount) {
+            addDamage(&newItems[j++]);
+        }
+    }
+};
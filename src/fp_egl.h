@@ -0,0 +1,122 @@
+/******************************************************************************
+* Headless OpenGL via EGL
+*
+* Creates an OpenGL core context without a window on Linux. This uses the
+* Mesa surfaceless platform, so it also works on machines without a GPU
+* (llvmpipe). There is no default framebuffer, render into an offscreen
+* target instead.
+*
+* Link with -lEGL -lGL
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_opengl.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+struct HeadlessContext
+{
+    EGLDisplay display;
+    EGLContext context;
+};
+
+static void* egl_getGlProcAddress(const char* name) {
+    return (void*)eglGetProcAddress(name);
+}
+
+/**
+ * Creates an OpenGL 4.5 core context and loads the function pointers.
+ * Returns false if no suitable context can be created.
+ */
+static bool gl_createHeadlessContext(HeadlessContext* result) {
+    *result = {};
+
+    PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (!eglGetPlatformDisplayEXT) {
+        OutputDebugStringW(L"EGL: eglGetPlatformDisplayEXT is not available\n");
+        return false;
+    }
+
+    EGLDisplay display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    EGLint major = 0;
+    EGLint minor = 0;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+        OutputDebugStringW(L"EGL: Failed to initialize surfaceless display\n");
+        return false;
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        OutputDebugStringW(L"EGL: OpenGL API is not supported\n");
+        return false;
+    }
+
+    EGLint attribs[] =
+    {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 5,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attribs);
+    if (context == EGL_NO_CONTEXT) {
+        OutputDebugStringW(L"EGL: Failed to create OpenGL 4.5 core context\n");
+        return false;
+    }
+
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        OutputDebugStringW(L"EGL: Failed to make context current\n");
+        return false;
+    }
+
+    gl_loadFunctions(&egl_getGlProcAddress);
+
+    result->display = display;
+    result->context = context;
+    return true;
+}
+
+static void gl_destroyHeadlessContext(HeadlessContext* headless) {
+    eglMakeCurrent(headless->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(headless->display, headless->context);
+    eglTerminate(headless->display);
+}
+
+/**
+ * Offscreen RGBA8 render target with a depth buffer for meshes, used instead
+ * of the window back buffer.
+ */
+struct OffscreenTarget
+{
+    unsigned int framebuffer;
+    unsigned int colorBuffer;
+    unsigned int depthBuffer;
+    int width;
+    int height;
+};
+
+static bool gl_createOffscreenTarget(OffscreenTarget* target, int width, int height) {
+    *target = {};
+    target->width = width;
+    target->height = height;
+
+    glGenRenderbuffers(1, &target->colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, target->colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+    glGenRenderbuffers(1, &target->depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, target->depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+    glGenFramebuffers(1, &target->framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target->colorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target->depthBuffer);
+
+    return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
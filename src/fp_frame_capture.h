@@ -0,0 +1,345 @@
+/******************************************************************************
+* Frame capture
+*
+* Records the render commands of each frame into a binary trace file, so real
+* workloads can be replayed offline (see tools/replay_capture.cpp).
+*
+* File layout, all values little endian:
+*
+* CaptureFileHeader
+* For each frame:
+*     CaptureFrameHeader
+*     rectCount records, recordBytes in total:
+*         command type (u8)
+*         x, y, width, height (f32), color (RGBA8), layer (u8)
+*         Render_TexturedRect only: uv0, uv1 (packed u32), opaque texture (u8)
+*         Render_Shape only: shape (packed u32)
+*         Drawn with the scissor only: clip rect minX, minY, maxX, maxY (f32),
+*         bit 7 of the command type is set for these records
+*
+* A rectangle takes 22 bytes in the file instead of the 44 bytes of a
+* RenderCommandRectangle. Commands of all command buffers of a frame are
+* stored in draw submission order, so the sort keys are the same on replay.
+* Trimmed rectangles are captured as they were trimmed.
+* The texels of the atlas are not captured, replayed textured rectangles
+* sample whatever the atlas contains at their texture coordinates. Mesh
+* commands refer to GPU resources of the application and are skipped.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_core.h"
+#include "fp_os.h"
+#include "fp_render_commands.h"
+
+static const u32 CAPTURE_FILE_MAGIC = 0x46435046; // "FPCF"
+static const u32 CAPTURE_FILE_VERSION = 4;
+static const u32 CAPTURE_FRAME_MAGIC = 0x4D415246; // "FRAM"
+static const u64 CAPTURE_RECT_BYTES = 22;
+static const u64 CAPTURE_TEXTURED_RECT_BYTES = CAPTURE_RECT_BYTES + 9;
+static const u64 CAPTURE_SHAPE_BYTES = CAPTURE_RECT_BYTES + 4;
+static const u64 CAPTURE_SCISSOR_BYTES = 16;
+static const u8 CAPTURE_SCISSOR_FLAG = 0x80;
+
+struct CaptureFileHeader {
+    u32 magic;
+    u32 version;
+};
+
+struct CaptureFrameHeader {
+    u32 magic;
+    u32 rectCount;
+    // Size of all records of the frame
+    u32 recordBytes;
+    // Viewport size in pixels
+    u32 width;
+    u32 height;
+    // Row-major, as passed to Renderer::setProjection()
+    float projection[16];
+    // Time since the capture was started
+    u64 timestampNs;
+    // Frame times measured by the frame pacer, the GPU time lags behind
+    float cpuFrameMs;
+    float gpuFrameMs;
+};
+
+static void copyCaptureBytes(void* target, void const* source, u64 size) {
+    u8* targetBytes = (u8*)target;
+    u8 const* sourceBytes = (u8 const*)source;
+    for (u64 i = 0; i < size; ++i) {
+        targetBytes[i] = sourceBytes[i];
+    }
+}
+
+static u64 captureRecordBytes(RenderCommand* command) {
+    u64 scissorBytes = command->scissor ? CAPTURE_SCISSOR_BYTES : 0;
+    if (command->type == Render_TexturedRect) {
+        return CAPTURE_TEXTURED_RECT_BYTES + scissorBytes;
+    }
+    return (command->type == Render_Shape ? CAPTURE_SHAPE_BYTES : CAPTURE_RECT_BYTES) + scissorBytes;
+}
+
+// Text is captured as the textured rectangles of its laid out glyphs, meshes are not captured
+static u64 captureCommandBytes(RenderCommand* command) {
+    if (command->type == Render_Text) {
+        u64 scissorBytes = command->scissor ? CAPTURE_SCISSOR_BYTES : 0;
+        return ((RenderCommandText*)command)->glyphCount * (CAPTURE_TEXTURED_RECT_BYTES + scissorBytes);
+    }
+    if (command->type == Render_Mesh) {
+        return 0;
+    }
+    return captureRecordBytes(command);
+}
+
+// scissor is the clip rect of scissored rectangles, nullptr for all others
+static void encodeCaptureRect(u8* record, RenderCommandRectangle* rect, ClipRect* scissor) {
+    record[0] = (u8)rect->type | (scissor ? CAPTURE_SCISSOR_FLAG : 0);
+    copyCaptureBytes(record + 1, &rect->x, 4);
+    copyCaptureBytes(record + 5, &rect->y, 4);
+    copyCaptureBytes(record + 9, &rect->width, 4);
+    copyCaptureBytes(record + 13, &rect->height, 4);
+    copyCaptureBytes(record + 17, &rect->packedColor, 4);
+    record[21] = rect->layer;
+
+    if (rect->type == Render_TexturedRect) {
+        RenderCommandTexturedRect* textured = (RenderCommandTexturedRect*)rect;
+        copyCaptureBytes(record + 22, &textured->uv0, 4);
+        copyCaptureBytes(record + 26, &textured->uv1, 4);
+        record[30] = textured->opaqueTexture ? 1 : 0;
+    }
+    else if (rect->type == Render_Shape) {
+        copyCaptureBytes(record + 22, &((RenderCommandShape*)rect)->shape, 4);
+    }
+
+    if (scissor) {
+        copyCaptureBytes(record + captureRecordBytes(rect) - CAPTURE_SCISSOR_BYTES, scissor, CAPTURE_SCISSOR_BYTES);
+    }
+}
+
+/**
+ * Decodes the record into captured and returns its size. Scissored records
+ * set captured->rect.scissor to 1 and store their clip rect in scissor, they
+ * are replayed inside of RenderCommandBuffer::pushClip().
+ */
+static u64 decodeCaptureRect(u8 const* record, AnyRectCommand* captured, ClipRect* scissor) {
+    *captured = {};
+    RenderCommandRectangle* rect = &captured->rect;
+    rect->type = Render_Rectangle;
+    u8 type = record[0] & ~CAPTURE_SCISSOR_FLAG;
+    if (type == Render_TexturedRect || type == Render_Shape) {
+        rect->type = (RenderCommandType)type;
+    }
+    rect->scissor = (record[0] & CAPTURE_SCISSOR_FLAG) ? 1 : 0;
+    copyCaptureBytes(&rect->x, record + 1, 4);
+    copyCaptureBytes(&rect->y, record + 5, 4);
+    copyCaptureBytes(&rect->width, record + 9, 4);
+    copyCaptureBytes(&rect->height, record + 13, 4);
+
+    // packColor() of these values gives back the captured color exactly
+    u32 packedColor = 0;
+    copyCaptureBytes(&packedColor, record + 17, 4);
+    for (int i = 0; i < 4; ++i) {
+        rect->color.color[i] = ((packedColor >> (8 * i)) & 0xFF) / 255.0f;
+    }
+    rect->layer = record[21];
+
+    if (rect->type == Render_TexturedRect) {
+        copyCaptureBytes(&captured->textured.uv0, record + 22, 4);
+        copyCaptureBytes(&captured->textured.uv1, record + 26, 4);
+        captured->textured.opaqueTexture = record[30] != 0;
+    }
+    else if (rect->type == Render_Shape) {
+        copyCaptureBytes(&captured->shape.shape, record + 22, 4);
+    }
+
+    u64 size = captureRecordBytes(rect);
+    if (rect->scissor) {
+        copyCaptureBytes(scissor, record + size - CAPTURE_SCISSOR_BYTES, CAPTURE_SCISSOR_BYTES);
+    }
+    return size;
+}
+
+/**
+ * Writes captured frames to a file. Records are collected in the staging
+ * memory and written whenever it is full.
+ *
+ * Example:
+ * {
+ *     FrameCapture capture = {};
+ *     capture.start(L"frames.fpcapture", stagingMemory, stagingSize);
+ *     // For each frame, after recording the commands:
+ *     capture.captureFrame(buffers, bufferCount, width, height, projection, cpuFrameMs, gpuFrameMs);
+ *     capture.stop();
+ * }
+ */
+struct FrameCapture {
+    FileWriter file;
+    bool active;
+    // Set if a write failed, the capture stops in that case
+    bool failed;
+
+    u8* staging;
+    u64 stagingSize;
+    u64 stagingUsed;
+
+    u64 startTicks;
+    u32 frameCount;
+
+    bool start(wchar_t const* filename, void* stagingMemory, u64 stagingMemorySize) {
+        Assert(stagingMemorySize >= sizeof(CaptureFrameHeader) + CAPTURE_TEXTURED_RECT_BYTES + CAPTURE_SCISSOR_BYTES);
+
+        if (!openFileForWriting(&file, filename)) {
+            OutputDebugStringW(L"Failed to open the frame capture file\n");
+            return false;
+        }
+
+        active = true;
+        failed = false;
+        staging = (u8*)stagingMemory;
+        stagingSize = stagingMemorySize;
+        stagingUsed = 0;
+        startTicks = getPerformanceCounter();
+        frameCount = 0;
+
+        CaptureFileHeader header = { CAPTURE_FILE_MAGIC, CAPTURE_FILE_VERSION };
+        append(&header, sizeof(header));
+        return true;
+    }
+
+    void flush() {
+        if (stagingUsed > 0 && !failed && !writeFile(&file, staging, stagingUsed)) {
+            OutputDebugStringW(L"Failed to write the frame capture file\n");
+            failed = true;
+        }
+        stagingUsed = 0;
+    }
+
+    u8* reserve(u64 size) {
+        if (stagingUsed + size > stagingSize) {
+            flush();
+        }
+        u8* result = staging + stagingUsed;
+        stagingUsed += size;
+        return result;
+    }
+
+    void append(void const* data, u64 size) {
+        copyCaptureBytes(reserve(size), data, size);
+    }
+
+    void captureFrame(RenderCommandBuffer** buffers, int bufferCount, int width, int height,
+        const float* projection, double cpuFrameMs, double gpuFrameMs) {
+        if (!active || failed) {
+            return;
+        }
+
+        CaptureFrameHeader header = {};
+        header.magic = CAPTURE_FRAME_MAGIC;
+        for (int i = 0; i < bufferCount; ++i) {
+            header.rectCount += buffers[i]->rectCount;
+            for (RenderCommandChunk* chunk = buffers[i]->chunks; chunk; chunk = chunk->next) {
+                RenderCommand* command = chunk->first();
+                RenderCommand* onePastLast = chunk->onePastLast();
+                while (command < onePastLast) {
+                    header.recordBytes += (u32)captureCommandBytes(command);
+                    command = nextRenderCommand(command);
+                }
+            }
+        }
+        header.width = width;
+        header.height = height;
+        for (int i = 0; i < 16; ++i) {
+            header.projection[i] = projection[i];
+        }
+        u64 elapsedTicks = getPerformanceCounter() - startTicks;
+        header.timestampNs = (u64)((double)elapsedTicks * 1e9 / (double)getPerformanceFrequency());
+        header.cpuFrameMs = (float)cpuFrameMs;
+        header.gpuFrameMs = (float)gpuFrameMs;
+        append(&header, sizeof(header));
+
+        for (int i = 0; i < bufferCount; ++i) {
+            for (RenderCommandChunk* chunk = buffers[i]->chunks; chunk; chunk = chunk->next) {
+                RenderCommand* command = chunk->first();
+                RenderCommand* onePastLast = chunk->onePastLast();
+                while (command < onePastLast) {
+                    u32 rectCount;
+                    u64 stride;
+                    RenderCommandRectangle* rect = getCommandRects(command, &rectCount, &stride);
+                    if (rect) {
+                        for (u32 j = 0; j < rectCount; ++j) {
+                            ClipRect* scissor = rect->scissor ? &buffers[i]->scissorRects[rect->scissor - 1] : nullptr;
+                            encodeCaptureRect(reserve(captureRecordBytes(rect)), rect, scissor);
+                            rect = (RenderCommandRectangle*)((u8*)rect + stride);
+                        }
+                        command = nextRenderCommand(command);
+                    }
+                    else {
+                        OutputDebugStringW(L"Unknown command type\n");
+                        DebugBreak();
+                        continue;
+                    }
+                }
+            }
+        }
+
+        frameCount += 1;
+    }
+
+    void stop() {
+        if (!active) {
+            return;
+        }
+        flush();
+        closeFile(&file);
+        active = false;
+    }
+};
+
+/**
+ * Iterates over the frames of a capture file that was read into memory.
+ */
+struct CaptureReader {
+    u8* data;
+    u64 size;
+    u64 offset;
+
+    bool open(u8* fileData, u64 fileSize) {
+        data = fileData;
+        size = fileSize;
+        offset = 0;
+
+        CaptureFileHeader header = {};
+        if (size < sizeof(header)) {
+            return false;
+        }
+        copyCaptureBytes(&header, data, sizeof(header));
+        offset = sizeof(header);
+        return header.magic == CAPTURE_FILE_MAGIC && header.version == CAPTURE_FILE_VERSION;
+    }
+
+    /**
+     * Reads the next frame header. records points to header->rectCount records,
+     * which are decoded one after another with decodeCaptureRect(). Returns false
+     * at the end of the file or if the frame is truncated.
+     */
+    bool nextFrame(CaptureFrameHeader* header, u8** records) {
+        if (offset + sizeof(CaptureFrameHeader) > size) {
+            return false;
+        }
+        copyCaptureBytes(header, data + offset, sizeof(CaptureFrameHeader));
+        if (header->magic != CAPTURE_FRAME_MAGIC) {
+            return false;
+        }
+
+        u64 recordBytes = header->recordBytes;
+        if (offset + sizeof(CaptureFrameHeader) + recordBytes > size) {
+            return false;
+        }
+        *records = data + offset + sizeof(CaptureFrameHeader);
+        offset += sizeof(CaptureFrameHeader) + recordBytes;
+        return true;
+    }
+};
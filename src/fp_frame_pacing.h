@@ -0,0 +1,154 @@
+/******************************************************************************
+* Frame pacing
+*
+* Limits the number of frames the CPU may submit ahead of the GPU. Each frame
+* ends with a fence, the CPU only blocks when the oldest frame in flight has
+* not finished yet. Timestamp queries around each frame measure how long the
+* GPU worked on the frame and how long it sat idle waiting for the CPU.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_core.h"
+#include "fp_opengl.h"
+#include "fp_os.h"
+
+// Upper bound for FramePacer::framesInFlight
+static const int MAX_FRAMES_IN_FLIGHT = 4;
+
+struct FrameStats {
+    // Index of the frame the GPU values belong to. The GPU values lag behind
+    // the CPU values by up to framesInFlight frames.
+    u64 gpuFrame;
+
+    // CPU time of the last frame, from one beginFrame() to the next
+    double cpuFrameMs;
+    // Time the CPU was blocked waiting for the oldest frame in flight
+    double cpuWaitMs;
+    // Time the GPU spent on the frame, from its first to its last command
+    double gpuFrameMs;
+    // Time the GPU was idle between the previous frame and this one
+    double gpuWaitMs;
+};
+
+struct FramePacer {
+    // Number of frames the CPU may be ahead of the GPU, between 1 and MAX_FRAMES_IN_FLIGHT
+    int framesInFlight;
+
+    GLsync fences[MAX_FRAMES_IN_FLIGHT];
+    unsigned int beginQueries[MAX_FRAMES_IN_FLIGHT];
+    unsigned int endQueries[MAX_FRAMES_IN_FLIGHT];
+
+    // Frames are numbered consecutively, the slot of a frame is its number modulo MAX_FRAMES_IN_FLIGHT
+    u64 submittedFrames;
+    u64 retiredFrames;
+
+    // GPU timestamp at the end of the last retired frame (in nanoseconds)
+    u64 lastGpuEnd;
+    u64 lastBeginTicks;
+
+    FrameStats stats;
+
+    void create(int frames) {
+        framesInFlight = frames;
+        submittedFrames = 0;
+        retiredFrames = 0;
+        lastGpuEnd = 0;
+        lastBeginTicks = 0;
+        stats = {};
+
+        glGenQueries(MAX_FRAMES_IN_FLIGHT, beginQueries);
+        glGenQueries(MAX_FRAMES_IN_FLIGHT, endQueries);
+    }
+
+    void destroy() {
+        while (retiredFrames < submittedFrames) {
+            retireOldestFrame(true);
+        }
+        glDeleteQueries(MAX_FRAMES_IN_FLIGHT, beginQueries);
+        glDeleteQueries(MAX_FRAMES_IN_FLIGHT, endQueries);
+    }
+
+    /**
+     * Waits until the GPU finished the oldest frame and reads back its timings.
+     * Returns false without waiting if blocking is false and the frame is not done yet.
+     */
+    bool retireOldestFrame(bool blocking) {
+        int slot = retiredFrames % MAX_FRAMES_IN_FLIGHT;
+        GLsync fence = fences[slot];
+
+        // Flush on the first wait, otherwise the fence might never be submitted
+        GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        GLenum result = glClientWaitSync(fence, flags, 0);
+        if (result == GL_TIMEOUT_EXPIRED && !blocking) {
+            return false;
+        }
+        while (result == GL_TIMEOUT_EXPIRED) {
+            flags = 0;
+            result = glClientWaitSync(fence, flags, 1000000);
+        }
+        if (result == GL_WAIT_FAILED) {
+            OutputDebugStringW(L"Waiting for frame fence failed\n");
+        }
+        glDeleteSync(fence);
+        fences[slot] = nullptr;
+
+        // The fence was signaled, so both queries are available without a stall
+        GLuint64 gpuBegin = 0;
+        GLuint64 gpuEnd = 0;
+        glGetQueryObjectui64v(beginQueries[slot], GL_QUERY_RESULT, &gpuBegin);
+        glGetQueryObjectui64v(endQueries[slot], GL_QUERY_RESULT, &gpuEnd);
+
+        stats.gpuFrame = retiredFrames;
+        stats.gpuFrameMs = (gpuEnd - gpuBegin) * 1e-6;
+        stats.gpuWaitMs = (lastGpuEnd != 0 && gpuBegin > lastGpuEnd) ? (gpuBegin - lastGpuEnd) * 1e-6 : 0.0;
+        lastGpuEnd = gpuEnd;
+
+        retiredFrames += 1;
+        return true;
+    }
+
+    /**
+     * Blocks until fewer than framesInFlight frames are in flight.
+     * Must be called before any GPU command of the frame is issued.
+     */
+    void beginFrame() {
+        u64 start = getPerformanceCounter();
+        double msPerTick = 1000.0 / (double)getPerformanceFrequency();
+
+        if (framesInFlight < 1) {
+            framesInFlight = 1;
+        }
+        if (framesInFlight > MAX_FRAMES_IN_FLIGHT) {
+            framesInFlight = MAX_FRAMES_IN_FLIGHT;
+        }
+        while (submittedFrames - retiredFrames >= (u64)framesInFlight) {
+            retireOldestFrame(true);
+        }
+        u64 end = getPerformanceCounter();
+
+        // Pick up timings of frames that finished early without waiting for them
+        while (retiredFrames < submittedFrames && retireOldestFrame(false)) {
+        }
+
+        stats.cpuWaitMs = (end - start) * msPerTick;
+        stats.cpuFrameMs = lastBeginTicks != 0 ? (start - lastBeginTicks) * msPerTick : 0.0;
+        lastBeginTicks = start;
+
+        glQueryCounter(beginQueries[submittedFrames % MAX_FRAMES_IN_FLIGHT], GL_TIMESTAMP);
+    }
+
+    /**
+     * Submits the fence for the current frame. Must be called after the last
+     * GPU command of the frame, e.g. after swapping buffers.
+     */
+    void endFrame() {
+        int slot = submittedFrames % MAX_FRAMES_IN_FLIGHT;
+        glQueryCounter(endQueries[slot], GL_TIMESTAMP);
+        fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        submittedFrames += 1;
+    }
+};
@@ -0,0 +1,289 @@
+/******************************************************************************
+* Glyph cache
+*
+* Rasterizes glyphs of a TrueType font on first use and keeps them in the
+* texture atlas, so text is drawn as textured rectangles in the same batches
+* as all other rectangles.
+*
+* Glyphs are cached per codepoint and pixel size in an open addressing hash
+* table. The metrics stay in the table when the atlas evicts the texels, the
+* glyph is rasterized again on its next use in that case.
+*
+* Text commands are laid out on the main thread right before rendering:
+*
+* {
+*     renderer.glyphCache.setFont(&font);
+*     ...
+*     RenderCommandText text = {};
+*     text.x = 10.0f;
+*     text.y = 20.0f;
+*     text.size = 16.0f;
+*     text.color = WHITE;
+*     commands.push(&text, "Hello", 5);
+* }
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_core.h"
+#include "fp_allocator.h"
+#include "fp_render_commands.h"
+#include "fp_texture_atlas.h"
+#include "fp_truetype.h"
+
+// Power of two, the table is cleared when it is three quarters full
+static const u32 GLYPH_CACHE_SLOTS = 4096;
+
+// Larger text is drawn with glyphs of this size
+static const int MAX_GLYPH_PIXEL_SIZE = 128;
+
+struct CachedGlyph {
+    u32 codepoint;
+    // 0 marks an empty slot
+    u16 pixelSize;
+    // Size of the bitmap, 0 for glyphs without an outline
+    u16 width;
+    u16 height;
+    // Bottom left of the bitmap relative to the pen position on the baseline
+    i16 offsetX;
+    i16 offsetY;
+    // Pixels to the pen position of the next glyph
+    float advance;
+    AtlasHandle handle;
+};
+
+struct GlyphCacheStats {
+    u64 lookups;
+    u64 rasterizedGlyphs;
+    u64 rasterizedPixels;
+};
+
+struct GlyphCache {
+    TrueTypeFont* font;
+    TextureAtlas* atlas;
+
+    CachedGlyph slots[GLYPH_CACHE_SLOTS];
+    u32 usedSlots;
+
+    GlyphCacheStats stats;
+
+    void create(TextureAtlas* textureAtlas) {
+        atlas = textureAtlas;
+        font = nullptr;
+        stats = {};
+        clear();
+    }
+
+    // Forgets all glyphs, their texels stay in the atlas until they are evicted
+    void clear() {
+        for (u32 i = 0; i < GLYPH_CACHE_SLOTS; ++i) {
+            slots[i].pixelSize = 0;
+        }
+        usedSlots = 0;
+    }
+
+    void setFont(TrueTypeFont* newFont) {
+        font = newFont;
+        clear();
+    }
+
+    CachedGlyph* findSlot(u32 codepoint, u16 pixelSize) {
+        u32 hash = (codepoint * 0x9E3779B1u) ^ (pixelSize * 0x85EBCA77u);
+        u32 index = (hash >> 16) & (GLYPH_CACHE_SLOTS - 1);
+        while (true) {
+            CachedGlyph* slot = &slots[index];
+            if (slot->pixelSize == 0 || (slot->codepoint == codepoint && slot->pixelSize == pixelSize)) {
+                return slot;
+            }
+            index = (index + 1) & (GLYPH_CACHE_SLOTS - 1);
+        }
+    }
+
+    // Rasterizes the glyph into the atlas, the metrics are already set
+    void rasterize(CachedGlyph* glyph, ArenaAllocator* scratch) {
+        u64 mark = scratch->used;
+        defer{ scratch->used = mark; };
+
+        u32 glyphIndex = findGlyphIndex(font, glyph->codepoint);
+        float scale = scaleForPixelHeight(font, glyph->pixelSize);
+        GlyphBitmap bitmap = {};
+        if (!rasterizeGlyph(font, glyphIndex, scale, scratch, &bitmap) && !bitmap.coverage) {
+            glyph->width = 0;
+            glyph->height = 0;
+            return;
+        }
+
+        // White texels, the coverage becomes the alpha which is multiplied with the text color
+        u64 pixelCount = (u64)bitmap.width * bitmap.height;
+        u32* pixels = scratch->allocateArray<u32>(pixelCount);
+        if (!pixels) {
+            OutputDebugStringW(L"Not enough scratch memory to rasterize a glyph\n");
+            glyph->width = 0;
+            glyph->height = 0;
+            return;
+        }
+        for (u64 i = 0; i < pixelCount; ++i) {
+            pixels[i] = ((u32)bitmap.coverage[i] << 24) | 0x00FFFFFF;
+        }
+
+        glyph->width = (u16)bitmap.width;
+        glyph->height = (u16)bitmap.height;
+        glyph->offsetX = (i16)bitmap.offsetX;
+        glyph->offsetY = (i16)bitmap.offsetY;
+        glyph->handle = atlas->insert(bitmap.width, bitmap.height, pixels);
+
+        stats.rasterizedGlyphs += 1;
+        stats.rasterizedPixels += pixelCount;
+    }
+
+    /**
+     * Returns the glyph and, if it has an outline, its atlas region. Glyphs
+     * are rasterized on first use and after their texels were evicted.
+     * scratch is only used temporarily.
+     */
+    CachedGlyph* getGlyph(u32 codepoint, u16 pixelSize, AtlasRegion* region, ArenaAllocator* scratch) {
+        stats.lookups += 1;
+
+        CachedGlyph* glyph = findSlot(codepoint, pixelSize);
+        if (glyph->pixelSize == 0) {
+            if (usedSlots >= GLYPH_CACHE_SLOTS / 4 * 3) {
+                clear();
+                glyph = findSlot(codepoint, pixelSize);
+            }
+            usedSlots += 1;
+
+            u32 glyphIndex = findGlyphIndex(font, codepoint);
+            float scale = scaleForPixelHeight(font, pixelSize);
+            *glyph = {};
+            glyph->codepoint = codepoint;
+            glyph->pixelSize = pixelSize;
+            glyph->advance = getGlyphAdvance(font, glyphIndex) * scale;
+            rasterize(glyph, scratch);
+        }
+
+        if (glyph->width > 0 && !atlas->lookup(glyph->handle, region)) {
+            rasterize(glyph, scratch);
+            if (glyph->width > 0 && !atlas->lookup(glyph->handle, region)) {
+                // The atlas is full with glyphs of this frame, the glyph is skipped
+                glyph->width = 0;
+            }
+        }
+        return glyph;
+    }
+};
+
+// Decodes the codepoint at *index and advances it, invalid sequences give U+FFFD
+static u32 decodeUtf8(char const* text, u32 length, u32* index) {
+    u8 first = (u8)text[*index];
+    *index += 1;
+    if (first < 0x80) {
+        return first;
+    }
+
+    u32 extraBytes = first >= 0xF0 ? 3 : (first >= 0xE0 ? 2 : (first >= 0xC0 ? 1 : 0));
+    if (extraBytes == 0 || *index + extraBytes > length) {
+        return 0xFFFD;
+    }
+    u32 codepoint = first & (0x3F >> extraBytes);
+    for (u32 i = 0; i < extraBytes; ++i) {
+        u8 next = (u8)text[*index];
+        if ((next & 0xC0) != 0x80) {
+            return 0xFFFD;
+        }
+        codepoint = (codepoint << 6) | (next & 0x3F);
+        *index += 1;
+    }
+    return codepoint;
+}
+
+/**
+ * Writes one textured rectangle per visible glyph into the glyph slots of the
+ * command and returns their number. Glyphs start on whole pixels, so their
+ * texels are drawn 1:1. '\n' starts a new line below. Glyphs are trimmed to
+ * the clip rect of the command, unless it is drawn with the scissor.
+ */
+static u32 layoutText(RenderCommandText* command, GlyphCache* cache, ArenaAllocator* scratch, ClipStats* clipStats) {
+    TrueTypeFont* font = cache->font;
+    int pixelSize = (int)(command->size + 0.5f);
+    pixelSize = pixelSize < 1 ? 1 : (pixelSize > MAX_GLYPH_PIXEL_SIZE ? MAX_GLYPH_PIXEL_SIZE : pixelSize);
+    float scale = scaleForPixelHeight(font, (float)pixelSize);
+    float lineHeight = (font->ascent - font->descent + font->lineGap) * scale;
+
+    RenderCommandTexturedRect* glyphs = command->glyphs();
+    char const* text = command->text();
+    u32 glyphCount = 0;
+    float penX = command->x;
+    float penY = command->y;
+
+    u32 index = 0;
+    while (index < command->length) {
+        u32 codepoint = decodeUtf8(text, command->length, &index);
+        if (codepoint == '\n') {
+            penX = command->x;
+            penY -= lineHeight;
+            continue;
+        }
+
+        AtlasRegion region = {};
+        CachedGlyph* glyph = cache->getGlyph(codepoint, (u16)pixelSize, &region, scratch);
+        if (glyph->width > 0) {
+            RenderCommandTexturedRect* rect = &glyphs[glyphCount++];
+            rect->type = Render_TexturedRect;
+            rect->layer = command->layer;
+            rect->x = floorFloat(penX + 0.5f) + glyph->offsetX;
+            rect->y = floorFloat(penY + 0.5f) + glyph->offsetY;
+            rect->width = glyph->width;
+            rect->height = glyph->height;
+            rect->color = command->color;
+            rect->packedColor = command->packedColor;
+            rect->scissor = command->scissor;
+            setAtlasRegion(rect, &region);
+
+            ClipOverlap overlap = clipOverlap(rect, command->clip);
+            if (overlap == Clip_Outside) {
+                glyphCount -= 1;
+                clipStats->culled += 1;
+            }
+            else if (command->scissor) {
+                clipStats->scissored += 1;
+            }
+            else if (overlap == Clip_Crossing) {
+                trimRect(rect, command->clip);
+                clipStats->trimmed += 1;
+            }
+        }
+        penX += glyph->advance;
+    }
+
+    return glyphCount;
+}
+
+/**
+ * Lays out all text commands of the buffers and updates their rectangle
+ * counts. Without a font, text commands draw nothing.
+ */
+static void layoutTextCommands(RenderCommandBuffer** buffers, int bufferCount, GlyphCache* cache, ArenaAllocator* scratch) {
+    for (int i = 0; i < bufferCount; ++i) {
+        if (buffers[i]->textCount == 0) {
+            continue;
+        }
+
+        for (RenderCommandChunk* chunk = buffers[i]->chunks; chunk; chunk = chunk->next) {
+            RenderCommand* command = chunk->first();
+            RenderCommand* onePastLast = chunk->onePastLast();
+            while (command < onePastLast) {
+                if (command->type == Render_Text) {
+                    RenderCommandText* text = (RenderCommandText*)command;
+                    u32 glyphCount = cache->font ? layoutText(text, cache, scratch, &buffers[i]->clipStats) : 0;
+                    buffers[i]->rectCount += (int)glyphCount - (int)text->glyphCount;
+                    chunk->rectCount += glyphCount - text->glyphCount;
+                    text->glyphCount = glyphCount;
+                }
+                command = nextRenderCommand(command);
+            }
+        }
+    }
+}
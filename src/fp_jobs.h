@@ -0,0 +1,126 @@
+/******************************************************************************
+* Job system
+*
+* A fixed pool of worker threads that execute parallel for loops. The calling
+* thread works on the loop as well and returns once every index is done.
+*
+* Example:
+* {
+*     JobSystem jobs = {};
+*     jobs.create(getProcessorCount() - 1);
+*     jobs.run(&work, &workData, count);   // calls work(&workData, i) for i in [0, count)
+*     jobs.destroy();
+* }
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_core.h"
+#include "fp_os.h"
+
+static const int MAX_WORKER_THREADS = 31;
+
+typedef void JobFunction(void* data, int index);
+
+struct JobSystem {
+    Thread threads[MAX_WORKER_THREADS];
+    int threadCount;
+
+    // Signaled once per worker when a new loop starts
+    Semaphore workAvailable;
+    // Signaled once by each worker when it has left the current loop
+    Semaphore workDone;
+
+    // The current loop, only written while all workers are idle
+    JobFunction* function;
+    void* data;
+    i32 jobCount;
+    volatile i32 nextJob;
+    bool running;
+
+    void create(int workerCount) {
+        if (workerCount < 0) {
+            workerCount = 0;
+        }
+        if (workerCount > MAX_WORKER_THREADS) {
+            workerCount = MAX_WORKER_THREADS;
+        }
+
+        threadCount = workerCount;
+        jobCount = 0;
+        nextJob = 0;
+        running = true;
+        createSemaphore(&workAvailable, 0);
+        createSemaphore(&workDone, 0);
+
+        for (int i = 0; i < threadCount; ++i) {
+            startThread(&threads[i], +[](void* parameter) {
+                JobSystem* jobs = (JobSystem*)parameter;
+                while (true) {
+                    waitSemaphore(&jobs->workAvailable);
+                    if (!jobs->running) {
+                        return;
+                    }
+                    jobs->work();
+                    signalSemaphore(&jobs->workDone, 1);
+                }
+            }, this);
+        }
+    }
+
+    void destroy() {
+        running = false;
+        signalSemaphore(&workAvailable, threadCount);
+        for (int i = 0; i < threadCount; ++i) {
+            joinThread(&threads[i]);
+        }
+        threadCount = 0;
+
+        destroySemaphore(&workAvailable);
+        destroySemaphore(&workDone);
+    }
+
+    void work() {
+        while (true) {
+            i32 index = atomicAdd(&nextJob, 1) - 1;
+            if (index >= jobCount) {
+                return;
+            }
+            function(data, index);
+        }
+    }
+
+    /**
+     * Calls jobFunction(jobData, i) for every i in [0, count) and blocks until all calls returned.
+     * The order in which indices are processed is not specified.
+     */
+    void run(JobFunction* jobFunction, void* jobData, int count) {
+        if (count <= 0) {
+            return;
+        }
+        if (threadCount == 0 || count == 1) {
+            for (int i = 0; i < count; ++i) {
+                jobFunction(jobData, i);
+            }
+            return;
+        }
+
+        function = jobFunction;
+        data = jobData;
+        jobCount = count;
+        nextJob = 0;
+
+        // The workers are idle, signaling the semaphore publishes the fields above
+        signalSemaphore(&workAvailable, threadCount);
+        work();
+
+        // Each wake up is answered by exactly one signal after the worker stopped
+        // touching the loop state, so it is safe to start the next loop afterwards
+        for (int i = 0; i < threadCount; ++i) {
+            waitSemaphore(&workDone);
+        }
+    }
+};
@@ -0,0 +1,233 @@
+/******************************************************************************
+* Linux platform layer
+*
+* Implements the OS abstraction (fp_os.h) and the page allocator on top of
+* POSIX. This is used by the headless tools in bench/.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_allocator.h"
+#include "fp_os.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// The shared renderer code reports errors through the Win32 debug output.
+// On Linux, these messages go to stderr instead.
+static void OutputDebugStringA(const char* message)
+{
+    fputs(message, stderr);
+}
+
+static void OutputDebugStringW(const wchar_t* message)
+{
+    fprintf(stderr, "%ls", message);
+}
+
+static void DebugBreak()
+{
+    raise(SIGTRAP);
+}
+
+Allocator createPageAllocator()
+{
+    Allocator allocator = {};
+    allocator.allocateFunction = +[](Allocator* context, u64 size) -> void*
+    {
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+        {
+            return nullptr;
+        }
+        return memory;
+    };
+    allocator.freeFunction = +[](Allocator* context, void* data, u64 size)
+    {
+        // Unlike VirtualFree, munmap needs the size of the mapping
+        munmap(data, size);
+    };
+    return allocator;
+}
+
+u64 getPerformanceCounter()
+{
+    timespec time = {};
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (u64)time.tv_sec * 1000000000ULL + (u64)time.tv_nsec;
+}
+
+u64 getPerformanceFrequency()
+{
+    // CLOCK_MONOTONIC is reported in nanoseconds
+    return 1000000000ULL;
+}
+
+u64 getPageSize()
+{
+    return (u64)sysconf(_SC_PAGESIZE);
+}
+
+u32 getProcessorCount()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (u32)count : 1;
+}
+
+static void* linux_threadMain(void* parameter)
+{
+    Thread* thread = (Thread*)parameter;
+    thread->function(thread->parameter);
+    return nullptr;
+}
+
+void startThread(Thread* thread, ThreadFunction* function, void* parameter)
+{
+    thread->function = function;
+    thread->parameter = parameter;
+
+    pthread_t handle = {};
+    int error = pthread_create(&handle, nullptr, &linux_threadMain, thread);
+    Assert(error == 0);
+    thread->handle = (u64)handle;
+}
+
+void joinThread(Thread* thread)
+{
+    pthread_join((pthread_t)thread->handle, nullptr);
+    thread->handle = 0;
+}
+
+u64 getCurrentThreadId()
+{
+    // gettid() would be a system call, pthread_self() only reads the thread pointer
+    return (u64)pthread_self();
+}
+
+void createSemaphore(Semaphore* semaphore, u32 initialCount)
+{
+    // sem_t must not be copied or moved, so it lives on the heap
+    sem_t* handle = (sem_t*)malloc(sizeof(sem_t));
+    int error = sem_init(handle, 0, initialCount);
+    Assert(error == 0);
+    semaphore->handle = (u64)handle;
+}
+
+void destroySemaphore(Semaphore* semaphore)
+{
+    sem_t* handle = (sem_t*)semaphore->handle;
+    sem_destroy(handle);
+    free(handle);
+    semaphore->handle = 0;
+}
+
+void signalSemaphore(Semaphore* semaphore, u32 count)
+{
+    for (u32 i = 0; i < count; ++i)
+    {
+        sem_post((sem_t*)semaphore->handle);
+    }
+}
+
+void waitSemaphore(Semaphore* semaphore)
+{
+    // Retry if the wait was interrupted by a signal handler
+    while (sem_wait((sem_t*)semaphore->handle) != 0)
+    {
+    }
+}
+
+i32 atomicAdd(volatile i32* target, i32 value)
+{
+    return __atomic_add_fetch(target, value, __ATOMIC_SEQ_CST);
+}
+
+bool openFileForWriting(FileWriter* file, wchar_t const* filename)
+{
+    // The shared code uses wide filenames like Win32, Linux expects multibyte ones
+    char path[1024];
+    size_t length = wcstombs(path, filename, sizeof(path));
+    if (length == (size_t)-1 || length == sizeof(path))
+    {
+        file->handle = 0;
+        return false;
+    }
+
+    FILE* handle = fopen(path, "wb");
+    file->handle = (u64)handle;
+    return handle != nullptr;
+}
+
+bool writeFile(FileWriter* file, void const* data, u64 size)
+{
+    return fwrite(data, 1, size, (FILE*)file->handle) == size;
+}
+
+void closeFile(FileWriter* file)
+{
+    fclose((FILE*)file->handle);
+    file->handle = 0;
+}
+
+ReadFileResult readEntireFile(wchar_t const* filename)
+{
+    ReadFileResult result = {};
+
+    char path[1024];
+    size_t length = wcstombs(path, filename, sizeof(path));
+    if (length == (size_t)-1 || length == sizeof(path))
+    {
+        result.errorText = L"wcstombs failed";
+        result.error = 1;
+        return result;
+    }
+
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        result.errorText = L"fopen failed";
+        result.error = errno;
+        return result;
+    }
+    defer{ fclose(file); };
+
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (fileSize < 0)
+    {
+        result.errorText = L"ftell failed";
+        result.error = errno;
+        return result;
+    }
+
+    // One extra byte, so malloc does not return nullptr for empty files
+    u8* buffer = (u8*)malloc(fileSize + 1);
+    if (!buffer || fread(buffer, 1, fileSize, file) != (size_t)fileSize)
+    {
+        free(buffer);
+        result.errorText = L"fread failed";
+        result.error = 1;
+        return result;
+    }
+
+    result.data = buffer;
+    result.size = fileSize;
+    return result;
+}
+
+void freeReadFileResult(ReadFileResult* result)
+{
+    free(result->data);
+    result->data = nullptr;
+}
@@ -4,6 +4,15 @@
 
 #define FP_PI 3.14159265358979323846264338327950288419716939937510
 
+// SSE4.1 rounding, since there is no CRT for floorf and ceilf
+static float floorFloat(float value) {
+    return _mm_cvtss_f32(_mm_floor_ss(_mm_setzero_ps(), _mm_set_ss(value)));
+}
+
+static float ceilFloat(float value) {
+    return _mm_cvtss_f32(_mm_ceil_ss(_mm_setzero_ps(), _mm_set_ss(value)));
+}
+
 __m256 mm256_sincos_ps(__m256 x, __m256* c) {
     __m256 signBitSin = x;
     
@@ -0,0 +1,390 @@
+/******************************************************************************
+* Static meshes
+*
+* Indexed triangle meshes are uploaded once and drawn every frame with
+* Render_Mesh commands, which only carry a handle and a transform.
+*
+* Vertices and indices are sub-allocated from a few large pools. Each pool is
+* a pair of immutable buffers created with glNamedBufferStorage, meshes are
+* copied into the next free range of a pool that still has room. Meshes are
+* not freed individually, all of them are released with the store.
+*
+* The renderer gathers the mesh commands of a frame per pool, all meshes of a
+* pool share the shader and the vertex format. Each pool is drawn with one
+* glMultiDrawElementsIndirect, the transforms and colors are read from a
+* storage buffer indexed by the draw. The index comes from an instanced
+* vertex attribute, see drawIndexBuffer.
+*
+* Meshes outside the view frustum are culled by testing their bounding sphere
+* against the frustum planes. On the GPU, a compute shader tests one
+* MeshCandidate per mesh and appends the commands of the visible meshes with
+* an atomic counter per batch, which glMultiDrawElementsIndirectCount reads
+* as draw count. The CPU fallback runs the same test while writing the
+* commands and draws the same meshes.
+*
+* Example:
+* {
+*     MeshHandle deer = renderer.meshes.upload(vertices, vertexCount, indices, indexCount);
+*     ...
+*     RenderCommandMesh mesh = {};
+*     mesh.mesh = deer;
+*     // Set mesh.transform and mesh.color
+*     commands.push(&mesh);
+* }
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_core.h"
+#include "fp_allocator.h"
+#include "fp_obj.h"
+#include "fp_opengl.h"
+#include "fp_render_commands.h"
+
+#include <immintrin.h>
+
+static const int MAX_MESHES = 4096;
+static const int MAX_MESH_POOLS = 8;
+
+// Capacity of a pool, larger meshes get a pool of their own size
+static const u32 MESH_POOL_VERTICES = 1 << 20;
+static const u32 MESH_POOL_INDICES = 3 << 20;
+
+// Draws of one glMultiDrawElementsIndirect, larger batches are split
+static const u32 MAX_MESH_BATCH_DRAWS = 1 << 16;
+
+struct MeshVertex {
+    float position[3];
+    float normal[3];
+};
+
+// Bounding sphere in mesh space
+struct MeshBounds {
+    float center[3];
+    float radius;
+};
+
+struct Mesh {
+    u32 pool;
+    u32 firstIndex;
+    u32 indexCount;
+    i32 baseVertex;
+    MeshBounds bounds;
+};
+
+struct MeshPool {
+    unsigned int vertexBuffer;
+    unsigned int indexBuffer;
+    u32 vertexCapacity;
+    u32 vertexCount;
+    u32 indexCapacity;
+    u32 indexCount;
+};
+
+// Layout defined by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+    u32 count;
+    u32 instanceCount;
+    u32 firstIndex;
+    i32 baseVertex;
+    // Index of the draw in its batch, see MeshStore::drawIndexBuffer
+    u32 baseInstance;
+};
+
+// Per draw data of a batch, std430 layout with a row-major matrix
+struct MeshInstance {
+    float transform[16];
+    float color[4];
+};
+
+// Input of the culling compute shader, one per mesh command, std430 layout
+struct MeshCandidate {
+    // Bounding sphere in mesh space
+    float sphere[4];
+    u32 indexCount;
+    u32 firstIndex;
+    i32 baseVertex;
+    // Index into the instances of the frame
+    u32 instance;
+    // Index of the draw in its batch, becomes the base instance
+    u32 drawIndex;
+    // Counter which is incremented for a visible mesh
+    u32 batch;
+    // Command index of the first draw of the batch
+    u32 firstCommand;
+    u32 padding;
+};
+
+// Planes of the view frustum, a point p is inside if dot(plane.xyz, p) + plane.w >= 0 for all planes
+struct Frustum {
+    float planes[6][4];
+};
+
+struct MeshStats {
+    u64 uploads;
+    u64 uploadedBytes;
+    u64 failedUploads;
+};
+
+static MeshBounds computeMeshBounds(const MeshVertex* vertices, u32 vertexCount) {
+    MeshBounds bounds = {};
+    if (vertexCount == 0) {
+        return bounds;
+    }
+
+    float minimum[3];
+    float maximum[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        minimum[axis] = maximum[axis] = vertices[0].position[axis];
+    }
+    for (u32 i = 1; i < vertexCount; ++i) {
+        for (int axis = 0; axis < 3; ++axis) {
+            float value = vertices[i].position[axis];
+            minimum[axis] = value < minimum[axis] ? value : minimum[axis];
+            maximum[axis] = value > maximum[axis] ? value : maximum[axis];
+        }
+    }
+
+    // Centered on the box, not minimal but cheap and stable
+    for (int axis = 0; axis < 3; ++axis) {
+        bounds.center[axis] = 0.5f * (minimum[axis] + maximum[axis]);
+    }
+    float radiusSquared = 0.0f;
+    for (u32 i = 0; i < vertexCount; ++i) {
+        float distanceSquared = 0.0f;
+        for (int axis = 0; axis < 3; ++axis) {
+            float delta = vertices[i].position[axis] - bounds.center[axis];
+            distanceSquared += delta * delta;
+        }
+        radiusSquared = distanceSquared > radiusSquared ? distanceSquared : radiusSquared;
+    }
+    bounds.radius = _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(radiusSquared)));
+    return bounds;
+}
+
+/**
+ * Extracts the normalized frustum planes of a row-major view and projection
+ * matrix: left, right, bottom, top, near and far.
+ */
+static Frustum computeFrustum(const float* viewProjection) {
+    Frustum frustum = {};
+    const float* w = viewProjection + 12;
+    for (int axis = 0; axis < 3; ++axis) {
+        const float* row = viewProjection + 4 * axis;
+        for (int i = 0; i < 4; ++i) {
+            frustum.planes[2 * axis][i] = w[i] + row[i];
+            frustum.planes[2 * axis + 1][i] = w[i] - row[i];
+        }
+    }
+
+    for (int p = 0; p < 6; ++p) {
+        float* plane = frustum.planes[p];
+        float lengthSquared = plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2];
+        if (lengthSquared > 0.0f) {
+            float scale = 1.0f / _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(lengthSquared)));
+            for (int i = 0; i < 4; ++i) {
+                plane[i] *= scale;
+            }
+        }
+    }
+    return frustum;
+}
+
+/**
+ * Tests the bounding sphere, moved by the row-major transform, against the
+ * frustum. The radius grows with the largest axis scale. Must match the
+ * culling compute shader, so both sides draw the same meshes.
+ */
+static bool isSphereInFrustum(const Frustum* frustum, const float* transform, const float* sphere) {
+    float center[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        const float* row = transform + 4 * axis;
+        center[axis] = row[0] * sphere[0] + row[1] * sphere[1] + row[2] * sphere[2] + row[3];
+    }
+
+    float scaleSquared = 0.0f;
+    for (int column = 0; column < 3; ++column) {
+        float lengthSquared = transform[column] * transform[column] + transform[4 + column] * transform[4 + column]
+            + transform[8 + column] * transform[8 + column];
+        scaleSquared = lengthSquared > scaleSquared ? lengthSquared : scaleSquared;
+    }
+    float radius = sphere[3] * _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(scaleSquared)));
+
+    for (int p = 0; p < 6; ++p) {
+        const float* plane = frustum->planes[p];
+        float distance = plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2] + plane[3];
+        if (distance < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct MeshStore {
+    MeshPool pools[MAX_MESH_POOLS];
+    int poolCount;
+
+    // Slot 0 is unused, see MeshHandle
+    Mesh meshes[MAX_MESHES];
+    u32 meshCount;
+
+    // Holds 0, 1, 2, ... as instanced vertex attribute. With one instance per
+    // draw, the attribute is the base instance, which is the index of the draw.
+    unsigned int drawIndexBuffer;
+
+    MeshStats stats;
+
+    void create() {
+        poolCount = 0;
+        meshCount = 1;
+        stats = {};
+
+        glCreateBuffers(1, &drawIndexBuffer);
+        glNamedBufferStorage(drawIndexBuffer, MAX_MESH_BATCH_DRAWS * sizeof(u32), nullptr, GL_DYNAMIC_STORAGE_BIT);
+        u32 drawIndices[1024];
+        for (u32 first = 0; first < MAX_MESH_BATCH_DRAWS; first += 1024) {
+            for (u32 i = 0; i < 1024; ++i) {
+                drawIndices[i] = first + i;
+            }
+            glNamedBufferSubData(drawIndexBuffer, first * sizeof(u32), sizeof(drawIndices), drawIndices);
+        }
+    }
+
+    void destroy() {
+        for (int i = 0; i < poolCount; ++i) {
+            glDeleteBuffers(1, &pools[i].vertexBuffer);
+            glDeleteBuffers(1, &pools[i].indexBuffer);
+        }
+        glDeleteBuffers(1, &drawIndexBuffer);
+        poolCount = 0;
+        meshCount = 1;
+    }
+
+    // Returns a pool with room for the mesh, or -1
+    int findPool(u32 vertexCount, u32 indexCount) {
+        for (int i = 0; i < poolCount; ++i) {
+            MeshPool* pool = &pools[i];
+            if (pool->vertexCapacity - pool->vertexCount >= vertexCount && pool->indexCapacity - pool->indexCount >= indexCount) {
+                return i;
+            }
+        }
+        if (poolCount == MAX_MESH_POOLS) {
+            return -1;
+        }
+
+        // Only written by glNamedBufferSubData, once for each mesh
+        MeshPool* pool = &pools[poolCount];
+        pool->vertexCapacity = vertexCount > MESH_POOL_VERTICES ? vertexCount : MESH_POOL_VERTICES;
+        pool->indexCapacity = indexCount > MESH_POOL_INDICES ? indexCount : MESH_POOL_INDICES;
+        pool->vertexCount = 0;
+        pool->indexCount = 0;
+        glCreateBuffers(1, &pool->vertexBuffer);
+        glNamedBufferStorage(pool->vertexBuffer, (u64)pool->vertexCapacity * sizeof(MeshVertex), nullptr, GL_DYNAMIC_STORAGE_BIT);
+        glCreateBuffers(1, &pool->indexBuffer);
+        glNamedBufferStorage(pool->indexBuffer, (u64)pool->indexCapacity * sizeof(u32), nullptr, GL_DYNAMIC_STORAGE_BIT);
+        return poolCount++;
+    }
+
+    /**
+     * Copies an indexed triangle list to the GPU. The indices refer to the
+     * vertices of this mesh. Returns an invalid handle if there is no room.
+     */
+    MeshHandle upload(const MeshVertex* vertices, u32 vertexCount, const u32* indices, u32 indexCount) {
+        MeshHandle handle = {};
+        int poolIndex = meshCount < MAX_MESHES && indexCount > 0 ? findPool(vertexCount, indexCount) : -1;
+        if (poolIndex < 0) {
+            OutputDebugStringW(L"No room left for the mesh\n");
+            stats.failedUploads += 1;
+            return handle;
+        }
+
+        MeshPool* pool = &pools[poolIndex];
+        u64 vertexBytes = (u64)vertexCount * sizeof(MeshVertex);
+        u64 indexBytes = (u64)indexCount * sizeof(u32);
+        glNamedBufferSubData(pool->vertexBuffer, (u64)pool->vertexCount * sizeof(MeshVertex), vertexBytes, vertices);
+        glNamedBufferSubData(pool->indexBuffer, (u64)pool->indexCount * sizeof(u32), indexBytes, indices);
+
+        Mesh* mesh = &meshes[meshCount];
+        mesh->pool = (u32)poolIndex;
+        mesh->firstIndex = pool->indexCount;
+        mesh->indexCount = indexCount;
+        mesh->baseVertex = (i32)pool->vertexCount;
+        mesh->bounds = computeMeshBounds(vertices, vertexCount);
+        pool->vertexCount += vertexCount;
+        pool->indexCount += indexCount;
+
+        stats.uploads += 1;
+        stats.uploadedBytes += vertexBytes + indexBytes;
+
+        handle.index = meshCount++;
+        return handle;
+    }
+
+    // Returns nullptr for invalid handles
+    Mesh* get(MeshHandle handle) {
+        return handle.index > 0 && handle.index < meshCount ? &meshes[handle.index] : nullptr;
+    }
+};
+
+// OBJ indices start at 1, negative indices count back from the last vertex
+static u32 objVertexIndex(i32 index, i64 vertexCount) {
+    i64 result = index > 0 ? index - 1 : vertexCount + index;
+    return result >= 0 && result < vertexCount ? (u32)result : 0;
+}
+
+/**
+ * Uploads the faces of an OBJ model as one mesh. Vertices are shared between
+ * faces by their position index, the OBJ normals have their own indices, so
+ * smooth normals are computed from the faces instead. allocator is only used
+ * temporarily.
+ */
+static MeshHandle uploadObjModel(MeshStore* store, ObjModel* model, Allocator* allocator) {
+    MeshHandle handle = {};
+    u32 vertexCount = (u32)model->verticesCount;
+    u32 indexCount = (u32)model->facesCount * 3;
+    if (vertexCount == 0 || indexCount == 0) {
+        return handle;
+    }
+
+    MeshVertex* vertices = allocator->allocateArray<MeshVertex>(vertexCount);
+    u32* indices = allocator->allocateArray<u32>(indexCount);
+    defer{ if (vertices) allocator->freeArray(vertices, vertexCount); };
+    defer{ if (indices) allocator->freeArray(indices, indexCount); };
+    if (!vertices || !indices) {
+        OutputDebugStringW(L"Not enough memory to convert the OBJ model\n");
+        return handle;
+    }
+
+    for (u32 i = 0; i < vertexCount; ++i) {
+        Vertex3 position = model->vertices[i];
+        vertices[i] = { { position.x, position.y, position.z }, { 0.0f, 0.0f, 0.0f } };
+    }
+
+    // Area weighted face normals summed per vertex, the shader normalizes them
+    for (i64 face = 0; face < model->facesCount; ++face) {
+        u32* corner = indices + 3 * face;
+        for (int i = 0; i < 3; ++i) {
+            corner[i] = objVertexIndex(model->faces[face].v[i], model->verticesCount);
+        }
+
+        float* a = vertices[corner[0]].position;
+        float* b = vertices[corner[1]].position;
+        float* c = vertices[corner[2]].position;
+        float ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        float ac[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+        float normal[3] = {
+            ab[1] * ac[2] - ab[2] * ac[1],
+            ab[2] * ac[0] - ab[0] * ac[2],
+            ab[0] * ac[1] - ab[1] * ac[0],
+        };
+        for (int i = 0; i < 3; ++i) {
+            for (int axis = 0; axis < 3; ++axis) {
+                vertices[corner[i]].normal[axis] += normal[axis];
+            }
+        }
+    }
+    return store->upload(vertices, vertexCount, indices, indexCount);
+}
@@ -14,8 +14,12 @@
 
 // TODO: Replace OutputDebugString with OS independent functions
 //       Maybe even better to return an error string that can be printed outside
+#if defined(_WIN32)
 //#define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#else
+#include "fp_linux.h"
+#endif
 
 
 struct Vertex3
@@ -1,7 +1,8 @@
 /******************************************************************************
 * OpenGL helper functions
 *
-* Setup OpenGL on Windows
+* Setup OpenGL on Windows (WGL) and load the function pointers.
+* Headless contexts on Linux are created in fp_egl.h.
 *
 * Author: Fabian Paus
 *
@@ -9,11 +10,20 @@
 
 #pragma once
 
+#if defined(_WIN32)
 #include "fp_win32.h"
 
 #include <Windows.h>
 #include <gl/GL.h>
+#else
+#include "fp_linux.h"
 
+// Only the OpenGL 1.1 declarations are used, everything else is loaded below
+#define GL_GLEXT_LEGACY
+#include <GL/gl.h>
+#endif
+
+#if defined(_WIN32)
 // OpenGL on Windows (WGL)
 // https://registry.khronos.org/OpenGL/api/GL/wglext.h
 
@@ -82,7 +92,7 @@ static wglChoosePixelFormatARBF* wglChoosePixelFormatARB;
 
 typedef BOOL WINAPI wglSwapIntervalEXTF(int interval);
 static wglSwapIntervalEXTF* wglSwapIntervalEXT;
-
+#endif // _WIN32
 
 
 // OpenGL extensions
@@ -135,7 +145,68 @@ static wglSwapIntervalEXTF* wglSwapIntervalEXT;
 #define GL_DEBUG_OUTPUT 0x92E0
 #define GL_DEBUG_OUTPUT_SYNCHRONOUS       0x8242
 
+#define GL_FRAMEBUFFER                    0x8D40
+#define GL_RENDERBUFFER                   0x8D41
+#define GL_COLOR_ATTACHMENT0              0x8CE0
+#define GL_FRAMEBUFFER_COMPLETE           0x8CD5
+
+#define GL_MAP_READ_BIT                   0x0001
+#define GL_MAP_WRITE_BIT                  0x0002
+#define GL_MAP_PERSISTENT_BIT             0x0040
+#define GL_MAP_COHERENT_BIT               0x0080
+#define GL_DYNAMIC_STORAGE_BIT            0x0100
+#define GL_CLIENT_STORAGE_BIT             0x0200
+
+#define GL_SYNC_GPU_COMMANDS_COMPLETE     0x9117
+#define GL_SYNC_FLUSH_COMMANDS_BIT        0x00000001
+#define GL_ALREADY_SIGNALED               0x911A
+#define GL_TIMEOUT_EXPIRED                0x911B
+#define GL_CONDITION_SATISFIED            0x911C
+#define GL_WAIT_FAILED                    0x911D
+#define GL_TIMEOUT_IGNORED                0xFFFFFFFFFFFFFFFFull
+
+#define GL_QUERY_RESULT                   0x8866
+#define GL_QUERY_RESULT_AVAILABLE         0x8867
+#define GL_TIME_ELAPSED                   0x88BF
+#define GL_TIMESTAMP                      0x8E28
+
+#define GL_CLAMP_TO_EDGE                  0x812F
+
+#define GL_DEPTH_COMPONENT24              0x81A6
+#define GL_DEPTH_ATTACHMENT               0x8D00
+
+#define GL_DRAW_INDIRECT_BUFFER           0x8F3F
+#define GL_SHADER_STORAGE_BUFFER          0x90D2
+#define GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT 0x90DF
+
+#define GL_COMPUTE_SHADER                 0x91B9
+#define GL_PARAMETER_BUFFER               0x80EE
+#define GL_COMMAND_BARRIER_BIT            0x00000040
+#define GL_SHADER_STORAGE_BARRIER_BIT     0x00002000
+
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH          0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS     0x87FE
+#define GL_COMPLETION_STATUS_KHR          0x91B1
+
+#define GL_PIXEL_UNPACK_BUFFER            0x88EC
+#define GL_TEXTURE_BASE_LEVEL             0x813C
+
+#define GL_READ_FRAMEBUFFER               0x8CA8
+#define GL_DRAW_FRAMEBUFFER               0x8CA9
+#define GL_DRAW_FRAMEBUFFER_BINDING       0x8CA6
+#define GL_READ_FRAMEBUFFER_BINDING       0x8CAA
+#define GL_DEPTH24_STENCIL8               0x88F0
+#define GL_DEPTH_STENCIL_ATTACHMENT       0x821A
+
+#define GL_RGBA16F                        0x881A
+#define GL_DEPTH_STENCIL                  0x84F9
+
 typedef intptr_t GLintptr;
+typedef intptr_t GLsizeiptr;
+typedef uint64_t GLuint64;
+typedef int64_t GLint64;
+typedef struct __GLsync* GLsync;
 
 typedef const GLubyte* glGetStringiF(GLenum name, GLuint index);
 static glGetStringiF* glGetStringi;
@@ -234,6 +305,272 @@ static glVertexArrayAttribBindingF* glVertexArrayAttribBinding;
 typedef void glVertexArrayVertexBufferF(GLuint vaobj, GLuint bindingindex, GLuint buffer, GLintptr offset, GLsizei stride);
 static glVertexArrayVertexBufferF* glVertexArrayVertexBuffer;
 
+typedef void glDrawArraysInstancedF(GLenum mode, GLint first, GLsizei count, GLsizei instancecount);
+static glDrawArraysInstancedF* glDrawArraysInstanced;
+
+typedef void glVertexArrayBindingDivisorF(GLuint vaobj, GLuint bindingindex, GLuint divisor);
+static glVertexArrayBindingDivisorF* glVertexArrayBindingDivisor;
+
+typedef void glEnableVertexArrayAttribF(GLuint vaobj, GLuint index);
+static glEnableVertexArrayAttribF* glEnableVertexArrayAttrib;
+
+typedef void glGenFramebuffersF(GLsizei n, GLuint* framebuffers);
+static glGenFramebuffersF* glGenFramebuffers;
+
+typedef void glBindFramebufferF(GLenum target, GLuint framebuffer);
+static glBindFramebufferF* glBindFramebuffer;
+
+typedef void glGenRenderbuffersF(GLsizei n, GLuint* renderbuffers);
+static glGenRenderbuffersF* glGenRenderbuffers;
+
+typedef void glBindRenderbufferF(GLenum target, GLuint renderbuffer);
+static glBindRenderbufferF* glBindRenderbuffer;
+
+typedef void glRenderbufferStorageF(GLenum target, GLenum internalformat, GLsizei width, GLsizei height);
+static glRenderbufferStorageF* glRenderbufferStorage;
+
+typedef void glFramebufferRenderbufferF(GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer);
+static glFramebufferRenderbufferF* glFramebufferRenderbuffer;
+
+typedef GLenum glCheckFramebufferStatusF(GLenum target);
+static glCheckFramebufferStatusF* glCheckFramebufferStatus;
+
+typedef void glCreateBuffersF(GLsizei n, GLuint* buffers);
+static glCreateBuffersF* glCreateBuffers;
+
+typedef void glDeleteBuffersF(GLsizei n, const GLuint* buffers);
+static glDeleteBuffersF* glDeleteBuffers;
+
+typedef void glNamedBufferStorageF(GLuint buffer, GLsizeiptr size, const void* data, GLbitfield flags);
+static glNamedBufferStorageF* glNamedBufferStorage;
+
+typedef void* glMapNamedBufferRangeF(GLuint buffer, GLintptr offset, GLsizeiptr length, GLbitfield access);
+static glMapNamedBufferRangeF* glMapNamedBufferRange;
+
+typedef GLsync glFenceSyncF(GLenum condition, GLbitfield flags);
+static glFenceSyncF* glFenceSync;
+
+typedef GLenum glClientWaitSyncF(GLsync sync, GLbitfield flags, GLuint64 timeout);
+static glClientWaitSyncF* glClientWaitSync;
+
+typedef void glDeleteSyncF(GLsync sync);
+static glDeleteSyncF* glDeleteSync;
+
+typedef void glGenQueriesF(GLsizei n, GLuint* ids);
+static glGenQueriesF* glGenQueries;
+
+typedef void glDeleteQueriesF(GLsizei n, const GLuint* ids);
+static glDeleteQueriesF* glDeleteQueries;
+
+typedef void glQueryCounterF(GLuint id, GLenum target);
+static glQueryCounterF* glQueryCounter;
+
+typedef void glGetQueryObjectivF(GLuint id, GLenum pname, GLint* params);
+static glGetQueryObjectivF* glGetQueryObjectiv;
+
+typedef void glGetQueryObjectui64vF(GLuint id, GLenum pname, GLuint64* params);
+static glGetQueryObjectui64vF* glGetQueryObjectui64v;
+
+typedef void glCopyNamedBufferSubDataF(GLuint readBuffer, GLuint writeBuffer, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size);
+static glCopyNamedBufferSubDataF* glCopyNamedBufferSubData;
+
+typedef void glCreateTexturesF(GLenum target, GLsizei n, GLuint* textures);
+static glCreateTexturesF* glCreateTextures;
+
+typedef void glTextureStorage2DF(GLuint texture, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+static glTextureStorage2DF* glTextureStorage2D;
+
+typedef void glTextureSubImage2DF(GLuint texture, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void* pixels);
+static glTextureSubImage2DF* glTextureSubImage2D;
+
+typedef void glTextureParameteriF(GLuint texture, GLenum pname, GLint param);
+static glTextureParameteriF* glTextureParameteri;
+
+typedef void glBindTextureUnitF(GLuint unit, GLuint texture);
+static glBindTextureUnitF* glBindTextureUnit;
+
+typedef void glNamedBufferSubDataF(GLuint buffer, GLintptr offset, GLsizeiptr size, const void* data);
+static glNamedBufferSubDataF* glNamedBufferSubData;
+
+typedef void glVertexArrayElementBufferF(GLuint vaobj, GLuint buffer);
+static glVertexArrayElementBufferF* glVertexArrayElementBuffer;
+
+typedef void glDrawElementsBaseVertexF(GLenum mode, GLsizei count, GLenum type, const void* indices, GLint basevertex);
+static glDrawElementsBaseVertexF* glDrawElementsBaseVertex;
+
+typedef void glBindBufferRangeF(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+static glBindBufferRangeF* glBindBufferRange;
+
+typedef void glMultiDrawElementsIndirectF(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+static glMultiDrawElementsIndirectF* glMultiDrawElementsIndirect;
+
+typedef void glUniform4fvF(GLint location, GLsizei count, const GLfloat* value);
+static glUniform4fvF* glUniform4fv;
+
+typedef void glUniform1uiF(GLint location, GLuint v0);
+static glUniform1uiF* glUniform1ui;
+
+typedef void glDispatchComputeF(GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z);
+static glDispatchComputeF* glDispatchCompute;
+
+typedef void glMemoryBarrierF(GLbitfield barriers);
+static glMemoryBarrierF* glMemoryBarrier;
+
+typedef void glMultiDrawElementsIndirectCountF(GLenum mode, GLenum type, const void* indirect, GLintptr drawcount, GLsizei maxdrawcount, GLsizei stride);
+static glMultiDrawElementsIndirectCountF* glMultiDrawElementsIndirectCount;
+
+typedef void glProgramParameteriF(GLuint program, GLenum pname, GLint value);
+static glProgramParameteriF* glProgramParameteri;
+
+typedef void glGetProgramBinaryF(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+static glGetProgramBinaryF* glGetProgramBinary;
+
+typedef void glProgramBinaryF(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+static glProgramBinaryF* glProgramBinary;
+
+typedef void glMaxShaderCompilerThreadsKHRF(GLuint count);
+static glMaxShaderCompilerThreadsKHRF* glMaxShaderCompilerThreadsKHR;
+
+typedef void glGetInteger64vF(GLenum pname, GLint64* data);
+static glGetInteger64vF* glGetInteger64v;
+
+typedef void glGetTextureImageF(GLuint texture, GLint level, GLenum format, GLenum type, GLsizei bufSize, void* pixels);
+static glGetTextureImageF* glGetTextureImage;
+
+typedef void glDeleteFramebuffersF(GLsizei n, const GLuint* framebuffers);
+static glDeleteFramebuffersF* glDeleteFramebuffers;
+
+typedef void glDeleteRenderbuffersF(GLsizei n, const GLuint* renderbuffers);
+static glDeleteRenderbuffersF* glDeleteRenderbuffers;
+
+typedef void glBlitFramebufferF(GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter);
+static glBlitFramebufferF* glBlitFramebuffer;
+
+typedef void glCreateFramebuffersF(GLsizei n, GLuint* framebuffers);
+static glCreateFramebuffersF* glCreateFramebuffers;
+
+typedef void glNamedFramebufferTextureF(GLuint framebuffer, GLenum attachment, GLuint texture, GLint level);
+static glNamedFramebufferTextureF* glNamedFramebufferTexture;
+
+typedef void glNamedFramebufferDrawBuffersF(GLuint framebuffer, GLsizei n, const GLenum* bufs);
+static glNamedFramebufferDrawBuffersF* glNamedFramebufferDrawBuffers;
+
+typedef GLenum glCheckNamedFramebufferStatusF(GLuint framebuffer, GLenum target);
+static glCheckNamedFramebufferStatusF* glCheckNamedFramebufferStatus;
+
+typedef void glClearBufferfvF(GLenum buffer, GLint drawbuffer, const GLfloat* value);
+static glClearBufferfvF* glClearBufferfv;
+
+typedef void glClearBufferfiF(GLenum buffer, GLint drawbuffer, GLfloat depth, GLint stencil);
+static glClearBufferfiF* glClearBufferfi;
+
+typedef void glGetNamedBufferSubDataF(GLuint buffer, GLintptr offset, GLsizeiptr size, void* data);
+static glGetNamedBufferSubDataF* glGetNamedBufferSubData;
+
+
+typedef void* gl_GetProcAddressF(const char* name);
+
+// Loads all OpenGL functions above 1.1 through the platform specific getProcAddress
+static void gl_loadFunctions(gl_GetProcAddressF* getProcAddress) {
+    glGetStringi            = (glGetStringiF*)          getProcAddress("glGetStringi");
+    glDebugMessageCallback  = (glDebugMessageCallbackF*)getProcAddress("glDebugMessageCallback");
+    glGenBuffers            = (glGenBuffersF*)          getProcAddress("glGenBuffers");
+    glBindBuffer            = (glBindBufferF*)          getProcAddress("glBindBuffer");
+    glBufferData            = (glBufferDataF*)          getProcAddress("glBufferData");
+    glNamedBufferData = (glNamedBufferDataF*)getProcAddress("glNamedBufferData");
+    glCreateShader = (glCreateShaderF*)getProcAddress("glCreateShader");
+    glShaderSource = (glShaderSourceF*)getProcAddress("glShaderSource");
+    glCompileShader = (glCompileShaderF*)getProcAddress("glCompileShader");
+    glGetShaderiv = (glGetShaderivF*)getProcAddress("glGetShaderiv");
+    glGetShaderInfoLog = (glGetShaderInfoLogF*)getProcAddress("glGetShaderInfoLog");
+    glCreateProgram = (glCreateProgramF*)getProcAddress("glCreateProgram");
+    glAttachShader = (glAttachShaderF*)getProcAddress("glAttachShader");
+    glLinkProgram = (glLinkProgramF*)getProcAddress("glLinkProgram");
+    glGetProgramiv = (glGetProgramivF*)getProcAddress("glGetProgramiv");
+    glGetProgramInfoLog = (glGetProgramInfoLogF*)getProcAddress("glGetProgramInfoLog");
+    glUseProgram = (glUseProgramF*)getProcAddress("glUseProgram");
+    glDeleteShader = (glDeleteShaderF*)getProcAddress("glDeleteShader");
+    glVertexAttribPointer = (glVertexAttribPointerF*)getProcAddress("glVertexAttribPointer");
+    glEnableVertexAttribArray = (glEnableVertexAttribArrayF*)getProcAddress("glEnableVertexAttribArray");
+    glGenVertexArrays = (glGenVertexArraysF*)getProcAddress("glGenVertexArrays");
+    glBindVertexArray = (glBindVertexArrayF*)getProcAddress("glBindVertexArray");
+    glGetUniformLocation = (glGetUniformLocationF*)getProcAddress("glGetUniformLocation");
+    glUniform4f = (glUniform4fF*)getProcAddress("glUniform4f");
+    glUniformMatrix4fv = (glUniformMatrix4fvF*)getProcAddress("glUniformMatrix4fv");
+    glVertexArrayAttribFormat = (glVertexArrayAttribFormatF*)getProcAddress("glVertexArrayAttribFormat");
+    glVertexArrayAttribIFormat = (glVertexArrayAttribIFormatF*)getProcAddress("glVertexArrayAttribIFormat");
+    glVertexArrayAttribBinding = (glVertexArrayAttribBindingF*)getProcAddress("glVertexArrayAttribBinding");
+    glVertexArrayVertexBuffer = (glVertexArrayVertexBufferF*)getProcAddress("glVertexArrayVertexBuffer");
+    glDrawArraysInstanced = (glDrawArraysInstancedF*)getProcAddress("glDrawArraysInstanced");
+    glVertexArrayBindingDivisor = (glVertexArrayBindingDivisorF*)getProcAddress("glVertexArrayBindingDivisor");
+    glEnableVertexArrayAttrib = (glEnableVertexArrayAttribF*)getProcAddress("glEnableVertexArrayAttrib");
+    glGenFramebuffers = (glGenFramebuffersF*)getProcAddress("glGenFramebuffers");
+    glBindFramebuffer = (glBindFramebufferF*)getProcAddress("glBindFramebuffer");
+    glGenRenderbuffers = (glGenRenderbuffersF*)getProcAddress("glGenRenderbuffers");
+    glBindRenderbuffer = (glBindRenderbufferF*)getProcAddress("glBindRenderbuffer");
+    glRenderbufferStorage = (glRenderbufferStorageF*)getProcAddress("glRenderbufferStorage");
+    glFramebufferRenderbuffer = (glFramebufferRenderbufferF*)getProcAddress("glFramebufferRenderbuffer");
+    glCheckFramebufferStatus = (glCheckFramebufferStatusF*)getProcAddress("glCheckFramebufferStatus");
+    glCreateBuffers = (glCreateBuffersF*)getProcAddress("glCreateBuffers");
+    glDeleteBuffers = (glDeleteBuffersF*)getProcAddress("glDeleteBuffers");
+    glNamedBufferStorage = (glNamedBufferStorageF*)getProcAddress("glNamedBufferStorage");
+    glMapNamedBufferRange = (glMapNamedBufferRangeF*)getProcAddress("glMapNamedBufferRange");
+    glFenceSync = (glFenceSyncF*)getProcAddress("glFenceSync");
+    glClientWaitSync = (glClientWaitSyncF*)getProcAddress("glClientWaitSync");
+    glDeleteSync = (glDeleteSyncF*)getProcAddress("glDeleteSync");
+    glGenQueries = (glGenQueriesF*)getProcAddress("glGenQueries");
+    glDeleteQueries = (glDeleteQueriesF*)getProcAddress("glDeleteQueries");
+    glQueryCounter = (glQueryCounterF*)getProcAddress("glQueryCounter");
+    glGetQueryObjectiv = (glGetQueryObjectivF*)getProcAddress("glGetQueryObjectiv");
+    glGetQueryObjectui64v = (glGetQueryObjectui64vF*)getProcAddress("glGetQueryObjectui64v");
+    glCopyNamedBufferSubData = (glCopyNamedBufferSubDataF*)getProcAddress("glCopyNamedBufferSubData");
+    glCreateTextures = (glCreateTexturesF*)getProcAddress("glCreateTextures");
+    glTextureStorage2D = (glTextureStorage2DF*)getProcAddress("glTextureStorage2D");
+    glTextureSubImage2D = (glTextureSubImage2DF*)getProcAddress("glTextureSubImage2D");
+    glTextureParameteri = (glTextureParameteriF*)getProcAddress("glTextureParameteri");
+    glBindTextureUnit = (glBindTextureUnitF*)getProcAddress("glBindTextureUnit");
+    glNamedBufferSubData = (glNamedBufferSubDataF*)getProcAddress("glNamedBufferSubData");
+    glVertexArrayElementBuffer = (glVertexArrayElementBufferF*)getProcAddress("glVertexArrayElementBuffer");
+    glDrawElementsBaseVertex = (glDrawElementsBaseVertexF*)getProcAddress("glDrawElementsBaseVertex");
+    glBindBufferRange = (glBindBufferRangeF*)getProcAddress("glBindBufferRange");
+    glMultiDrawElementsIndirect = (glMultiDrawElementsIndirectF*)getProcAddress("glMultiDrawElementsIndirect");
+    glUniform4fv = (glUniform4fvF*)getProcAddress("glUniform4fv");
+    glUniform1ui = (glUniform1uiF*)getProcAddress("glUniform1ui");
+    glDispatchCompute = (glDispatchComputeF*)getProcAddress("glDispatchCompute");
+    glMemoryBarrier = (glMemoryBarrierF*)getProcAddress("glMemoryBarrier");
+    glMultiDrawElementsIndirectCount = (glMultiDrawElementsIndirectCountF*)getProcAddress("glMultiDrawElementsIndirectCount");
+
+    // Core in OpenGL 4.6, before that GL_ARB_indirect_parameters
+    if (!glMultiDrawElementsIndirectCount) {
+        glMultiDrawElementsIndirectCount = (glMultiDrawElementsIndirectCountF*)getProcAddress("glMultiDrawElementsIndirectCountARB");
+    }
+    glProgramParameteri = (glProgramParameteriF*)getProcAddress("glProgramParameteri");
+    glGetProgramBinary = (glGetProgramBinaryF*)getProcAddress("glGetProgramBinary");
+    glProgramBinary = (glProgramBinaryF*)getProcAddress("glProgramBinary");
+    glMaxShaderCompilerThreadsKHR = (glMaxShaderCompilerThreadsKHRF*)getProcAddress("glMaxShaderCompilerThreadsKHR");
+
+    // GL_ARB_parallel_shader_compile has the same function and query
+    if (!glMaxShaderCompilerThreadsKHR) {
+        glMaxShaderCompilerThreadsKHR = (glMaxShaderCompilerThreadsKHRF*)getProcAddress("glMaxShaderCompilerThreadsARB");
+    }
+    glGetInteger64v = (glGetInteger64vF*)getProcAddress("glGetInteger64v");
+    glGetTextureImage = (glGetTextureImageF*)getProcAddress("glGetTextureImage");
+    glDeleteFramebuffers = (glDeleteFramebuffersF*)getProcAddress("glDeleteFramebuffers");
+    glDeleteRenderbuffers = (glDeleteRenderbuffersF*)getProcAddress("glDeleteRenderbuffers");
+    glBlitFramebuffer = (glBlitFramebufferF*)getProcAddress("glBlitFramebuffer");
+    glCreateFramebuffers = (glCreateFramebuffersF*)getProcAddress("glCreateFramebuffers");
+    glNamedFramebufferTexture = (glNamedFramebufferTextureF*)getProcAddress("glNamedFramebufferTexture");
+    glNamedFramebufferDrawBuffers = (glNamedFramebufferDrawBuffersF*)getProcAddress("glNamedFramebufferDrawBuffers");
+    glCheckNamedFramebufferStatus = (glCheckNamedFramebufferStatusF*)getProcAddress("glCheckNamedFramebufferStatus");
+    glClearBufferfv = (glClearBufferfvF*)getProcAddress("glClearBufferfv");
+    glClearBufferfi = (glClearBufferfiF*)getProcAddress("glClearBufferfi");
+    glGetNamedBufferSubData = (glGetNamedBufferSubDataF*)getProcAddress("glGetNamedBufferSubData");
+}
+
+#if defined(_WIN32)
+static void* win32_getGlProcAddress(const char* name) {
+    return (void*)wglGetProcAddress(name);
+}
 
 static void gl_initialize() {
     HWND dummyWindow = CreateWindowExW(
@@ -274,36 +611,7 @@ static void gl_initialize() {
     wglChoosePixelFormatARB = (wglChoosePixelFormatARBF*)       wglGetProcAddress("wglChoosePixelFormatARB");
     wglSwapIntervalEXT      = (wglSwapIntervalEXTF*)            wglGetProcAddress("wglSwapIntervalEXT");
 
-    glGetStringi            = (glGetStringiF*)          wglGetProcAddress("glGetStringi");
-    glDebugMessageCallback  = (glDebugMessageCallbackF*)wglGetProcAddress("glDebugMessageCallback");
-    glGenBuffers            = (glGenBuffersF*)          wglGetProcAddress("glGenBuffers");
-    glBindBuffer            = (glBindBufferF*)          wglGetProcAddress("glBindBuffer");
-    glBufferData            = (glBufferDataF*)          wglGetProcAddress("glBufferData");
-    glNamedBufferData = (glNamedBufferDataF*)wglGetProcAddress("glNamedBufferData");
-    glCreateShader = (glCreateShaderF*)wglGetProcAddress("glCreateShader");
-    glShaderSource = (glShaderSourceF*)wglGetProcAddress("glShaderSource");
-    glCompileShader = (glCompileShaderF*)wglGetProcAddress("glCompileShader");
-    glGetShaderiv = (glGetShaderivF*)wglGetProcAddress("glGetShaderiv");
-    glGetShaderInfoLog = (glGetShaderInfoLogF*)wglGetProcAddress("glGetShaderInfoLog");
-    glCreateProgram = (glCreateProgramF*)wglGetProcAddress("glCreateProgram");
-    glAttachShader = (glAttachShaderF*)wglGetProcAddress("glAttachShader");
-    glLinkProgram = (glLinkProgramF*)wglGetProcAddress("glLinkProgram");
-    glGetProgramiv = (glGetProgramivF*)wglGetProcAddress("glGetProgramiv");
-    glGetProgramInfoLog = (glGetProgramInfoLogF*)wglGetProcAddress("glGetProgramInfoLog");
-    glUseProgram = (glUseProgramF*)wglGetProcAddress("glUseProgram");
-    glDeleteShader = (glDeleteShaderF*)wglGetProcAddress("glDeleteShader");
-    glVertexAttribPointer = (glVertexAttribPointerF*)wglGetProcAddress("glVertexAttribPointer");
-    glEnableVertexAttribArray = (glEnableVertexAttribArrayF*)wglGetProcAddress("glEnableVertexAttribArray");
-    glGenVertexArrays = (glGenVertexArraysF*)wglGetProcAddress("glGenVertexArrays");
-    glBindVertexArray = (glBindVertexArrayF*)wglGetProcAddress("glBindVertexArray");
-    glGetUniformLocation = (glGetUniformLocationF*)wglGetProcAddress("glGetUniformLocation");
-    glUniform4f = (glUniform4fF*)wglGetProcAddress("glUniform4f");
-    glUniformMatrix4fv = (glUniformMatrix4fvF*)wglGetProcAddress("glUniformMatrix4fv");
-    glVertexArrayAttribFormat = (glVertexArrayAttribFormatF*)wglGetProcAddress("glVertexArrayAttribFormat");
-    glVertexArrayAttribIFormat = (glVertexArrayAttribIFormatF*)wglGetProcAddress("glVertexArrayAttribIFormat");
-    glVertexArrayAttribBinding = (glVertexArrayAttribBindingF*)wglGetProcAddress("glVertexArrayAttribBinding");
-    glVertexArrayVertexBuffer = (glVertexArrayVertexBufferF*)wglGetProcAddress("glVertexArrayVertexBuffer");
-
+    gl_loadFunctions(&win32_getGlProcAddress);
 
     wglMakeCurrent(dc, nullptr);
     wglDeleteContext(rc);
@@ -327,8 +635,9 @@ static HGLRC gl_createContext(HDC deviceContext) {
 
         // uncomment for multisampled framebuffer, from WGL_ARB_multisample extension
         // https://www.khronos.org/registry/OpenGL/extensions/ARB/ARB_multisample.txt
-        WGL_SAMPLE_BUFFERS_ARB, 1,
-        WGL_SAMPLES_ARB,        4, // 4x MSAA
+        // Not needed for the renderer, shapes antialias their edges in the fragment shader
+        //WGL_SAMPLE_BUFFERS_ARB, 1,
+        //WGL_SAMPLES_ARB,        4, // 4x MSAA
 
         0,
     };
@@ -372,6 +681,7 @@ static HGLRC gl_createContext(HDC deviceContext) {
 
     return glContext;
 }
+#endif // _WIN32
 
 static void gl_printExtensions() {
     GLint numExtensions = 0;
@@ -385,10 +695,24 @@ static void gl_printExtensions() {
     }
 }
 
-static void gl_compileShader(unsigned int shader, const char* source) {
-    glShaderSource(shader, 1, &source, NULL);
-    glCompileShader(shader);
+static bool gl_hasExtension(const char* name) {
+    GLint numExtensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    for (int i = 0; i < numExtensions; ++i) {
+        const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        int c = 0;
+        while (name[c] && name[c] == extension[c]) {
+            ++c;
+        }
+        if (name[c] == extension[c]) {
+            return true;
+        }
+    }
+    return false;
+}
 
+// Reports the info log and breaks if the shader did not compile. Blocks until it is compiled.
+static bool gl_checkCompileStatus(unsigned int shader) {
     int success = 0;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
     if (!success) {
@@ -401,11 +725,11 @@ static void gl_compileShader(unsigned int shader, const char* source) {
         OutputDebugStringW(L"\n");
         DebugBreak();
     }
+    return success != 0;
 }
 
-static void gl_linkProgram(unsigned int program) {
-    glLinkProgram(program);
-
+// Reports the info log and breaks if the program did not link. Blocks until it is linked.
+static bool gl_checkLinkStatus(unsigned int program) {
     int success = 0;
     glGetProgramiv(program, GL_LINK_STATUS, &success);
     if (!success) {
@@ -416,4 +740,48 @@ static void gl_linkProgram(unsigned int program) {
         OutputDebugStringW(L"\n");
         DebugBreak();
     }
-}
\ No newline at end of file
+    return success != 0;
+}
+
+static void gl_compileShader(unsigned int shader, const char* source) {
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    gl_checkCompileStatus(shader);
+}
+
+static void gl_linkProgram(unsigned int program) {
+    glLinkProgram(program);
+    gl_checkLinkStatus(program);
+}
+
+// Compiles both shader stages and links them into a new program
+static unsigned int gl_createProgram(const char* vertexSource, const char* fragmentSource) {
+    unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
+    gl_compileShader(vertexShader, vertexSource);
+
+    unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    gl_compileShader(fragmentShader, fragmentSource);
+
+    unsigned int program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    gl_linkProgram(program);
+
+    // The shaders are only flagged for deletion, they are freed with the program
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    return program;
+}
+
+static unsigned int gl_createComputeProgram(const char* computeSource) {
+    unsigned int computeShader = glCreateShader(GL_COMPUTE_SHADER);
+    gl_compileShader(computeShader, computeSource);
+
+    unsigned int program = glCreateProgram();
+    glAttachShader(program, computeShader);
+    gl_linkProgram(program);
+    glDeleteShader(computeShader);
+
+    return program;
+}
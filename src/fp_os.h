@@ -0,0 +1,123 @@
+/******************************************************************************
+* Operating system abstraction
+*
+* Functions declared here need to be implemented by each platform layer:
+*
+* Windows: fp_win32.h
+* Linux:   fp_linux.h
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_core.h"
+
+/**
+ * High resolution timer.
+ *
+ * getPerformanceCounter() returns a monotonic tick count. The number of ticks
+ * per second is returned by getPerformanceFrequency().
+ */
+u64 getPerformanceCounter();
+u64 getPerformanceFrequency();
+
+/**
+ * Size of a memory page in bytes as used by the page allocator.
+ */
+u64 getPageSize();
+
+/**
+ * Number of logical processors available to the process.
+ */
+u32 getProcessorCount();
+
+/**
+ * Threads
+ *
+ * The Thread struct is owned by the caller and must stay alive until
+ * joinThread() returns, since the platform layer passes it to the new thread.
+ *
+ * Example:
+ * {
+ *     Thread thread = {};
+ *     startThread(&thread, &work, &workData);
+ *     ...
+ *     joinThread(&thread);
+ * }
+ */
+typedef void ThreadFunction(void* parameter);
+
+struct Thread
+{
+    ThreadFunction* function;
+    void* parameter;
+    u64 handle;
+};
+
+void startThread(Thread* thread, ThreadFunction* function, void* parameter);
+void joinThread(Thread* thread);
+
+/**
+ * Identifies the calling thread, unique among the running threads.
+ * Cheap enough to be called for every profiler zone.
+ */
+u64 getCurrentThreadId();
+
+/**
+ * Semaphores
+ *
+ * waitSemaphore() blocks until the count is greater than zero and then
+ * decrements it. signalSemaphore() increments the count and wakes up
+ * waiting threads.
+ */
+struct Semaphore
+{
+    u64 handle;
+};
+
+void createSemaphore(Semaphore* semaphore, u32 initialCount);
+void destroySemaphore(Semaphore* semaphore);
+void signalSemaphore(Semaphore* semaphore, u32 count);
+void waitSemaphore(Semaphore* semaphore);
+
+/**
+ * Atomically adds value to target and returns the new value.
+ * Acts as a full memory barrier.
+ */
+i32 atomicAdd(volatile i32* target, i32 value);
+
+/**
+ * Files for sequential writing
+ *
+ * openFileForWriting() creates the file or truncates an existing one.
+ * writeFile() appends size bytes and returns false if not all of them
+ * could be written.
+ */
+struct FileWriter
+{
+    u64 handle;
+};
+
+bool openFileForWriting(FileWriter* file, wchar_t const* filename);
+bool writeFile(FileWriter* file, void const* data, u64 size);
+void closeFile(FileWriter* file);
+
+/**
+ * Files for reading
+ *
+ * readEntireFile() reads the whole file into memory of the platform layer,
+ * which is released with freeReadFileResult(). On failure, error is not 0
+ * and errorText names the failed call.
+ */
+struct ReadFileResult
+{
+    u8* data;
+    i64 size;
+    i64 error;
+    wchar_t const* errorText;
+};
+
+ReadFileResult readEntireFile(wchar_t const* filename);
+void freeReadFileResult(ReadFileResult* result);
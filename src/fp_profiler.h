@@ -0,0 +1,615 @@
+/******************************************************************************
+* Frame profiler
+*
+* Measures where the time of a frame goes, on the CPU and on the GPU:
+*
+* - CPU zones read the time stamp counter when a scope is entered and left.
+*   Every thread appends its zones to a buffer of its own, so recording
+*   takes no locks. A thread gets its buffer with its first zone.
+* - GPU zones write GL_TIMESTAMP queries before and after their commands.
+*   The queries of a frame are read back PROFILE_GPU_FRAMES frames later,
+*   when the GPU is long done with them, so reading never stalls.
+*
+* endFrame() adds the zones of the frame to rolling statistics over the last
+* PROFILE_HISTORY_FRAMES frames. Between startTrace() and stopTrace(), the
+* zones are also written to a file in the Chrome trace_event format, which
+* chrome://tracing and ui.perfetto.dev can open.
+*
+* Zones are only recorded while g_profiler is set. Zones of other threads
+* must be closed before endFrame(), e.g. by recording them inside jobs.
+*
+* Example:
+* {
+*     Profiler profiler = {};
+*     profiler.create(memory, size);
+*     g_profiler = &profiler;
+*     while (running) {
+*         profiler.beginFrame();
+*         {
+*             PROFILE_ZONE("update");
+*             ...
+*         }
+*         {
+*             PROFILE_GPU_ZONE("draw");
+*             glDrawArrays(...);
+*         }
+*         profiler.endFrame();
+*     }
+* }
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_core.h"
+#include "fp_frame_pacing.h"
+#include "fp_opengl.h"
+#include "fp_os.h"
+
+#if defined(_WIN32)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+static const int MAX_PROFILE_THREADS = 32;
+// Power of two, zones are found by hashing their name
+static const int MAX_PROFILE_ZONES = 128;
+static const int PROFILE_HISTORY_FRAMES = 64;
+static const int MAX_GPU_ZONES_PER_FRAME = 64;
+// The frame pacer keeps fewer frames in flight, so their queries are available when read
+static const int PROFILE_GPU_FRAMES = MAX_FRAMES_IN_FLIGHT + 1;
+static const u64 PROFILE_TRACE_STAGING_SIZE = 64 * KB;
+// Thread id of the GPU zones in the trace
+static const int PROFILE_GPU_TRACE_THREAD = 1000;
+static const u32 NO_GPU_ZONE = 0xFFFFFFFF;
+
+// A closed CPU zone, in time stamp counter ticks
+struct ProfileEvent {
+    const char* name;
+    u64 begin;
+    u64 end;
+};
+
+// Only written by its own thread, filled up to a cache line against false sharing
+struct ProfileThread {
+    u64 threadId;
+    ProfileEvent* events;
+    u32 count;
+    u32 dropped;
+    u8 padding[40];
+};
+
+struct GpuProfileFrame {
+    // A timestamp before and after each zone
+    unsigned int queries[2 * MAX_GPU_ZONES_PER_FRAME];
+    const char* names[MAX_GPU_ZONES_PER_FRAME];
+    u32 zoneCount;
+    // Added to GPU timestamps to get profiler nanoseconds
+    double gpuToProfileNs;
+};
+
+struct ProfileZone {
+    const char* name;
+    bool gpu;
+    // Summed over the calls of the current frame
+    double frameMs;
+    u32 frameCalls;
+    u32 lastCalls;
+    // Milliseconds per frame, indexed by frame modulo PROFILE_HISTORY_FRAMES
+    double history[PROFILE_HISTORY_FRAMES];
+    u64 frames;
+};
+
+struct ProfileZoneStats {
+    const char* name;
+    bool gpu;
+    // Calls in the last frame
+    u32 calls;
+    // Milliseconds per frame over the history, all calls of a frame are summed
+    double lastMs;
+    double averageMs;
+    double minMs;
+    double maxMs;
+};
+
+struct ProfileCounters {
+    // CPU zones that did not fit into the buffer of their thread
+    u64 droppedEvents;
+    // GPU zones beyond MAX_GPU_ZONES_PER_FRAME
+    u64 droppedGpuZones;
+    // Frames whose queries were not available when read back
+    u64 droppedGpuFrames;
+};
+
+static u64 hashZoneName(const char* name, bool gpu) {
+    // FNV-1a
+    u64 hash = 0xCBF29CE484222325ULL ^ (gpu ? 1 : 0);
+    for (const char* c = name; *c; ++c) {
+        hash = (hash ^ (u8)*c) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static bool equalZoneNames(const char* a, const char* b) {
+    while (*a && *a == *b) {
+        ++a;
+        ++b;
+    }
+    return *a == *b;
+}
+
+static char* appendText(char* out, const char* text) {
+    while (*text) {
+        *out++ = *text++;
+    }
+    return out;
+}
+
+static char* appendUnsigned(char* out, u64 value) {
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (count > 0) {
+        *out++ = digits[--count];
+    }
+    return out;
+}
+
+// Timestamps in the trace format are microseconds, written with three decimals
+static char* appendMicroseconds(char* out, u64 nanoseconds) {
+    out = appendUnsigned(out, nanoseconds / 1000);
+    u64 fraction = nanoseconds % 1000;
+    *out++ = '.';
+    *out++ = (char)('0' + fraction / 100);
+    *out++ = (char)('0' + fraction / 10 % 10);
+    *out++ = (char)('0' + fraction % 10);
+    return out;
+}
+
+// Zone names longer than this are cut off in the trace
+static const int MAX_TRACE_NAME_LENGTH = 96;
+
+struct Profiler {
+    ProfileThread threads[MAX_PROFILE_THREADS];
+    volatile i32 threadCount;
+    ProfileEvent* eventMemory;
+    u32 eventsPerThread;
+
+    GpuProfileFrame gpuFrames[PROFILE_GPU_FRAMES];
+    bool gpuTimestamps;
+
+    ProfileZone zones[MAX_PROFILE_ZONES];
+    int zoneCount;
+
+    // The time stamp counter is converted with its rate measured against the performance counter
+    u64 startTsc;
+    u64 startCounter;
+    double nsPerTsc;
+
+    u64 frameIndex;
+    u64 frameBeginTsc;
+    ProfileCounters counters;
+
+    FileWriter traceFile;
+    bool tracing;
+    bool firstTraceEvent;
+    char* traceStaging;
+    u64 traceStagingUsed;
+
+    /**
+     * The memory holds the event buffers of all threads and the staging
+     * memory of the trace. It has to stay valid until the profiler is destroyed.
+     */
+    void create(void* memory, u64 size) {
+        for (int i = 0; i < MAX_PROFILE_THREADS; ++i) {
+            threads[i] = {};
+        }
+        threadCount = 0;
+        for (int i = 0; i < MAX_PROFILE_ZONES; ++i) {
+            zones[i] = {};
+        }
+        zoneCount = 0;
+        frameIndex = 0;
+        counters = {};
+        tracing = false;
+
+        traceStaging = (char*)memory;
+        traceStagingUsed = 0;
+        u64 eventBytes = size > PROFILE_TRACE_STAGING_SIZE ? size - PROFILE_TRACE_STAGING_SIZE : 0;
+        eventMemory = (ProfileEvent*)((u8*)memory + PROFILE_TRACE_STAGING_SIZE);
+        eventsPerThread = (u32)(eventBytes / sizeof(ProfileEvent) / MAX_PROFILE_THREADS);
+
+        // A first estimate of the counter rate over one millisecond, endFrame() refines it
+        nsPerTsc = 1.0;
+        startTsc = __rdtsc();
+        startCounter = getPerformanceCounter();
+        u64 calibrationTicks = getPerformanceFrequency() / 1000;
+        while (getPerformanceCounter() - startCounter < calibrationTicks) {
+        }
+        calibrate();
+
+        // Timer queries need a GL context, without one only CPU zones are recorded
+        gpuTimestamps = glGenQueries != nullptr && glQueryCounter != nullptr;
+        if (gpuTimestamps) {
+            for (int i = 0; i < PROFILE_GPU_FRAMES; ++i) {
+                gpuFrames[i].zoneCount = 0;
+                glGenQueries(2 * MAX_GPU_ZONES_PER_FRAME, gpuFrames[i].queries);
+            }
+        }
+    }
+
+    void destroy() {
+        stopTrace();
+        if (gpuTimestamps) {
+            for (int i = 0; i < PROFILE_GPU_FRAMES; ++i) {
+                glDeleteQueries(2 * MAX_GPU_ZONES_PER_FRAME, gpuFrames[i].queries);
+            }
+        }
+    }
+
+    void calibrate() {
+        u64 counter = getPerformanceCounter();
+        u64 tsc = __rdtsc();
+        if (counter > startCounter && tsc > startTsc) {
+            double elapsedNs = (double)(counter - startCounter) * 1e9 / (double)getPerformanceFrequency();
+            nsPerTsc = elapsedNs / (double)(tsc - startTsc);
+        }
+    }
+
+    // Nanoseconds since create()
+    double toNanoseconds(u64 tsc) {
+        return (double)(i64)(tsc - startTsc) * nsPerTsc;
+    }
+
+    // Finds the buffer of the calling thread, threads are added on their first zone
+    ProfileThread* getThread() {
+        u64 threadId = getCurrentThreadId();
+        i32 count = threadCount < MAX_PROFILE_THREADS ? threadCount : MAX_PROFILE_THREADS;
+        for (i32 i = 0; i < count; ++i) {
+            if (threads[i].threadId == threadId) {
+                return &threads[i];
+            }
+        }
+        if (count == MAX_PROFILE_THREADS) {
+            return nullptr;
+        }
+
+        // Other threads only compare the id, so it is written last
+        i32 slot = atomicAdd(&threadCount, 1) - 1;
+        if (slot >= MAX_PROFILE_THREADS) {
+            return nullptr;
+        }
+        ProfileThread* thread = &threads[slot];
+        thread->events = eventMemory + (u64)slot * eventsPerThread;
+        thread->count = 0;
+        thread->dropped = 0;
+        thread->threadId = threadId;
+        return thread;
+    }
+
+    void record(const char* name, u64 begin, u64 end) {
+        ProfileThread* thread = getThread();
+        if (!thread) {
+            return;
+        }
+        if (thread->count == eventsPerThread) {
+            thread->dropped += 1;
+            return;
+        }
+        ProfileEvent* event = &thread->events[thread->count++];
+        event->name = name;
+        event->begin = begin;
+        event->end = end;
+    }
+
+    // Returns the zone to pass to endGpuZone(), must be called on the thread of the GL context
+    u32 beginGpuZone(const char* name) {
+        if (!gpuTimestamps) {
+            return NO_GPU_ZONE;
+        }
+        GpuProfileFrame* frame = &gpuFrames[frameIndex % PROFILE_GPU_FRAMES];
+        if (frame->zoneCount == MAX_GPU_ZONES_PER_FRAME) {
+            counters.droppedGpuZones += 1;
+            return NO_GPU_ZONE;
+        }
+        u32 zone = frame->zoneCount++;
+        frame->names[zone] = name;
+        glQueryCounter(frame->queries[2 * zone], GL_TIMESTAMP);
+        return zone;
+    }
+
+    void endGpuZone(u32 zone) {
+        if (zone != NO_GPU_ZONE) {
+            GpuProfileFrame* frame = &gpuFrames[frameIndex % PROFILE_GPU_FRAMES];
+            glQueryCounter(frame->queries[2 * zone + 1], GL_TIMESTAMP);
+        }
+    }
+
+    ProfileZone* findZone(const char* name, bool gpu) {
+        u32 mask = MAX_PROFILE_ZONES - 1;
+        u32 index = (u32)hashZoneName(name, gpu) & mask;
+        for (int probe = 0; probe < MAX_PROFILE_ZONES; ++probe) {
+            ProfileZone* zone = &zones[index];
+            if (!zone->name) {
+                // Zones are added with empty history, so their statistics start with their first frame
+                zone->name = name;
+                zone->gpu = gpu;
+                zoneCount += 1;
+                return zone;
+            }
+            if (zone->gpu == gpu && equalZoneNames(zone->name, name)) {
+                return zone;
+            }
+            index = (index + 1) & mask;
+        }
+        return nullptr;
+    }
+
+    void addZoneTime(const char* name, bool gpu, double nanoseconds) {
+        ProfileZone* zone = findZone(name, gpu);
+        if (zone) {
+            zone->frameMs += nanoseconds * 1e-6;
+            zone->frameCalls += 1;
+        }
+    }
+
+    /**
+     * Reads the GPU zones of the frame that used this slot PROFILE_GPU_FRAMES
+     * frames ago. Has to be called before any GPU zone of the new frame.
+     */
+    void beginFrame() {
+        frameBeginTsc = __rdtsc();
+        if (!gpuTimestamps) {
+            return;
+        }
+
+        GpuProfileFrame* frame = &gpuFrames[frameIndex % PROFILE_GPU_FRAMES];
+        if (frame->zoneCount > 0) {
+            readGpuFrame(frame);
+        }
+        frame->zoneCount = 0;
+
+        GLint64 gpuNow = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        frame->gpuToProfileNs = toNanoseconds(__rdtsc()) - (double)gpuNow;
+    }
+
+    void readGpuFrame(GpuProfileFrame* frame) {
+        // Queries complete in order, so the last one tells about all of them
+        int available = 0;
+        glGetQueryObjectiv(frame->queries[2 * frame->zoneCount - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            counters.droppedGpuFrames += 1;
+            return;
+        }
+
+        for (u32 i = 0; i < frame->zoneCount; ++i) {
+            GLuint64 begin = 0;
+            GLuint64 end = 0;
+            glGetQueryObjectui64v(frame->queries[2 * i], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(frame->queries[2 * i + 1], GL_QUERY_RESULT, &end);
+            double duration = end > begin ? (double)(end - begin) : 0.0;
+            addZoneTime(frame->names[i], true, duration);
+            if (tracing) {
+                double beginNs = (double)begin + frame->gpuToProfileNs;
+                writeTraceEvent(frame->names[i], PROFILE_GPU_TRACE_THREAD, beginNs, duration);
+            }
+        }
+    }
+
+    /**
+     * Collects the CPU zones of all threads. No other thread may record
+     * zones at the same time, e.g. the job system has to be idle.
+     */
+    void endFrame() {
+        record("frame", frameBeginTsc, __rdtsc());
+        calibrate();
+
+        i32 count = threadCount < MAX_PROFILE_THREADS ? threadCount : MAX_PROFILE_THREADS;
+        for (i32 t = 0; t < count; ++t) {
+            ProfileThread* thread = &threads[t];
+            for (u32 i = 0; i < thread->count; ++i) {
+                ProfileEvent* event = &thread->events[i];
+                double beginNs = toNanoseconds(event->begin);
+                double duration = toNanoseconds(event->end) - beginNs;
+                addZoneTime(event->name, false, duration);
+                if (tracing) {
+                    writeTraceEvent(event->name, t, beginNs, duration);
+                }
+            }
+            counters.droppedEvents += thread->dropped;
+            thread->count = 0;
+            thread->dropped = 0;
+        }
+
+        for (int i = 0; i < MAX_PROFILE_ZONES; ++i) {
+            ProfileZone* zone = &zones[i];
+            if (zone->name) {
+                zone->history[zone->frames % PROFILE_HISTORY_FRAMES] = zone->frameMs;
+                zone->frames += 1;
+                zone->lastCalls = zone->frameCalls;
+                zone->frameMs = 0.0;
+                zone->frameCalls = 0;
+            }
+        }
+
+        frameIndex += 1;
+    }
+
+    void computeStats(ProfileZone* zone, ProfileZoneStats* stats) {
+        *stats = {};
+        stats->name = zone->name;
+        stats->gpu = zone->gpu;
+        stats->calls = zone->lastCalls;
+        if (zone->frames == 0) {
+            return;
+        }
+
+        u64 count = zone->frames < PROFILE_HISTORY_FRAMES ? zone->frames : PROFILE_HISTORY_FRAMES;
+        stats->lastMs = zone->history[(zone->frames - 1) % PROFILE_HISTORY_FRAMES];
+        stats->minMs = zone->history[0];
+        stats->maxMs = zone->history[0];
+        double sum = 0.0;
+        for (u64 i = 0; i < count; ++i) {
+            double ms = zone->history[i];
+            sum += ms;
+            stats->minMs = ms < stats->minMs ? ms : stats->minMs;
+            stats->maxMs = ms > stats->maxMs ? ms : stats->maxMs;
+        }
+        stats->averageMs = sum / (double)count;
+    }
+
+    // Writes the statistics of up to capacity zones and returns their number
+    int getZoneStats(ProfileZoneStats* stats, int capacity) {
+        int count = 0;
+        for (int i = 0; i < MAX_PROFILE_ZONES && count < capacity; ++i) {
+            if (zones[i].name && zones[i].frames > 0) {
+                computeStats(&zones[i], &stats[count++]);
+            }
+        }
+        return count;
+    }
+
+    bool findZoneStats(const char* name, bool gpu, ProfileZoneStats* stats) {
+        u32 mask = MAX_PROFILE_ZONES - 1;
+        u32 index = (u32)hashZoneName(name, gpu) & mask;
+        for (int probe = 0; probe < MAX_PROFILE_ZONES && zones[index].name; ++probe) {
+            ProfileZone* zone = &zones[index];
+            if (zone->gpu == gpu && equalZoneNames(zone->name, name) && zone->frames > 0) {
+                computeStats(zone, stats);
+                return true;
+            }
+            index = (index + 1) & mask;
+        }
+        return false;
+    }
+
+    /**
+     * Starts writing all following zones to a trace file. GPU zones are
+     * written when they are read back, the last frames before stopTrace()
+     * are missing them.
+     */
+    bool startTrace(wchar_t const* filename) {
+        stopTrace();
+        if (!openFileForWriting(&traceFile, filename)) {
+            OutputDebugStringW(L"Could not open the trace file\n");
+            return false;
+        }
+        tracing = true;
+        firstTraceEvent = true;
+        traceStagingUsed = 0;
+        appendTrace("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        return true;
+    }
+
+    void stopTrace() {
+        if (!tracing) {
+            return;
+        }
+
+        // Names the threads in the viewer, they are numbered by their first zone
+        i32 count = threadCount < MAX_PROFILE_THREADS ? threadCount : MAX_PROFILE_THREADS;
+        for (i32 t = 0; t <= count; ++t) {
+            int traceThread = t < count ? t : PROFILE_GPU_TRACE_THREAD;
+            char event[128];
+            char* out = appendText(event, firstTraceEvent ? "" : ",\n");
+            out = appendText(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":");
+            out = appendUnsigned(out, traceThread);
+            out = appendText(out, ",\"args\":{\"name\":\"");
+            if (t < count) {
+                out = appendText(out, "Thread ");
+                out = appendUnsigned(out, t);
+            }
+            else {
+                out = appendText(out, "GPU");
+            }
+            out = appendText(out, "\"}}");
+            *out = '\0';
+            appendTrace(event);
+            firstTraceEvent = false;
+        }
+
+        appendTrace("\n]}\n");
+        flushTrace();
+        closeFile(&traceFile);
+        tracing = false;
+    }
+
+    void flushTrace() {
+        if (traceStagingUsed > 0) {
+            writeFile(&traceFile, traceStaging, traceStagingUsed);
+            traceStagingUsed = 0;
+        }
+    }
+
+    void appendTrace(const char* text) {
+        for (const char* c = text; *c; ++c) {
+            if (traceStagingUsed == PROFILE_TRACE_STAGING_SIZE) {
+                flushTrace();
+            }
+            traceStaging[traceStagingUsed++] = *c;
+        }
+    }
+
+    // A complete event, "ph":"X", with its begin and duration
+    void writeTraceEvent(const char* name, int traceThread, double beginNs, double durationNs) {
+        char event[MAX_TRACE_NAME_LENGTH + 160];
+        char* out = appendText(event, firstTraceEvent ? "{\"name\":\"" : ",\n{\"name\":\"");
+        for (int i = 0; name[i] && i < MAX_TRACE_NAME_LENGTH; ++i) {
+            // Quotes and backslashes would end the JSON string
+            char c = name[i];
+            *out++ = (c == '"' || c == '\\') ? '\'' : c;
+        }
+        out = appendText(out, "\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+        out = appendUnsigned(out, traceThread);
+        out = appendText(out, ",\"ts\":");
+        out = appendMicroseconds(out, beginNs > 0.0 ? (u64)beginNs : 0);
+        out = appendText(out, ",\"dur\":");
+        out = appendMicroseconds(out, durationNs > 0.0 ? (u64)durationNs : 0);
+        out = appendText(out, "}");
+        *out = '\0';
+        appendTrace(event);
+        firstTraceEvent = false;
+    }
+};
+
+// Zones are recorded into this profiler, none while it is null
+static Profiler* g_profiler = nullptr;
+
+struct ProfileScope {
+    const char* name;
+    u64 begin;
+
+    ProfileScope(const char* zoneName) : name(zoneName), begin(__rdtsc()) {}
+
+    ~ProfileScope() {
+        if (g_profiler) {
+            g_profiler->record(name, begin, __rdtsc());
+        }
+    }
+};
+
+struct GpuProfileScope {
+    u32 zone;
+
+    GpuProfileScope(const char* zoneName) {
+        zone = g_profiler ? g_profiler->beginGpuZone(zoneName) : NO_GPU_ZONE;
+    }
+
+    ~GpuProfileScope() {
+        if (g_profiler) {
+            g_profiler->endGpuZone(zone);
+        }
+    }
+};
+
+// Measures the CPU time until the end of the enclosing scope, the name has to outlive the frame
+#define PROFILE_ZONE(name) ProfileScope CONCAT_COUNTER(profileZone)(name)
+// Measures the GPU time of the commands until the end of the enclosing scope
+#define PROFILE_GPU_ZONE(name) GpuProfileScope CONCAT_COUNTER(gpuProfileZone)(name)
@@ -0,0 +1,796 @@
+/******************************************************************************
+* Render commands
+*
+* Commands are recorded into a RenderCommandBuffer and consumed by a renderer
+* backend. This file does not depend on a graphics API.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_allocator.h"
+
+struct Color {
+    float color[4];
+};
+
+static const Color RED = { 1.0f, 0.0f, 0.0f, 1.0f };
+static const Color GREEN = { 0.0f, 1.0f, 0.0f, 1.0f };
+static const Color BLUE = { 0.0f, 0.0f, 1.0f, 1.0f };
+static const Color WHITE = { 1.0f, 1.0f, 1.0f, 1.0f };
+static const Color BLACK = { 0.0f, 0.0f, 0.0f, 1.0f };
+
+// Packs a color to RGBA8 with red in the lowest byte
+static u32 packColor(Color color) {
+    u32 result = 0;
+    for (int i = 0; i < 4; ++i) {
+        float channel = color.color[i];
+        channel = channel < 0.0f ? 0.0f : (channel > 1.0f ? 1.0f : channel);
+        result |= (u32)(channel * 255.0f + 0.5f) << (8 * i);
+    }
+    return result;
+}
+
+enum RenderCommandType {
+	Render_Rectangle,
+	Render_TexturedRect,
+	Render_Text,
+	Render_Shape,
+	Render_Mesh,
+};
+
+struct RenderCommand {
+	RenderCommandType type;
+	// Commands of a lower layer are drawn first, see fp_command_sort.h
+	u8 layer;
+	// Set by RenderCommandBuffer::push(): index + 1 of the scissor rect in its buffer, 0 draws without scissor
+	u8 scissor;
+};
+
+struct RenderCommandRectangle : RenderCommand {
+	float x;
+	float y;
+	float width;
+	float height;
+
+	Color color;
+	// Set from color by RenderCommandBuffer::push()
+	u32 packedColor;
+};
+
+// Packs texture coordinates in [0, 1] to 16 bit each, u in the lower half
+static u32 packTexCoord(float u, float v) {
+    u = u < 0.0f ? 0.0f : (u > 1.0f ? 1.0f : u);
+    v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+    return (u32)(u * 65535.0f + 0.5f) | ((u32)(v * 65535.0f + 0.5f) << 16);
+}
+
+/**
+ * Rectangle which multiplies its color with a region of the texture atlas,
+ * see fp_texture_atlas.h. Untextured rectangles sample the white texels at
+ * texture coordinate 0, so both kinds are drawn with the same state.
+ */
+struct RenderCommandTexturedRect : RenderCommandRectangle {
+    // Packed texture coordinates of (x, y) and (x + width, y + height)
+    u32 uv0;
+    u32 uv1;
+    // No texel in the region is translucent, so the rectangle does not need blending if its color is opaque
+    bool opaqueTexture;
+};
+
+union FloatBits {
+    float f;
+    u32 u;
+};
+
+enum ShapeKind {
+    Shape_None,
+    Shape_RoundedRect,
+    Shape_Line,
+};
+
+// Radius and width are stored with 14 bits each in 1/16 units
+static const float SHAPE_UNITS = 16.0f;
+static const float MAX_SHAPE_SIZE = 0x3FFF / SHAPE_UNITS;
+
+// Lines are drawn into a quad which extends this far beyond their ends, for the antialiased edge
+static const float LINE_ANTIALIAS_MARGIN = 1.0f;
+
+/**
+ * Shape parameters evaluated by the fragment shader: the kind in bits 0-1, a
+ * line from the top left to the bottom right of its quad in bit 2, the corner
+ * radius in bits 4-17 and the border or line width in bits 18-31.
+ */
+static u32 packShape(ShapeKind kind, bool flipped, float radius, float width) {
+    radius = radius < 0.0f ? 0.0f : (radius > MAX_SHAPE_SIZE ? MAX_SHAPE_SIZE : radius);
+    width = width < 0.0f ? 0.0f : (width > MAX_SHAPE_SIZE ? MAX_SHAPE_SIZE : width);
+    return (u32)kind | (flipped ? 4u : 0u) | ((u32)(radius * SHAPE_UNITS + 0.5f) << 4) | ((u32)(width * SHAPE_UNITS + 0.5f) << 18);
+}
+
+static ShapeKind shapeKind(u32 shape) {
+    return (ShapeKind)(shape & 3);
+}
+
+static float shapeRadius(u32 shape) {
+    return ((shape >> 4) & 0x3FFF) / SHAPE_UNITS;
+}
+
+static float shapeWidth(u32 shape) {
+    return (shape >> 18) / SHAPE_UNITS;
+}
+
+/**
+ * Rectangle drawn as a signed distance shape with antialiased edges. The
+ * rectangle is the quad the shape is drawn into, shape is set by
+ * RenderCommandBuffer::push() from a RenderCommandRoundedRect or a
+ * RenderCommandLine. Shapes share the instances and batches of all other
+ * rectangles and are always blended.
+ */
+struct RenderCommandShape : RenderCommandRectangle {
+    // See packShape()
+    u32 shape;
+};
+
+// Filled rounded rectangle, or only its border if borderWidth is above 0
+struct RenderCommandRoundedRect : RenderCommandRectangle {
+    // Limited to half the shorter side
+    float radius;
+    // Drawn inside the rectangle
+    float borderWidth;
+};
+
+// Line from (x0, y0) to (x1, y1) with round caps
+struct RenderCommandLine : RenderCommand {
+    float x0;
+    float y0;
+    float x1;
+    float y1;
+    float width;
+
+    Color color;
+};
+
+static RenderCommandShape makeShape(RenderCommandRoundedRect* rect) {
+    RenderCommandShape shape = {};
+    *(RenderCommandRectangle*)&shape = *rect;
+    shape.type = Render_Shape;
+    shape.shape = packShape(Shape_RoundedRect, false, rect->radius, rect->borderWidth);
+    return shape;
+}
+
+// The quad is the bounding box of the line, extended by half the width and the antialiasing margin
+static RenderCommandShape makeShape(RenderCommandLine* line) {
+    RenderCommandShape shape = {};
+    shape.type = Render_Shape;
+    shape.layer = line->layer;
+    shape.color = line->color;
+    float dx = line->x1 - line->x0;
+    float dy = line->y1 - line->y0;
+    shape.shape = packShape(Shape_Line, (dx < 0.0f) != (dy < 0.0f), 0.0f, line->width);
+
+    // The shader derives the end points from the quad with the same margin
+    float margin = 0.5f * shapeWidth(shape.shape) + LINE_ANTIALIAS_MARGIN;
+    shape.x = (dx < 0.0f ? line->x1 : line->x0) - margin;
+    shape.y = (dy < 0.0f ? line->y1 : line->y0) - margin;
+    shape.width = (dx < 0.0f ? -dx : dx) + 2.0f * margin;
+    shape.height = (dy < 0.0f ? -dy : dy) + 2.0f * margin;
+    return shape;
+}
+
+// Rectangles with an alpha below 1, a translucent texture or antialiased shape edges are blended
+static bool isTranslucentRect(RenderCommandRectangle* rect) {
+    if (rect->type == Render_Shape) {
+        return true;
+    }
+    if (rect->type == Render_TexturedRect && !((RenderCommandTexturedRect*)rect)->opaqueTexture) {
+        return true;
+    }
+    return (rect->packedColor >> 24) != 0xFF;
+}
+
+// All rectangle commands start with the fields of RenderCommandRectangle
+static bool isRectangleCommand(RenderCommand* command) {
+    return command->type == Render_Rectangle || command->type == Render_TexturedRect || command->type == Render_Shape;
+}
+
+/**
+ * Per rectangle parameters of the instance and vertex formats. Texture
+ * coordinates of 0 select the white texels of the atlas. Shapes are never
+ * textured, they pass the size of their quad instead.
+ */
+static void getRectParams(RenderCommandRectangle* rect, u32* uv0, u32* uv1, u32* shape) {
+    if (rect->type == Render_TexturedRect) {
+        *uv0 = ((RenderCommandTexturedRect*)rect)->uv0;
+        *uv1 = ((RenderCommandTexturedRect*)rect)->uv1;
+        *shape = 0;
+    }
+    else if (rect->type == Render_Shape) {
+        FloatBits width = { rect->width };
+        FloatBits height = { rect->height };
+        *uv0 = width.u;
+        *uv1 = height.u;
+        *shape = ((RenderCommandShape*)rect)->shape;
+    }
+    else {
+        *uv0 = 0;
+        *uv1 = 0;
+        *shape = 0;
+    }
+}
+
+// Axis aligned area in the units of the projection, see RenderCommandBuffer::pushClip()
+struct ClipRect {
+    float minX;
+    float minY;
+    float maxX;
+    float maxY;
+};
+
+// Clip rect of commands recorded outside of pushClip()
+static const ClipRect NO_CLIP = { -3.0e38f, -3.0e38f, 3.0e38f, 3.0e38f };
+
+enum ClipOverlap {
+    Clip_Inside,
+    Clip_Crossing,
+    Clip_Outside,
+};
+
+static ClipOverlap clipOverlap(RenderCommandRectangle* rect, ClipRect clip) {
+    float x0 = rect->x;
+    float x1 = rect->x + rect->width;
+    float y0 = rect->y;
+    float y1 = rect->y + rect->height;
+    float minX = x0 < x1 ? x0 : x1;
+    float maxX = x0 < x1 ? x1 : x0;
+    float minY = y0 < y1 ? y0 : y1;
+    float maxY = y0 < y1 ? y1 : y0;
+
+    if (maxX <= clip.minX || minX >= clip.maxX || maxY <= clip.minY || minY >= clip.maxY) {
+        return Clip_Outside;
+    }
+    if (minX >= clip.minX && maxX <= clip.maxX && minY >= clip.minY && maxY <= clip.maxY) {
+        return Clip_Inside;
+    }
+    return Clip_Crossing;
+}
+
+/**
+ * Trims one axis of a rectangle to [minimum, maximum]. t0 and t1 tell where
+ * the new edges lie between the old ones, from 0 to 1. An axis that is
+ * already inside stays exactly as it was.
+ */
+static void trimAxis(float* position, float* size, float minimum, float maximum, float* t0, float* t1) {
+    *t0 = 0.0f;
+    *t1 = 1.0f;
+    float start = *position;
+    float end = *position + *size;
+    float low = start < end ? start : end;
+    float high = start < end ? end : start;
+    if (low >= minimum && high <= maximum) {
+        return;
+    }
+
+    low = low > minimum ? low : minimum;
+    high = high < maximum ? high : maximum;
+    float newStart = *size < 0.0f ? high : low;
+    float newEnd = *size < 0.0f ? low : high;
+    *t0 = (newStart - start) / *size;
+    *t1 = (newEnd - start) / *size;
+    *position = newStart;
+    *size = newEnd - newStart;
+}
+
+static u32 lerpTexCoord(u32 a, u32 b, float t) {
+    return (u32)((float)a + ((float)b - (float)a) * t + 0.5f);
+}
+
+/**
+ * Trims a plain or textured rectangle to the part inside the clip rect. The
+ * texture coordinates are trimmed by the same fraction, so the remaining
+ * texels stay where they were. Shapes cannot be trimmed, their distance
+ * function depends on the size of the whole quad.
+ */
+static void trimRect(RenderCommandRectangle* rect, ClipRect clip) {
+    float tx0, tx1, ty0, ty1;
+    trimAxis(&rect->x, &rect->width, clip.minX, clip.maxX, &tx0, &tx1);
+    trimAxis(&rect->y, &rect->height, clip.minY, clip.maxY, &ty0, &ty1);
+
+    if (rect->type == Render_TexturedRect) {
+        RenderCommandTexturedRect* textured = (RenderCommandTexturedRect*)rect;
+        u32 u0 = textured->uv0 & 0xFFFF;
+        u32 v0 = textured->uv0 >> 16;
+        u32 u1 = textured->uv1 & 0xFFFF;
+        u32 v1 = textured->uv1 >> 16;
+        textured->uv0 = lerpTexCoord(u0, u1, tx0) | (lerpTexCoord(v0, v1, ty0) << 16);
+        textured->uv1 = lerpTexCoord(u0, u1, tx1) | (lerpTexCoord(v0, v1, ty1) << 16);
+    }
+}
+
+// Rectangles affected by clip rects since the last reset
+struct ClipStats {
+    // Trimmed on the CPU, they stay in the batches of unclipped rectangles
+    u32 trimmed;
+    // Entirely outside of their clip rect, they are not drawn
+    u32 culled;
+    // Drawn with the hardware scissor, which needs a batch of their own
+    u32 scissored;
+    // Needed a scissor rect after all of them were taken, trimmed instead when crossing the clip rect
+    u32 scissorOverflow;
+};
+
+/**
+ * UTF-8 text drawn with the glyphs of a glyph cache, see fp_glyph_cache.h.
+ * The command is followed by the text and one glyph slot per byte of text.
+ * layoutTextCommands() fills the slots with textured rectangles before the
+ * commands are sorted, so text is drawn in the same batches as rectangles.
+ */
+struct RenderCommandText : RenderCommand {
+    // Start of the baseline of the first line
+    float x;
+    float y;
+    // Distance from the lowest descender to the highest ascender in pixels
+    float size;
+
+    Color color;
+    // Set from color by RenderCommandBuffer::push()
+    u32 packedColor;
+
+    // Bytes of text, without a terminating zero
+    u32 length;
+    // Laid out glyphs, these are counted in RenderCommandBuffer::rectCount
+    u32 glyphCount;
+    // Clip rect at the time of push(), the glyphs are trimmed to it when they are laid out
+    ClipRect clip;
+
+    char* text() {
+        return (char*)(this + 1);
+    }
+
+    RenderCommandTexturedRect* glyphs() {
+        return (RenderCommandTexturedRect*)((u8*)(this + 1) + ((length + 7) & ~7u));
+    }
+};
+
+// Mesh uploaded to a MeshStore, see fp_mesh.h. Index 0 is never used, so a zero initialized handle is invalid.
+struct MeshHandle {
+    u32 index;
+};
+
+/**
+ * Static mesh drawn with depth testing before all rectangles. Only the
+ * handle and the transform are recorded, the vertices stay on the GPU.
+ */
+struct RenderCommandMesh : RenderCommand {
+    MeshHandle mesh;
+    // Row-major transform from the mesh to world space, see Renderer::setViewProjection()
+    float transform[16];
+
+    Color color;
+};
+
+static u64 textCommandSize(u32 length) {
+    return sizeof(RenderCommandText) + ((length + 7) & ~7u) + (u64)length * sizeof(RenderCommandTexturedRect);
+}
+
+// Room for any single rectangle command, rect.type tells which one it is
+union AnyRectCommand {
+    RenderCommandRectangle rect;
+    RenderCommandTexturedRect textured;
+    RenderCommandShape shape;
+};
+
+static RenderCommand* nextRenderCommand(RenderCommand* command) {
+    u64 size = sizeof(RenderCommandRectangle);
+    if (command->type == Render_TexturedRect) {
+        size = sizeof(RenderCommandTexturedRect);
+    }
+    else if (command->type == Render_Shape) {
+        size = sizeof(RenderCommandShape);
+    }
+    else if (command->type == Render_Mesh) {
+        size = sizeof(RenderCommandMesh);
+    }
+    else if (command->type == Render_Text) {
+        size = textCommandSize(((RenderCommandText*)command)->length);
+    }
+    return (RenderCommand*)((u8*)command + size);
+}
+
+/**
+ * Rectangles drawn by a command: the command itself for rectangles and the
+ * laid out glyphs for text. Consecutive rectangles are stride bytes apart.
+ * Meshes return themselves with a count of 0, nullptr marks unknown command types.
+ */
+static RenderCommandRectangle* getCommandRects(RenderCommand* command, u32* count, u64* stride) {
+    *count = 1;
+    *stride = sizeof(RenderCommandTexturedRect);
+    if (isRectangleCommand(command)) {
+        return (RenderCommandRectangle*)command;
+    }
+    if (command->type == Render_Text) {
+        RenderCommandText* text = (RenderCommandText*)command;
+        *count = text->glyphCount;
+        return text->glyphs();
+    }
+    if (command->type == Render_Mesh) {
+        *count = 0;
+        return (RenderCommandRectangle*)command;
+    }
+    *count = 0;
+    return nullptr;
+}
+
+// Command memory of chunks allocated when the buffer grows
+static const u64 RENDER_COMMAND_CHUNK_SIZE = 1 * MB;
+
+// Nesting depth of pushClip(), and distinct scissor rects per buffer and frame
+static const int MAX_CLIP_DEPTH = 32;
+static const u32 MAX_SCISSOR_RECTS = 255;
+
+/**
+ * A block of command memory. Commands never span two chunks, so iterating a
+ * chunk works like iterating a single array of commands.
+ */
+struct RenderCommandChunk {
+    RenderCommandChunk* next;
+    // Bytes of command memory following the header
+    u64 size;
+    u64 used;
+    // Rectangles of the commands in this chunk, like RenderCommandBuffer::rectCount
+    u32 rectCount;
+    // Allocated by the buffer, not part of the memory passed to create()
+    bool owned;
+
+    RenderCommand* first() {
+        return (RenderCommand*)(this + 1);
+    }
+
+    RenderCommand* onePastLast() {
+        return (RenderCommand*)((u8*)(this + 1) + used);
+    }
+};
+
+/**
+ * Commands are recorded into a list of chunks. The first chunk uses the
+ * memory passed to create(), further chunks come from the grow allocator
+ * when it is full. Chunks are kept by reset(), so a buffer stops allocating
+ * once it has grown to the largest frame.
+ *
+ * Iterate all commands with:
+ * for (RenderCommandChunk* chunk = buffer->chunks; chunk; chunk = chunk->next) {
+ *     for (RenderCommand* command = chunk->first(); command < chunk->onePastLast(); command = nextRenderCommand(command)) {
+ *         ...
+ *     }
+ * }
+ *
+ * Rectangles and text between pushClip() and popClip() are clipped on the
+ * CPU: they are trimmed to the clip rect, or skipped if they are outside of
+ * it, so they stay in the same batches as unclipped rectangles. Only shapes
+ * that cross the edge of the clip rect are drawn with the hardware scissor,
+ * their distance function needs the whole quad. Once all MAX_SCISSOR_RECTS
+ * are taken, they are trimmed as well.
+ */
+struct RenderCommandBuffer {
+    RenderCommandChunk* chunks;
+    RenderCommandChunk* current;
+    // Allocates further chunks, without one the buffer is limited to the memory passed to create()
+    Allocator* growAllocator;
+
+    // Number of rectangles to draw, textured or not, including the laid out glyphs of text commands
+    int rectCount;
+    // Text commands need to be laid out before drawing
+    int textCount;
+    // Mesh commands, they are not counted in rectCount
+    int meshCount;
+    // Commands that did not fit, since the last reset
+    u64 droppedCount;
+
+    // Stack of pushClip(), each clip rect is already intersected with the ones below it
+    ClipRect clipStack[MAX_CLIP_DEPTH];
+    // Scissor of each clip rect on the stack, 0 until a command needs it
+    u8 clipScissors[MAX_CLIP_DEPTH];
+    int clipDepth;
+    // Clip rects of the commands drawn with the hardware scissor, see RenderCommand::scissor
+    ClipRect scissorRects[MAX_SCISSOR_RECTS];
+    u32 scissorCount;
+    // Scissor of the last blended rectangle, see applyClip()
+    u8 lastTranslucentScissor;
+    // Trim clipped rectangles on the CPU. Without it, everything inside a clip rect is drawn with the scissor.
+    bool useClipTrimming;
+    ClipStats clipStats;
+
+    void create(void* memory, u64 size, Allocator* allocator) {
+        chunks = nullptr;
+        current = nullptr;
+        growAllocator = allocator;
+        useClipTrimming = true;
+        if (memory && size > sizeof(RenderCommandChunk)) {
+            chunks = (RenderCommandChunk*)memory;
+            *chunks = {};
+            chunks->size = size - sizeof(RenderCommandChunk);
+        }
+        current = chunks;
+        reset();
+    }
+
+    // Frees the chunks of the grow allocator
+    void destroy() {
+        RenderCommandChunk* chunk = chunks;
+        while (chunk) {
+            RenderCommandChunk* next = chunk->next;
+            if (chunk->owned) {
+                growAllocator->free(chunk, sizeof(RenderCommandChunk) + chunk->size);
+            }
+            chunk = next;
+        }
+        chunks = nullptr;
+        current = nullptr;
+    }
+
+	void reset() {
+        for (RenderCommandChunk* chunk = chunks; chunk; chunk = chunk->next) {
+            chunk->used = 0;
+            chunk->rectCount = 0;
+        }
+        current = chunks;
+        rectCount = 0;
+        textCount = 0;
+        meshCount = 0;
+        droppedCount = 0;
+        clipDepth = 0;
+        scissorCount = 0;
+        lastTranslucentScissor = 0;
+        clipStats = {};
+	}
+
+    // Moves to the next chunk with room for size bytes, the chunks of earlier frames are used first
+    bool advanceChunk(u64 size) {
+        RenderCommandChunk* next = current ? current->next : chunks;
+        if (!next || next->size < size) {
+            if (!growAllocator) {
+                return false;
+            }
+            u64 chunkSize = size > RENDER_COMMAND_CHUNK_SIZE ? size : RENDER_COMMAND_CHUNK_SIZE;
+            RenderCommandChunk* chunk = (RenderCommandChunk*)growAllocator->allocate(sizeof(RenderCommandChunk) + chunkSize);
+            if (!chunk) {
+                return false;
+            }
+            *chunk = {};
+            chunk->size = chunkSize;
+            chunk->owned = true;
+
+            // Inserted before a chunk that is too small, that one is still used by later commands
+            chunk->next = next;
+            if (current) {
+                current->next = chunk;
+            }
+            else {
+                chunks = chunk;
+            }
+            next = chunk;
+        }
+        current = next;
+        return true;
+    }
+
+    // Returns nullptr and counts the command as dropped if no memory is left
+    void* allocateCommand(u64 size) {
+        if (!current || current->used + size > current->size) {
+            if (!advanceChunk(size)) {
+                droppedCount += 1;
+                return nullptr;
+            }
+        }
+        void* command = (u8*)current->first() + current->used;
+        current->used += size;
+        return command;
+    }
+
+    template <typename T>
+    T* allocateCommand() {
+        return (T*)allocateCommand(sizeof(T));
+    }
+
+    void addRects(int count) {
+        rectCount += count;
+        current->rectCount += count;
+    }
+
+    /**
+     * Clips the following rectangle, shape and text commands to the rect,
+     * intersected with the clip rects pushed before. Meshes are not clipped.
+     */
+    void pushClip(float x, float y, float width, float height) {
+        Assert(clipDepth < MAX_CLIP_DEPTH);
+
+        ClipRect clip = { x, y, x + width, y + height };
+        if (clipDepth > 0) {
+            ClipRect outer = clipStack[clipDepth - 1];
+            clip.minX = clip.minX > outer.minX ? clip.minX : outer.minX;
+            clip.minY = clip.minY > outer.minY ? clip.minY : outer.minY;
+            clip.maxX = clip.maxX < outer.maxX ? clip.maxX : outer.maxX;
+            clip.maxY = clip.maxY < outer.maxY ? clip.maxY : outer.maxY;
+        }
+        clipStack[clipDepth] = clip;
+        clipScissors[clipDepth] = 0;
+        clipDepth += 1;
+    }
+
+    void popClip() {
+        Assert(clipDepth > 0);
+        clipDepth -= 1;
+    }
+
+    ClipRect currentClip() {
+        return clipDepth > 0 ? clipStack[clipDepth - 1] : NO_CLIP;
+    }
+
+    // Scissor of the current clip rect, 0 once all scissor rects are taken
+    u8 currentScissor() {
+        u8* scissor = &clipScissors[clipDepth - 1];
+        if (*scissor == 0) {
+            // A clip rect that is pushed again, e.g. for each row of a list, shares the batches of the first one
+            ClipRect clip = clipStack[clipDepth - 1];
+            for (u32 i = 0; i < scissorCount && *scissor == 0; ++i) {
+                ClipRect other = scissorRects[i];
+                if (other.minX == clip.minX && other.minY == clip.minY && other.maxX == clip.maxX && other.maxY == clip.maxY) {
+                    *scissor = (u8)(i + 1);
+                }
+            }
+            if (*scissor == 0 && scissorCount < MAX_SCISSOR_RECTS) {
+                scissorRects[scissorCount++] = clip;
+                *scissor = (u8)scissorCount;
+            }
+        }
+        return *scissor;
+    }
+
+    // Counts the rectangle as culled if it is entirely outside of the current clip rect
+    bool isClippedAway(RenderCommandRectangle* rect) {
+        if (clipDepth == 0 || clipOverlap(rect, clipStack[clipDepth - 1]) != Clip_Outside) {
+            return false;
+        }
+        clipStats.culled += 1;
+        return true;
+    }
+
+    /**
+     * Trims a recorded rectangle to the current clip rect, shapes get the
+     * scissor instead. Rectangles are drawn in submission order, so a
+     * blended rectangle right after a scissored one of the same clip rect
+     * takes the scissor as well instead of starting a new batch. Once all
+     * scissor rects are taken, crossing rectangles are trimmed after all,
+     * shapes then lose their exact edges but are never drawn unclipped.
+     */
+    void applyClip(RenderCommandRectangle* rect) {
+        rect->scissor = 0;
+        if (clipDepth == 0) {
+            if (lastTranslucentScissor && isTranslucentRect(rect)) {
+                lastTranslucentScissor = 0;
+            }
+            return;
+        }
+
+        bool crossing = clipOverlap(rect, clipStack[clipDepth - 1]) == Clip_Crossing;
+        bool translucent = isTranslucentRect(rect);
+        bool joinRun = translucent && lastTranslucentScissor && lastTranslucentScissor == clipScissors[clipDepth - 1];
+        if (!useClipTrimming || joinRun || (crossing && rect->type == Render_Shape)) {
+            rect->scissor = currentScissor();
+            clipStats.scissored += rect->scissor ? 1 : 0;
+            clipStats.scissorOverflow += rect->scissor ? 0 : 1;
+        }
+        if (crossing && rect->scissor == 0) {
+            trimRect(rect, clipStack[clipDepth - 1]);
+            clipStats.trimmed += 1;
+        }
+        if (translucent) {
+            lastTranslucentScissor = rect->scissor;
+        }
+    }
+
+	void push(RenderCommandRectangle* rect) {
+		if (isClippedAway(rect)) {
+			return;
+		}
+		RenderCommandRectangle* target = allocateCommand<RenderCommandRectangle>();
+		if (!target) {
+			return;
+		}
+		*target = *rect;
+		target->packedColor = packColor(rect->color);
+		applyClip(target);
+        addRects(1);
+	}
+
+	void push(RenderCommandTexturedRect* rect) {
+		if (isClippedAway(rect)) {
+			return;
+		}
+		RenderCommandTexturedRect* target = allocateCommand<RenderCommandTexturedRect>();
+		if (!target) {
+			return;
+		}
+		*target = *rect;
+		target->type = Render_TexturedRect;
+		target->packedColor = packColor(rect->color);
+		applyClip(target);
+        addRects(1);
+	}
+
+	// Stores an already packed shape, e.g. a replayed one
+	void push(RenderCommandShape* shape) {
+		if (isClippedAway(shape)) {
+			return;
+		}
+		RenderCommandShape* target = allocateCommand<RenderCommandShape>();
+		if (!target) {
+			return;
+		}
+		*target = *shape;
+		target->type = Render_Shape;
+		target->packedColor = packColor(shape->color);
+		applyClip(target);
+        addRects(1);
+	}
+
+	void push(AnyRectCommand* command) {
+		if (command->rect.type == Render_TexturedRect) {
+			push(&command->textured);
+		}
+		else if (command->rect.type == Render_Shape) {
+			push(&command->shape);
+		}
+		else {
+			push(&command->rect);
+		}
+	}
+
+	void push(RenderCommandRoundedRect* rect) {
+		RenderCommandShape shape = makeShape(rect);
+		push(&shape);
+	}
+
+	void push(RenderCommandLine* line) {
+		RenderCommandShape shape = makeShape(line);
+		push(&shape);
+	}
+
+	void push(RenderCommandMesh* mesh) {
+		RenderCommandMesh* target = allocateCommand<RenderCommandMesh>();
+		if (!target) {
+			return;
+		}
+		*target = *mesh;
+		target->type = Render_Mesh;
+		target->scissor = 0;
+        meshCount += 1;
+	}
+
+	// Copies the text, its glyphs are counted once they are laid out
+	void push(RenderCommandText* command, char const* text, u32 length) {
+		RenderCommandText* target = (RenderCommandText*)allocateCommand(textCommandSize(length));
+		if (!target) {
+			return;
+		}
+		*target = *command;
+		target->type = Render_Text;
+		target->packedColor = packColor(command->color);
+		target->length = length;
+		target->glyphCount = 0;
+		// Glyphs are trimmed when they are laid out, unless they share the scissor of the command like in applyClip().
+		// Without a free scissor rect, the scissor stays 0 and the glyphs are trimmed as well.
+		target->clip = currentClip();
+		target->scissor = 0;
+		if (clipDepth > 0 && (!useClipTrimming || (lastTranslucentScissor && lastTranslucentScissor == clipScissors[clipDepth - 1]))) {
+			target->scissor = currentScissor();
+		}
+		lastTranslucentScissor = target->scissor;
+		char* targetText = target->text();
+		for (u32 i = 0; i < length; ++i) {
+			targetText[i] = text[i];
+		}
+        textCount += 1;
+	}
+};
@@ -0,0 +1,737 @@
+/******************************************************************************
+* Render graph
+*
+* Schedules the render passes of a frame from the render targets they read
+* and write, instead of binding framebuffers and clearing targets by hand.
+*
+* The graph is rebuilt every frame. A pass declares the targets it reads and
+* writes. Every write creates a new version of a target, so the pass that
+* produced the version a read refers to is always known. Passes may be added
+* in any order:
+* - Passes that nothing depends on are culled, unless they write an imported
+*   target, a target marked as output, or are marked as having side effects
+* - The remaining passes are sorted so every pass runs after the producers of
+*   what it reads, and after the readers of a version it overwrites. Ties keep
+*   the order the passes were added in
+* - Transient targets only live from their first to their last use. Targets
+*   with the same size and format whose lifetimes do not overlap share the
+*   same texture. Targets marked as output live until the end of the frame
+*
+* Execution goes through a backend. The OpenGL backend creates the textures,
+* attaches the written targets to a framebuffer and clears them. The null
+* backend only records the schedule and the memory plan, so graphs can be
+* checked without a GPU.
+*
+* OpenGL orders rendering into a texture before later texture fetches from it,
+* so unlike Vulkan or D3D12 there are no barriers to place between passes.
+*
+* Example:
+* {
+*     graph.create();   // once
+*     ...
+*     graph.reset();    // every frame
+*     RenderResource backbuffer = graph.importTarget("backbuffer", { width, height, RenderFormat_RGBA8 }, 0);
+*     RenderResource scene = graph.createTarget("scene", { width, height, RenderFormat_RGBA8 });
+*     int scenePass = graph.addPass("scene", &drawScene, &sceneData);
+*     scene = graph.clear(scenePass, scene, BLACK);
+*     int compositePass = graph.addPass("composite", &composite, &compositeData);
+*     graph.read(compositePass, scene);
+*     graph.write(compositePass, backbuffer);
+*     if (graph.compile()) {
+*         graph.execute(&glBackend);
+*     }
+* }
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_core.h"
+#include "fp_opengl.h"
+#include "fp_render_commands.h"
+
+static const int MAX_RENDER_PASSES = 64;
+static const int MAX_RENDER_TARGETS = 64;
+// Every write creates a new version of a target
+static const int MAX_RENDER_VERSIONS = 256;
+static const int MAX_PASS_READS = 8;
+// Up to four color attachments and a depth attachment
+static const int MAX_PASS_WRITES = 5;
+
+enum RenderTargetFormat : u8 {
+    RenderFormat_RGBA8,
+    RenderFormat_RGBA16F,
+    RenderFormat_Depth24Stencil8,
+};
+
+struct RenderTargetDesc {
+    int width;
+    int height;
+    RenderTargetFormat format;
+};
+
+static u64 renderTargetBytes(RenderTargetDesc desc) {
+    u64 bytesPerPixel = desc.format == RenderFormat_RGBA16F ? 8 : 4;
+    return bytesPerPixel * (u64)desc.width * (u64)desc.height;
+}
+
+static bool isDepthFormat(RenderTargetFormat format) {
+    return format == RenderFormat_Depth24Stencil8;
+}
+
+static bool sameRenderTargetDesc(RenderTargetDesc a, RenderTargetDesc b) {
+    return a.width == b.width && a.height == b.height && a.format == b.format;
+}
+
+// A version of a render target
+typedef int RenderResource;
+static const RenderResource NO_RENDER_RESOURCE = -1;
+
+struct RenderGraph;
+struct RenderGraphPass;
+
+typedef void RenderPassFunction(RenderGraph* graph, RenderGraphPass* pass, void* data);
+
+struct RenderGraphTarget {
+    const char* name;
+    RenderTargetDesc desc;
+    // Imported targets are owned by someone else, e.g. the backbuffer
+    bool imported;
+    // Passes writing the target are kept, although nothing reads it
+    bool output;
+    // Handle of an imported target in the backend, a framebuffer for OpenGL
+    u32 external;
+    // Only the latest version can be written, older ones stay for their readers
+    RenderResource latest;
+
+    // Filled by compile(), positions in the schedule, -1 if unused
+    int firstUse;
+    int lastUse;
+    // Index of the shared texture, -1 for imported and unused targets
+    int physical;
+};
+
+struct RenderGraphVersion {
+    int target;
+    // Pass that wrote this version, -1 for the initial contents
+    int producer;
+    RenderResource previous;
+};
+
+struct RenderGraphPass {
+    const char* name;
+    RenderPassFunction* execute;
+    void* data;
+    // Runs although nothing reads its writes, e.g. a readback
+    bool sideEffects;
+
+    int readCount;
+    RenderResource reads[MAX_PASS_READS];
+    int writeCount;
+    // The versions created by this pass
+    RenderResource writes[MAX_PASS_WRITES];
+    // Cleared instead of loading the previous contents
+    bool clears[MAX_PASS_WRITES];
+    Color clearColors[MAX_PASS_WRITES];
+
+    // Filled by compile()
+    bool culled;
+};
+
+// A texture shared by transient targets whose lifetimes do not overlap
+struct PhysicalRenderTarget {
+    RenderTargetDesc desc;
+    int lastUse;
+    // Texture of the backend, set during execute()
+    u32 handle;
+};
+
+struct RenderGraphStats {
+    u32 passes;
+    u32 culledPasses;
+    u32 transientTargets;
+    u32 physicalTargets;
+    // Memory of all used transient targets without aliasing
+    u64 transientBytes;
+    // Memory of the physical targets, with aliasing
+    u64 allocatedBytes;
+};
+
+struct RenderGraphBackend;
+
+// Returns the texture for a physical target, may reuse the one of the last frame
+typedef u32 AcquireRenderTargetFunction(RenderGraphBackend* backend, int physical, RenderTargetDesc desc);
+typedef void BeginRenderPassFunction(RenderGraphBackend* backend, RenderGraph* graph, RenderGraphPass* pass);
+typedef void EndRenderPassFunction(RenderGraphBackend* backend, RenderGraph* graph, RenderGraphPass* pass);
+
+/**
+ * Render graph backend interface
+ *
+ * Subclass RenderGraphBackend to add the state of a backend, like Allocator.
+ */
+struct RenderGraphBackend {
+    AcquireRenderTargetFunction* acquireTargetFunction;
+    BeginRenderPassFunction* beginPassFunction;
+    EndRenderPassFunction* endPassFunction;
+};
+
+struct RenderGraph {
+    int passCount;
+    RenderGraphPass passes[MAX_RENDER_PASSES];
+    int targetCount;
+    RenderGraphTarget targets[MAX_RENDER_TARGETS];
+    int versionCount;
+    RenderGraphVersion versions[MAX_RENDER_VERSIONS];
+
+    // Filled by compile()
+    int scheduleCount;
+    int schedule[MAX_RENDER_PASSES];
+    int physicalCount;
+    PhysicalRenderTarget physicalTargets[MAX_RENDER_TARGETS];
+    RenderGraphStats stats;
+
+    // Transient targets share textures when their lifetimes do not overlap
+    bool useAliasing;
+
+    void create() {
+        reset();
+        useAliasing = true;
+    }
+
+    void reset() {
+        passCount = 0;
+        targetCount = 0;
+        versionCount = 0;
+        scheduleCount = 0;
+        physicalCount = 0;
+        stats = {};
+    }
+
+    RenderResource createTarget(const char* name, RenderTargetDesc desc) {
+        Assert(targetCount < MAX_RENDER_TARGETS);
+        Assert(desc.width > 0 && desc.height > 0);
+        RenderGraphTarget* target = &targets[targetCount];
+        *target = {};
+        target->name = name;
+        target->desc = desc;
+        targetCount += 1;
+        return addVersion(targetCount - 1, -1, NO_RENDER_RESOURCE);
+    }
+
+    // The initial contents of an imported target are defined, passes writing it are never culled
+    RenderResource importTarget(const char* name, RenderTargetDesc desc, u32 external) {
+        RenderResource resource = createTarget(name, desc);
+        RenderGraphTarget* target = &targets[versions[resource].target];
+        target->imported = true;
+        target->output = true;
+        target->external = external;
+        return resource;
+    }
+
+    void markOutput(RenderResource resource) {
+        targets[versions[resource].target].output = true;
+    }
+
+    int addPass(const char* name, RenderPassFunction* execute, void* data) {
+        Assert(passCount < MAX_RENDER_PASSES);
+        RenderGraphPass* pass = &passes[passCount];
+        *pass = {};
+        pass->name = name;
+        pass->execute = execute;
+        pass->data = data;
+        passCount += 1;
+        return passCount - 1;
+    }
+
+    void read(int pass, RenderResource resource) {
+        RenderGraphPass* graphPass = &passes[pass];
+        Assert(graphPass->readCount < MAX_PASS_READS);
+        Assert(resource >= 0 && resource < versionCount);
+        // A transient target has no contents before its first write
+        Assert(versions[resource].producer >= 0 || targetOf(resource)->imported);
+        graphPass->reads[graphPass->readCount] = resource;
+        graphPass->readCount += 1;
+    }
+
+    // Draws on top of the previous contents, returns the new version
+    RenderResource write(int pass, RenderResource resource) {
+        return addWrite(pass, resource, false, {});
+    }
+
+    // Discards the previous contents, depth targets are cleared to 1 and the stencil to 0
+    RenderResource clear(int pass, RenderResource resource, Color color) {
+        return addWrite(pass, resource, true, color);
+    }
+
+    RenderGraphTarget* targetOf(RenderResource resource) {
+        return &targets[versions[resource].target];
+    }
+
+    // Texture of a transient target or the external handle of an imported one, valid during execute()
+    u32 handleOf(RenderResource resource) {
+        RenderGraphTarget* target = targetOf(resource);
+        return target->imported ? target->external : physicalTargets[target->physical].handle;
+    }
+
+    /**
+     * Culls the passes nothing depends on, sorts the rest and assigns the
+     * transient targets to physical ones. Returns false if the passes depend
+     * on each other in a cycle.
+     */
+    bool compile() {
+        stats = {};
+        stats.passes = passCount;
+        scheduleCount = 0;
+        physicalCount = 0;
+
+        cullPasses();
+
+        // Edges from a pass to the passes that have to run after it
+        u64 successors[MAX_RENDER_PASSES] = {};
+        for (int index = 0; index < passCount; ++index) {
+            RenderGraphPass* pass = &passes[index];
+            if (pass->culled) {
+                continue;
+            }
+            for (int i = 0; i < pass->readCount; ++i) {
+                addDependency(successors, versions[pass->reads[i]].producer, index);
+            }
+            for (int i = 0; i < pass->writeCount; ++i) {
+                // The previous version has to be written and read before it is overwritten
+                RenderResource previous = versions[pass->writes[i]].previous;
+                addDependency(successors, versions[previous].producer, index);
+                for (int reader = 0; reader < passCount; ++reader) {
+                    if (reader != index && !passes[reader].culled && readsVersion(&passes[reader], previous)) {
+                        addDependency(successors, reader, index);
+                    }
+                }
+            }
+        }
+
+        // Kahn's algorithm, always taking the earliest added pass that is ready
+        int predecessorCounts[MAX_RENDER_PASSES] = {};
+        for (int index = 0; index < passCount; ++index) {
+            for (int successor = 0; successor < passCount; ++successor) {
+                predecessorCounts[successor] += (successors[index] >> successor) & 1;
+            }
+        }
+        u64 scheduled = 0;
+        int livePasses = passCount - (int)stats.culledPasses;
+        while (scheduleCount < livePasses) {
+            int next = -1;
+            for (int index = 0; index < passCount; ++index) {
+                if (!passes[index].culled && predecessorCounts[index] == 0 && !(scheduled & (1ULL << index))) {
+                    next = index;
+                    break;
+                }
+            }
+            if (next < 0) {
+                OutputDebugStringW(L"Render graph has a cycle\n");
+                return false;
+            }
+            scheduled |= 1ULL << next;
+            schedule[scheduleCount] = next;
+            scheduleCount += 1;
+            for (int successor = 0; successor < passCount; ++successor) {
+                predecessorCounts[successor] -= (successors[next] >> successor) & 1;
+            }
+        }
+
+        computeLifetimes();
+        assignPhysicalTargets();
+        return true;
+    }
+
+    void execute(RenderGraphBackend* backend) {
+        for (int i = 0; i < physicalCount; ++i) {
+            PhysicalRenderTarget* physical = &physicalTargets[i];
+            physical->handle = backend->acquireTargetFunction(backend, i, physical->desc);
+        }
+        for (int i = 0; i < scheduleCount; ++i) {
+            RenderGraphPass* pass = &passes[schedule[i]];
+            backend->beginPassFunction(backend, this, pass);
+            pass->execute(this, pass, pass->data);
+            backend->endPassFunction(backend, this, pass);
+        }
+    }
+
+    RenderResource addVersion(int target, int producer, RenderResource previous) {
+        Assert(versionCount < MAX_RENDER_VERSIONS);
+        versions[versionCount] = { target, producer, previous };
+        targets[target].latest = versionCount;
+        versionCount += 1;
+        return versionCount - 1;
+    }
+
+    RenderResource addWrite(int pass, RenderResource resource, bool clear, Color color) {
+        RenderGraphPass* graphPass = &passes[pass];
+        Assert(graphPass->writeCount < MAX_PASS_WRITES);
+        Assert(resource >= 0 && resource < versionCount);
+        Assert(targetOf(resource)->latest == resource);
+
+        RenderResource written = addVersion(versions[resource].target, pass, resource);
+        graphPass->writes[graphPass->writeCount] = written;
+        graphPass->clears[graphPass->writeCount] = clear;
+        graphPass->clearColors[graphPass->writeCount] = color;
+        graphPass->writeCount += 1;
+        return written;
+    }
+
+    bool readsVersion(RenderGraphPass* pass, RenderResource resource) {
+        for (int i = 0; i < pass->readCount; ++i) {
+            if (pass->reads[i] == resource) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void addDependency(u64* successors, int producer, int consumer) {
+        if (producer >= 0 && producer != consumer) {
+            successors[producer] |= 1ULL << consumer;
+        }
+    }
+
+    /**
+     * Marks the passes that are needed, starting at the ones writing outputs
+     * and walking back to the producers of what they read. A write that does
+     * not clear loads the previous version, so its producer is needed too.
+     */
+    void cullPasses() {
+        int stack[MAX_RENDER_PASSES];
+        int stackCount = 0;
+        for (int index = 0; index < passCount; ++index) {
+            RenderGraphPass* pass = &passes[index];
+            pass->culled = true;
+            bool root = pass->sideEffects;
+            for (int i = 0; i < pass->writeCount; ++i) {
+                root = root || targetOf(pass->writes[i])->output;
+            }
+            if (root) {
+                pass->culled = false;
+                stack[stackCount] = index;
+                stackCount += 1;
+            }
+        }
+
+        while (stackCount > 0) {
+            stackCount -= 1;
+            RenderGraphPass* pass = &passes[stack[stackCount]];
+            int neededCount = 0;
+            int needed[MAX_PASS_READS + MAX_PASS_WRITES];
+            for (int i = 0; i < pass->readCount; ++i) {
+                needed[neededCount] = versions[pass->reads[i]].producer;
+                neededCount += 1;
+            }
+            for (int i = 0; i < pass->writeCount; ++i) {
+                if (!pass->clears[i]) {
+                    needed[neededCount] = versions[versions[pass->writes[i]].previous].producer;
+                    neededCount += 1;
+                }
+            }
+            for (int i = 0; i < neededCount; ++i) {
+                int producer = needed[i];
+                if (producer >= 0 && passes[producer].culled) {
+                    passes[producer].culled = false;
+                    stack[stackCount] = producer;
+                    stackCount += 1;
+                }
+            }
+        }
+
+        for (int index = 0; index < passCount; ++index) {
+            stats.culledPasses += passes[index].culled ? 1 : 0;
+        }
+    }
+
+    void useTarget(RenderResource resource, int position) {
+        RenderGraphTarget* target = targetOf(resource);
+        target->firstUse = target->firstUse < 0 ? position : target->firstUse;
+        target->lastUse = position;
+    }
+
+    void computeLifetimes() {
+        for (int i = 0; i < targetCount; ++i) {
+            targets[i].firstUse = -1;
+            targets[i].lastUse = -1;
+            targets[i].physical = -1;
+        }
+        for (int position = 0; position < scheduleCount; ++position) {
+            RenderGraphPass* pass = &passes[schedule[position]];
+            for (int i = 0; i < pass->readCount; ++i) {
+                useTarget(pass->reads[i], position);
+            }
+            for (int i = 0; i < pass->writeCount; ++i) {
+                useTarget(pass->writes[i], position);
+            }
+        }
+        // Outputs are read after the graph ran, so no later target may take their texture
+        for (int i = 0; i < targetCount; ++i) {
+            if (targets[i].output && targets[i].firstUse >= 0) {
+                targets[i].lastUse = scheduleCount;
+            }
+        }
+    }
+
+    /**
+     * Greedy interval assignment in the order of first use: a target takes
+     * the first physical target of the same size and format that is free
+     * again, otherwise a new one. Lifetimes include both ends, so a target
+     * read by a pass never shares a texture with a target the pass writes.
+     */
+    void assignPhysicalTargets() {
+        for (int position = 0; position < scheduleCount; ++position) {
+            for (int i = 0; i < targetCount; ++i) {
+                RenderGraphTarget* target = &targets[i];
+                if (target->imported || target->firstUse != position) {
+                    continue;
+                }
+
+                stats.transientTargets += 1;
+                stats.transientBytes += renderTargetBytes(target->desc);
+                for (int p = 0; p < physicalCount && useAliasing; ++p) {
+                    PhysicalRenderTarget* physical = &physicalTargets[p];
+                    if (physical->lastUse < position && sameRenderTargetDesc(physical->desc, target->desc)) {
+                        target->physical = p;
+                        break;
+                    }
+                }
+                if (target->physical < 0) {
+                    target->physical = physicalCount;
+                    physicalTargets[physicalCount] = { target->desc, -1, 0 };
+                    physicalCount += 1;
+                    stats.allocatedBytes += renderTargetBytes(target->desc);
+                }
+                physicalTargets[target->physical].lastUse = target->lastUse;
+            }
+        }
+        stats.physicalTargets = physicalCount;
+    }
+};
+
+/**
+ * Null backend
+ *
+ * Executes nothing on a GPU and records what the graph asked for: the passes
+ * in the order they ran and the physical targets, so the schedule and the
+ * memory plan of a graph can be checked.
+ */
+struct NullRenderBackend : RenderGraphBackend {
+    int passCount;
+    int passes[MAX_RENDER_PASSES];
+    int targetCount;
+    RenderTargetDesc targets[MAX_RENDER_TARGETS];
+    u64 targetBytes;
+    u32 clearCount;
+    // Pass that is between begin and end, -1 outside of a pass
+    int currentPass;
+
+    void reset() {
+        passCount = 0;
+        targetCount = 0;
+        targetBytes = 0;
+        clearCount = 0;
+        currentPass = -1;
+    }
+
+    // Position of a pass in the recorded schedule, -1 if it did not run
+    int positionOf(int pass) {
+        for (int i = 0; i < passCount; ++i) {
+            if (passes[i] == pass) {
+                return i;
+            }
+        }
+        return -1;
+    }
+};
+
+static u32 nullAcquireRenderTarget(RenderGraphBackend* backend, int physical, RenderTargetDesc desc) {
+    NullRenderBackend* nullBackend = (NullRenderBackend*)backend;
+    nullBackend->targets[physical] = desc;
+    nullBackend->targetCount = physical + 1 > nullBackend->targetCount ? physical + 1 : nullBackend->targetCount;
+    nullBackend->targetBytes += renderTargetBytes(desc);
+    // Any non-zero handle, 0 is no texture
+    return (u32)physical + 1;
+}
+
+static void nullBeginRenderPass(RenderGraphBackend* backend, RenderGraph* graph, RenderGraphPass* pass) {
+    NullRenderBackend* nullBackend = (NullRenderBackend*)backend;
+    Assert(nullBackend->currentPass < 0);
+    nullBackend->currentPass = nullBackend->passCount;
+    nullBackend->passes[nullBackend->passCount] = (int)(pass - graph->passes);
+    nullBackend->passCount += 1;
+    for (int i = 0; i < pass->writeCount; ++i) {
+        nullBackend->clearCount += pass->clears[i] ? 1 : 0;
+    }
+}
+
+static void nullEndRenderPass(RenderGraphBackend* backend, RenderGraph*, RenderGraphPass*) {
+    NullRenderBackend* nullBackend = (NullRenderBackend*)backend;
+    Assert(nullBackend->currentPass >= 0);
+    nullBackend->currentPass = -1;
+}
+
+static NullRenderBackend createNullRenderBackend() {
+    NullRenderBackend backend = {};
+    backend.acquireTargetFunction = &nullAcquireRenderTarget;
+    backend.beginPassFunction = &nullBeginRenderPass;
+    backend.endPassFunction = &nullEndRenderPass;
+    backend.reset();
+    return backend;
+}
+
+/**
+ * OpenGL backend
+ *
+ * Keeps the texture of each physical target between frames and only
+ * recreates it when its size or format changes. The transient targets a pass
+ * writes are attached to one shared framebuffer. An imported target is a
+ * framebuffer of its own, 0 for the default one, and clearing it clears its
+ * color and depth.
+ */
+struct GLRenderBackend : RenderGraphBackend {
+    GLuint framebuffer;
+    // For blits from a target
+    GLuint readFramebuffer;
+    int textureCount;
+    GLuint textures[MAX_RENDER_TARGETS];
+    RenderTargetDesc textureDescs[MAX_RENDER_TARGETS];
+    u64 textureBytes;
+    // Size of the pass that is being executed
+    int passWidth;
+    int passHeight;
+
+    void destroy() {
+        for (int i = 0; i < textureCount; ++i) {
+            glDeleteTextures(1, &textures[i]);
+        }
+        textureCount = 0;
+        textureBytes = 0;
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteFramebuffers(1, &readFramebuffer);
+        framebuffer = 0;
+        readFramebuffer = 0;
+    }
+
+    // Scales a target over the whole target of the current pass, with linear filtering for color
+    void blitFrom(RenderGraph* graph, RenderResource source) {
+        RenderGraphTarget* target = graph->targetOf(source);
+        Assert(!target->imported);
+        bool depth = isDepthFormat(target->desc.format);
+        GLenum attachment = depth ? GL_DEPTH_STENCIL_ATTACHMENT : GL_COLOR_ATTACHMENT0;
+        glNamedFramebufferTexture(readFramebuffer, attachment, graph->handleOf(source), 0);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+        glBlitFramebuffer(0, 0, target->desc.width, target->desc.height, 0, 0, passWidth, passHeight,
+            depth ? GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT : GL_COLOR_BUFFER_BIT, depth ? GL_NEAREST : GL_LINEAR);
+        glNamedFramebufferTexture(readFramebuffer, attachment, 0, 0);
+    }
+};
+
+static u32 glAcquireRenderTarget(RenderGraphBackend* backend, int physical, RenderTargetDesc desc) {
+    GLRenderBackend* glBackend = (GLRenderBackend*)backend;
+    if (physical < glBackend->textureCount && sameRenderTargetDesc(glBackend->textureDescs[physical], desc)) {
+        return glBackend->textures[physical];
+    }
+
+    if (physical < glBackend->textureCount) {
+        glDeleteTextures(1, &glBackend->textures[physical]);
+        glBackend->textureBytes -= renderTargetBytes(glBackend->textureDescs[physical]);
+    }
+    GLenum formats[] = { GL_RGBA8, GL_RGBA16F, GL_DEPTH24_STENCIL8 };
+    GLuint texture = 0;
+    glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+    glTextureStorage2D(texture, 1, formats[desc.format], desc.width, desc.height);
+    glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // Physical targets are acquired in order, so this only appends
+    Assert(physical <= glBackend->textureCount);
+    glBackend->textures[physical] = texture;
+    glBackend->textureDescs[physical] = desc;
+    glBackend->textureBytes += renderTargetBytes(desc);
+    glBackend->textureCount = physical + 1 > glBackend->textureCount ? physical + 1 : glBackend->textureCount;
+    return texture;
+}
+
+static void glBeginRenderPass(RenderGraphBackend* backend, RenderGraph* graph, RenderGraphPass* pass) {
+    GLRenderBackend* glBackend = (GLRenderBackend*)backend;
+    glBackend->passWidth = 0;
+    glBackend->passHeight = 0;
+    glDisable(GL_SCISSOR_TEST);
+    if (pass->writeCount == 0) {
+        return;
+    }
+
+    RenderGraphTarget* first = graph->targetOf(pass->writes[0]);
+    glBackend->passWidth = first->desc.width;
+    glBackend->passHeight = first->desc.height;
+    glViewport(0, 0, first->desc.width, first->desc.height);
+
+    if (first->imported) {
+        // A framebuffer of its own, it can not be combined with other targets
+        Assert(pass->writeCount == 1);
+        glBindFramebuffer(GL_FRAMEBUFFER, first->external);
+        if (pass->clears[0]) {
+            glClearBufferfv(GL_COLOR, 0, pass->clearColors[0].color);
+            glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+        }
+        return;
+    }
+
+    GLenum drawBuffers[MAX_PASS_WRITES];
+    int colorCount = 0;
+    GLuint depthTexture = 0;
+    for (int i = 0; i < pass->writeCount; ++i) {
+        RenderGraphTarget* target = graph->targetOf(pass->writes[i]);
+        Assert(!target->imported);
+        if (isDepthFormat(target->desc.format)) {
+            depthTexture = graph->handleOf(pass->writes[i]);
+        }
+        else {
+            glNamedFramebufferTexture(glBackend->framebuffer, GL_COLOR_ATTACHMENT0 + colorCount, graph->handleOf(pass->writes[i]), 0);
+            drawBuffers[colorCount] = GL_COLOR_ATTACHMENT0 + colorCount;
+            colorCount += 1;
+        }
+    }
+    // Detach what the previous pass left behind
+    for (int i = colorCount; i < MAX_PASS_WRITES - 1; ++i) {
+        glNamedFramebufferTexture(glBackend->framebuffer, GL_COLOR_ATTACHMENT0 + i, 0, 0);
+    }
+    glNamedFramebufferTexture(glBackend->framebuffer, GL_DEPTH_STENCIL_ATTACHMENT, depthTexture, 0);
+    glNamedFramebufferDrawBuffers(glBackend->framebuffer, colorCount, drawBuffers);
+    glBindFramebuffer(GL_FRAMEBUFFER, glBackend->framebuffer);
+
+    if (glCheckNamedFramebufferStatus(glBackend->framebuffer, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        OutputDebugStringW(L"Render graph framebuffer is incomplete\n");
+    }
+
+    int colorIndex = 0;
+    for (int i = 0; i < pass->writeCount; ++i) {
+        bool depth = isDepthFormat(graph->targetOf(pass->writes[i])->desc.format);
+        if (pass->clears[i] && depth) {
+            glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+        }
+        else if (pass->clears[i]) {
+            glClearBufferfv(GL_COLOR, colorIndex, pass->clearColors[i].color);
+        }
+        colorIndex += depth ? 0 : 1;
+    }
+}
+
+// The next pass binds its own framebuffer, the last one stays bound for the swap
+static void glEndRenderPass(RenderGraphBackend*, RenderGraph*, RenderGraphPass*) {
+}
+
+static GLRenderBackend createGLRenderBackend() {
+    GLRenderBackend backend = {};
+    backend.acquireTargetFunction = &glAcquireRenderTarget;
+    backend.beginPassFunction = &glBeginRenderPass;
+    backend.endPassFunction = &glEndRenderPass;
+    glCreateFramebuffers(1, &backend.framebuffer);
+    glCreateFramebuffers(1, &backend.readFramebuffer);
+    return backend;
+}
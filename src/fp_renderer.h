@@ -1,216 +1,1784 @@
 #pragma once
 
 #include "fp_allocator.h"
+#include "fp_command_sort.h"
+#include "fp_culling.h"
+#include "fp_damage.h"
+#include "fp_frame_pacing.h"
+#include "fp_glyph_cache.h"
+#include "fp_jobs.h"
+#include "fp_math.h"
+#include "fp_mesh.h"
+#include "fp_shader_cache.h"
+#include "fp_opengl.h"
+#include "fp_profiler.h"
+#include "fp_render_commands.h"
+#include "fp_retained_cache.h"
+#include "fp_streaming_buffer.h"
+#include "fp_texture_atlas.h"
+#include "fp_texture_streaming.h"
+#include "fp_vertex_expansion.h"
 
-struct Color {
-    float color[4];
+static const char* VERTEX_SHADER_SIMPLE_COLOR =
+"#version 430 core\n"
+"#line " STR(__LINE__) "\n"
+R"(
+// See ExpandedRect, the draws start at the first vertex of their first rectangle
+struct ExpandedRect
+{
+    vec2 vertices[6];
+    uint color;
+    uint uv0;
+    uint uv1;
+    uint shape;
 };
 
-static const Color RED = { 1.0f, 0.0f, 0.0f, 1.0f };
-static const Color GREEN = { 0.0f, 1.0f, 0.0f, 1.0f };
-static const Color BLUE = { 0.0f, 0.0f, 1.0f, 1.0f };
-
-enum RenderCommandType {
-	Render_Rectangle,
+layout (std430, binding = 0) readonly buffer ExpandedRects
+{
+    ExpandedRect rects[];
 };
 
-struct RenderCommand {
-	RenderCommandType type;
-};
+uniform mat4 projection;
 
-struct RenderCommandRectangle : RenderCommand {
-	float x;
-	float y;
-	float width;
-	float height;
+out vec4 vertexColor;
+out vec2 uv;
+out vec2 local;
+flat out vec2 size;
+flat out uint shapeParams;
 
-	Color color;
-};
+// Same triangle order as expandRect()
+const vec2 corners[6] = vec2[6](
+    vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(0.0, 1.0),
+    vec2(1.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 1.0)
+);
 
-struct RenderCommandBuffer {
-	ArenaAllocator allocator;
-    int rectCount;
+void main()
+{
+    ExpandedRect rect = rects[gl_VertexID / 6];
+    vec2 pos = rect.vertices[gl_VertexID % 6];
+    gl_Position = projection * vec4(pos.x, pos.y, 0.0, 1.0);
+    // Unpacked like the normalized RGBA8 and 16 bit attributes of the instanced path
+    vertexColor = unpackUnorm4x8(rect.color);
+    vec4 uvRect = vec4(unpackUnorm2x16(rect.uv0), unpackUnorm2x16(rect.uv1));
+    // The corner selects the texture coordinate. Shapes store their size instead and sample the white texels.
+    vec2 corner = corners[gl_VertexID % 6];
+    uv = (rect.shape & 3u) == 0u ? mix(uvRect.xy, uvRect.zw, corner) : vec2(0.0);
+    local = corner;
+    size = vec2(uintBitsToFloat(rect.uv0), uintBitsToFloat(rect.uv1));
+    shapeParams = rect.shape;
+}
+)";
 
-	RenderCommand* first() {
-		return (RenderCommand*)allocator.data;
-	}
+static const char* FRAGMENT_SHADER_VERTEX_COLOR =
+"#version 330 core\n"
+"#line " STR(__LINE__) "\n"
+R"(
+out vec4 FragColor;
 
-    RenderCommand* onePastLast() {
-        return (RenderCommand*)(allocator.data + allocator.used);
-    }
+in vec4 vertexColor;
+in vec2 uv;
+// Position in the quad in [0, 1], the shape is evaluated in units of the projection
+in vec2 local;
+flat in vec2 size;
+flat in uint shapeParams;
 
-	void reset() {
-		allocator.reset();
-        rectCount = 0;
-	}
+uniform sampler2D atlas;
 
-	void push(RenderCommandRectangle* rect) {
-		RenderCommandRectangle* target = allocator.allocateSingle<RenderCommandRectangle>();
-		*target = *rect;
-        rectCount += 1;
-	}
-};
+// Signed distance to a rounded box with its lower left corner at the origin
+float roundedBoxDistance(vec2 p, vec2 halfSize, float radius)
+{
+    vec2 q = abs(p - halfSize) - halfSize + radius;
+    return length(max(q, 0.0)) + min(max(q.x, q.y), 0.0) - radius;
+}
 
-static const char* VERTEX_SHADER_SIMPLE_COLOR =
+void main()
+{
+    vec4 color = vertexColor * texture(atlas, uv);
+
+    // Derivatives need all pixels of the quad, so they are taken outside of the branch
+    vec2 p = local * size;
+    float pixel = max(abs(dFdx(p.x)), abs(dFdy(p.y)));
+
+    uint kind = shapeParams & 3u;
+    if (kind != 0u) {
+        // Decoded like shapeRadius() and shapeWidth()
+        float radius = float((shapeParams >> 4) & 0x3FFFu) / 16.0;
+        float width = float(shapeParams >> 18) / 16.0;
+
+        float distance;
+        if (kind == 1u) {
+            vec2 halfSize = 0.5 * size;
+            radius = min(radius, min(halfSize.x, halfSize.y));
+            distance = roundedBoxDistance(p, halfSize, radius);
+            if (width > 0.0) {
+                // Border inside the edge
+                distance = abs(distance + 0.5 * width) - 0.5 * width;
+            }
+        }
+        else {
+            // The end points are inset by the margin added in RenderCommandBuffer::push()
+            float margin = 0.5 * width + 1.0;
+            bool flipped = (shapeParams & 4u) != 0u;
+            vec2 a = vec2(margin, flipped ? size.y - margin : margin);
+            vec2 b = vec2(size.x - margin, flipped ? margin : size.y - margin);
+            vec2 pa = p - a;
+            vec2 ba = b - a;
+            float h = clamp(dot(pa, ba) / max(dot(ba, ba), 1e-6), 0.0, 1.0);
+            distance = length(pa - ba * h) - 0.5 * width;
+        }
+
+        // Coverage of a one pixel wide filter across the edge
+        color.a *= clamp(0.5 - distance / pixel, 0.0, 1.0);
+    }
+    FragColor = color;
+}
+)";
+
+// The instanced path generates the quad corners from gl_VertexID,
+// so only one RectInstance is uploaded per rectangle.
+static const char* VERTEX_SHADER_RECT_INSTANCED =
 "#version 330 core\n"
 "#line " STR(__LINE__) "\n"
 R"(
-layout (location = 0) in vec3 pos;
+layout (location = 0) in vec4 rect;
 layout (location = 1) in vec4 color;
+layout (location = 2) in vec4 uvRect;
+layout (location = 4) in uint shape;
 
 uniform mat4 projection;
 
 out vec4 vertexColor;
+out vec2 uv;
+out vec2 local;
+flat out vec2 size;
+flat out uint shapeParams;
+
+// Same triangle order as expandRect()
+const vec2 corners[6] = vec2[6](
+    vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(0.0, 1.0),
+    vec2(1.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 1.0)
+);
 
 void main()
 {
-    vec4 pos = projection * vec4(pos.x, pos.y, pos.z, 1.0);
-    gl_Position = pos;
+    vec2 corner = corners[gl_VertexID];
+    vec2 pos = rect.xy + corner * rect.zw;
+    gl_Position = projection * vec4(pos, 0.0, 1.0);
     vertexColor = color;
+    uv = (shape & 3u) == 0u ? mix(uvRect.xy, uvRect.zw, corner) : vec2(0.0);
+    local = corner;
+    size = rect.zw;
+    shapeParams = shape;
 }
 )";
 
-static const char* FRAGMENT_SHADER_VERTEX_COLOR =
+// Static meshes, lit by a fixed directional light
+static const char* VERTEX_SHADER_MESH =
+"#version 330 core\n"
+"#line " STR(__LINE__) "\n"
+R"(
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 normal;
+
+uniform mat4 viewProjection;
+uniform mat4 model;
+uniform vec4 color;
+
+out vec3 worldNormal;
+flat out vec4 meshColor;
+
+void main()
+{
+    gl_Position = viewProjection * model * vec4(position, 1.0);
+    // Only correct for uniform scaling, which is enough for static meshes
+    worldNormal = mat3(model) * normal;
+    meshColor = color;
+}
+)";
+
+// Batched meshes read their transform and color from the instances of the batch
+static const char* VERTEX_SHADER_MESH_MULTI_DRAW =
+"#version 430 core\n"
+"#line " STR(__LINE__) "\n"
+R"(
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 normal;
+layout (location = 2) in uint drawIndex;
+
+struct MeshInstance
+{
+    mat4 transform;
+    vec4 color;
+};
+
+layout (std430, row_major, binding = 0) readonly buffer MeshInstances
+{
+    MeshInstance instances[];
+};
+
+uniform mat4 viewProjection;
+
+out vec3 worldNormal;
+flat out vec4 meshColor;
+
+void main()
+{
+    MeshInstance instance = instances[drawIndex];
+    gl_Position = viewProjection * instance.transform * vec4(position, 1.0);
+    worldNormal = mat3(instance.transform) * normal;
+    meshColor = instance.color;
+}
+)";
+
+static const char* FRAGMENT_SHADER_MESH =
 "#version 330 core\n"
 "#line " STR(__LINE__) "\n"
 R"(
 out vec4 FragColor;
 
-in vec4 vertexColor;
+in vec3 worldNormal;
+flat in vec4 meshColor;
+
+const vec3 lightDirection = vec3(0.267261, 0.801784, 0.534522);
 
 void main()
 {
-    FragColor = vertexColor;
-} 
+    float diffuse = max(dot(normalize(worldNormal), lightDirection), 0.0);
+    FragColor = vec4(meshColor.rgb * (0.25 + 0.75 * diffuse), meshColor.a);
+}
+)";
+
+// Appends the commands of the meshes inside the frustum, see isSphereInFrustum
+static const char* COMPUTE_SHADER_MESH_CULL =
+"#version 430 core\n"
+"#line " STR(__LINE__) "\n"
+R"(
+layout (local_size_x = 64) in;
+
+struct MeshInstance
+{
+    mat4 transform;
+    vec4 color;
+};
+
+struct MeshCandidate
+{
+    vec4 sphere;
+    uint indexCount;
+    uint firstIndex;
+    int baseVertex;
+    uint instance;
+    uint drawIndex;
+    uint batch;
+    uint firstCommand;
+    uint padding;
+};
+
+struct DrawElementsIndirectCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout (std430, row_major, binding = 0) readonly buffer MeshInstances
+{
+    MeshInstance instances[];
+};
+
+layout (std430, binding = 1) readonly buffer MeshCandidates
+{
+    MeshCandidate candidates[];
+};
+
+layout (std430, binding = 2) writeonly buffer DrawCommands
+{
+    DrawElementsIndirectCommand commands[];
+};
+
+layout (std430, binding = 3) buffer DrawCounts
+{
+    uint counts[];
+};
+
+uniform vec4 planes[6];
+uniform uint candidateCount;
+
+void main()
+{
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= candidateCount) {
+        return;
+    }
+
+    MeshCandidate candidate = candidates[index];
+    mat4 transform = instances[candidate.instance].transform;
+    vec4 sphere = candidate.sphere;
+
+    // Rows of the transform, written out like on the CPU
+    vec3 center;
+    for (int axis = 0; axis < 3; ++axis) {
+        center[axis] = transform[0][axis] * sphere.x + transform[1][axis] * sphere.y + transform[2][axis] * sphere.z + transform[3][axis];
+    }
+    float scaleSquared = 0.0;
+    for (int column = 0; column < 3; ++column) {
+        vec3 axis = transform[column].xyz;
+        scaleSquared = max(axis.x * axis.x + axis.y * axis.y + axis.z * axis.z, scaleSquared);
+    }
+    float radius = sphere.w * sqrt(scaleSquared);
+
+    for (int p = 0; p < 6; ++p) {
+        vec4 plane = planes[p];
+        if (plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w < -radius) {
+            return;
+        }
+    }
+
+    uint slot = atomicAdd(counts[candidate.batch], 1u);
+    commands[candidate.firstCommand + slot] = DrawElementsIndirectCommand(
+        candidate.indexCount, 1u, candidate.firstIndex, candidate.baseVertex, candidate.drawIndex);
+}
 )";
 
-#pragma pack(1)
-struct ColoredVertex {
-    float pos[3];
-    Color color;
+// The binding index connects the attribute location with a specific buffer
+// They do not have to be the same
+static const int INSTANCE_BINDING_INDEX = 0;
+static const int MESH_BINDING_INDEX = 1;
+static const int MESH_DRAW_INDEX_BINDING_INDEX = 2;
+
+// Work group size of the culling compute shader
+static const u32 MESH_CULL_GROUP_SIZE = 64;
+
+enum MeshCulling {
+    MeshCulling_None,
+    // Tests the meshes while writing the indirect commands
+    MeshCulling_Cpu,
+    // Tests the meshes in a compute shader, which writes the indirect commands
+    MeshCulling_Gpu,
+};
+
+// Initial size of each frame region in the streaming buffer, it grows on demand
+static const u64 STREAMING_REGION_SIZE = 1 * MB;
+
+// Number of frames the CPU may record while the GPU is still busy with earlier ones
+static const int DEFAULT_FRAMES_IN_FLIGHT = 2;
+
+// Upper bound for command buffers which are recorded on other threads
+static const int MAX_THREAD_COMMAND_BUFFERS = 16;
+
+// Sorted commands are uploaded in parallel once there are at least this many per job
+static const u64 UPLOAD_JOB_MIN_COMMANDS = 4096;
+static const int MAX_UPLOAD_JOBS = 16;
+
+// Size of the texture atlas in texels
+static const int DEFAULT_ATLAS_SIZE = 2048;
+
+// Temporary memory per rectangle of a segment: entry, sort buffer, batch, cull bounds and the gather of the expanded path
+static const u64 RECT_SEGMENT_BYTES_PER_COMMAND = 2 * sizeof(SortEntry) + sizeof(RenderBatch) + 4 * sizeof(float) + RECT_BATCH_ARRAYS * sizeof(float);
+// Kept free for the allocations of a segment that do not grow with it, like the sort histograms
+static const u64 RECT_SEGMENT_RESERVE = 64 * KB;
+
+// Builds the sort keys of one command chunk
+struct SortKeyJob {
+    RenderCommandChunk* chunk;
+    // Index of the command buffer of the chunk, for the scissor in the keys
+    u32 buffer;
+    SortEntry* entries;
+    // Optional, filled in the same order as the entries
+    CullBounds* bounds;
+    // Submission index of the first command in the chunk
+    u32 firstDepth;
+};
+
+// Where gatherRectSegment() continues in the command buffers
+struct RectCursor {
+    int buffer;
+    RenderCommandChunk* chunk;
+    RenderCommand* command;
+    // Next rectangle of the command, text commands have one per glyph
+    u32 rect;
+    // Submission index of the next rectangle
+    u32 depth;
+};
+
+// Uploads a range of sorted rectangles into the streaming buffer
+struct RectUploadJob {
+    SortEntry* entries;
+    u64 first;
+    u64 count;
+    void* target;
+    // Expanded path only: scratch memory for the gather
+    ArenaAllocator scratch;
+    // Content hash of the range, used by the retained cache
+    u64 hash;
+};
+
+// CPU time spent in the phases of a render() call, in performance counter ticks
+struct RenderTimings {
+    // Sort keys, culling, sorting and batching
+    u64 prepareTicks;
+    // Writing the instance or vertex data, including the vertex expansion
+    u64 uploadTicks;
+    // State changes and draw calls
+    u64 submitTicks;
+    // Writing the draw data, state changes and draw calls of the meshes
+    u64 meshSubmitTicks;
+};
+
+// Where the instance or vertex data of the sorted commands was uploaded to
+struct UploadedCommands {
+    unsigned int buffer;
+    u64 offset;
 };
 
 struct Renderer {
     RenderCommandBuffer commands;
+
+    // Command buffers recorded in parallel, rendered after commands in index order
+    RenderCommandBuffer threadCommands[MAX_THREAD_COMMAND_BUFFERS];
+    int threadCommandCount;
+
+    // Runs key generation and uploads in parallel, optional
+    JobSystem* jobSystem;
+
+    // Allocates further chunks when the command buffers grow
+    Allocator commandAllocator;
+
     // Used to to store temporary data during rendering
     ArenaAllocator temporaryRenderBuffer;
 
-    // TODO: Get rid of the windows specific code here
-    HDC deviceContext;
+    // Vertex and instance data is written directly into this buffer
+    StreamingBuffer streamingBuffer;
 
-    unsigned int vertexArray;
-    unsigned int vertexBuffer;
+    // Reuses the uploaded data of segments that did not change since the last frame
+    RetainedCache retainedCache;
+    bool useRetainedCache;
 
-    unsigned int vertexShader;
-    unsigned int fragmentShader;
-    unsigned int shaderProgram;
+    // Keeps the CPU at most a few frames ahead of the GPU
+    FramePacer framePacer;
+
+    // Images of textured rectangles, bound for all rectangles
+    TextureAtlas atlas;
+    // Glyphs of text commands, stored in the atlas
+    GlyphCache glyphCache;
+    // Large textures uploaded over several frames, advanced by each render() call
+    TextureStreamer textureStreamer;
+
+    // Vertices and indices of mesh commands
+    MeshStore meshes;
+
+    // Compiles the programs in parallel and keeps their binaries on disk
+    ShaderCache shaderCache;
+    // Prefix of the program binary files, set before setup(). nullptr disables the disk cache.
+    wchar_t const* shaderCachePath;
 
+    // Draw rectangles with one instance each instead of six expanded vertices
+    bool useInstancedRects;
+    // Expand the vertices with the AVX2 kernel instead of the scalar loop. It is not faster on the
+    // machines measured with bench_vertex_expansion, even when writing into the mapped buffer.
+    bool useAvx2Expansion;
+    // Draw the meshes of a pool with one glMultiDrawElementsIndirect instead of one call each
+    bool useMeshMultiDraw;
+    // Frustum culling of multi-draw meshes, GPU culling falls back to the CPU if it is not supported
+    MeshCulling meshCulling;
+    bool gpuMeshCullingSupported;
+
+    unsigned int vertexArray;
+    unsigned int shaderProgram;
     int projectionLocation;
 
-    void setup(HDC dc, void* renderMemory, int renderMemorySize) {
+    unsigned int rectVertexArray;
+    unsigned int rectShaderProgram;
+    int rectProjectionLocation;
+
+    unsigned int meshVertexArray;
+    unsigned int meshShaderProgram;
+    int meshViewProjectionLocation;
+    int meshModelLocation;
+    int meshColorLocation;
+    unsigned int meshMultiDrawProgram;
+    int meshMultiDrawViewProjectionLocation;
+    unsigned int meshCullProgram;
+    int meshCullPlanesLocation;
+    int meshCullCandidateCountLocation;
+    // Offsets of storage buffer ranges must be multiples of this
+    int storageBufferAlignment;
+
+    float projection[16];
+    // Applied to meshes instead of the projection
+    float viewProjection[16];
+
+    // Area covered by the projection, only valid for axis aligned 2D projections
+    CullRect viewport;
+    bool viewportValid;
+
+    // Skip rectangles outside the viewport or hidden behind later opaque rectangles
+    bool useViewportCulling;
+    bool useOcclusionCulling;
+    // Area rectangles are culled against in the current render() call, the viewport or the bounds of the damage
+    CullRect cullViewport;
+    // Counts of the last render() call
+    CullStats cullStats;
+
+    // Number of state batches drawn by the last render() call
+    u32 batchCount;
+    // Batches of the last render() call drawn with the hardware scissor, see RenderCommandBuffer::pushClip()
+    u32 scissorBatchCount;
+    // GL viewport of the last render() call, scissor rects are converted to pixels with it
+    int scissorViewport[4];
+    // Number of segments the rectangles of the last render() call were drawn in, see renderRectSegments()
+    u32 rectSegmentCount;
+    // Number of meshes submitted and of the draw calls for them in the last render() call
+    u32 meshDrawCount;
+    u32 meshDrawCalls;
+    // Meshes culled on the CPU in the last render() call, GPU culling is not counted here
+    u32 meshCulledCount;
+    // Visible mesh count of each batch of the last GPU culled frame, see readGpuVisibleMeshes.
+    // The counts are copied out of the streaming buffer, which is replaced when it has to grow.
+    unsigned int meshCullCountBuffer;
+    u32 meshCullCountCapacity;
+    u32 meshCullBatchCount;
+    RenderTimings timings;
+
+    // Only redraw what changed since the last frame, see beginDamagedFrame()
+    bool useDamageTracking;
+    DamageTracker damage;
+    // The last render() call found no damage and drew nothing, the frame does not need to be presented
+    bool frameSkipped;
+    // Keeps the content of the last frame, damaged regions are redrawn into it and then copied to the target
+    unsigned int damageFramebuffer;
+    unsigned int damageColorBuffer;
+    unsigned int damageDepthBuffer;
+    int damageWidth;
+    int damageHeight;
+    // Draw framebuffer of the caller, the cache is copied to it at the end of render()
+    int damageTargetFramebuffer;
+
+    void setup(void* renderMemory, int renderMemorySize) {
+        // The first chunk of the commands, larger frames grow the buffer with pages
         int commandSize = renderMemorySize / 2;
-        commands.allocator = createArenaAllocator(renderMemory, commandSize);
+        commandAllocator = createPageAllocator();
+        commands.create(renderMemory, commandSize, &commandAllocator);
         int tempSize = renderMemorySize - commandSize;
         temporaryRenderBuffer = createArenaAllocator((u8*)renderMemory + commandSize, tempSize);
 
-        deviceContext = dc;
+        useInstancedRects = true;
+        useMeshMultiDraw = true;
+        meshCulling = MeshCulling_Gpu;
+        useRetainedCache = true;
+        useViewportCulling = true;
+        useOcclusionCulling = true;
 
+        streamingBuffer.create(STREAMING_REGION_SIZE);
+        framePacer.create(DEFAULT_FRAMES_IN_FLIGHT);
+        atlas.create(DEFAULT_ATLAS_SIZE, DEFAULT_ATLAS_SIZE, nullptr);
+        glyphCache.create(&atlas);
+        textureStreamer.create(DEFAULT_TEXTURE_STREAM_RING_SIZE, DEFAULT_TEXTURE_STREAM_BUDGET);
+        meshes.create();
+        damage.create(&commandAllocator);
+
+        // The draw count of the culled commands is read from a buffer
+        int versionMajor = 0;
+        int versionMinor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &versionMajor);
+        glGetIntegerv(GL_MINOR_VERSION, &versionMinor);
+        bool hasIndirectCount = versionMajor > 4 || (versionMajor == 4 && versionMinor >= 6) || gl_hasExtension("GL_ARB_indirect_parameters");
+        gpuMeshCullingSupported = hasIndirectCount && glMultiDrawElementsIndirectCount;
+
+        // All programs compile while the vertex arrays are set up, their uniforms are looked up at the end
+        shaderCache.create(shaderCachePath);
+        shaderProgram = shaderCache.add("expanded rects", VERTEX_SHADER_SIMPLE_COLOR, FRAGMENT_SHADER_VERTEX_COLOR);
+        rectShaderProgram = shaderCache.add("instanced rects", VERTEX_SHADER_RECT_INSTANCED, FRAGMENT_SHADER_VERTEX_COLOR);
+        meshShaderProgram = shaderCache.add("meshes", VERTEX_SHADER_MESH, FRAGMENT_SHADER_MESH);
+        meshMultiDrawProgram = shaderCache.add("multi-draw meshes", VERTEX_SHADER_MESH_MULTI_DRAW, FRAGMENT_SHADER_MESH);
+        if (gpuMeshCullingSupported) {
+            meshCullProgram = shaderCache.addCompute("mesh culling", COMPUTE_SHADER_MESH_CULL);
+        }
+
+        // Expanded rectangles are read from a storage buffer, the core profile still needs a vertex array
         glGenVertexArrays(1, &vertexArray);
         glBindVertexArray(vertexArray);
 
-        glGenBuffers(1, &vertexBuffer);
+        // Instanced rectangles: all attributes advance once per instance
+        glGenVertexArrays(1, &rectVertexArray);
+        glBindVertexArray(rectVertexArray);
+
+        glVertexArrayBindingDivisor(rectVertexArray, INSTANCE_BINDING_INDEX, 1);
+
+        int rectIndex = 0;
+        glVertexArrayAttribFormat(rectVertexArray, rectIndex, 4, GL_FLOAT, GL_FALSE, 0);
+        glVertexArrayAttribBinding(rectVertexArray, rectIndex, INSTANCE_BINDING_INDEX);
+        glEnableVertexArrayAttrib(rectVertexArray, rectIndex);
+
+        int rectColorIndex = 1;
+        glVertexArrayAttribFormat(rectVertexArray, rectColorIndex, 4, GL_UNSIGNED_BYTE, GL_TRUE, 4 * sizeof(float));
+        glVertexArrayAttribBinding(rectVertexArray, rectColorIndex, INSTANCE_BINDING_INDEX);
+        glEnableVertexArrayAttrib(rectVertexArray, rectColorIndex);
+
+        int rectTexCoordIndex = 2;
+        glVertexArrayAttribFormat(rectVertexArray, rectTexCoordIndex, 4, GL_UNSIGNED_SHORT, GL_TRUE, 4 * sizeof(float) + sizeof(u32));
+        glVertexArrayAttribBinding(rectVertexArray, rectTexCoordIndex, INSTANCE_BINDING_INDEX);
+        glEnableVertexArrayAttrib(rectVertexArray, rectTexCoordIndex);
+
+        int rectShapeIndex = 4;
+        glVertexArrayAttribIFormat(rectVertexArray, rectShapeIndex, 1, GL_UNSIGNED_INT, 4 * sizeof(float) + 3 * sizeof(u32));
+        glVertexArrayAttribBinding(rectVertexArray, rectShapeIndex, INSTANCE_BINDING_INDEX);
+        glEnableVertexArrayAttrib(rectVertexArray, rectShapeIndex);
 
-        vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        gl_compileShader(vertexShader, VERTEX_SHADER_SIMPLE_COLOR);
+        // Meshes: the buffers of a pool are bound before its meshes are drawn
+        glGenVertexArrays(1, &meshVertexArray);
+        glBindVertexArray(meshVertexArray);
 
-        fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        gl_compileShader(fragmentShader, FRAGMENT_SHADER_VERTEX_COLOR);
+        int meshPositionIndex = 0;
+        glVertexArrayAttribFormat(meshVertexArray, meshPositionIndex, 3, GL_FLOAT, GL_FALSE, 0);
+        glVertexArrayAttribBinding(meshVertexArray, meshPositionIndex, MESH_BINDING_INDEX);
+        glEnableVertexArrayAttrib(meshVertexArray, meshPositionIndex);
 
-        shaderProgram = glCreateProgram();
-        glAttachShader(shaderProgram, vertexShader);
-        glAttachShader(shaderProgram, fragmentShader);
-        gl_linkProgram(shaderProgram);
+        int meshNormalIndex = 1;
+        glVertexArrayAttribFormat(meshVertexArray, meshNormalIndex, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float));
+        glVertexArrayAttribBinding(meshVertexArray, meshNormalIndex, MESH_BINDING_INDEX);
+        glEnableVertexArrayAttrib(meshVertexArray, meshNormalIndex);
 
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageBufferAlignment);
+
+        // Advances once per instance, so it is the base instance of the draw
+        int meshDrawIndex = 2;
+        glVertexArrayBindingDivisor(meshVertexArray, MESH_DRAW_INDEX_BINDING_INDEX, 1);
+        glVertexArrayVertexBuffer(meshVertexArray, MESH_DRAW_INDEX_BINDING_INDEX, meshes.drawIndexBuffer, 0, sizeof(u32));
+        glVertexArrayAttribIFormat(meshVertexArray, meshDrawIndex, 1, GL_UNSIGNED_INT, 0);
+        glVertexArrayAttribBinding(meshVertexArray, meshDrawIndex, MESH_DRAW_INDEX_BINDING_INDEX);
+        glEnableVertexArrayAttrib(meshVertexArray, meshDrawIndex);
+
+        glBindVertexArray(vertexArray);
+
+        shaderCache.finish();
         projectionLocation = glGetUniformLocation(shaderProgram, "projection");
+        rectProjectionLocation = glGetUniformLocation(rectShaderProgram, "projection");
+        meshViewProjectionLocation = glGetUniformLocation(meshShaderProgram, "viewProjection");
+        meshModelLocation = glGetUniformLocation(meshShaderProgram, "model");
+        meshColorLocation = glGetUniformLocation(meshShaderProgram, "color");
+        meshMultiDrawViewProjectionLocation = glGetUniformLocation(meshMultiDrawProgram, "viewProjection");
+        if (gpuMeshCullingSupported) {
+            meshCullPlanesLocation = glGetUniformLocation(meshCullProgram, "planes");
+            meshCullCandidateCountLocation = glGetUniformLocation(meshCullProgram, "candidateCount");
+        }
     }
 
-    void render() {
-        // Be careful if we use the same arenas for the command buffer and rendering memory
-        // TODO: We probably want to separate them
-        RenderCommand* command = commands.first();
-        RenderCommand* onePastLast = commands.onePastLast();
-
-        ColoredVertex* rectVertices = temporaryRenderBuffer.allocateArray<ColoredVertex>(commands.rectCount * 6ULL);
-        ColoredVertex* rectVertex = rectVertices;
-
-        while (command < onePastLast) {
-            if (command->type == Render_Rectangle) {
-                RenderCommandRectangle* rect = (RenderCommandRectangle*)command;
-
-                ColoredVertex* vertex = rectVertex;
-
-                float xPos = rect->x;
-                float yPos = rect->y;
-                Color color = rect->color;
-
-                // First triangle
-                rectVertex[0].pos[0] = xPos;
-                rectVertex[0].pos[1] = yPos;
-                rectVertex[0].pos[2] = 0.0f;
-                rectVertex[0].color = color;
-                rectVertex[1].pos[0] = xPos + rect->width;
-                rectVertex[1].pos[1] = yPos;
-                rectVertex[1].pos[2] = 0.0f;
-                rectVertex[1].color = color;
-                rectVertex[2].pos[0] = xPos;
-                rectVertex[2].pos[1] = yPos + rect->height;
-                rectVertex[2].pos[2] = 0.0f;
-                rectVertex[2].color = color;
-
-                // Second triangle
-                rectVertex[3].pos[0] = xPos + rect->width;
-                rectVertex[3].pos[1] = yPos;
-                rectVertex[3].pos[2] = 0.0f;
-                rectVertex[3].color = color;
-                rectVertex[4].pos[0] = xPos + rect->width;
-                rectVertex[4].pos[1] = yPos + rect->height;
-                rectVertex[4].pos[2] = 0.0f;
-                rectVertex[4].color = color;
-                rectVertex[5].pos[0] = xPos;
-                rectVertex[5].pos[1] = yPos + rect->height;
-                rectVertex[5].pos[2] = 0.0f;
-                rectVertex[5].color = color;
-
-                rectVertex += 6;
-
-                command = (RenderCommand*)((u8*)command + sizeof(RenderCommandRectangle));
+    // Row-major projection matrix which is applied to all following render() calls
+    void setProjection(const float* matrix) {
+        for (int i = 0; i < 16; ++i) {
+            projection[i] = matrix[i];
+        }
+
+        // Invert the scale and translation of x and y to get the area that maps to [-1, 1].
+        // Rotations and perspective projections disable culling.
+        const float* m = projection;
+        viewportValid = m[1] == 0.0f && m[4] == 0.0f && m[0] != 0.0f && m[5] != 0.0f
+            && m[12] == 0.0f && m[13] == 0.0f && m[15] == 1.0f;
+        if (viewportValid) {
+            float x0 = (-1.0f - m[3]) / m[0];
+            float x1 = (1.0f - m[3]) / m[0];
+            float y0 = (-1.0f - m[7]) / m[5];
+            float y1 = (1.0f - m[7]) / m[5];
+            viewport.minX = x0 < x1 ? x0 : x1;
+            viewport.maxX = x0 < x1 ? x1 : x0;
+            viewport.minY = y0 < y1 ? y0 : y1;
+            viewport.maxY = y0 < y1 ? y1 : y0;
+        }
+    }
+
+    // Row-major view and projection matrix for meshes, applied to all following render() calls
+    void setViewProjection(const float* matrix) {
+        for (int i = 0; i < 16; ++i) {
+            viewProjection[i] = matrix[i];
+        }
+    }
+
+    /**
+     * Splits memory into count command buffers, which can be recorded on other threads.
+     * Each thread must only push to its own buffer between beginFrame() and render().
+     * A buffer that outgrows its part of the memory continues in chunks of pages.
+     */
+    void setupThreadCommands(int count, void* memory, u64 size) {
+        Assert(count <= MAX_THREAD_COMMAND_BUFFERS);
+
+        threadCommandCount = count;
+        u64 bufferSize = size / count;
+        for (int i = 0; i < count; ++i) {
+            threadCommands[i] = {};
+            threadCommands[i].create((u8*)memory + i * bufferSize, bufferSize, &commandAllocator);
+        }
+    }
+
+    // Main thread commands come first, followed by the thread buffers in index order
+    int collectCommandBuffers(RenderCommandBuffer** buffers) {
+        int count = 0;
+        buffers[count++] = &commands;
+        for (int i = 0; i < threadCommandCount; ++i) {
+            buffers[count++] = &threadCommands[i];
+        }
+        return count;
+    }
+
+    void runJobs(JobFunction* function, void* data, int count) {
+        if (jobSystem) {
+            jobSystem->run(function, data, count);
+        }
+        else {
+            for (int i = 0; i < count; ++i) {
+                function(data, i);
             }
-            else {
+        }
+    }
+
+    /**
+     * Builds the sort keys of all command chunks in parallel. The depth of a command is its submission index.
+     * If bounds is not null, the bounds of each command are stored at the index of its entry.
+     */
+    bool buildSortKeys(RenderCommandBuffer** buffers, int bufferCount, SortEntry* entries, CullBounds* bounds) {
+        int jobCount = 0;
+        for (int i = 0; i < bufferCount; ++i) {
+            for (RenderCommandChunk* chunk = buffers[i]->chunks; chunk; chunk = chunk->next) {
+                jobCount += chunk->rectCount > 0 ? 1 : 0;
+            }
+        }
+        SortKeyJob* jobs = temporaryRenderBuffer.allocateArray<SortKeyJob>(jobCount);
+        if (!jobs) {
+            return false;
+        }
+
+        int jobIndex = 0;
+        u32 depth = 0;
+        for (int i = 0; i < bufferCount; ++i) {
+            for (RenderCommandChunk* chunk = buffers[i]->chunks; chunk; chunk = chunk->next) {
+                if (chunk->rectCount > 0) {
+                    SortKeyJob* job = &jobs[jobIndex++];
+                    job->chunk = chunk;
+                    job->buffer = i;
+                    job->entries = entries + depth;
+                    job->bounds = bounds;
+                    job->firstDepth = depth;
+                    depth += chunk->rectCount;
+                }
+            }
+        }
+
+        runJobs(+[](void* data, int index) {
+            PROFILE_ZONE("sort keys job");
+            SortKeyJob* job = (SortKeyJob*)data + index;
+            RenderCommand* command = job->chunk->first();
+            RenderCommand* onePastLast = job->chunk->onePastLast();
+
+            SortEntry* entry = job->entries;
+            u32 depth = job->firstDepth;
+            while (command < onePastLast) {
+                u32 rectCount;
+                u64 stride;
+                RenderCommandRectangle* rect = getCommandRects(command, &rectCount, &stride);
+                if (rect) {
+                    // Text commands add one entry per glyph
+                    for (u32 i = 0; i < rectCount; ++i) {
+                        entry->key = makeRectangleSortKey(rect, depth, job->buffer);
+                        entry->command = rect;
+                        if (job->bounds) {
+                            storeCullBounds(job->bounds, depth, rect);
+                        }
+                        entry += 1;
+                        depth += 1;
+                        rect = (RenderCommandRectangle*)((u8*)rect + stride);
+                    }
+
+                    command = nextRenderCommand(command);
+                }
+                else {
+                    OutputDebugStringW(L"Unknown command type\n");
+                    DebugBreak();
+                    continue;
+                }
+            }
+        }, jobs, jobCount);
+        return true;
+    }
+
+    /**
+     * Collects the next up to capacity rectangles of one sort key class, in
+     * submission order and starting where the cursor stopped. Returns their
+     * number, 0 once all buffers are done.
+     */
+    u64 gatherRectSegment(RenderCommandBuffer** buffers, int bufferCount, RectCursor* cursor, u32 rectClass,
+                          SortEntry* entries, CullBounds* bounds, u64 capacity) {
+        u64 count = 0;
+        while (count < capacity && cursor->buffer < bufferCount) {
+            // Without a chunk, the cursor is at the start of its buffer
+            if (!cursor->chunk) {
+                cursor->chunk = buffers[cursor->buffer]->chunks;
+                if (!cursor->chunk) {
+                    cursor->buffer += 1;
+                    continue;
+                }
+                cursor->command = cursor->chunk->first();
+            }
+            if (cursor->command >= cursor->chunk->onePastLast()) {
+                cursor->chunk = cursor->chunk->next;
+                if (cursor->chunk) {
+                    cursor->command = cursor->chunk->first();
+                }
+                else {
+                    cursor->buffer += 1;
+                }
+                continue;
+            }
+
+            u32 rectCount;
+            u64 stride;
+            RenderCommandRectangle* rect = getCommandRects(cursor->command, &rectCount, &stride);
+            if (!rect) {
                 OutputDebugStringW(L"Unknown command type\n");
                 DebugBreak();
-                continue;
+                cursor->buffer = bufferCount;
+                break;
+            }
+
+            rect = (RenderCommandRectangle*)((u8*)rect + cursor->rect * stride);
+            while (cursor->rect < rectCount && count < capacity) {
+                u64 key = makeRectangleSortKey(rect, cursor->depth, cursor->buffer);
+                if (sortKeyClass(key) == rectClass) {
+                    entries[count].key = key;
+                    entries[count].command = rect;
+                    if (bounds) {
+                        storeCullBounds(bounds, count, rect);
+                    }
+                    count += 1;
+                }
+                cursor->rect += 1;
+                cursor->depth += 1;
+                rect = (RenderCommandRectangle*)((u8*)rect + stride);
+            }
+            if (cursor->rect == rectCount) {
+                cursor->command = nextRenderCommand(cursor->command);
+                cursor->rect = 0;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * Splits the sorted entries into ranges for parallel upload. Ranges start at a
+     * multiple of 8 entries, which keeps the expanded vertices 32 byte aligned.
+     */
+    int splitUploadJobs(SortEntry* entries, u64 count, RectUploadJob* jobs) {
+        u64 jobCount = count / UPLOAD_JOB_MIN_COMMANDS + 1;
+        u64 threadCount = jobSystem ? jobSystem->threadCount + 1 : 1;
+        jobCount = jobCount < threadCount ? jobCount : threadCount;
+        jobCount = jobCount < MAX_UPLOAD_JOBS ? jobCount : MAX_UPLOAD_JOBS;
+
+        u64 jobSize = ((count + jobCount - 1) / jobCount + 7) & ~7ULL;
+        int jobIndex = 0;
+        for (u64 first = 0; first < count; first += jobSize) {
+            RectUploadJob* job = &jobs[jobIndex++];
+            *job = {};
+            job->entries = entries + first;
+            job->first = first;
+            job->count = count - first < jobSize ? count - first : jobSize;
+        }
+        return jobIndex;
+    }
+
+    // Batches of only opaque rectangles are drawn without blending, which gives the same result for an alpha of 1
+    void setBatchState(RenderBatch* batch, RenderBatch* previous) {
+        if (!previous || previous->blended != batch->blended) {
+            if (batch->blended) {
+                glEnable(GL_BLEND);
+            }
+            else {
+                glDisable(GL_BLEND);
+            }
+        }
+
+        u32 scissor = sortKeyScissor(batch->key);
+        if (!previous || sortKeyScissor(previous->key) != scissor) {
+            if (scissor) {
+                glEnable(GL_SCISSOR_TEST);
+                setScissor(scissor);
+            }
+            else {
+                glDisable(GL_SCISSOR_TEST);
+            }
+        }
+    }
+
+    /**
+     * Converts the clip rect of a scissor key to pixels with the projection and
+     * the viewport. A pixel is inside if its center is, like for a rectangle
+     * trimmed to the clip rect.
+     */
+    void setScissor(u32 scissorKey) {
+        RenderCommandBuffer* buffers[1 + MAX_THREAD_COMMAND_BUFFERS];
+        collectCommandBuffers(buffers);
+        ClipRect* clip = findScissorRect(buffers, scissorKey);
+
+        float pixels[4];
+        projectToPixels(projection, scissorViewport, clip->minX, clip->minY, clip->maxX, clip->maxY, pixels);
+
+        int x0 = (int)ceilFloat(pixels[0] - 0.5f);
+        int y0 = (int)ceilFloat(pixels[1] - 0.5f);
+        int x1 = (int)ceilFloat(pixels[2] - 0.5f);
+        int y1 = (int)ceilFloat(pixels[3] - 0.5f);
+        glScissor(x0, y0, x1 > x0 ? x1 - x0 : 0, y1 > y0 ? y1 - y0 : 0);
+    }
+
+    void render() {
+        PROFILE_ZONE("render");
+        timings = {};
+
+        RenderCommandBuffer* buffers[1 + MAX_THREAD_COMMAND_BUFFERS];
+        int bufferCount = collectCommandBuffers(buffers);
+
+        {
+            PROFILE_ZONE("stream textures");
+            textureStreamer.update(jobSystem);
+        }
+
+        // Rasterizes and uploads new glyphs, so it has to run on this thread
+        {
+            PROFILE_ZONE("layout text");
+            layoutTextCommands(buffers, bufferCount, &glyphCache, &temporaryRenderBuffer);
+        }
+
+        // Damage is computed after the layout, so it sees the glyphs
+        cullViewport = viewport;
+        frameSkipped = false;
+        bool damaged = useDamageTracking && beginDamagedFrame(buffers, bufferCount);
+        if (useDamageTracking && !damaged && damageFramebuffer) {
+            frameSkipped = true;
+            temporaryRenderBuffer.reset();
+            return;
+        }
+        defer{
+            if (damaged) {
+                endDamagedFrame();
             }
+        };
+
+        u64 commandCount = 0;
+        int meshCommandCount = 0;
+        u32 scissorCount = 0;
+        for (int i = 0; i < bufferCount; ++i) {
+            commandCount += buffers[i]->rectCount;
+            meshCommandCount += buffers[i]->meshCount;
+            scissorCount += buffers[i]->scissorCount;
+        }
+        if (scissorCount > 0) {
+            glGetIntegerv(GL_VIEWPORT, scissorViewport);
+        }
+
+        // Meshes are drawn below all rectangles
+        meshDrawCount = 0;
+        meshDrawCalls = 0;
+        meshCulledCount = 0;
+        meshCullBatchCount = 0;
+        if (meshCommandCount > 0) {
+            renderMeshes(buffers, bufferCount);
         }
 
-        if (commands.rectCount > 0) {
-            // TODO: Replace with named buffer calls
-            glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-            int vertexCount = rectVertex - rectVertices;
-            int bufferSize = vertexCount * sizeof(ColoredVertex);
-            glBufferData(GL_ARRAY_BUFFER, bufferSize, rectVertices, GL_STREAM_DRAW);
+        batchCount = 0;
+        scissorBatchCount = 0;
+        rectSegmentCount = 0;
+        cullStats = {};
+        cullStats.inputCommands = commandCount;
+        if (commandCount > 0) {
+            PROFILE_GPU_ZONE("rects");
 
-            glDrawArrays(GL_TRIANGLES, 0, vertexCount);
+            // Be careful if we use the same arenas for the command buffer and rendering memory
+            // TODO: We probably want to separate them
+            u64 segmentCapacity = rectSegmentCapacity();
+            if (commandCount <= segmentCapacity) {
+                u64 prepareStartTicks = getPerformanceCounter();
+                SortEntry* entries = temporaryRenderBuffer.allocateArray<SortEntry>(commandCount);
+
+                // Without bounds, the viewport culling is skipped for this frame
+                CullBounds bounds = {};
+                if (useViewportCulling && viewportValid) {
+                    bounds = allocateCullBounds(commandCount, &temporaryRenderBuffer);
+                }
+
+                if (!entries || !buildSortKeys(buffers, bufferCount, entries, bounds.minX ? &bounds : nullptr)) {
+                    OutputDebugStringW(L"Temporary render memory exhausted\n");
+                    temporaryRenderBuffer.reset();
+                    return;
+                }
+                timings.prepareTicks += getPerformanceCounter() - prepareStartTicks;
+                renderRectSegment(entries, commandCount, bounds.minX ? &bounds : nullptr, useRetainedCache);
+            }
+            else {
+                renderRectSegments(buffers, bufferCount, segmentCapacity);
+            }
         }
 
         temporaryRenderBuffer.reset();
     }
 
+    /**
+     * Finds the damage of this frame and prepares the cache to redraw it.
+     * Returns false if nothing changed, or if the cache could not be created,
+     * in which case the frame is drawn directly to the target.
+     *
+     * The damaged rectangles of the cache are cleared and get a stencil value
+     * of 1, everything drawn afterwards only passes the stencil test there.
+     * This keeps the clip scissor of the rectangles and the depth test of the
+     * meshes working as usual. Rectangles outside the bounds of the damage are
+     * culled.
+     */
+    bool beginDamagedFrame(RenderCommandBuffer** buffers, int bufferCount) {
+        PROFILE_ZONE("damage");
+        int frameViewport[4];
+        glGetIntegerv(GL_VIEWPORT, frameViewport);
+        int width = frameViewport[0] + frameViewport[2];
+        int height = frameViewport[1] + frameViewport[3];
+        if ((!damageFramebuffer || width != damageWidth || height != damageHeight) && !createDamageCache(width, height)) {
+            return false;
+        }
+
+        int rectCount = damage.update(buffers, bufferCount, projection, viewProjection, frameViewport, atlas.stats.evictedShelves);
+        if (rectCount == 0) {
+            return false;
+        }
+
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &damageTargetFramebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, damageFramebuffer);
+
+        glClearStencil(0);
+        glClear(GL_STENCIL_BUFFER_BIT);
+        glClearStencil(1);
+        glEnable(GL_SCISSOR_TEST);
+        DamageRect bounds = damage.rects[0];
+        for (int i = 0; i < rectCount; ++i) {
+            DamageRect* rect = &damage.rects[i];
+            glScissor(rect->minX, rect->minY, rect->maxX - rect->minX, rect->maxY - rect->minY);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+            bounds = unionDamageRects(&bounds, rect);
+        }
+        glDisable(GL_SCISSOR_TEST);
+        glClearStencil(0);
+
+        glEnable(GL_STENCIL_TEST);
+        glStencilFunc(GL_EQUAL, 1, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+
+        // Inverts the axis aligned projection for the pixel bounds of the damage
+        if (viewportValid && !damage.fullDamage) {
+            const float* m = projection;
+            float x0 = (2.0f * (bounds.minX - frameViewport[0]) / frameViewport[2] - 1.0f - m[3]) / m[0];
+            float x1 = (2.0f * (bounds.maxX - frameViewport[0]) / frameViewport[2] - 1.0f - m[3]) / m[0];
+            float y0 = (2.0f * (bounds.minY - frameViewport[1]) / frameViewport[3] - 1.0f - m[7]) / m[5];
+            float y1 = (2.0f * (bounds.maxY - frameViewport[1]) / frameViewport[3] - 1.0f - m[7]) / m[5];
+            cullViewport.minX = x0 < x1 ? x0 : x1;
+            cullViewport.maxX = x0 < x1 ? x1 : x0;
+            cullViewport.minY = y0 < y1 ? y0 : y1;
+            cullViewport.maxY = y0 < y1 ? y1 : y0;
+        }
+        return true;
+    }
+
+    /**
+     * Copies the whole cache to the target. The back buffer is undefined after
+     * a swap, so the undamaged pixels have to be copied as well.
+     */
+    void endDamagedFrame() {
+        glDisable(GL_STENCIL_TEST);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, damageTargetFramebuffer);
+
+        int readFramebuffer = 0;
+        glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, damageFramebuffer);
+        int* v = damage.viewport;
+        glBlitFramebuffer(v[0], v[1], v[0] + v[2], v[1] + v[3], v[0], v[1], v[0] + v[2], v[1] + v[3], GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+    }
+
+    // Returns false and disables damage tracking if the framebuffer is not supported
+    bool createDamageCache(int width, int height) {
+        destroyDamageCache();
+
+        int drawFramebuffer = 0;
+        int readFramebuffer = 0;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+        glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+
+        glGenRenderbuffers(1, &damageColorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, damageColorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+        // Meshes need depth, the stencil marks the damaged pixels
+        glGenRenderbuffers(1, &damageDepthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, damageDepthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+
+        glGenFramebuffers(1, &damageFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, damageFramebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, damageColorBuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, damageDepthBuffer);
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+        if (!complete) {
+            OutputDebugStringW(L"Damage cache framebuffer is incomplete, damage tracking is disabled\n");
+            destroyDamageCache();
+            useDamageTracking = false;
+            return false;
+        }
+
+        damageWidth = width;
+        damageHeight = height;
+        damage.invalidate();
+        return true;
+    }
+
+    void destroyDamageCache() {
+        if (damageFramebuffer) {
+            glDeleteFramebuffers(1, &damageFramebuffer);
+            glDeleteRenderbuffers(1, &damageColorBuffer);
+            glDeleteRenderbuffers(1, &damageDepthBuffer);
+            damageFramebuffer = 0;
+            damageColorBuffer = 0;
+            damageDepthBuffer = 0;
+        }
+    }
+
+    // Rectangles that fit into the temporary memory left for one segment, a multiple of the retained segment size
+    u64 rectSegmentCapacity() {
+        u64 available = temporaryRenderBuffer.size - temporaryRenderBuffer.used;
+        available = available > RECT_SEGMENT_RESERVE ? available - RECT_SEGMENT_RESERVE : 0;
+        u64 capacity = available / RECT_SEGMENT_BYTES_PER_COMMAND & ~(RETAINED_SEGMENT_COMMANDS - 1);
+        return capacity > RETAINED_SEGMENT_COMMANDS ? capacity : RETAINED_SEGMENT_COMMANDS;
+    }
+
+    /**
+     * Culls, sorts, uploads and draws the entries of one segment. The temporary
+     * memory it allocates can be released once it returns.
+     */
+    void renderRectSegment(SortEntry* entries, u64 count, CullBounds* bounds, bool retain) {
+        u64 startTicks = getPerformanceCounter();
+        rectSegmentCount += 1;
+
+        RenderBatch* batches = temporaryRenderBuffer.allocateArray<RenderBatch>(count);
+        if (!batches) {
+            OutputDebugStringW(L"Temporary render memory exhausted\n");
+            return;
+        }
+
+        if (bounds) {
+            u64 visibleCount = cullOutsideViewport(entries, bounds, count, cullViewport);
+            cullStats.viewportCulled += count - visibleCount;
+            count = visibleCount;
+        }
+
+        bool sorted = false;
+        {
+            PROFILE_ZONE("sort");
+            sorted = sortEntriesByLayer(entries, count, &temporaryRenderBuffer);
+        }
+        if (!sorted) {
+            // Unsorted entries are still drawn correctly, only with more state changes
+            OutputDebugStringW(L"Not enough temporary render memory to sort commands\n");
+        }
+
+        // Needs the final draw order, so it runs after sorting
+        if (useOcclusionCulling && viewportValid) {
+            OcclusionGrid occlusionGrid;
+            occlusionGrid.reset(viewport);
+            u64 visibleCount = cullOccluded(entries, count, &occlusionGrid);
+            cullStats.occlusionCulled += count - visibleCount;
+            count = visibleCount;
+        }
+
+        {
+            PROFILE_ZONE("merge batches");
+            mergeBatchNeighbors(entries, count);
+        }
+
+        u32 segmentBatchCount = buildRenderBatches(entries, count, batches);
+        batchCount += segmentBatchCount;
+        for (u32 i = 0; i < segmentBatchCount; ++i) {
+            scissorBatchCount += sortKeyScissor(batches[i].key) ? 1 : 0;
+        }
+        timings.prepareTicks += getPerformanceCounter() - startTicks;
+
+        // Everything may have been culled
+        if (count > 0) {
+            if (useInstancedRects) {
+                renderInstanced(entries, count, batches, segmentBatchCount, retain);
+            }
+            else {
+                renderExpanded(entries, count, batches, segmentBatchCount, retain);
+            }
+
+            // Blending is expected to be enabled and the scissor test disabled outside of the renderer
+            glEnable(GL_BLEND);
+            glDisable(GL_SCISSOR_TEST);
+        }
+    }
+
+    /**
+     * Draws a frame with more rectangles than fit into the temporary memory.
+     *
+     * Layers (the class of a sort key) decide the draw order before everything
+     * else, so the classes are drawn one after the other. The rectangles of a
+     * class are gathered in submission order into segments, and each segment is
+     * drawn before the next one is gathered. Within a class, rectangles are
+     * drawn in submission order, so the result is the same as sorting the whole
+     * frame. Batches are only merged within a segment.
+     *
+     * The retained cache is not used and occluders only hide rectangles of
+     * their own segment.
+     */
+    void renderRectSegments(RenderCommandBuffer** buffers, int bufferCount, u64 capacity) {
+        u64 classMask[SORT_KEY_CLASS_COUNT / 64] = {};
+        for (int i = 0; i < bufferCount; ++i) {
+            for (RenderCommandChunk* chunk = buffers[i]->chunks; chunk; chunk = chunk->next) {
+                for (RenderCommand* command = chunk->first(); command < chunk->onePastLast(); command = nextRenderCommand(command)) {
+                    u32 rectCount;
+                    u64 stride;
+                    RenderCommandRectangle* rect = getCommandRects(command, &rectCount, &stride);
+                    for (u32 r = 0; rect && r < rectCount; ++r) {
+                        u32 rectClass = sortKeyClass(makeRectangleSortKey(rect, 0, i));
+                        classMask[rectClass / 64] |= 1ULL << (rectClass % 64);
+                        rect = (RenderCommandRectangle*)((u8*)rect + stride);
+                    }
+                }
+            }
+        }
+
+        SortEntry* entries = temporaryRenderBuffer.allocateArray<SortEntry>(capacity);
+        CullBounds bounds = {};
+        if (useViewportCulling && viewportValid) {
+            bounds = allocateCullBounds(capacity, &temporaryRenderBuffer);
+        }
+        if (!entries) {
+            OutputDebugStringW(L"Temporary render memory exhausted\n");
+            return;
+        }
+
+        // Each segment releases its temporary memory before the next one
+        u64 segmentStart = temporaryRenderBuffer.used;
+        for (u32 rectClass = 0; rectClass < SORT_KEY_CLASS_COUNT; ++rectClass) {
+            if ((classMask[rectClass / 64] & (1ULL << (rectClass % 64))) == 0) {
+                continue;
+            }
+
+            RectCursor cursor = {};
+            while (true) {
+                u64 startTicks = getPerformanceCounter();
+                u64 count = gatherRectSegment(buffers, bufferCount, &cursor, rectClass, entries,
+                    bounds.minX ? &bounds : nullptr, capacity);
+                timings.prepareTicks += getPerformanceCounter() - startTicks;
+                if (count == 0) {
+                    break;
+                }
+
+                renderRectSegment(entries, count, bounds.minX ? &bounds : nullptr, false);
+                temporaryRenderBuffer.used = segmentStart;
+            }
+        }
+    }
+
+    /**
+     * Writes the data of the sorted entries into a buffer the draws can read from.
+     *
+     * writeJob is run for RectUploadJobs and writes job->count commands to job->target.
+     * Each job gets scratchPerCommand bytes of scratch memory per command.
+     */
+    UploadedCommands uploadCommands(SortEntry* entries, u64 count, u64 commandBytes, u64 alignment,
+                                    u64 scratchPerCommand, JobFunction* writeJob, bool retain) {
+        UploadedCommands result = {};
+        if (retain) {
+            return uploadRetained(entries, count, commandBytes, alignment, scratchPerCommand, writeJob);
+        }
+
+        StreamingAllocation allocation = streamingBuffer.allocate(count * commandBytes, alignment);
+
+        RectUploadJob jobs[MAX_UPLOAD_JOBS];
+        int jobCount = splitUploadJobs(entries, count, jobs);
+        for (int i = 0; i < jobCount; ++i) {
+            prepareUploadJob(&jobs[i], (u8*)allocation.data + jobs[i].first * commandBytes, scratchPerCommand);
+        }
+        runJobs(writeJob, jobs, jobCount);
+
+        result.buffer = streamingBuffer.buffer;
+        result.offset = allocation.offset;
+        return result;
+    }
+
+    void prepareUploadJob(RectUploadJob* job, void* target, u64 scratchPerCommand) {
+        job->target = target;
+        if (scratchPerCommand > 0) {
+            // The arena is not thread safe, so each job gathers into memory reserved up front
+            u64 scratchSize = scratchPerCommand * ((job->count + 7ULL) & ~7ULL);
+            job->scratch = createArenaAllocator(temporaryRenderBuffer.allocate(scratchSize), scratchSize);
+        }
+    }
+
+    /**
+     * Uploads only the segments whose content changed since the last frame.
+     * Changed segments are written to the streaming buffer and copied into the
+     * retained buffer on the GPU, which is ordered after the draws of earlier frames.
+     */
+    UploadedCommands uploadRetained(SortEntry* entries, u64 count, u64 commandBytes, u64 alignment,
+                                    u64 scratchPerCommand, JobFunction* writeJob) {
+        UploadedCommands result = {};
+        retainedCache.reserve(count, commandBytes);
+        result.buffer = retainedCache.buffer;
+        result.offset = 0;
+
+        u64 segmentCount = (count + RETAINED_SEGMENT_COMMANDS - 1) / RETAINED_SEGMENT_COMMANDS;
+        RectUploadJob* jobs = temporaryRenderBuffer.allocateArray<RectUploadJob>(segmentCount);
+        if (!jobs) {
+            OutputDebugStringW(L"Temporary render memory exhausted\n");
+            return result;
+        }
+
+        for (u64 i = 0; i < segmentCount; ++i) {
+            jobs[i] = {};
+            jobs[i].first = i * RETAINED_SEGMENT_COMMANDS;
+            jobs[i].count = count - jobs[i].first < RETAINED_SEGMENT_COMMANDS ? count - jobs[i].first : RETAINED_SEGMENT_COMMANDS;
+            jobs[i].entries = entries + jobs[i].first;
+        }
+        runJobs(+[](void* data, int index) {
+            RectUploadJob* job = (RectUploadJob*)data + index;
+            job->hash = hashRectSegment(job->entries, job->count);
+        }, jobs, (int)segmentCount);
+
+        // Move the changed segments to the front, they keep their order
+        RetainedStats* frameStats = &retainedCache.frameStats;
+        *frameStats = {};
+        u64 dirtyCount = 0;
+        u64 dirtyBytes = 0;
+        for (u64 i = 0; i < segmentCount; ++i) {
+            u64 segmentBytes = jobs[i].count * commandBytes;
+            if (retainedCache.contains(i, jobs[i].hash)) {
+                frameStats->segmentHits += 1;
+                frameStats->bytesReused += segmentBytes;
+            }
+            else {
+                frameStats->segmentMisses += 1;
+                frameStats->bytesUploaded += segmentBytes;
+                jobs[dirtyCount++] = jobs[i];
+                dirtyBytes += segmentBytes;
+            }
+        }
+        retainedCache.stats.segmentHits += frameStats->segmentHits;
+        retainedCache.stats.segmentMisses += frameStats->segmentMisses;
+        retainedCache.stats.bytesReused += frameStats->bytesReused;
+        retainedCache.stats.bytesUploaded += frameStats->bytesUploaded;
+
+        if (dirtyCount == 0) {
+            return result;
+        }
+
+        // Changed segments are packed back to back. All but the last segment are full,
+        // so every segment in the staging memory keeps the alignment.
+        StreamingAllocation staging = streamingBuffer.allocate(dirtyBytes, alignment);
+        u64 stagingOffset = 0;
+        for (u64 i = 0; i < dirtyCount; ++i) {
+            prepareUploadJob(&jobs[i], (u8*)staging.data + stagingOffset, scratchPerCommand);
+            stagingOffset += jobs[i].count * commandBytes;
+        }
+        runJobs(writeJob, jobs, (int)dirtyCount);
+
+        // Adjacent changed segments are copied together
+        u64 copyStart = 0;
+        for (u64 i = 0; i < dirtyCount; ++i) {
+            retainedCache.store(jobs[i].first / RETAINED_SEGMENT_COMMANDS, jobs[i].hash);
+
+            bool lastInRun = i + 1 == dirtyCount || jobs[i + 1].first != jobs[i].first + jobs[i].count;
+            if (lastInRun) {
+                u64 sourceOffset = (u8*)jobs[copyStart].target - (u8*)staging.data;
+                u64 size = (jobs[i].first + jobs[i].count - jobs[copyStart].first) * commandBytes;
+                glCopyNamedBufferSubData(streamingBuffer.buffer, retainedCache.buffer,
+                    staging.offset + sourceOffset, jobs[copyStart].first * commandBytes, size);
+                copyStart = i + 1;
+            }
+        }
+
+        return result;
+    }
+
+    void renderInstanced(SortEntry* entries, u64 count, RenderBatch* batches, u32 segmentBatchCount, bool retain) {
+        u64 uploadStartTicks = getPerformanceCounter();
+        UploadedCommands uploaded = uploadCommands(entries, count, sizeof(RectInstance), sizeof(RectInstance), 0,
+            +[](void* data, int index) {
+                PROFILE_ZONE("upload job");
+                RectUploadJob* job = (RectUploadJob*)data + index;
+                writeRectInstances(job->entries, job->count, (RectInstance*)job->target);
+            }, retain);
+        u64 submitStartTicks = getPerformanceCounter();
+        timings.uploadTicks += submitStartTicks - uploadStartTicks;
+        PROFILE_ZONE("submit rects");
+
+        glUseProgram(rectShaderProgram);
+        glUniformMatrix4fv(rectProjectionLocation, 1, GL_TRUE, projection);
+        glBindVertexArray(rectVertexArray);
+        glBindTextureUnit(0, atlas.texture);
+
+        for (u32 i = 0; i < segmentBatchCount; ++i) {
+            RenderBatch* batch = &batches[i];
+            setBatchState(batch, i > 0 ? &batches[i - 1] : nullptr);
+
+            u64 offset = uploaded.offset + batch->first * sizeof(RectInstance);
+            glVertexArrayVertexBuffer(rectVertexArray, INSTANCE_BINDING_INDEX, uploaded.buffer, offset, sizeof(RectInstance));
+            glDrawArraysInstanced(GL_TRIANGLES, 0, 6, batch->count);
+        }
+        timings.submitTicks += getPerformanceCounter() - submitStartTicks;
+    }
+
+    void renderExpanded(SortEntry* entries, u64 count, RenderBatch* batches, u32 segmentBatchCount, bool retain) {
+        // The rectangles are bound as a storage buffer, the streaming stores need 32 byte alignment
+        u64 alignment = storageBufferAlignment > 32 ? storageBufferAlignment : 32;
+        u64 uploadStartTicks = getPerformanceCounter();
+        UploadedCommands uploaded = {};
+        if (useAvx2Expansion) {
+            uploaded = uploadCommands(entries, count, sizeof(ExpandedRect), alignment, RECT_BATCH_ARRAYS * sizeof(float),
+                +[](void* data, int index) {
+                    PROFILE_ZONE("upload job");
+                    RectUploadJob* job = (RectUploadJob*)data + index;
+                    RectBatch batch = gatherRectBatch(job->entries, job->count, &job->scratch);
+                    expandRectBatchAvx2(&batch, (ExpandedRect*)job->target);
+                }, retain);
+        }
+        else {
+            uploaded = uploadCommands(entries, count, sizeof(ExpandedRect), alignment, 0,
+                +[](void* data, int index) {
+                    PROFILE_ZONE("upload job");
+                    RectUploadJob* job = (RectUploadJob*)data + index;
+                    expandRects(job->entries, job->count, (ExpandedRect*)job->target);
+                }, retain);
+        }
+        u64 submitStartTicks = getPerformanceCounter();
+        timings.uploadTicks += submitStartTicks - uploadStartTicks;
+        PROFILE_ZONE("submit rects");
+
+        glUseProgram(shaderProgram);
+        glUniformMatrix4fv(projectionLocation, 1, GL_TRUE, projection);
+        glBindVertexArray(vertexArray);
+        glBindTextureUnit(0, atlas.texture);
+
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, uploaded.buffer, uploaded.offset, count * sizeof(ExpandedRect));
+
+        for (u32 i = 0; i < segmentBatchCount; ++i) {
+            RenderBatch* batch = &batches[i];
+            setBatchState(batch, i > 0 ? &batches[i - 1] : nullptr);
+            glDrawArrays(GL_TRIANGLES, 6 * batch->first, 6 * batch->count);
+        }
+        timings.submitTicks += getPerformanceCounter() - submitStartTicks;
+    }
+
+    // Draws the meshes with depth testing and without blending
+    void renderMeshes(RenderCommandBuffer** buffers, int bufferCount) {
+        PROFILE_ZONE("meshes");
+        PROFILE_GPU_ZONE("meshes");
+        u64 startTicks = getPerformanceCounter();
+
+        glBindVertexArray(meshVertexArray);
+        glEnable(GL_DEPTH_TEST);
+        glDisable(GL_BLEND);
+
+        if (useMeshMultiDraw) {
+            renderMeshesMultiDraw(buffers, bufferCount);
+        }
+        else {
+            renderMeshesSingle(buffers, bufferCount);
+        }
+
+        glDisable(GL_DEPTH_TEST);
+        // Blending is expected to be enabled outside of the renderer
+        glEnable(GL_BLEND);
+        timings.meshSubmitTicks = getPerformanceCounter() - startTicks;
+    }
+
+    // Binds the vertices and indices of a pool for the following mesh draws
+    void bindMeshPool(u32 poolIndex) {
+        MeshPool* pool = &meshes.pools[poolIndex];
+        glVertexArrayVertexBuffer(meshVertexArray, MESH_BINDING_INDEX, pool->vertexBuffer, 0, sizeof(MeshVertex));
+        glVertexArrayElementBuffer(meshVertexArray, pool->indexBuffer);
+    }
+
+    // One draw call per mesh, in submission order
+    void renderMeshesSingle(RenderCommandBuffer** buffers, int bufferCount) {
+        glUseProgram(meshShaderProgram);
+        glUniformMatrix4fv(meshViewProjectionLocation, 1, GL_TRUE, viewProjection);
+
+        u32 boundPool = ~0u;
+        for (int i = 0; i < bufferCount; ++i) {
+            if (buffers[i]->meshCount == 0) {
+                continue;
+            }
+
+            for (RenderCommandChunk* chunk = buffers[i]->chunks; chunk; chunk = chunk->next) {
+                RenderCommand* command = chunk->first();
+                RenderCommand* onePastLast = chunk->onePastLast();
+                while (command < onePastLast) {
+                    if (command->type == Render_Mesh) {
+                        RenderCommandMesh* meshCommand = (RenderCommandMesh*)command;
+                        Mesh* mesh = meshes.get(meshCommand->mesh);
+                        if (mesh) {
+                            if (mesh->pool != boundPool) {
+                                bindMeshPool(mesh->pool);
+                                boundPool = mesh->pool;
+                            }
+
+                            Color color = meshCommand->color;
+                            glUniformMatrix4fv(meshModelLocation, 1, GL_TRUE, meshCommand->transform);
+                            glUniform4f(meshColorLocation, color.color[0], color.color[1], color.color[2], color.color[3]);
+                            glDrawElementsBaseVertex(GL_TRIANGLES, mesh->indexCount, GL_UNSIGNED_INT,
+                                (void*)((u64)mesh->firstIndex * sizeof(u32)), mesh->baseVertex);
+                            meshDrawCount += 1;
+                            meshDrawCalls += 1;
+                        }
+                    }
+                    command = nextRenderCommand(command);
+                }
+            }
+        }
+    }
+
+    /**
+     * Writes an instance per mesh and the indirect commands into the streaming
+     * buffer, grouped by pool, and draws each batch of a pool with one call.
+     * Within a pool the submission order is kept, except with GPU culling.
+     */
+    void renderMeshesMultiDraw(RenderCommandBuffer** buffers, int bufferCount) {
+        u32 poolDraws[MAX_MESH_POOLS] = {};
+        for (int i = 0; i < bufferCount; ++i) {
+            if (buffers[i]->meshCount == 0) {
+                continue;
+            }
+
+            for (RenderCommandChunk* chunk = buffers[i]->chunks; chunk; chunk = chunk->next) {
+                RenderCommand* command = chunk->first();
+                RenderCommand* onePastLast = chunk->onePastLast();
+                while (command < onePastLast) {
+                    if (command->type == Render_Mesh) {
+                        Mesh* mesh = meshes.get(((RenderCommandMesh*)command)->mesh);
+                        if (mesh) {
+                            poolDraws[mesh->pool] += 1;
+                        }
+                    }
+                    command = nextRenderCommand(command);
+                }
+            }
+        }
+
+        // A batch has up to MAX_MESH_BATCH_DRAWS draws of one pool. The instances of each
+        // pool start at a multiple of instanceAlignment, so their storage buffer ranges are aligned.
+        u64 alignment = storageBufferAlignment > 16 ? storageBufferAlignment : 16;
+        u32 instanceAlignment = (u32)(alignment / 16);
+        u32 poolFirstInstance[MAX_MESH_POOLS];
+        u32 poolFirstCommand[MAX_MESH_POOLS];
+        u32 poolFirstBatch[MAX_MESH_POOLS];
+        u32 instanceCount = 0;
+        u32 drawCount = 0;
+        u32 meshBatchCount = 0;
+        for (int pool = 0; pool < meshes.poolCount; ++pool) {
+            poolFirstInstance[pool] = instanceCount;
+            poolFirstCommand[pool] = drawCount;
+            poolFirstBatch[pool] = meshBatchCount;
+            instanceCount += (poolDraws[pool] + instanceAlignment - 1) / instanceAlignment * instanceAlignment;
+            drawCount += poolDraws[pool];
+            meshBatchCount += (poolDraws[pool] + MAX_MESH_BATCH_DRAWS - 1) / MAX_MESH_BATCH_DRAWS;
+        }
+        if (drawCount == 0) {
+            return;
+        }
+
+        bool gpuCulling = meshCulling == MeshCulling_Gpu && gpuMeshCullingSupported;
+        bool cpuCulling = meshCulling != MeshCulling_None && !gpuCulling;
+        u32* batchCounts = temporaryRenderBuffer.allocateArray<u32>(meshBatchCount);
+        if (!batchCounts) {
+            OutputDebugStringW(L"Temporary render memory exhausted\n");
+            return;
+        }
+        for (u32 i = 0; i < meshBatchCount; ++i) {
+            batchCounts[i] = 0;
+        }
+
+        // One allocation for everything, a second one could replace the buffer
+        u64 instancesOffset = 0;
+        u64 size = (u64)instanceCount * sizeof(MeshInstance);
+        u64 candidatesOffset = size;
+        if (gpuCulling) {
+            size += ((u64)drawCount * sizeof(MeshCandidate) + alignment - 1) & ~(alignment - 1);
+        }
+        u64 commandsOffset = size;
+        size += ((u64)drawCount * sizeof(DrawElementsIndirectCommand) + alignment - 1) & ~(alignment - 1);
+        u64 countsOffset = size;
+        size += (u64)meshBatchCount * sizeof(u32);
+        StreamingAllocation allocation = streamingBuffer.allocate(size, alignment);
+
+        u8* data = (u8*)allocation.data;
+        MeshInstance* instances = (MeshInstance*)(data + instancesOffset);
+        MeshCandidate* candidates = (MeshCandidate*)(data + candidatesOffset);
+        DrawElementsIndirectCommand* commands = (DrawElementsIndirectCommand*)(data + commandsOffset);
+        Frustum frustum = computeFrustum(viewProjection);
+
+        u32 poolCursors[MAX_MESH_POOLS] = {};
+        for (int i = 0; i < bufferCount; ++i) {
+            if (buffers[i]->meshCount == 0) {
+                continue;
+            }
+
+            for (RenderCommandChunk* chunk = buffers[i]->chunks; chunk; chunk = chunk->next) {
+                RenderCommand* command = chunk->first();
+                RenderCommand* onePastLast = chunk->onePastLast();
+                while (command < onePastLast) {
+                    if (command->type == Render_Mesh) {
+                        RenderCommandMesh* meshCommand = (RenderCommandMesh*)command;
+                        Mesh* mesh = meshes.get(meshCommand->mesh);
+                        if (mesh) {
+                            u32 draw = poolCursors[mesh->pool]++;
+                            u32 batch = poolFirstBatch[mesh->pool] + draw / MAX_MESH_BATCH_DRAWS;
+                            u32 firstCommand = poolFirstCommand[mesh->pool] + draw / MAX_MESH_BATCH_DRAWS * MAX_MESH_BATCH_DRAWS;
+                            u32 instanceIndex = poolFirstInstance[mesh->pool] + draw;
+
+                            MeshInstance* instance = instances + instanceIndex;
+                            for (int e = 0; e < 16; ++e) {
+                                instance->transform[e] = meshCommand->transform[e];
+                            }
+                            for (int c = 0; c < 4; ++c) {
+                                instance->color[c] = meshCommand->color.color[c];
+                            }
+
+                            float sphere[4] = { mesh->bounds.center[0], mesh->bounds.center[1], mesh->bounds.center[2], mesh->bounds.radius };
+                            if (gpuCulling) {
+                                MeshCandidate* candidate = candidates + (poolFirstCommand[mesh->pool] + draw);
+                                for (int c = 0; c < 4; ++c) {
+                                    candidate->sphere[c] = sphere[c];
+                                }
+                                candidate->indexCount = mesh->indexCount;
+                                candidate->firstIndex = mesh->firstIndex;
+                                candidate->baseVertex = mesh->baseVertex;
+                                candidate->instance = instanceIndex;
+                                candidate->drawIndex = draw % MAX_MESH_BATCH_DRAWS;
+                                candidate->batch = batch;
+                                candidate->firstCommand = firstCommand;
+                                candidate->padding = 0;
+                            }
+                            else if (!cpuCulling || isSphereInFrustum(&frustum, meshCommand->transform, sphere)) {
+                                DrawElementsIndirectCommand* indirect = commands + firstCommand + batchCounts[batch]++;
+                                indirect->count = mesh->indexCount;
+                                indirect->instanceCount = 1;
+                                indirect->firstIndex = mesh->firstIndex;
+                                indirect->baseVertex = mesh->baseVertex;
+                                indirect->baseInstance = draw % MAX_MESH_BATCH_DRAWS;
+                            }
+                            else {
+                                meshCulledCount += 1;
+                            }
+                        }
+                    }
+                    command = nextRenderCommand(command);
+                }
+            }
+        }
+
+        u32* counts = (u32*)(data + countsOffset);
+        for (u32 i = 0; i < meshBatchCount; ++i) {
+            counts[i] = batchCounts[i];
+        }
+        meshCullBatchCount = gpuCulling ? meshBatchCount : 0;
+
+        if (gpuCulling) {
+            glUseProgram(meshCullProgram);
+            glUniform4fv(meshCullPlanesLocation, 6, &frustum.planes[0][0]);
+            glUniform1ui(meshCullCandidateCountLocation, drawCount);
+            unsigned int buffer = streamingBuffer.buffer;
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, buffer, allocation.offset + instancesOffset, (u64)instanceCount * sizeof(MeshInstance));
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, buffer, allocation.offset + candidatesOffset, (u64)drawCount * sizeof(MeshCandidate));
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, buffer, allocation.offset + commandsOffset, (u64)drawCount * sizeof(DrawElementsIndirectCommand));
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 3, buffer, allocation.offset + countsOffset, (u64)meshBatchCount * sizeof(u32));
+            glDispatchCompute((drawCount + MESH_CULL_GROUP_SIZE - 1) / MESH_CULL_GROUP_SIZE, 1, 1);
+            // The commands and counts are read by the following draws
+            glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+            glBindBuffer(GL_PARAMETER_BUFFER, buffer);
+        }
+
+        glUseProgram(meshMultiDrawProgram);
+        glUniformMatrix4fv(meshMultiDrawViewProjectionLocation, 1, GL_TRUE, viewProjection);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, streamingBuffer.buffer);
+
+        for (int pool = 0; pool < meshes.poolCount; ++pool) {
+            if (poolDraws[pool] == 0) {
+                continue;
+            }
+            bindMeshPool(pool);
+
+            // The draw indices start at 0 for each batch, so each batch binds its own instances
+            for (u32 first = 0; first < poolDraws[pool]; first += MAX_MESH_BATCH_DRAWS) {
+                u32 count = poolDraws[pool] - first < MAX_MESH_BATCH_DRAWS ? poolDraws[pool] - first : MAX_MESH_BATCH_DRAWS;
+                u32 batch = poolFirstBatch[pool] + first / MAX_MESH_BATCH_DRAWS;
+                u64 instanceOffset = allocation.offset + instancesOffset + (u64)(poolFirstInstance[pool] + first) * sizeof(MeshInstance);
+                u64 commandOffset = allocation.offset + commandsOffset + (u64)(poolFirstCommand[pool] + first) * sizeof(DrawElementsIndirectCommand);
+                glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, streamingBuffer.buffer, instanceOffset, count * sizeof(MeshInstance));
+                if (gpuCulling) {
+                    u64 countOffset = allocation.offset + countsOffset + batch * sizeof(u32);
+                    glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)commandOffset, countOffset, count, 0);
+                }
+                else if (batchCounts[batch] > 0) {
+                    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)commandOffset, batchCounts[batch], 0);
+                }
+                else {
+                    continue;
+                }
+                meshDrawCalls += 1;
+            }
+        }
+        meshDrawCount += drawCount;
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        if (gpuCulling) {
+            glBindBuffer(GL_PARAMETER_BUFFER, 0);
+
+            if (meshCullCountCapacity < meshBatchCount) {
+                glDeleteBuffers(1, &meshCullCountBuffer);
+                meshCullCountCapacity = meshBatchCount < 64 ? 64 : 2 * meshBatchCount;
+                glCreateBuffers(1, &meshCullCountBuffer);
+                glNamedBufferStorage(meshCullCountBuffer, (u64)meshCullCountCapacity * sizeof(u32), nullptr, 0);
+            }
+            glCopyNamedBufferSubData(streamingBuffer.buffer, meshCullCountBuffer, allocation.offset + countsOffset, 0, (u64)meshBatchCount * sizeof(u32));
+        }
+    }
+
+    /**
+     * Sums the visible meshes of the last GPU culled frame. Reads back the
+     * counters written by the compute shader, this waits for the GPU.
+     */
+    u32 readGpuVisibleMeshes() {
+        u32 visible = 0;
+        u32 counts[64];
+        for (u32 first = 0; first < meshCullBatchCount; first += 64) {
+            u32 count = meshCullBatchCount - first < 64 ? meshCullBatchCount - first : 64;
+            glGetNamedBufferSubData(meshCullCountBuffer, (u64)first * sizeof(u32), count * sizeof(u32), counts);
+            for (u32 i = 0; i < count; ++i) {
+                visible += counts[i];
+            }
+        }
+        return visible;
+    }
+
     void beginFrame() {
+        framePacer.beginFrame();
         commands.reset();
+        for (int i = 0; i < threadCommandCount; ++i) {
+            threadCommands[i].reset();
+        }
+        streamingBuffer.beginFrame();
+        atlas.beginFrame();
     }
 
     void endFrame() {
-        glFinish();
+        streamingBuffer.endFrame();
+        framePacer.endFrame();
     }
 };
-
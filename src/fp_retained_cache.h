@@ -0,0 +1,149 @@
+/******************************************************************************
+* Retained cache
+*
+* Keeps the uploaded instance or vertex data of the previous frames in a GPU
+* buffer. The sorted commands are split into fixed size segments and each
+* segment is identified by a hash of its content. Only segments whose hash
+* changed since the last frame need to be written and uploaded again, all
+* other segments are drawn from the data already on the GPU.
+*
+* Segments are addressed by their position in the sorted command stream, so
+* inserting a command shifts and invalidates all following segments.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_core.h"
+#include "fp_opengl.h"
+#include "fp_command_sort.h"
+
+// A multiple of 8, so every segment starts 32 byte aligned for the AVX2 expansion
+static const u64 RETAINED_SEGMENT_COMMANDS = 256;
+// Commands beyond MAX_RETAINED_SEGMENTS * RETAINED_SEGMENT_COMMANDS are uploaded every frame
+static const u32 MAX_RETAINED_SEGMENTS = 4096;
+
+struct RetainedStats {
+    u64 segmentHits;
+    u64 segmentMisses;
+    u64 bytesReused;
+    u64 bytesUploaded;
+
+    double hitRate() {
+        u64 total = segmentHits + segmentMisses;
+        return total > 0 ? (double)segmentHits / (double)total : 0.0;
+    }
+};
+
+static u64 rotateLeft(u64 value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+/**
+ * 64 bit hash over the drawn fields of rectangle commands.
+ *
+ * Four independent accumulators consume one rectangle each per step, so the
+ * multiplications of consecutive rectangles do not depend on each other and
+ * can be executed in parallel. The accumulators are merged and mixed at the end.
+ */
+static u64 hashRectSegment(SortEntry* entries, u64 count) {
+    const u64 PRIME_1 = 0x9E3779B185EBCA87ULL;
+    const u64 PRIME_2 = 0xC2B2AE3D27D4EB4FULL;
+
+    u64 lanes[4] = { PRIME_1, PRIME_2, 0, count * PRIME_1 };
+    for (u64 i = 0; i < count; ++i) {
+        RenderCommandRectangle* rect = (RenderCommandRectangle*)entries[i].command;
+
+        FloatBits x = { rect->x };
+        FloatBits y = { rect->y };
+        FloatBits width = { rect->width };
+        FloatBits height = { rect->height };
+        u64 position = (u64)x.u | ((u64)y.u << 32);
+        u64 size = (u64)width.u | ((u64)height.u << 32);
+
+        u64* lane = &lanes[i & 3];
+        *lane = rotateLeft(*lane + position * PRIME_2, 31) * PRIME_1;
+        *lane = rotateLeft(*lane + (size ^ ((u64)rect->packedColor << 17)) * PRIME_2, 31) * PRIME_1;
+
+        u32 uv0, uv1, shape;
+        getRectParams(rect, &uv0, &uv1, &shape);
+        *lane = rotateLeft(*lane + ((u64)uv0 | ((u64)uv1 << 32)) * PRIME_2, 31) * PRIME_1;
+        *lane = rotateLeft(*lane + (u64)shape * PRIME_2, 31) * PRIME_1;
+    }
+
+    u64 hash = rotateLeft(lanes[0], 1) + rotateLeft(lanes[1], 7) + rotateLeft(lanes[2], 12) + rotateLeft(lanes[3], 18);
+
+    // Final avalanche, so that single bit changes affect the whole hash
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+struct RetainedCache {
+    // Only written by the GPU through buffer copies
+    unsigned int buffer;
+    // Capacity in commands
+    u64 capacity;
+    u64 bytesPerCommand;
+
+    u64 segmentHashes[MAX_RETAINED_SEGMENTS];
+    bool segmentValid[MAX_RETAINED_SEGMENTS];
+
+    // Counted since the cache was created and for the last frame
+    RetainedStats stats;
+    RetainedStats frameStats;
+
+    void invalidate() {
+        for (u32 i = 0; i < MAX_RETAINED_SEGMENTS; ++i) {
+            segmentValid[i] = false;
+        }
+    }
+
+    void destroy() {
+        if (buffer) {
+            glDeleteBuffers(1, &buffer);
+            buffer = 0;
+        }
+        capacity = 0;
+        invalidate();
+    }
+
+    /**
+     * Makes room for commandCount commands of commandBytes each. The buffer is
+     * recreated and all segments become invalid if it is too small or the
+     * data layout changed.
+     */
+    void reserve(u64 commandCount, u64 commandBytes) {
+        if (buffer && commandBytes == bytesPerCommand && commandCount <= capacity) {
+            return;
+        }
+
+        u64 newCapacity = commandBytes == bytesPerCommand ? 2 * capacity : 0;
+        newCapacity = newCapacity > RETAINED_SEGMENT_COMMANDS ? newCapacity : RETAINED_SEGMENT_COMMANDS;
+        while (newCapacity < commandCount) {
+            newCapacity *= 2;
+        }
+
+        destroy();
+        capacity = newCapacity;
+        bytesPerCommand = commandBytes;
+        glCreateBuffers(1, &buffer);
+        glNamedBufferStorage(buffer, capacity * bytesPerCommand, nullptr, 0);
+    }
+
+    bool contains(u64 segment, u64 hash) {
+        return segment < MAX_RETAINED_SEGMENTS && segmentValid[segment] && segmentHashes[segment] == hash;
+    }
+
+    void store(u64 segment, u64 hash) {
+        if (segment < MAX_RETAINED_SEGMENTS) {
+            segmentHashes[segment] = hash;
+            segmentValid[segment] = true;
+        }
+    }
+};
@@ -0,0 +1,300 @@
+/******************************************************************************
+* Shader programs
+*
+* Creates all shader programs of the renderer at startup without waiting for
+* each compile in turn:
+*
+* 1. add() looks for a binary of the program in the disk cache and loads it
+*    with glProgramBinary. Without one, the shaders are compiled and linked
+*    without querying their status, so the driver can work on all programs
+*    at the same time (GL_KHR_parallel_shader_compile).
+* 2. finish() polls GL_COMPLETION_STATUS_KHR until all programs are linked,
+*    reports errors and writes the binaries of new programs to the cache.
+*
+* Cache files are keyed by a hash of the sources and of the GL_VENDOR,
+* GL_RENDERER and GL_VERSION strings, so a driver update misses the cache.
+* Without parallel compilation, finish() waits for one program after the
+* other like before.
+*
+* Example:
+* {
+*     ShaderCache shaders = {};
+*     shaders.create(L"cache/shader_");
+*     unsigned int program = shaders.add("rects", vertexSource, fragmentSource);
+*     ...
+*     shaders.finish();
+*     int location = glGetUniformLocation(program, "projection");
+* }
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_core.h"
+#include "fp_opengl.h"
+#include "fp_os.h"
+
+static const int MAX_SHADER_PROGRAMS = 16;
+static const int MAX_SHADER_STAGES = 2;
+
+static const u32 SHADER_CACHE_MAGIC = 0x42535046; // "FPSB"
+
+// Precedes the program binary in a cache file
+struct ShaderCacheHeader {
+    u32 magic;
+    u32 binaryFormat;
+    // Guards against files of another program with a colliding name
+    u64 hash;
+};
+
+struct ShaderProgramEntry {
+    const char* name;
+    unsigned int program;
+    unsigned int shaders[MAX_SHADER_STAGES];
+    int shaderCount;
+    u64 hash;
+
+    u64 startTicks;
+    // From add() until the program was seen linked, compiles overlap with parallel compilation
+    u64 compileTicks;
+    bool fromCache;
+    bool done;
+};
+
+struct ShaderCacheStats {
+    u32 cacheHits;
+    u32 cacheMisses;
+    // Time spent in finish(), waiting for the compiles
+    u64 finishTicks;
+};
+
+static u64 hashString(u64 hash, const char* text) {
+    // FNV-1a
+    for (const char* c = text; *c; ++c) {
+        hash = (hash ^ (u8)*c) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+struct ShaderCache {
+    ShaderProgramEntry entries[MAX_SHADER_PROGRAMS];
+    int count;
+
+    // Prefix of the cache file names, nullptr disables the disk cache
+    wchar_t const* pathPrefix;
+    u64 driverHash;
+    bool parallelCompile;
+
+    ShaderCacheStats stats;
+
+    void create(wchar_t const* cachePathPrefix) {
+        count = 0;
+        stats = {};
+
+        // Drivers without binary formats cannot load any cached program
+        int formatCount = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+        pathPrefix = formatCount > 0 ? cachePathPrefix : nullptr;
+
+        driverHash = 0xCBF29CE484222325ULL;
+        driverHash = hashString(driverHash, (const char*)glGetString(GL_VENDOR));
+        driverHash = hashString(driverHash, (const char*)glGetString(GL_RENDERER));
+        driverHash = hashString(driverHash, (const char*)glGetString(GL_VERSION));
+
+        parallelCompile = glMaxShaderCompilerThreadsKHR
+            && (gl_hasExtension("GL_KHR_parallel_shader_compile") || gl_hasExtension("GL_ARB_parallel_shader_compile"));
+        if (parallelCompile) {
+            // Let the driver choose the number of threads
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        }
+    }
+
+    // Cache file of a program: prefix, 16 hex digits of the hash and ".bin"
+    bool buildPath(u64 hash, wchar_t* path, int capacity) {
+        int length = 0;
+        while (pathPrefix[length]) {
+            if (length >= capacity - 21) {
+                return false;
+            }
+            path[length] = pathPrefix[length];
+            ++length;
+        }
+        for (int i = 15; i >= 0; --i) {
+            path[length++] = L"0123456789abcdef"[(hash >> (4 * i)) & 0xF];
+        }
+        const wchar_t* extension = L".bin";
+        for (int i = 0; i < 5; ++i) {
+            path[length++] = extension[i];
+        }
+        return true;
+    }
+
+    bool loadBinary(ShaderProgramEntry* entry) {
+        wchar_t path[512];
+        if (!pathPrefix || !buildPath(entry->hash, path, 512)) {
+            return false;
+        }
+
+        ReadFileResult file = readEntireFile(path);
+        defer{ freeReadFileResult(&file); };
+        if (file.error || file.size <= (i64)sizeof(ShaderCacheHeader)) {
+            return false;
+        }
+
+        ShaderCacheHeader* header = (ShaderCacheHeader*)file.data;
+        if (header->magic != SHADER_CACHE_MAGIC || header->hash != entry->hash) {
+            return false;
+        }
+
+        // The driver may still reject the binary, e.g. after an update with the same version string
+        glProgramBinary(entry->program, header->binaryFormat, header + 1, (GLsizei)(file.size - sizeof(ShaderCacheHeader)));
+        int success = 0;
+        glGetProgramiv(entry->program, GL_LINK_STATUS, &success);
+        return success != 0;
+    }
+
+    void storeBinary(ShaderProgramEntry* entry) {
+        wchar_t path[512];
+        if (!pathPrefix || !buildPath(entry->hash, path, 512)) {
+            return;
+        }
+
+        int length = 0;
+        glGetProgramiv(entry->program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0) {
+            return;
+        }
+
+        u64 size = sizeof(ShaderCacheHeader) + (u64)length;
+        Allocator pageAllocator = createPageAllocator();
+        u8* data = (u8*)pageAllocator.allocate(size);
+        if (!data) {
+            return;
+        }
+        defer{ pageAllocator.free(data, size); };
+
+        ShaderCacheHeader* header = (ShaderCacheHeader*)data;
+        GLenum binaryFormat = 0;
+        glGetProgramBinary(entry->program, length, nullptr, &binaryFormat, header + 1);
+        header->magic = SHADER_CACHE_MAGIC;
+        header->binaryFormat = binaryFormat;
+        header->hash = entry->hash;
+
+        FileWriter file = {};
+        if (!openFileForWriting(&file, path)) {
+            OutputDebugStringW(L"Could not write the shader cache, is the directory missing?\n");
+            return;
+        }
+        writeFile(&file, data, size);
+        closeFile(&file);
+    }
+
+    unsigned int addProgram(const char* name, const GLenum* stages, const char** sources, int stageCount) {
+        if (count == MAX_SHADER_PROGRAMS) {
+            OutputDebugStringW(L"Too many shader programs\n");
+            DebugBreak();
+            return 0;
+        }
+
+        ShaderProgramEntry* entry = &entries[count++];
+        *entry = {};
+        entry->name = name;
+        entry->startTicks = getPerformanceCounter();
+        entry->hash = driverHash;
+        for (int i = 0; i < stageCount; ++i) {
+            entry->hash = hashString(entry->hash ^ stages[i], sources[i]);
+        }
+
+        entry->program = glCreateProgram();
+        if (loadBinary(entry)) {
+            entry->fromCache = true;
+            entry->done = true;
+            entry->compileTicks = getPerformanceCounter() - entry->startTicks;
+            stats.cacheHits += 1;
+            return entry->program;
+        }
+        stats.cacheMisses += 1;
+
+        // No status queries here, they would wait for the compile
+        for (int i = 0; i < stageCount; ++i) {
+            unsigned int shader = glCreateShader(stages[i]);
+            glShaderSource(shader, 1, &sources[i], NULL);
+            glCompileShader(shader);
+            glAttachShader(entry->program, shader);
+            entry->shaders[entry->shaderCount++] = shader;
+        }
+        if (pathPrefix) {
+            glProgramParameteri(entry->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+        glLinkProgram(entry->program);
+        return entry->program;
+    }
+
+    // Returns the program, it can only be used after finish()
+    unsigned int add(const char* name, const char* vertexSource, const char* fragmentSource) {
+        GLenum stages[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+        const char* sources[] = { vertexSource, fragmentSource };
+        return addProgram(name, stages, sources, 2);
+    }
+
+    unsigned int addCompute(const char* name, const char* computeSource) {
+        GLenum stages[] = { GL_COMPUTE_SHADER };
+        const char* sources[] = { computeSource };
+        return addProgram(name, stages, sources, 1);
+    }
+
+    void complete(ShaderProgramEntry* entry) {
+        entry->done = true;
+        entry->compileTicks = getPerformanceCounter() - entry->startTicks;
+
+        // Only the info logs of failed programs are of interest
+        int linked = 0;
+        glGetProgramiv(entry->program, GL_LINK_STATUS, &linked);
+        if (!linked) {
+            OutputDebugStringW(L"Shader program failed: ");
+            OutputDebugStringA(entry->name);
+            OutputDebugStringW(L"\n");
+            for (int i = 0; i < entry->shaderCount; ++i) {
+                gl_checkCompileStatus(entry->shaders[i]);
+            }
+            gl_checkLinkStatus(entry->program);
+        }
+        else {
+            storeBinary(entry);
+        }
+
+        // The shaders are only flagged for deletion, they are freed with the program
+        for (int i = 0; i < entry->shaderCount; ++i) {
+            glDeleteShader(entry->shaders[i]);
+        }
+    }
+
+    // Waits until all added programs are linked
+    void finish() {
+        u64 startTicks = getPerformanceCounter();
+        bool pending = true;
+        while (pending) {
+            pending = false;
+            for (int i = 0; i < count; ++i) {
+                ShaderProgramEntry* entry = &entries[i];
+                if (entry->done) {
+                    continue;
+                }
+
+                int completed = 1;
+                if (parallelCompile) {
+                    glGetProgramiv(entry->program, GL_COMPLETION_STATUS_KHR, &completed);
+                }
+                if (completed) {
+                    complete(entry);
+                }
+                else {
+                    pending = true;
+                }
+            }
+        }
+        stats.finishTicks += getPerformanceCounter() - startTicks;
+    }
+};
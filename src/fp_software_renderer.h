@@ -0,0 +1,545 @@
+/******************************************************************************
+* Software renderer
+*
+* CPU backend for the render command buffers, e.g. for headless machines
+* without a GPU. It produces the same image as the OpenGL renderer, up to
+* rounding on the antialiased edges of shapes:
+*
+* 1. Commands are sorted with the same keys as in the OpenGL renderer
+* 2. The rectangles are converted to pixel bounds and binned into screen tiles
+* 3. Tiles are rasterized in parallel, each tile draws its rectangles in order
+*
+* Tiles do not overlap, so no synchronization is needed between them.
+* Opaque spans are filled and translucent spans are blended with AVX2, 8
+* pixels at a time. Blending matches glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA)
+* on an RGBA8 target, including the alpha channel.
+*
+* Pixel coverage follows the OpenGL rules: a pixel is covered if its center
+* lies inside the rectangle, after snapping the edges to 1/256 pixel.
+* Textured rectangles sample the nearest texel at the pixel center from a CPU
+* copy of the texture atlas, see TextureAtlas::shadowPixels. Shapes evaluate
+* the same signed distance functions as the fragment shader. Scissored
+* commands only cover the pixels inside their clip rect, like with
+* glScissor. Mesh commands are not drawn.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_core.h"
+#include "fp_allocator.h"
+#include "fp_command_sort.h"
+#include "fp_glyph_cache.h"
+#include "fp_jobs.h"
+#include "fp_render_commands.h"
+
+#include <immintrin.h>
+
+static const int SOFTWARE_TILE_SIZE = 64;
+
+// Edges are snapped to 1/256 pixel
+static const int SOFTWARE_SUBPIXEL_BITS = 8;
+static const int SOFTWARE_SUBPIXELS = 1 << SOFTWARE_SUBPIXEL_BITS;
+
+/**
+ * RGBA8 pixels with red in the lowest byte, the same layout as packColor().
+ * Row 0 is the bottom row, like the result of glReadPixels.
+ */
+struct SoftwareFramebuffer {
+    u32* pixels;
+    int width;
+    int height;
+};
+
+// RGBA8 texels with the same layout as the texture atlas
+struct SoftwareTexture {
+    u32* pixels;
+    int width;
+    int height;
+};
+
+// Covered pixels [minX, maxX) x [minY, maxY), clipped to the framebuffer
+struct SoftwareRect {
+    i32 minX;
+    i32 minY;
+    i32 maxX;
+    i32 maxY;
+    u32 color;
+    bool textured;
+    // Texel coordinate of pixel x is texelX0 + x * texelStepX, the same for y.
+    // Shapes use the position in their quad in [0, 1] instead.
+    float texelX0;
+    float texelStepX;
+    float texelY0;
+    float texelStepY;
+    // See packShape(), 0 for plain and textured rectangles
+    u32 shape;
+    float shapeWidth;
+    float shapeHeight;
+};
+
+struct SoftwareRasterJob {
+    SoftwareFramebuffer* target;
+    // In draw order
+    SoftwareRect* rects;
+    // Indices into rects, grouped by tile. Tile i uses [tileOffsets[i], tileOffsets[i + 1])
+    u32* tileRects;
+    u32* tileOffsets;
+    int tilesX;
+    SoftwareTexture* texture;
+};
+
+static void fillSpan(u32* pixels, int count, u32 color) {
+    __m256i value = _mm256_set1_epi32((int)color);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_si256((__m256i*)(pixels + i), value);
+    }
+    for (; i < count; ++i) {
+        pixels[i] = color;
+    }
+}
+
+// a * b / 255 rounded to nearest, exact for all 8 bit inputs
+static u32 multiplyUnorm8(u32 a, u32 b) {
+    u32 t = a * b + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+/**
+ * result = source * alpha / 255 + destination * (255 - alpha) / 255 per channel.
+ * Both products are rounded separately like the 8 bit blending of Mesa llvmpipe,
+ * which gives exactly the same pixels.
+ */
+static u32 blendPixel(u32 destination, u32 color) {
+    u32 alpha = color >> 24;
+    u32 inverse = 255 - alpha;
+
+    u32 result = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        u32 value = multiplyUnorm8((color >> shift) & 0xFF, alpha) + multiplyUnorm8((destination >> shift) & 0xFF, inverse);
+        result |= (value < 255 ? value : 255) << shift;
+    }
+    return result;
+}
+
+static void blendSpan(u32* pixels, int count, u32 color) {
+    u32 alpha = color >> 24;
+
+    // The source term is the same for every pixel, one 16 bit lane per channel
+    u64 sourceTerm = 0;
+    for (int channel = 0; channel < 4; ++channel) {
+        u64 term = multiplyUnorm8((color >> (8 * channel)) & 0xFF, alpha);
+        sourceTerm |= term << (16 * channel);
+    }
+    __m256i source = _mm256_set1_epi64x((long long)sourceTerm);
+    __m256i inverse = _mm256_set1_epi16((short)(255 - alpha));
+    __m256i bias = _mm256_set1_epi16(128);
+    __m256i zero = _mm256_setzero_si256();
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i destination = _mm256_loadu_si256((__m256i*)(pixels + i));
+
+        // Widen to 16 bits, the pack below restores the pixel order within each 128 bit lane
+        __m256i low = _mm256_unpacklo_epi8(destination, zero);
+        __m256i high = _mm256_unpackhi_epi8(destination, zero);
+
+        low = _mm256_add_epi16(_mm256_mullo_epi16(low, inverse), bias);
+        high = _mm256_add_epi16(_mm256_mullo_epi16(high, inverse), bias);
+        low = _mm256_srli_epi16(_mm256_add_epi16(low, _mm256_srli_epi16(low, 8)), 8);
+        high = _mm256_srli_epi16(_mm256_add_epi16(high, _mm256_srli_epi16(high, 8)), 8);
+        low = _mm256_add_epi16(low, source);
+        high = _mm256_add_epi16(high, source);
+
+        // The pack saturates sums above 255
+        _mm256_storeu_si256((__m256i*)(pixels + i), _mm256_packus_epi16(low, high));
+    }
+    for (; i < count; ++i) {
+        pixels[i] = blendPixel(pixels[i], color);
+    }
+}
+
+static void clearFramebuffer(SoftwareFramebuffer* target, Color color) {
+    fillSpan(target->pixels, target->width * target->height, packColor(color));
+}
+
+// First pixel whose center is at or right of the edge, using the snapped edge
+static i32 pixelEdge(float edge) {
+    // Keeps the fixed point value in range for offscreen rectangles
+    const float LIMIT = 1 << 20;
+    edge = edge < -LIMIT ? -LIMIT : (edge > LIMIT ? LIMIT : edge);
+
+    i32 subpixels = _mm_cvtss_si32(_mm_set_ss(edge * SOFTWARE_SUBPIXELS));
+    return (subpixels - SOFTWARE_SUBPIXELS / 2 + SOFTWARE_SUBPIXELS - 1) >> SOFTWARE_SUBPIXEL_BITS;
+}
+
+// Texel index along one axis, clamped to the edge like GL_CLAMP_TO_EDGE
+static i32 texelIndex(float coordinate, int size) {
+    i32 index = (i32)coordinate;
+    return index < 0 ? 0 : (index < size ? index : size - 1);
+}
+
+// Nearest texel times the rectangle color, blended if the result is translucent
+static void textureSpan(u32* pixels, i32 minX, i32 maxX, i32 y, SoftwareRect* rect, SoftwareTexture* texture) {
+    u32* texels = texture->pixels + (u64)texelIndex(rect->texelY0 + y * rect->texelStepY, texture->height) * texture->width;
+    for (i32 x = minX; x < maxX; ++x) {
+        u32 texel = texels[texelIndex(rect->texelX0 + x * rect->texelStepX, texture->width)];
+
+        u32 color = 0;
+        for (int shift = 0; shift < 32; shift += 8) {
+            color |= multiplyUnorm8((texel >> shift) & 0xFF, (rect->color >> shift) & 0xFF) << shift;
+        }
+        pixels[x - minX] = (color >> 24) == 0xFF ? color : blendPixel(pixels[x - minX], color);
+    }
+}
+
+static float absolute(float value) {
+    return value < 0.0f ? -value : value;
+}
+
+static float squareRoot(float value) {
+    return _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(value)));
+}
+
+// Signed distance of the point (px, py) in the quad to the shape, see FRAGMENT_SHADER_VERTEX_COLOR
+static float shapeDistance(u32 shape, float px, float py, float width, float height) {
+    float radius = shapeRadius(shape);
+    float lineWidth = shapeWidth(shape);
+
+    if (shapeKind(shape) == Shape_RoundedRect) {
+        float halfWidth = 0.5f * width;
+        float halfHeight = 0.5f * height;
+        float maxRadius = halfWidth < halfHeight ? halfWidth : halfHeight;
+        radius = radius < maxRadius ? radius : maxRadius;
+
+        float qx = absolute(px - halfWidth) - halfWidth + radius;
+        float qy = absolute(py - halfHeight) - halfHeight + radius;
+        float outsideX = qx > 0.0f ? qx : 0.0f;
+        float outsideY = qy > 0.0f ? qy : 0.0f;
+        float inside = qx > qy ? qx : qy;
+        inside = inside < 0.0f ? inside : 0.0f;
+        float distance = squareRoot(outsideX * outsideX + outsideY * outsideY) + inside - radius;
+        if (lineWidth > 0.0f) {
+            distance = absolute(distance + 0.5f * lineWidth) - 0.5f * lineWidth;
+        }
+        return distance;
+    }
+
+    float margin = 0.5f * lineWidth + LINE_ANTIALIAS_MARGIN;
+    bool flipped = (shape & 4) != 0;
+    float ax = margin;
+    float ay = flipped ? height - margin : margin;
+    float bax = width - margin - ax;
+    float bay = (flipped ? margin : height - margin) - ay;
+    float pax = px - ax;
+    float pay = py - ay;
+    float lengthSquared = bax * bax + bay * bay;
+    float h = (pax * bax + pay * bay) / (lengthSquared > 1e-6f ? lengthSquared : 1e-6f);
+    h = h < 0.0f ? 0.0f : (h > 1.0f ? 1.0f : h);
+    float dx = pax - bax * h;
+    float dy = pay - bay * h;
+    return squareRoot(dx * dx + dy * dy) - 0.5f * lineWidth;
+}
+
+// Color with the alpha scaled by the coverage of the shape, always blended
+static void shapeSpan(u32* pixels, i32 minX, i32 maxX, i32 y, SoftwareRect* rect) {
+    float py = (rect->texelY0 + y * rect->texelStepY) * rect->shapeHeight;
+    float stepX = absolute(rect->texelStepX * rect->shapeWidth);
+    float stepY = absolute(rect->texelStepY * rect->shapeHeight);
+    float pixel = stepX > stepY ? stepX : stepY;
+    float alpha = (rect->color >> 24) / 255.0f;
+
+    for (i32 x = minX; x < maxX; ++x) {
+        float px = (rect->texelX0 + x * rect->texelStepX) * rect->shapeWidth;
+        float coverage = 0.5f - shapeDistance(rect->shape, px, py, rect->shapeWidth, rect->shapeHeight) / pixel;
+        coverage = coverage < 0.0f ? 0.0f : (coverage > 1.0f ? 1.0f : coverage);
+
+        u32 coveredAlpha = (u32)_mm_cvtss_si32(_mm_set_ss(alpha * coverage * 255.0f));
+        if (coveredAlpha > 0) {
+            pixels[x - minX] = blendPixel(pixels[x - minX], (rect->color & 0x00FFFFFF) | (coveredAlpha << 24));
+        }
+    }
+}
+
+static void rasterizeTile(void* data, int index) {
+    SoftwareRasterJob* job = (SoftwareRasterJob*)data;
+    SoftwareFramebuffer* target = job->target;
+
+    i32 tileMinX = (index % job->tilesX) * SOFTWARE_TILE_SIZE;
+    i32 tileMinY = (index / job->tilesX) * SOFTWARE_TILE_SIZE;
+    i32 tileMaxX = tileMinX + SOFTWARE_TILE_SIZE < target->width ? tileMinX + SOFTWARE_TILE_SIZE : target->width;
+    i32 tileMaxY = tileMinY + SOFTWARE_TILE_SIZE < target->height ? tileMinY + SOFTWARE_TILE_SIZE : target->height;
+
+    for (u32 i = job->tileOffsets[index]; i < job->tileOffsets[index + 1]; ++i) {
+        SoftwareRect* rect = &job->rects[job->tileRects[i]];
+        i32 minX = rect->minX > tileMinX ? rect->minX : tileMinX;
+        i32 maxX = rect->maxX < tileMaxX ? rect->maxX : tileMaxX;
+        i32 minY = rect->minY > tileMinY ? rect->minY : tileMinY;
+        i32 maxY = rect->maxY < tileMaxY ? rect->maxY : tileMaxY;
+
+        bool opaque = (rect->color >> 24) == 0xFF;
+        for (i32 y = minY; y < maxY; ++y) {
+            u32* row = target->pixels + (u64)y * target->width + minX;
+            if (rect->shape) {
+                shapeSpan(row, minX, maxX, y, rect);
+            }
+            else if (rect->textured) {
+                textureSpan(row, minX, maxX, y, rect, job->texture);
+            }
+            else if (opaque) {
+                fillSpan(row, maxX - minX, rect->color);
+            }
+            else {
+                blendSpan(row, maxX - minX, rect->color);
+            }
+        }
+    }
+}
+
+struct SoftwareRenderer {
+    // Sort entries, pixel bounds and tile bins, reset after every render() call
+    ArenaAllocator temporaryMemory;
+
+    // Rasterizes tiles in parallel, optional
+    JobSystem* jobSystem;
+
+    float projection[16];
+
+    // Texels of textured rectangles, usually the shadow copy of the texture atlas
+    SoftwareTexture texture;
+
+    // Lays out text commands, optional. Its atlas has to be the one in texture.
+    GlyphCache* glyphCache;
+
+    // Pixels written by the last render() call, counting overdraw
+    u64 pixelsWritten;
+
+    void setup(void* memory, u64 size) {
+        temporaryMemory = createArenaAllocator(memory, size);
+    }
+
+    // Row-major projection matrix, only axis aligned 2D projections are supported
+    void setProjection(const float* matrix) {
+        for (int i = 0; i < 16; ++i) {
+            projection[i] = matrix[i];
+        }
+    }
+
+    void runJobs(JobFunction* function, void* data, int count) {
+        if (jobSystem) {
+            jobSystem->run(function, data, count);
+        }
+        else {
+            for (int i = 0; i < count; ++i) {
+                function(data, i);
+            }
+        }
+    }
+
+    /**
+     * Draws the commands of the buffers in the same order as the OpenGL renderer
+     * would, commands of earlier buffers come first.
+     */
+    void render(RenderCommandBuffer** buffers, int bufferCount, SoftwareFramebuffer* target) {
+        pixelsWritten = 0;
+
+        const float* m = projection;
+        if (m[1] != 0.0f || m[4] != 0.0f || m[12] != 0.0f || m[13] != 0.0f || m[15] != 1.0f) {
+            OutputDebugStringW(L"Software renderer only supports axis aligned 2D projections\n");
+            return;
+        }
+
+        // Projection followed by the viewport transform to pixels
+        float scaleX = 0.5f * target->width * m[0];
+        float offsetX = 0.5f * target->width * (m[3] + 1.0f);
+        float scaleY = 0.5f * target->height * m[5];
+        float offsetY = 0.5f * target->height * (m[7] + 1.0f);
+
+        if (glyphCache) {
+            layoutTextCommands(buffers, bufferCount, glyphCache, &temporaryMemory);
+        }
+
+        u64 commandCount = 0;
+        for (int i = 0; i < bufferCount; ++i) {
+            commandCount += buffers[i]->rectCount;
+        }
+        if (commandCount == 0) {
+            return;
+        }
+
+        int tilesX = (target->width + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+        int tilesY = (target->height + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+        int tileCount = tilesX * tilesY;
+
+        SortEntry* entries = temporaryMemory.allocateArray<SortEntry>(commandCount);
+        SoftwareRect* rects = temporaryMemory.allocateArray<SoftwareRect>(commandCount);
+        u32* tileOffsets = temporaryMemory.allocateArray<u32>(tileCount + 1);
+        u32* tileCursors = temporaryMemory.allocateArray<u32>(tileCount);
+        if (!entries || !rects || !tileOffsets || !tileCursors) {
+            OutputDebugStringW(L"Software renderer memory exhausted\n");
+            temporaryMemory.reset();
+            return;
+        }
+
+        u32 depth = 0;
+        for (int i = 0; i < bufferCount; ++i) {
+            for (RenderCommandChunk* chunk = buffers[i]->chunks; chunk; chunk = chunk->next) {
+                RenderCommand* command = chunk->first();
+                RenderCommand* onePastLast = chunk->onePastLast();
+                while (command < onePastLast) {
+                    u32 rectCount;
+                    u64 stride;
+                    RenderCommandRectangle* rect = getCommandRects(command, &rectCount, &stride);
+                    if (rect) {
+                        for (u32 j = 0; j < rectCount; ++j) {
+                            entries[depth].key = makeRectangleSortKey(rect, depth, i);
+                            entries[depth].command = rect;
+                            depth += 1;
+                            rect = (RenderCommandRectangle*)((u8*)rect + stride);
+                        }
+
+                        command = nextRenderCommand(command);
+                    }
+                    else {
+                        OutputDebugStringW(L"Unknown command type\n");
+                        DebugBreak();
+                        continue;
+                    }
+                }
+            }
+        }
+
+        if (!sortEntriesByLayer(entries, commandCount, &temporaryMemory)) {
+            // Unlike on the GPU, the order matters for the result
+            OutputDebugStringW(L"Not enough software renderer memory to sort commands\n");
+            temporaryMemory.reset();
+            return;
+        }
+
+        // Pixel bounds in draw order, empty and invisible rectangles are dropped
+        for (int i = 0; i <= tileCount; ++i) {
+            tileOffsets[i] = 0;
+        }
+        u64 rectCount = 0;
+        for (u64 i = 0; i < commandCount; ++i) {
+            RenderCommandRectangle* command = (RenderCommandRectangle*)entries[i].command;
+            if ((command->packedColor >> 24) == 0) {
+                continue;
+            }
+
+            float edgeX0 = command->x * scaleX + offsetX;
+            float edgeX1 = (command->x + command->width) * scaleX + offsetX;
+            float edgeY0 = command->y * scaleY + offsetY;
+            float edgeY1 = (command->y + command->height) * scaleY + offsetY;
+            i32 x0 = pixelEdge(edgeX0);
+            i32 x1 = pixelEdge(edgeX1);
+            i32 y0 = pixelEdge(edgeY0);
+            i32 y1 = pixelEdge(edgeY1);
+
+            SoftwareRect* rect = &rects[rectCount];
+            rect->minX = x0 < x1 ? x0 : x1;
+            rect->maxX = x0 < x1 ? x1 : x0;
+            rect->minY = y0 < y1 ? y0 : y1;
+            rect->maxY = y0 < y1 ? y1 : y0;
+            rect->minX = rect->minX > 0 ? rect->minX : 0;
+            rect->minY = rect->minY > 0 ? rect->minY : 0;
+            rect->maxX = rect->maxX < target->width ? rect->maxX : target->width;
+            rect->maxY = rect->maxY < target->height ? rect->maxY : target->height;
+            rect->color = command->packedColor;
+
+            // The scissor only limits the covered pixels, the texels and shapes still span the whole rectangle
+            u32 scissor = sortKeyScissor(entries[i].key);
+            if (scissor) {
+                ClipRect* clip = findScissorRect(buffers, scissor);
+                i32 clipX0 = pixelEdge(clip->minX * scaleX + offsetX);
+                i32 clipX1 = pixelEdge(clip->maxX * scaleX + offsetX);
+                i32 clipY0 = pixelEdge(clip->minY * scaleY + offsetY);
+                i32 clipY1 = pixelEdge(clip->maxY * scaleY + offsetY);
+                i32 clipMinX = clipX0 < clipX1 ? clipX0 : clipX1;
+                i32 clipMaxX = clipX0 < clipX1 ? clipX1 : clipX0;
+                i32 clipMinY = clipY0 < clipY1 ? clipY0 : clipY1;
+                i32 clipMaxY = clipY0 < clipY1 ? clipY1 : clipY0;
+                rect->minX = rect->minX > clipMinX ? rect->minX : clipMinX;
+                rect->minY = rect->minY > clipMinY ? rect->minY : clipMinY;
+                rect->maxX = rect->maxX < clipMaxX ? rect->maxX : clipMaxX;
+                rect->maxY = rect->maxY < clipMaxY ? rect->maxY : clipMaxY;
+            }
+            if (rect->minX >= rect->maxX || rect->minY >= rect->maxY) {
+                continue;
+            }
+
+            // The texture coordinates are interpolated between the snapped edges and sampled at pixel centers
+            u32 uv0, uv1;
+            getRectParams(command, &uv0, &uv1, &rect->shape);
+            rect->textured = (uv0 != 0 || uv1 != 0) && texture.pixels && !rect->shape;
+
+            float snap = 1.0f / SOFTWARE_SUBPIXELS;
+            edgeX0 = _mm_cvtss_si32(_mm_set_ss(edgeX0 * SOFTWARE_SUBPIXELS)) * snap;
+            edgeX1 = _mm_cvtss_si32(_mm_set_ss(edgeX1 * SOFTWARE_SUBPIXELS)) * snap;
+            edgeY0 = _mm_cvtss_si32(_mm_set_ss(edgeY0 * SOFTWARE_SUBPIXELS)) * snap;
+            edgeY1 = _mm_cvtss_si32(_mm_set_ss(edgeY1 * SOFTWARE_SUBPIXELS)) * snap;
+            if (rect->shape) {
+                rect->shapeWidth = command->width;
+                rect->shapeHeight = command->height;
+                rect->texelStepX = 1.0f / (edgeX1 - edgeX0);
+                rect->texelX0 = (0.5f - edgeX0) * rect->texelStepX;
+                rect->texelStepY = 1.0f / (edgeY1 - edgeY0);
+                rect->texelY0 = (0.5f - edgeY0) * rect->texelStepY;
+            }
+            else if (rect->textured) {
+                float u0 = (uv0 & 0xFFFF) / 65535.0f * texture.width;
+                float u1 = (uv1 & 0xFFFF) / 65535.0f * texture.width;
+                float v0 = (uv0 >> 16) / 65535.0f * texture.height;
+                float v1 = (uv1 >> 16) / 65535.0f * texture.height;
+                rect->texelStepX = (u1 - u0) / (edgeX1 - edgeX0);
+                rect->texelX0 = u0 + (0.5f - edgeX0) * rect->texelStepX;
+                rect->texelStepY = (v1 - v0) / (edgeY1 - edgeY0);
+                rect->texelY0 = v0 + (0.5f - edgeY0) * rect->texelStepY;
+            }
+            pixelsWritten += (u64)(rect->maxX - rect->minX) * (rect->maxY - rect->minY);
+
+            // Counted one slot later, so the prefix sum below yields the start offsets
+            for (i32 tileY = rect->minY / SOFTWARE_TILE_SIZE; tileY <= (rect->maxY - 1) / SOFTWARE_TILE_SIZE; ++tileY) {
+                for (i32 tileX = rect->minX / SOFTWARE_TILE_SIZE; tileX <= (rect->maxX - 1) / SOFTWARE_TILE_SIZE; ++tileX) {
+                    tileOffsets[tileY * tilesX + tileX + 1] += 1;
+                }
+            }
+            rectCount += 1;
+        }
+
+        for (int i = 0; i < tileCount; ++i) {
+            tileOffsets[i + 1] += tileOffsets[i];
+            tileCursors[i] = tileOffsets[i];
+        }
+
+        u32* tileRects = temporaryMemory.allocateArray<u32>(tileOffsets[tileCount]);
+        if (!tileRects) {
+            OutputDebugStringW(L"Software renderer memory exhausted\n");
+            temporaryMemory.reset();
+            return;
+        }
+        for (u64 i = 0; i < rectCount; ++i) {
+            SoftwareRect* rect = &rects[i];
+            for (i32 tileY = rect->minY / SOFTWARE_TILE_SIZE; tileY <= (rect->maxY - 1) / SOFTWARE_TILE_SIZE; ++tileY) {
+                for (i32 tileX = rect->minX / SOFTWARE_TILE_SIZE; tileX <= (rect->maxX - 1) / SOFTWARE_TILE_SIZE; ++tileX) {
+                    tileRects[tileCursors[tileY * tilesX + tileX]++] = (u32)i;
+                }
+            }
+        }
+
+        SoftwareRasterJob job = {};
+        job.target = target;
+        job.rects = rects;
+        job.tileRects = tileRects;
+        job.tileOffsets = tileOffsets;
+        job.tilesX = tilesX;
+        job.texture = &texture;
+        runJobs(&rasterizeTile, &job, tileCount);
+
+        temporaryMemory.reset();
+    }
+};
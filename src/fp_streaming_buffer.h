@@ -0,0 +1,127 @@
+/******************************************************************************
+* Streaming buffer
+*
+* Persistently mapped ring buffer for per-frame vertex data. The buffer is
+* split into one region per frame in flight. Each region is guarded by a
+* fence, so the CPU only overwrites a region after the GPU finished reading
+* from it. Vertex data is written directly into the mapped memory.
+*
+* There is one region for each frame the frame pacer allows in flight, so
+* the region fences are usually signaled already when a region is reused.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_core.h"
+#include "fp_opengl.h"
+#include "fp_frame_pacing.h"
+
+static const int STREAMING_BUFFER_REGIONS = MAX_FRAMES_IN_FLIGHT;
+
+struct StreamingAllocation {
+    // Pointer into the mapped buffer
+    void* data;
+    // Offset from the start of the buffer, used to bind the data for drawing
+    u64 offset;
+};
+
+struct StreamingBuffer {
+    unsigned int buffer;
+    u8* mapped;
+    u64 regionSize;
+
+    int region;
+    u64 used;
+    GLsync fences[STREAMING_BUFFER_REGIONS];
+
+    void create(u64 size) {
+        regionSize = size;
+        region = 0;
+        used = 0;
+
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glCreateBuffers(1, &buffer);
+        glNamedBufferStorage(buffer, STREAMING_BUFFER_REGIONS * regionSize, nullptr, flags);
+        mapped = (u8*)glMapNamedBufferRange(buffer, 0, STREAMING_BUFFER_REGIONS * regionSize, flags);
+        if (!mapped) {
+            OutputDebugStringW(L"Failed to map streaming buffer\n");
+            DebugBreak();
+        }
+    }
+
+    void destroy() {
+        for (int i = 0; i < STREAMING_BUFFER_REGIONS; ++i) {
+            if (fences[i]) {
+                glDeleteSync(fences[i]);
+                fences[i] = nullptr;
+            }
+        }
+
+        // Deleting a mapped buffer unmaps it. Draw calls that were already
+        // submitted keep the storage alive until the GPU is done with it.
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+        mapped = nullptr;
+    }
+
+    /**
+     * Waits until the GPU finished reading the current region.
+     */
+    void beginFrame() {
+        GLsync fence = fences[region];
+        if (fence) {
+            // Flush on the first wait, otherwise the fence might never be submitted
+            GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+            GLenum result = glClientWaitSync(fence, flags, 0);
+            while (result == GL_TIMEOUT_EXPIRED) {
+                flags = 0;
+                result = glClientWaitSync(fence, flags, 1000000);
+            }
+            if (result == GL_WAIT_FAILED) {
+                OutputDebugStringW(L"Waiting for streaming buffer fence failed\n");
+            }
+
+            glDeleteSync(fence);
+            fences[region] = nullptr;
+        }
+        used = 0;
+    }
+
+    /**
+     * Marks the end of GPU commands reading from the current region and
+     * advances to the next region.
+     */
+    void endFrame() {
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        region = (region + 1) % STREAMING_BUFFER_REGIONS;
+    }
+
+    /**
+     * Allocates size bytes from the current region.
+     *
+     * If the region is too small, the buffer is replaced by a larger one.
+     * Data written before in this frame stays valid for the draws that
+     * were already issued.
+     */
+    StreamingAllocation allocate(u64 size, u64 alignment) {
+        u64 start = (used + alignment - 1) & ~(alignment - 1);
+        if (start + size > regionSize) {
+            u64 newSize = 2 * regionSize;
+            while (newSize < size + alignment) {
+                newSize *= 2;
+            }
+            destroy();
+            create(newSize);
+            start = 0;
+        }
+
+        StreamingAllocation result = {};
+        result.offset = region * regionSize + start;
+        result.data = mapped + result.offset;
+        used = start + size;
+        return result;
+    }
+};
@@ -0,0 +1,300 @@
+/******************************************************************************
+* Texture atlas
+*
+* All images drawn with Render_TexturedRect live in one RGBA8 texture, so
+* textured and colored rectangles are drawn with the same texture binding and
+* can share a batch.
+*
+* Images are packed into shelves: horizontal strips with the height of their
+* tallest image, filled from left to right. When no shelf has room, the least
+* recently used shelf is evicted as a whole. Shelves used in the current
+* frame are never evicted, since commands already refer to their texels.
+*
+* Images are uploaded once with glTextureSubImage2D when they are inserted.
+* The caller keeps the returned handle and looks it up every frame, which
+* fails after the image was evicted. The image has to be inserted again then.
+*
+* Example:
+* {
+*     if (!atlas.lookup(icon, &region)) {
+*         icon = atlas.insert(width, height, pixels);
+*         atlas.lookup(icon, &region);
+*     }
+*     RenderCommandTexturedRect rect = {};
+*     ...
+*     setAtlasRegion(&rect, &region);
+*     commands.push(&rect);
+* }
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_core.h"
+#include "fp_opengl.h"
+#include "fp_render_commands.h"
+
+static const int MAX_ATLAS_ENTRIES = 4096;
+static const int MAX_ATLAS_SHELVES = 256;
+
+// White texels at the origin, sampled by rectangles without a texture
+static const int ATLAS_SOLID_SIZE = 4;
+
+// Empty texels to the right of and above each image
+static const int ATLAS_PADDING = 1;
+
+// Shelf heights are rounded up to a multiple of this, so similar images share shelves
+static const int ATLAS_SHELF_GRANULARITY = 4;
+
+// Generation 0 is never used, so a zero initialized handle is invalid
+struct AtlasHandle {
+    u32 index;
+    u32 generation;
+};
+
+struct AtlasRegion {
+    // Packed texture coordinates, see packTexCoord()
+    u32 uv0;
+    u32 uv1;
+    // All texels have an alpha of 1
+    bool opaque;
+};
+
+struct AtlasEntry {
+    u16 x;
+    u16 y;
+    u16 width;
+    u16 height;
+    u16 shelf;
+    bool used;
+    bool opaque;
+    u32 generation;
+};
+
+struct AtlasShelf {
+    u16 y;
+    u16 height;
+    u16 usedWidth;
+    u64 lastUsedFrame;
+};
+
+struct AtlasStats {
+    u64 uploads;
+    u64 uploadedBytes;
+    u64 evictedShelves;
+    u64 evictedEntries;
+    u64 failedInserts;
+};
+
+static void setAtlasRegion(RenderCommandTexturedRect* rect, AtlasRegion* region) {
+    rect->uv0 = region->uv0;
+    rect->uv1 = region->uv1;
+    rect->opaqueTexture = region->opaque;
+}
+
+struct TextureAtlas {
+    unsigned int texture;
+    int width;
+    int height;
+
+    // Optional copy of the texels for the software renderer, width * height pixels
+    u32* shadowPixels;
+
+    AtlasEntry entries[MAX_ATLAS_ENTRIES];
+    AtlasShelf shelves[MAX_ATLAS_SHELVES];
+    int shelfCount;
+    // Top of the highest shelf, new shelves are opened above it
+    int shelfTop;
+
+    u64 frame;
+    AtlasStats stats;
+
+    void create(int atlasWidth, int atlasHeight, u32* shadowMemory) {
+        width = atlasWidth;
+        height = atlasHeight;
+        shadowPixels = shadowMemory;
+        shelfCount = 0;
+        shelfTop = 0;
+        frame = 1;
+        stats = {};
+        for (int i = 0; i < MAX_ATLAS_ENTRIES; ++i) {
+            entries[i] = {};
+        }
+
+        glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+        glTextureStorage2D(texture, 1, GL_RGBA8, width, height);
+        // Texels are drawn 1:1, nearest sampling keeps them exact and never reads neighbors
+        glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        // The first shelf holds the solid texels and is never evicted
+        u32 white[ATLAS_SOLID_SIZE * ATLAS_SOLID_SIZE];
+        for (int i = 0; i < ATLAS_SOLID_SIZE * ATLAS_SOLID_SIZE; ++i) {
+            white[i] = 0xFFFFFFFF;
+        }
+        AtlasShelf* solid = &shelves[shelfCount++];
+        solid->y = 0;
+        solid->height = ATLAS_SOLID_SIZE;
+        solid->usedWidth = ATLAS_SOLID_SIZE + ATLAS_PADDING;
+        solid->lastUsedFrame = ~0ULL;
+        shelfTop = ATLAS_SOLID_SIZE + ATLAS_PADDING;
+        upload(0, 0, ATLAS_SOLID_SIZE, ATLAS_SOLID_SIZE, white);
+    }
+
+    void destroy() {
+        glDeleteTextures(1, &texture);
+        texture = 0;
+    }
+
+    // Entries looked up or inserted from now on are protected from eviction until the next frame
+    void beginFrame() {
+        frame += 1;
+    }
+
+    void upload(int x, int y, int imageWidth, int imageHeight, const u32* pixels) {
+        glTextureSubImage2D(texture, 0, x, y, imageWidth, imageHeight, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        stats.uploads += 1;
+        stats.uploadedBytes += (u64)imageWidth * imageHeight * sizeof(u32);
+
+        if (shadowPixels) {
+            for (int row = 0; row < imageHeight; ++row) {
+                for (int column = 0; column < imageWidth; ++column) {
+                    shadowPixels[(u64)(y + row) * width + x + column] = pixels[row * imageWidth + column];
+                }
+            }
+        }
+    }
+
+    bool lookup(AtlasHandle handle, AtlasRegion* region) {
+        if (handle.generation == 0 || handle.index >= MAX_ATLAS_ENTRIES) {
+            return false;
+        }
+        AtlasEntry* entry = &entries[handle.index];
+        if (!entry->used || entry->generation != handle.generation) {
+            return false;
+        }
+
+        shelves[entry->shelf].lastUsedFrame = frame;
+
+        float scaleX = 1.0f / width;
+        float scaleY = 1.0f / height;
+        region->uv0 = packTexCoord(entry->x * scaleX, entry->y * scaleY);
+        region->uv1 = packTexCoord((entry->x + entry->width) * scaleX, (entry->y + entry->height) * scaleY);
+        region->opaque = entry->opaque;
+        return true;
+    }
+
+    void evictShelf(int shelfIndex) {
+        for (int i = 0; i < MAX_ATLAS_ENTRIES; ++i) {
+            if (entries[i].used && entries[i].shelf == shelfIndex) {
+                entries[i].used = false;
+                stats.evictedEntries += 1;
+            }
+        }
+        shelves[shelfIndex].usedWidth = 0;
+        stats.evictedShelves += 1;
+    }
+
+    // Returns the shelf to place an image of the padded size in, or -1
+    int findShelf(int paddedWidth, int paddedHeight) {
+        // Would not fit into any shelf, and evicting one for it would only lose its entries
+        if (paddedWidth > width || paddedHeight > height) {
+            return -1;
+        }
+
+        // Best fit among the shelves with enough space left, without wasting too much height
+        int best = -1;
+        for (int i = 0; i < shelfCount; ++i) {
+            AtlasShelf* shelf = &shelves[i];
+            bool fits = shelf->height >= paddedHeight && shelf->usedWidth + paddedWidth <= width;
+            bool tooTall = shelf->height > 2 * paddedHeight + ATLAS_SHELF_GRANULARITY;
+            if (fits && !tooTall && (best < 0 || shelf->height < shelves[best].height)) {
+                best = i;
+            }
+        }
+        if (best >= 0) {
+            return best;
+        }
+
+        int shelfHeight = (paddedHeight + ATLAS_SHELF_GRANULARITY - 1) / ATLAS_SHELF_GRANULARITY * ATLAS_SHELF_GRANULARITY;
+        if (shelfCount < MAX_ATLAS_SHELVES && shelfTop + shelfHeight <= height) {
+            AtlasShelf* shelf = &shelves[shelfCount];
+            shelf->y = (u16)shelfTop;
+            shelf->height = (u16)shelfHeight;
+            shelf->usedWidth = 0;
+            shelf->lastUsedFrame = 0;
+            shelfTop += shelfHeight;
+            return shelfCount++;
+        }
+
+        // The atlas is full, reuse the least recently used shelf which is tall enough
+        int oldest = -1;
+        for (int i = 0; i < shelfCount; ++i) {
+            AtlasShelf* shelf = &shelves[i];
+            if (shelf->height < paddedHeight || shelf->lastUsedFrame >= frame) {
+                continue;
+            }
+            if (oldest < 0 || shelf->lastUsedFrame < shelves[oldest].lastUsedFrame) {
+                oldest = i;
+            }
+        }
+        if (oldest >= 0) {
+            evictShelf(oldest);
+        }
+        return oldest;
+    }
+
+    /**
+     * Copies an image into the atlas. pixels are RGBA8 with red in the lowest
+     * byte, tightly packed and with the bottom row first, like in OpenGL.
+     * Returns an invalid handle if the image does not fit.
+     */
+    AtlasHandle insert(int imageWidth, int imageHeight, const u32* pixels) {
+        AtlasHandle handle = {};
+
+        int entryIndex = -1;
+        for (int i = 0; i < MAX_ATLAS_ENTRIES; ++i) {
+            if (!entries[i].used) {
+                entryIndex = i;
+                break;
+            }
+        }
+
+        int shelfIndex = -1;
+        if (entryIndex >= 0 && imageWidth > 0 && imageHeight > 0) {
+            shelfIndex = findShelf(imageWidth + ATLAS_PADDING, imageHeight + ATLAS_PADDING);
+        }
+        if (shelfIndex < 0) {
+            stats.failedInserts += 1;
+            return handle;
+        }
+
+        AtlasShelf* shelf = &shelves[shelfIndex];
+        AtlasEntry* entry = &entries[entryIndex];
+        entry->x = shelf->usedWidth;
+        entry->y = shelf->y;
+        entry->width = (u16)imageWidth;
+        entry->height = (u16)imageHeight;
+        entry->shelf = (u16)shelfIndex;
+        entry->used = true;
+        entry->generation += 1;
+        entry->generation += entry->generation == 0 ? 1 : 0;
+        shelf->usedWidth += (u16)(imageWidth + ATLAS_PADDING);
+        shelf->lastUsedFrame = frame;
+
+        entry->opaque = true;
+        for (int i = 0; i < imageWidth * imageHeight; ++i) {
+            entry->opaque = entry->opaque && (pixels[i] >> 24) == 0xFF;
+        }
+
+        upload(entry->x, entry->y, imageWidth, imageHeight, pixels);
+
+        handle.index = (u32)entryIndex;
+        handle.generation = entry->generation;
+        return handle;
+    }
+};
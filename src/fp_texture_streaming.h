@@ -0,0 +1,356 @@
+/******************************************************************************
+* Texture streaming
+*
+* Uploads large mipmapped textures over several frames without stalling the
+* render thread. Texels are decoded by a callback straight into a persistently
+* mapped pixel unpack buffer, the upload ring, and copied into the texture by
+* the GPU from there. glTextureSubImage2D from client memory would copy all
+* texels on the render thread instead and may wait for the driver.
+*
+* The ring is split into slices, each holding one tile: a band of rows of one
+* mip level. A slice is guarded by a fence and only refilled once the GPU
+* finished the upload from it. If no slice is free, streaming waits for the
+* next frame instead of the fence.
+*
+* Each update() uploads at most frameBudget bytes. The tiles of one update
+* are decoded in parallel on the job system. Mip levels stream from the
+* coarsest to the finest one, always continuing the texture with the smallest
+* pending level first. GL_TEXTURE_BASE_LEVEL is raised to each level once it
+* is complete, so a texture can be drawn blurry right away and sharpens as its
+* finer levels arrive.
+*
+* Example:
+* {
+*     StreamedTexture* image = streamer.stream(width, height, &decodeImage, &file);
+*     ...
+*     streamer.update(&jobs);   // once per frame
+*     if (image->residentLevel < image->levelCount) {
+*         glBindTextureUnit(0, image->texture);
+*     }
+*     ...
+*     streamer.release(image);
+* }
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_core.h"
+#include "fp_jobs.h"
+#include "fp_opengl.h"
+
+static const int TEXTURE_STREAM_SLICES = 16;
+static const int MAX_STREAMED_TEXTURES = 64;
+
+static const u64 DEFAULT_TEXTURE_STREAM_RING_SIZE = 16 * MB;
+static const u64 DEFAULT_TEXTURE_STREAM_BUDGET = 4 * MB;
+
+/**
+ * Writes rowCount rows of a mip level, starting at firstRow, to texels.
+ * Texels are RGBA8 with red in the lowest byte, tightly packed with
+ * levelWidth texels per row and the bottom row first, like in OpenGL.
+ * Called from worker threads, tiles of the same texture may be decoded at
+ * the same time.
+ */
+typedef void TextureDecodeFunction(void* data, int level, int firstRow, int rowCount, int levelWidth, u32* texels);
+
+struct StreamedTexture {
+    unsigned int texture;
+    int width;
+    int height;
+    int levelCount;
+
+    TextureDecodeFunction* decode;
+    void* decodeData;
+
+    // Level that is streamed next, counting down to 0, and its next row
+    int level;
+    int row;
+    // Finest level that is completely uploaded, levelCount while there is none
+    int residentLevel;
+    bool used;
+};
+
+// One band of rows of a mip level, decoded into a slice of the ring
+struct TextureStreamTile {
+    StreamedTexture* stream;
+    int level;
+    int firstRow;
+    int rowCount;
+    int levelWidth;
+    int slice;
+};
+
+struct TextureStreamStats {
+    u64 uploadedBytes;
+    u64 tiles;
+    u64 completedTextures;
+    // CPU time of update(), including the decoding
+    u64 updateTicks;
+    // Updates that stopped early because every free slice was still read by the GPU
+    u64 ringFullUpdates;
+};
+
+static int mipLevelSize(int size, int level) {
+    int result = size >> level;
+    return result > 0 ? result : 1;
+}
+
+struct TextureStreamer {
+    unsigned int buffer;
+    u8* mapped;
+    u64 ringSize;
+    u64 sliceSize;
+    GLsync fences[TEXTURE_STREAM_SLICES];
+    int nextSlice;
+
+    // Bytes uploaded by one update() at most, at least one tile is always uploaded
+    u64 frameBudget;
+
+    StreamedTexture textures[MAX_STREAMED_TEXTURES];
+    TextureStreamStats stats;
+
+    /**
+     * The ring is only allocated when the first texture is streamed, so
+     * renderers that never stream a texture do not pay for it.
+     */
+    void create(u64 size, u64 budget) {
+        ringSize = size;
+        sliceSize = size / TEXTURE_STREAM_SLICES & ~(u64)15;
+        frameBudget = budget;
+        nextSlice = 0;
+        stats = {};
+        for (int i = 0; i < MAX_STREAMED_TEXTURES; ++i) {
+            textures[i] = {};
+        }
+    }
+
+    void destroy() {
+        for (int i = 0; i < MAX_STREAMED_TEXTURES; ++i) {
+            if (textures[i].used) {
+                release(&textures[i]);
+            }
+        }
+        for (int i = 0; i < TEXTURE_STREAM_SLICES; ++i) {
+            if (fences[i]) {
+                glDeleteSync(fences[i]);
+                fences[i] = nullptr;
+            }
+        }
+        if (buffer) {
+            glDeleteBuffers(1, &buffer);
+            buffer = 0;
+            mapped = nullptr;
+        }
+    }
+
+    bool createRing() {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glCreateBuffers(1, &buffer);
+        glNamedBufferStorage(buffer, TEXTURE_STREAM_SLICES * sliceSize, nullptr, flags);
+        mapped = (u8*)glMapNamedBufferRange(buffer, 0, TEXTURE_STREAM_SLICES * sliceSize, flags);
+        if (!mapped) {
+            OutputDebugStringW(L"Failed to map texture upload ring\n");
+            glDeleteBuffers(1, &buffer);
+            buffer = 0;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Creates a texture with a full mip chain whose texels are streamed in by
+     * the following update() calls. Returns nullptr if all slots are in use,
+     * a row of the texture does not fit into a slice or the ring could not be
+     * mapped. The texture stays valid until release().
+     */
+    StreamedTexture* stream(int width, int height, TextureDecodeFunction* decode, void* decodeData) {
+        Assert(width > 0 && height > 0 && decode);
+        if ((u64)width * sizeof(u32) > sliceSize || (!buffer && !createRing())) {
+            return nullptr;
+        }
+
+        StreamedTexture* result = nullptr;
+        for (int i = 0; i < MAX_STREAMED_TEXTURES; ++i) {
+            if (!textures[i].used) {
+                result = &textures[i];
+                break;
+            }
+        }
+        if (!result) {
+            return nullptr;
+        }
+
+        int levelCount = 1;
+        while ((width >> levelCount) > 0 || (height >> levelCount) > 0) {
+            levelCount += 1;
+        }
+
+        *result = {};
+        result->width = width;
+        result->height = height;
+        result->levelCount = levelCount;
+        result->decode = decode;
+        result->decodeData = decodeData;
+        result->level = levelCount - 1;
+        result->residentLevel = levelCount;
+        result->used = true;
+
+        glCreateTextures(GL_TEXTURE_2D, 1, &result->texture);
+        glTextureStorage2D(result->texture, levelCount, GL_RGBA8, width, height);
+        glTextureParameteri(result->texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTextureParameteri(result->texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTextureParameteri(result->texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(result->texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(result->texture, GL_TEXTURE_BASE_LEVEL, levelCount - 1);
+        return result;
+    }
+
+    // Deletes the texture, tiles of it that are still uploading keep its storage alive
+    void release(StreamedTexture* texture) {
+        glDeleteTextures(1, &texture->texture);
+        *texture = {};
+    }
+
+    bool isComplete(StreamedTexture* texture) {
+        return texture->residentLevel == 0;
+    }
+
+    // Returns whether the slice may be overwritten, without waiting for the GPU
+    bool acquireSlice(int slice) {
+        GLsync fence = fences[slice];
+        if (!fence) {
+            return true;
+        }
+        // Flush, otherwise the fence might never be submitted while we keep polling
+        GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (result == GL_TIMEOUT_EXPIRED) {
+            return false;
+        }
+        if (result == GL_WAIT_FAILED) {
+            OutputDebugStringW(L"Waiting for texture upload fence failed\n");
+        }
+        glDeleteSync(fence);
+        fences[slice] = nullptr;
+        return true;
+    }
+
+    // Texture whose next level is the smallest, coarse levels of all textures come before fine ones
+    StreamedTexture* nextPendingTexture() {
+        StreamedTexture* result = nullptr;
+        u64 resultTexels = 0;
+        for (int i = 0; i < MAX_STREAMED_TEXTURES; ++i) {
+            StreamedTexture* texture = &textures[i];
+            if (!texture->used || texture->level < 0) {
+                continue;
+            }
+            u64 texels = (u64)mipLevelSize(texture->width, texture->level) * mipLevelSize(texture->height, texture->level);
+            if (!result || texels < resultTexels) {
+                result = texture;
+                resultTexels = texels;
+            }
+        }
+        return result;
+    }
+
+    /**
+     * Decodes and uploads the next tiles within the frame budget. Has to be
+     * called on the thread of the OpenGL context, jobs is optional.
+     */
+    void update(JobSystem* jobs) {
+        if (!buffer) {
+            return;
+        }
+        u64 startTicks = getPerformanceCounter();
+
+        TextureStreamTile tiles[TEXTURE_STREAM_SLICES];
+        int tileCount = 0;
+        u64 budget = frameBudget;
+        while (tileCount < TEXTURE_STREAM_SLICES) {
+            StreamedTexture* texture = nextPendingTexture();
+            if (!texture || (tileCount > 0 && budget == 0)) {
+                break;
+            }
+            if (!acquireSlice(nextSlice)) {
+                stats.ringFullUpdates += 1;
+                break;
+            }
+
+            int levelWidth = mipLevelSize(texture->width, texture->level);
+            int levelHeight = mipLevelSize(texture->height, texture->level);
+            u64 rowBytes = (u64)levelWidth * sizeof(u32);
+            u64 tileBytes = budget < sliceSize ? budget : sliceSize;
+            int rowCount = (int)(tileBytes / rowBytes);
+            rowCount = rowCount > 0 ? rowCount : 1;
+            rowCount = rowCount < levelHeight - texture->row ? rowCount : levelHeight - texture->row;
+
+            TextureStreamTile* tile = &tiles[tileCount++];
+            tile->stream = texture;
+            tile->level = texture->level;
+            tile->firstRow = texture->row;
+            tile->rowCount = rowCount;
+            tile->levelWidth = levelWidth;
+            tile->slice = nextSlice;
+            nextSlice = (nextSlice + 1) % TEXTURE_STREAM_SLICES;
+
+            u64 bytes = rowBytes * rowCount;
+            budget = budget > bytes ? budget - bytes : 0;
+            texture->row += rowCount;
+            if (texture->row == levelHeight) {
+                texture->level -= 1;
+                texture->row = 0;
+            }
+        }
+        if (tileCount == 0) {
+            stats.updateTicks += getPerformanceCounter() - startTicks;
+            return;
+        }
+
+        // The tiles write to different slices, so they are decoded independently
+        struct DecodeJob {
+            TextureStreamTile* tiles;
+            TextureStreamer* streamer;
+        } decodeJob = { tiles, this };
+        JobFunction* decodeTile = +[](void* data, int index) {
+            DecodeJob* job = (DecodeJob*)data;
+            TextureStreamTile* tile = &job->tiles[index];
+            u32* texels = (u32*)(job->streamer->mapped + tile->slice * job->streamer->sliceSize);
+            tile->stream->decode(tile->stream->decodeData, tile->level, tile->firstRow, tile->rowCount, tile->levelWidth, texels);
+        };
+        if (jobs) {
+            jobs->run(decodeTile, &decodeJob, tileCount);
+        }
+        else {
+            for (int i = 0; i < tileCount; ++i) {
+                decodeTile(&decodeJob, i);
+            }
+        }
+
+        // With an unpack buffer bound, the pixel pointer is an offset into it
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        for (int i = 0; i < tileCount; ++i) {
+            TextureStreamTile* tile = &tiles[i];
+            StreamedTexture* texture = tile->stream;
+            u64 offset = tile->slice * sliceSize;
+            glTextureSubImage2D(texture->texture, tile->level, 0, tile->firstRow, tile->levelWidth, tile->rowCount,
+                GL_RGBA, GL_UNSIGNED_BYTE, (void*)offset);
+            fences[tile->slice] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+            stats.uploadedBytes += (u64)tile->levelWidth * tile->rowCount * sizeof(u32);
+            stats.tiles += 1;
+
+            // Draws issued after this point sample the completed level
+            int levelHeight = mipLevelSize(texture->height, tile->level);
+            if (tile->firstRow + tile->rowCount == levelHeight) {
+                texture->residentLevel = tile->level;
+                glTextureParameteri(texture->texture, GL_TEXTURE_BASE_LEVEL, tile->level);
+                stats.completedTextures += tile->level == 0 ? 1 : 0;
+            }
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        stats.updateTicks += getPerformanceCounter() - startTicks;
+    }
+};
@@ -0,0 +1,658 @@
+/******************************************************************************
+* TrueType fonts
+*
+* Minimal TrueType parser and glyph rasterizer in the spirit of stb_truetype.
+* Only what is needed to draw text is supported:
+*
+* - Character to glyph mapping with cmap format 4 and 12
+* - Horizontal metrics from hhea and hmtx, no kerning
+* - Simple and composite glyphs with quadratic outlines from glyf
+*
+* Outlines are flattened to lines and rasterized with exact signed area
+* coverage: every line adds its area contribution to an accumulation buffer,
+* a prefix sum over each row then gives the coverage of each pixel. This is
+* the approach of font-rs and the newer stb_truetype rasterizer.
+*
+* The font data must stay alive as long as the font is used. All temporary
+* memory comes from the scratch arena passed to rasterizeGlyph().
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_core.h"
+#include "fp_allocator.h"
+#include "fp_math.h"
+
+#include <immintrin.h>
+
+struct TrueTypeFont {
+    u8 const* data;
+    u64 size;
+
+    u32 cmapSubtable;
+    u32 loca;
+    u32 glyf;
+    u32 hmtx;
+
+    u16 cmapFormat;
+    u16 indexToLocFormat;
+    u16 glyphCount;
+    u16 horizontalMetricCount;
+    u16 unitsPerEm;
+
+    // Font units, descent is negative
+    i16 ascent;
+    i16 descent;
+    i16 lineGap;
+};
+
+// Coverage of a glyph, one byte per pixel with the bottom row first
+struct GlyphBitmap {
+    u8* coverage;
+    int width;
+    int height;
+    // Position of the bottom left pixel relative to the pen position on the baseline
+    int offsetX;
+    int offsetY;
+};
+
+struct GlyphEdge {
+    float x0;
+    float y0;
+    float x1;
+    float y1;
+};
+
+static u16 ttUshort(u8 const* p) {
+    return (u16)((p[0] << 8) | p[1]);
+}
+
+static i16 ttShort(u8 const* p) {
+    return (i16)ttUshort(p);
+}
+
+static u32 ttUlong(u8 const* p) {
+    return ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | p[3];
+}
+
+static float ttAbs(float value) {
+    return value < 0.0f ? -value : value;
+}
+
+// Returns the offset of the table or 0 if the font does not contain it
+static u32 findTrueTypeTable(u8 const* data, u64 size, char const* tag) {
+    if (size < 12) {
+        return 0;
+    }
+    u16 tableCount = ttUshort(data + 4);
+    for (u32 i = 0; i < tableCount; ++i) {
+        u32 record = 12 + 16 * i;
+        if (record + 16 > size) {
+            return 0;
+        }
+        u8 const* recordTag = data + record;
+        if (recordTag[0] == tag[0] && recordTag[1] == tag[1] && recordTag[2] == tag[2] && recordTag[3] == tag[3]) {
+            u32 offset = ttUlong(data + record + 8);
+            return offset < size ? offset : 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Reads the tables needed for drawing text. Returns false if the data is not
+ * a TrueType font with quadratic outlines or lacks a Unicode character map.
+ */
+static bool initTrueTypeFont(TrueTypeFont* font, u8 const* data, u64 size) {
+    *font = {};
+    font->data = data;
+    font->size = size;
+
+    u32 cmap = findTrueTypeTable(data, size, "cmap");
+    u32 head = findTrueTypeTable(data, size, "head");
+    u32 hhea = findTrueTypeTable(data, size, "hhea");
+    u32 maxp = findTrueTypeTable(data, size, "maxp");
+    font->loca = findTrueTypeTable(data, size, "loca");
+    font->glyf = findTrueTypeTable(data, size, "glyf");
+    font->hmtx = findTrueTypeTable(data, size, "hmtx");
+    if (!cmap || !head || !hhea || !maxp || !font->loca || !font->glyf || !font->hmtx) {
+        return false;
+    }
+
+    font->unitsPerEm = ttUshort(data + head + 18);
+    font->indexToLocFormat = ttUshort(data + head + 50);
+    font->glyphCount = ttUshort(data + maxp + 4);
+    font->ascent = ttShort(data + hhea + 4);
+    font->descent = ttShort(data + hhea + 6);
+    font->lineGap = ttShort(data + hhea + 8);
+    font->horizontalMetricCount = ttUshort(data + hhea + 34);
+
+    // Prefer the full Unicode map, fall back to the basic multilingual plane
+    u16 subtableCount = ttUshort(data + cmap + 2);
+    for (u32 i = 0; i < subtableCount; ++i) {
+        u8 const* record = data + cmap + 4 + 8 * i;
+        u16 platform = ttUshort(record);
+        u16 encoding = ttUshort(record + 2);
+        u32 subtable = cmap + ttUlong(record + 4);
+        bool unicode = platform == 0 || (platform == 3 && (encoding == 1 || encoding == 10));
+        if (!unicode || subtable + 4 > size) {
+            continue;
+        }
+
+        u16 format = ttUshort(data + subtable);
+        if (format == 12 || (format == 4 && font->cmapFormat != 12)) {
+            font->cmapFormat = format;
+            font->cmapSubtable = subtable;
+        }
+    }
+
+    return font->cmapSubtable != 0 && font->unitsPerEm != 0;
+}
+
+// Glyph 0 is the missing glyph
+static u32 findGlyphIndex(TrueTypeFont* font, u32 codepoint) {
+    u8 const* subtable = font->data + font->cmapSubtable;
+
+    if (font->cmapFormat == 4) {
+        if (codepoint > 0xFFFF) {
+            return 0;
+        }
+        u16 segmentCount = ttUshort(subtable + 6) / 2;
+        u8 const* endCodes = subtable + 14;
+        u8 const* startCodes = endCodes + 2 * segmentCount + 2;
+        u8 const* idDeltas = startCodes + 2 * segmentCount;
+        u8 const* idRangeOffsets = idDeltas + 2 * segmentCount;
+
+        // Segments are sorted by their end code
+        u32 low = 0;
+        u32 high = segmentCount;
+        while (low < high) {
+            u32 middle = (low + high) / 2;
+            if (ttUshort(endCodes + 2 * middle) < codepoint) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        if (low == segmentCount || ttUshort(startCodes + 2 * low) > codepoint) {
+            return 0;
+        }
+
+        u16 start = ttUshort(startCodes + 2 * low);
+        u16 delta = ttUshort(idDeltas + 2 * low);
+        u16 rangeOffset = ttUshort(idRangeOffsets + 2 * low);
+        if (rangeOffset == 0) {
+            return (codepoint + delta) & 0xFFFF;
+        }
+        // The range offset is relative to its own position in the table
+        u16 glyph = ttUshort(idRangeOffsets + 2 * low + rangeOffset + 2 * (codepoint - start));
+        return glyph == 0 ? 0 : (glyph + delta) & 0xFFFF;
+    }
+
+    if (font->cmapFormat == 12) {
+        u32 groupCount = ttUlong(subtable + 12);
+        u32 low = 0;
+        u32 high = groupCount;
+        while (low < high) {
+            u32 middle = (low + high) / 2;
+            u8 const* group = subtable + 16 + 12 * middle;
+            if (codepoint < ttUlong(group)) {
+                high = middle;
+            }
+            else if (codepoint > ttUlong(group + 4)) {
+                low = middle + 1;
+            }
+            else {
+                return ttUlong(group + 8) + codepoint - ttUlong(group);
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Scale from font units to pixels, so that ascent - descent is pixelHeight high
+static float scaleForPixelHeight(TrueTypeFont* font, float pixelHeight) {
+    return pixelHeight / (float)(font->ascent - font->descent);
+}
+
+// Horizontal advance in font units
+static int getGlyphAdvance(TrueTypeFont* font, u32 glyph) {
+    // Glyphs after the last metric share its advance
+    u32 metric = glyph < font->horizontalMetricCount ? glyph : font->horizontalMetricCount - 1u;
+    return ttUshort(font->data + font->hmtx + 4 * metric);
+}
+
+// Returns the offset of the glyph data or 0 for glyphs without an outline
+static u32 getGlyphOffset(TrueTypeFont* font, u32 glyph) {
+    if (glyph >= font->glyphCount) {
+        return 0;
+    }
+
+    u32 start, end;
+    u8 const* loca = font->data + font->loca;
+    if (font->indexToLocFormat == 0) {
+        start = 2 * ttUshort(loca + 2 * glyph);
+        end = 2 * ttUshort(loca + 2 * glyph + 2);
+    }
+    else {
+        start = ttUlong(loca + 4 * glyph);
+        end = ttUlong(loca + 4 * glyph + 4);
+    }
+    if (start == end || font->glyf + end > font->size) {
+        return 0;
+    }
+    return font->glyf + start;
+}
+
+// Bounding box in font units, returns false for glyphs without an outline like the space
+static bool getGlyphBox(TrueTypeFont* font, u32 glyph, int* x0, int* y0, int* x1, int* y1) {
+    u32 offset = getGlyphOffset(font, glyph);
+    if (!offset) {
+        return false;
+    }
+    u8 const* header = font->data + offset;
+    *x0 = ttShort(header + 2);
+    *y0 = ttShort(header + 4);
+    *x1 = ttShort(header + 6);
+    *y1 = ttShort(header + 8);
+    return true;
+}
+
+// Row-major 2x3 transform from font units to pixels
+struct GlyphTransform {
+    float m[6];
+
+    void apply(float x, float y, float* outX, float* outY) {
+        *outX = m[0] * x + m[1] * y + m[2];
+        *outY = m[3] * x + m[4] * y + m[5];
+    }
+};
+
+struct GlyphEdgeList {
+    GlyphEdge* edges;
+    u32 count;
+    u32 capacity;
+    bool overflow;
+
+    void add(float x0, float y0, float x1, float y1) {
+        // Horizontal lines do not contribute to the coverage
+        if (y0 == y1) {
+            return;
+        }
+        if (count == capacity) {
+            overflow = true;
+            return;
+        }
+        edges[count++] = { x0, y0, x1, y1 };
+    }
+
+    // Flattens a quadratic Bezier curve, the segment count grows with the curvature in pixels
+    void addQuadratic(float x0, float y0, float cx, float cy, float x1, float y1) {
+        float dx = x0 - 2.0f * cx + x1;
+        float dy = y0 - 2.0f * cy + y1;
+        float deviation = _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(dx * dx + dy * dy)));
+        int segments = 1 + (int)_mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(2.0f * deviation)));
+        segments = segments < 16 ? segments : 16;
+
+        float previousX = x0;
+        float previousY = y0;
+        for (int i = 1; i <= segments; ++i) {
+            float t = (float)i / segments;
+            float s = 1.0f - t;
+            float x = s * s * x0 + 2.0f * s * t * cx + t * t * x1;
+            float y = s * s * y0 + 2.0f * s * t * cy + t * t * y1;
+            add(previousX, previousY, x, y);
+            previousX = x;
+            previousY = y;
+        }
+    }
+};
+
+static const int MAX_COMPOSITE_DEPTH = 4;
+
+/**
+ * Appends the outline of the glyph as lines in pixel coordinates. Composite
+ * glyphs recurse into their components with the combined transform.
+ */
+static void collectGlyphEdges(TrueTypeFont* font, u32 glyph, GlyphTransform* transform, GlyphEdgeList* list,
+    ArenaAllocator* scratch, int depth) {
+    u32 offset = getGlyphOffset(font, glyph);
+    if (!offset || depth > MAX_COMPOSITE_DEPTH) {
+        return;
+    }
+    u8 const* data = font->data + offset;
+    i16 contourCount = ttShort(data);
+
+    if (contourCount < 0) {
+        const u16 ARG_1_AND_2_ARE_WORDS = 0x0001;
+        const u16 WE_HAVE_A_SCALE = 0x0008;
+        const u16 MORE_COMPONENTS = 0x0020;
+        const u16 WE_HAVE_AN_X_AND_Y_SCALE = 0x0040;
+        const u16 WE_HAVE_A_TWO_BY_TWO = 0x0080;
+
+        u8 const* component = data + 10;
+        u16 flags = MORE_COMPONENTS;
+        while (flags & MORE_COMPONENTS) {
+            flags = ttUshort(component);
+            u16 componentGlyph = ttUshort(component + 2);
+            component += 4;
+
+            // Only offsets are supported as arguments, matching points are rare in practice
+            float dx, dy;
+            if (flags & ARG_1_AND_2_ARE_WORDS) {
+                dx = ttShort(component);
+                dy = ttShort(component + 2);
+                component += 4;
+            }
+            else {
+                dx = (i8)component[0];
+                dy = (i8)component[1];
+                component += 2;
+            }
+
+            float a = 1.0f, b = 0.0f, c = 0.0f, d = 1.0f;
+            if (flags & WE_HAVE_A_SCALE) {
+                a = d = ttShort(component) / 16384.0f;
+                component += 2;
+            }
+            else if (flags & WE_HAVE_AN_X_AND_Y_SCALE) {
+                a = ttShort(component) / 16384.0f;
+                d = ttShort(component + 2) / 16384.0f;
+                component += 4;
+            }
+            else if (flags & WE_HAVE_A_TWO_BY_TWO) {
+                a = ttShort(component) / 16384.0f;
+                c = ttShort(component + 2) / 16384.0f;
+                b = ttShort(component + 4) / 16384.0f;
+                d = ttShort(component + 6) / 16384.0f;
+                component += 8;
+            }
+
+            // The component transform is applied first
+            float* m = transform->m;
+            GlyphTransform combined = { {
+                m[0] * a + m[1] * c, m[0] * b + m[1] * d, m[0] * dx + m[1] * dy + m[2],
+                m[3] * a + m[4] * c, m[3] * b + m[4] * d, m[3] * dx + m[4] * dy + m[5],
+            } };
+            collectGlyphEdges(font, componentGlyph, &combined, list, scratch, depth + 1);
+        }
+        return;
+    }
+
+    const u8 ON_CURVE = 0x01;
+    const u8 X_SHORT = 0x02;
+    const u8 Y_SHORT = 0x04;
+    const u8 REPEAT = 0x08;
+    const u8 X_SAME_OR_POSITIVE = 0x10;
+    const u8 Y_SAME_OR_POSITIVE = 0x20;
+
+    u8 const* endPoints = data + 10;
+    if (contourCount == 0) {
+        return;
+    }
+    u32 pointCount = ttUshort(endPoints + 2 * (contourCount - 1)) + 1u;
+    u16 instructionLength = ttUshort(endPoints + 2 * contourCount);
+    u8 const* cursor = endPoints + 2 * contourCount + 2 + instructionLength;
+
+    u64 mark = scratch->used;
+    u8* flags = scratch->allocateArray<u8>(pointCount);
+    float* xs = scratch->allocateArray<float>(pointCount);
+    float* ys = scratch->allocateArray<float>(pointCount);
+    if (!flags || !xs || !ys) {
+        list->overflow = true;
+        scratch->used = mark;
+        return;
+    }
+
+    for (u32 i = 0; i < pointCount;) {
+        u8 flag = *cursor++;
+        u32 repeat = 1;
+        if (flag & REPEAT) {
+            repeat += *cursor++;
+        }
+        for (; repeat > 0 && i < pointCount; --repeat) {
+            flags[i++] = flag;
+        }
+    }
+
+    // Coordinates are stored as deltas
+    int x = 0;
+    for (u32 i = 0; i < pointCount; ++i) {
+        if (flags[i] & X_SHORT) {
+            int delta = *cursor++;
+            x += (flags[i] & X_SAME_OR_POSITIVE) ? delta : -delta;
+        }
+        else if (!(flags[i] & X_SAME_OR_POSITIVE)) {
+            x += ttShort(cursor);
+            cursor += 2;
+        }
+        xs[i] = (float)x;
+    }
+    int y = 0;
+    for (u32 i = 0; i < pointCount; ++i) {
+        if (flags[i] & Y_SHORT) {
+            int delta = *cursor++;
+            y += (flags[i] & Y_SAME_OR_POSITIVE) ? delta : -delta;
+        }
+        else if (!(flags[i] & Y_SAME_OR_POSITIVE)) {
+            y += ttShort(cursor);
+            cursor += 2;
+        }
+        ys[i] = (float)y;
+    }
+
+    for (u32 i = 0; i < pointCount; ++i) {
+        transform->apply(xs[i], ys[i], &xs[i], &ys[i]);
+    }
+
+    u32 first = 0;
+    for (int contour = 0; contour < contourCount; ++contour) {
+        u32 last = ttUshort(endPoints + 2 * contour);
+        if (last >= pointCount || last < first) {
+            break;
+        }
+
+        // Start on a point on the curve, two off curve points imply one on the curve between them
+        float startX, startY;
+        if (flags[first] & ON_CURVE) {
+            startX = xs[first];
+            startY = ys[first];
+        }
+        else if (flags[last] & ON_CURVE) {
+            startX = xs[last];
+            startY = ys[last];
+        }
+        else {
+            startX = 0.5f * (xs[first] + xs[last]);
+            startY = 0.5f * (ys[first] + ys[last]);
+        }
+
+        float currentX = startX;
+        float currentY = startY;
+        bool hasControl = false;
+        float controlX = 0.0f;
+        float controlY = 0.0f;
+        for (u32 i = first; i <= last + 1; ++i) {
+            // The contour is closed by returning to the start point
+            bool closing = i == last + 1;
+            u32 index = closing ? first : i;
+            bool onCurve = closing || (flags[index] & ON_CURVE);
+            float pointX = closing ? startX : xs[index];
+            float pointY = closing ? startY : ys[index];
+            if (!closing && index == first && (flags[first] & ON_CURVE)) {
+                continue;
+            }
+
+            if (onCurve) {
+                if (hasControl) {
+                    list->addQuadratic(currentX, currentY, controlX, controlY, pointX, pointY);
+                }
+                else {
+                    list->add(currentX, currentY, pointX, pointY);
+                }
+                currentX = pointX;
+                currentY = pointY;
+                hasControl = false;
+            }
+            else {
+                if (hasControl) {
+                    float middleX = 0.5f * (controlX + pointX);
+                    float middleY = 0.5f * (controlY + pointY);
+                    list->addQuadratic(currentX, currentY, controlX, controlY, middleX, middleY);
+                    currentX = middleX;
+                    currentY = middleY;
+                }
+                controlX = pointX;
+                controlY = pointY;
+                hasControl = true;
+            }
+        }
+
+        first = last + 1;
+    }
+
+    scratch->used = mark;
+}
+
+// Adds the signed area of one line to the accumulation buffer of width * height cells
+static void accumulateEdge(float* accumulation, int width, int height, GlyphEdge edge) {
+    float direction = 1.0f;
+    if (edge.y0 > edge.y1) {
+        direction = -1.0f;
+        GlyphEdge swapped = { edge.x1, edge.y1, edge.x0, edge.y0 };
+        edge = swapped;
+    }
+
+    float dxdy = (edge.x1 - edge.x0) / (edge.y1 - edge.y0);
+    float x = edge.x0;
+    int firstRow = (int)edge.y0;
+    int onePastLastRow = (int)ceilFloat(edge.y1);
+    onePastLastRow = onePastLastRow < height ? onePastLastRow : height;
+
+    for (int row = firstRow; row < onePastLastRow; ++row) {
+        float rowTop = (float)(row + 1) < edge.y1 ? (float)(row + 1) : edge.y1;
+        float rowBottom = (float)row > edge.y0 ? (float)row : edge.y0;
+        float dy = rowTop - rowBottom;
+        float xNext = x + dxdy * dy;
+        float d = dy * direction;
+
+        float left = x < xNext ? x : xNext;
+        float right = x < xNext ? xNext : x;
+        float leftFloor = floorFloat(left);
+        int leftIndex = (int)leftFloor;
+        float rightCeil = ceilFloat(right);
+        int rightIndex = (int)rightCeil;
+        float* line = accumulation + row * width;
+
+        if (rightIndex <= leftIndex + 1) {
+            // The line stays within one pixel column in this row
+            float middle = 0.5f * (x + xNext) - leftFloor;
+            line[leftIndex] += d - d * middle;
+            line[leftIndex + 1] += d * middle;
+        }
+        else {
+            float inverseWidth = 1.0f / (right - left);
+            float leftFraction = left - leftFloor;
+            float firstArea = 0.5f * inverseWidth * (1.0f - leftFraction) * (1.0f - leftFraction);
+            float rightFraction = right - rightCeil + 1.0f;
+            float lastArea = 0.5f * inverseWidth * rightFraction * rightFraction;
+
+            line[leftIndex] += d * firstArea;
+            if (rightIndex == leftIndex + 2) {
+                line[leftIndex + 1] += d * (1.0f - firstArea - lastArea);
+            }
+            else {
+                float secondArea = inverseWidth * (1.5f - leftFraction);
+                line[leftIndex + 1] += d * (secondArea - firstArea);
+                for (int column = leftIndex + 2; column < rightIndex - 1; ++column) {
+                    line[column] += d * inverseWidth;
+                }
+                float coveredArea = secondArea + (rightIndex - leftIndex - 3) * inverseWidth;
+                line[rightIndex - 1] += d * (1.0f - coveredArea - lastArea);
+            }
+            line[rightIndex] += d * lastArea;
+        }
+
+        x = xNext;
+    }
+}
+
+// Maximum number of lines per glyph after flattening the curves
+static const u32 MAX_GLYPH_EDGES = 4096;
+
+/**
+ * Rasterizes the glyph at the given scale, see scaleForPixelHeight(). The
+ * coverage is allocated from scratch. Returns false for glyphs without an
+ * outline or if scratch is exhausted, bitmap is empty in that case.
+ */
+static bool rasterizeGlyph(TrueTypeFont* font, u32 glyph, float scale, ArenaAllocator* scratch, GlyphBitmap* bitmap) {
+    *bitmap = {};
+
+    int boxX0, boxY0, boxX1, boxY1;
+    if (!getGlyphBox(font, glyph, &boxX0, &boxY0, &boxX1, &boxY1)) {
+        return false;
+    }
+    int x0 = (int)floorFloat(boxX0 * scale);
+    int y0 = (int)floorFloat(boxY0 * scale);
+    int x1 = (int)ceilFloat(boxX1 * scale);
+    int y1 = (int)ceilFloat(boxY1 * scale);
+    int width = x1 - x0;
+    int height = y1 - y0;
+    if (width <= 0 || height <= 0) {
+        return false;
+    }
+
+    u8* coverage = scratch->allocateArray<u8>((u64)width * height);
+    u64 mark = scratch->used;
+    // One cell of slack, lines ending at the right edge add to the cell after the row
+    float* accumulation = scratch->allocateArray<float>((u64)width * height + 2);
+    GlyphEdgeList list = {};
+    list.edges = scratch->allocateArray<GlyphEdge>(MAX_GLYPH_EDGES);
+    list.capacity = MAX_GLYPH_EDGES;
+    if (!coverage || !accumulation || !list.edges) {
+        scratch->used = mark;
+        return false;
+    }
+
+    // Font units to the pixels of the bitmap
+    GlyphTransform transform = { { scale, 0.0f, (float)-x0, 0.0f, scale, (float)-y0 } };
+    collectGlyphEdges(font, glyph, &transform, &list, scratch, 0);
+
+    for (u64 i = 0; i < (u64)width * height + 2; ++i) {
+        accumulation[i] = 0.0f;
+    }
+    for (u32 i = 0; i < list.count; ++i) {
+        // Rounding may move points slightly outside of the box
+        GlyphEdge edge = list.edges[i];
+        edge.x0 = edge.x0 < 0.0f ? 0.0f : (edge.x0 > width ? (float)width : edge.x0);
+        edge.x1 = edge.x1 < 0.0f ? 0.0f : (edge.x1 > width ? (float)width : edge.x1);
+        edge.y0 = edge.y0 < 0.0f ? 0.0f : (edge.y0 > height ? (float)height : edge.y0);
+        edge.y1 = edge.y1 < 0.0f ? 0.0f : (edge.y1 > height ? (float)height : edge.y1);
+        if (edge.y0 != edge.y1) {
+            accumulateEdge(accumulation, width, height, edge);
+        }
+    }
+
+    // The winding direction does not matter, only the absolute area
+    float sum = 0.0f;
+    for (u64 i = 0; i < (u64)width * height; ++i) {
+        sum += accumulation[i];
+        float value = ttAbs(sum);
+        value = value < 1.0f ? value : 1.0f;
+        coverage[i] = (u8)(value * 255.0f + 0.5f);
+    }
+
+    scratch->used = mark;
+
+    bitmap->coverage = coverage;
+    bitmap->width = width;
+    bitmap->height = height;
+    bitmap->offsetX = x0;
+    bitmap->offsetY = y0;
+    return !list.overflow;
+}
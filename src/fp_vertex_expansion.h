@@ -0,0 +1,279 @@
+/******************************************************************************
+* Vertex expansion
+*
+* Converts sorted rectangle commands into vertex data for the GPU, either one
+* instance per rectangle or 6 vertices per rectangle. The vertices are
+* written by a scalar loop, or gathered into a structure of arrays
+* (RectBatch) and expanded 8 rectangles at a time with AVX2.
+*
+* Only the positions are expanded to 6 vertices. Color, texture region and
+* shape are the same for all of them and follow once per rectangle.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#pragma once
+
+#include "fp_core.h"
+#include "fp_allocator.h"
+#include "fp_render_commands.h"
+#include "fp_command_sort.h"
+
+#include <immintrin.h>
+
+struct PackedVertex {
+    float x;
+    float y;
+};
+
+/**
+ * The 6 vertices of a rectangle and its parameters, 64 bytes instead of 6
+ * vertices that each carry the parameters. The vertex shader reads it from a
+ * storage buffer with gl_VertexID / 6 and selects the corner from gl_VertexID % 6.
+ */
+struct ExpandedRect {
+    PackedVertex vertices[6];
+    // RGBA8, red in the lowest byte
+    u32 color;
+    // Packed texture coordinates, see packTexCoord(), or the size of a shape
+    u32 uv0;
+    u32 uv1;
+    // See packShape(), 0 for plain rectangles
+    u32 shape;
+};
+
+struct RectInstance {
+    float x;
+    float y;
+    float width;
+    float height;
+    // RGBA8, red in the lowest byte
+    u32 color;
+    // Packed texture coordinates, see packTexCoord(), or the size of a shape
+    u32 uv0;
+    u32 uv1;
+    // See packShape(), 0 for plain rectangles
+    u32 shape;
+};
+
+// Writes the two triangles of a rectangle into 6 vertices
+static void expandRect(ExpandedRect* rect, float xPos, float yPos, float width, float height, u32 color,
+                       u32 uv0, u32 uv1, u32 shape) {
+    // First triangle
+    rect->vertices[0] = { xPos, yPos };
+    rect->vertices[1] = { xPos + width, yPos };
+    rect->vertices[2] = { xPos, yPos + height };
+
+    // Second triangle
+    rect->vertices[3] = { xPos + width, yPos };
+    rect->vertices[4] = { xPos + width, yPos + height };
+    rect->vertices[5] = { xPos, yPos + height };
+
+    rect->color = color;
+    rect->uv0 = uv0;
+    rect->uv1 = uv1;
+    rect->shape = shape;
+}
+
+/**
+ * Scalar vertex expansion of sorted rectangle commands.
+ *
+ * Writes one ExpandedRect per rectangle and returns one past the last written one.
+ */
+static ExpandedRect* expandRects(SortEntry* entries, u64 count, ExpandedRect* expanded) {
+    for (u64 i = 0; i < count; ++i) {
+        RenderCommandRectangle* rect = (RenderCommandRectangle*)entries[i].command;
+        u32 uv0, uv1, shape;
+        getRectParams(rect, &uv0, &uv1, &shape);
+        expandRect(expanded, rect->x, rect->y, rect->width, rect->height, rect->packedColor, uv0, uv1, shape);
+        expanded += 1;
+    }
+
+    return expanded;
+}
+
+/**
+ * Converts sorted rectangle commands to one instance each.
+ *
+ * Returns one past the last written instance.
+ */
+static RectInstance* writeRectInstances(SortEntry* entries, u64 count, RectInstance* instance) {
+    for (u64 i = 0; i < count; ++i) {
+        RenderCommandRectangle* rect = (RenderCommandRectangle*)entries[i].command;
+
+        instance->x = rect->x;
+        instance->y = rect->y;
+        instance->width = rect->width;
+        instance->height = rect->height;
+        instance->color = rect->packedColor;
+        getRectParams(rect, &instance->uv0, &instance->uv1, &instance->shape);
+        instance += 1;
+    }
+
+    return instance;
+}
+
+/**
+ * Rectangles as structure of arrays.
+ *
+ * The arrays are padded to a multiple of 8 elements, so that the SIMD kernels
+ * can always load full registers.
+ */
+struct RectBatch {
+    float* x;
+    float* y;
+    float* width;
+    float* height;
+    // RGBA8 colors as packed by RenderCommandBuffer::push()
+    u32* color;
+    u32* uv0;
+    u32* uv1;
+    u32* shape;
+    u64 count;
+};
+
+// Number of arrays in a RectBatch, each element is 4 bytes
+static const u64 RECT_BATCH_ARRAYS = 8;
+
+static RectBatch allocateRectBatch(u64 count, Allocator* allocator) {
+    RectBatch batch = {};
+
+    u64 capacity = (count + 7ULL) & ~7ULL;
+    float* data = allocator->allocateArray<float>(RECT_BATCH_ARRAYS * capacity);
+    if (!data) {
+        return batch;
+    }
+    batch.x = data;
+    batch.y = data + 1 * capacity;
+    batch.width = data + 2 * capacity;
+    batch.height = data + 3 * capacity;
+    batch.color = (u32*)(data + 4 * capacity);
+    batch.uv0 = (u32*)(data + 5 * capacity);
+    batch.uv1 = (u32*)(data + 6 * capacity);
+    batch.shape = (u32*)(data + 7 * capacity);
+
+    // Zero the padding, it is loaded but never written out
+    for (u64 i = count; i < capacity; ++i) {
+        batch.x[i] = batch.y[i] = batch.width[i] = batch.height[i] = 0.0f;
+        batch.color[i] = batch.uv0[i] = batch.uv1[i] = batch.shape[i] = 0;
+    }
+
+    return batch;
+}
+
+static void storeRect(RectBatch* batch, u64 i, RenderCommandRectangle* rect) {
+    batch->x[i] = rect->x;
+    batch->y[i] = rect->y;
+    batch->width[i] = rect->width;
+    batch->height[i] = rect->height;
+    batch->color[i] = rect->packedColor;
+    getRectParams(rect, &batch->uv0[i], &batch->uv1[i], &batch->shape[i]);
+}
+
+// Gathers sorted rectangle commands
+static RectBatch gatherRectBatch(SortEntry* entries, u64 count, Allocator* allocator) {
+    RectBatch batch = allocateRectBatch(count, allocator);
+    if (!batch.x) {
+        return batch;
+    }
+
+    for (u64 i = 0; i < count; ++i) {
+        storeRect(&batch, i, (RenderCommandRectangle*)entries[i].command);
+    }
+    batch.count = count;
+
+    return batch;
+}
+
+/**
+ * Lanes of the transposed rectangle (x, y, x + width, y + height, color, uv0,
+ * uv1, shape) that make up the two halves of an ExpandedRect. The vertex order
+ * matches expandRect().
+ */
+alignas(32) static const i32 EXPANDED_RECT_FIRST_HALF[8] = { 0, 1, 2, 1, 0, 3, 2, 1 };
+alignas(32) static const i32 EXPANDED_RECT_SECOND_HALF[8] = { 2, 3, 0, 3, 4, 5, 6, 7 };
+
+// In-register transpose of 8 rows with 8 floats each
+static void transpose8x8(__m256* rows) {
+    __m256 t0 = _mm256_unpacklo_ps(rows[0], rows[1]);
+    __m256 t1 = _mm256_unpackhi_ps(rows[0], rows[1]);
+    __m256 t2 = _mm256_unpacklo_ps(rows[2], rows[3]);
+    __m256 t3 = _mm256_unpackhi_ps(rows[2], rows[3]);
+    __m256 t4 = _mm256_unpacklo_ps(rows[4], rows[5]);
+    __m256 t5 = _mm256_unpackhi_ps(rows[4], rows[5]);
+    __m256 t6 = _mm256_unpacklo_ps(rows[6], rows[7]);
+    __m256 t7 = _mm256_unpackhi_ps(rows[6], rows[7]);
+
+    __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+    rows[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+    rows[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+    rows[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+    rows[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+    rows[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+    rows[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+    rows[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+    rows[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+/**
+ * AVX2 vertex expansion of a RectBatch.
+ *
+ * After transposing 8 rectangles, each one is a register from which both
+ * halves of its ExpandedRect are permuted. They are written with non-temporal
+ * stores, so the vertex data does not pollute the cache on its way to the GPU.
+ * The remaining rectangles are written with the scalar path.
+ *
+ * expanded must be aligned to 32 bytes.
+ */
+static ExpandedRect* expandRectBatchAvx2(RectBatch* batch, ExpandedRect* expanded) {
+    Assert(((uintptr_t)expanded & 31) == 0);
+
+    __m256i firstHalf = _mm256_load_si256((const __m256i*)EXPANDED_RECT_FIRST_HALF);
+    __m256i secondHalf = _mm256_load_si256((const __m256i*)EXPANDED_RECT_SECOND_HALF);
+
+    u64 fullCount = batch->count & ~7ULL;
+    float* output = (float*)expanded;
+    for (u64 i = 0; i < fullCount; i += 8) {
+        __m256 x = _mm256_loadu_ps(batch->x + i);
+        __m256 y = _mm256_loadu_ps(batch->y + i);
+
+        __m256 rects[8];
+        rects[0] = x;
+        rects[1] = y;
+        rects[2] = _mm256_add_ps(x, _mm256_loadu_ps(batch->width + i));
+        rects[3] = _mm256_add_ps(y, _mm256_loadu_ps(batch->height + i));
+        // The packed colors are only moved around, never used as floats
+        rects[4] = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)(batch->color + i)));
+        rects[5] = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)(batch->uv0 + i)));
+        rects[6] = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)(batch->uv1 + i)));
+        rects[7] = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)(batch->shape + i)));
+        transpose8x8(rects);
+
+        for (int r = 0; r < 8; ++r) {
+            _mm256_stream_ps(output, _mm256_permutevar8x32_ps(rects[r], firstHalf));
+            _mm256_stream_ps(output + 8, _mm256_permutevar8x32_ps(rects[r], secondHalf));
+            output += 16;
+        }
+    }
+
+    // Make the streaming stores visible before the buffer is handed to the GPU
+    _mm_sfence();
+
+    ExpandedRect* rect = expanded + fullCount;
+    for (u64 i = fullCount; i < batch->count; ++i) {
+        expandRect(rect, batch->x[i], batch->y[i], batch->width[i], batch->height[i], batch->color[i],
+            batch->uv0[i], batch->uv1[i], batch->shape[i]);
+        rect += 1;
+    }
+
+    return rect;
+}
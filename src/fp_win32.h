@@ -1,5 +1,7 @@
 #pragma once
 
+#include "fp_os.h"
+
 #include <Windows.h>
 
 void win32_printLastError(const char* context) {
@@ -38,13 +40,125 @@ Allocator createPageAllocator()
     return allocator;
 }
 
-struct ReadFileResult
+u64 getPerformanceCounter()
+{
+    LARGE_INTEGER counter = {};
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+u64 getPerformanceFrequency()
+{
+    LARGE_INTEGER frequency = {};
+    QueryPerformanceFrequency(&frequency);
+    return frequency.QuadPart;
+}
+
+u64 getPageSize()
+{
+    SYSTEM_INFO info = {};
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+}
+
+u32 getProcessorCount()
+{
+    SYSTEM_INFO info = {};
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+}
+
+static DWORD WINAPI win32_threadMain(LPVOID parameter)
+{
+    Thread* thread = (Thread*)parameter;
+    thread->function(thread->parameter);
+    return 0;
+}
+
+void startThread(Thread* thread, ThreadFunction* function, void* parameter)
+{
+    thread->function = function;
+    thread->parameter = parameter;
+
+    HANDLE handle = CreateThread(nullptr, 0, &win32_threadMain, thread, 0, nullptr);
+    win32_handleError(!handle, "Failed to create thread");
+    thread->handle = (u64)handle;
+}
+
+void joinThread(Thread* thread)
+{
+    WaitForSingleObject((HANDLE)thread->handle, INFINITE);
+    CloseHandle((HANDLE)thread->handle);
+    thread->handle = 0;
+}
+
+u64 getCurrentThreadId()
+{
+    return GetCurrentThreadId();
+}
+
+void createSemaphore(Semaphore* semaphore, u32 initialCount)
+{
+    HANDLE handle = CreateSemaphoreW(nullptr, initialCount, 0x7FFFFFFF, nullptr);
+    win32_handleError(!handle, "Failed to create semaphore");
+    semaphore->handle = (u64)handle;
+}
+
+void destroySemaphore(Semaphore* semaphore)
+{
+    CloseHandle((HANDLE)semaphore->handle);
+    semaphore->handle = 0;
+}
+
+void signalSemaphore(Semaphore* semaphore, u32 count)
+{
+    ReleaseSemaphore((HANDLE)semaphore->handle, count, nullptr);
+}
+
+void waitSemaphore(Semaphore* semaphore)
+{
+    WaitForSingleObject((HANDLE)semaphore->handle, INFINITE);
+}
+
+i32 atomicAdd(volatile i32* target, i32 value)
+{
+    return InterlockedAdd((volatile LONG*)target, value);
+}
+
+bool openFileForWriting(FileWriter* file, wchar_t const* filename)
 {
-    u8* data;
-    i64 size;
-    i64 error;
-    wchar_t const* errorText;
-};
+    HANDLE handle = CreateFileW(filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        file->handle = 0;
+        return false;
+    }
+    file->handle = (u64)handle;
+    return true;
+}
+
+bool writeFile(FileWriter* file, void const* data, u64 size)
+{
+    u8 const* readCursor = (u8 const*)data;
+    while (size > 0)
+    {
+        DWORD bytesToWrite = size > MAXDWORD ? MAXDWORD : (DWORD)size;
+        DWORD bytesWritten = 0;
+        if (!WriteFile((HANDLE)file->handle, readCursor, bytesToWrite, &bytesWritten, NULL))
+        {
+            return false;
+        }
+        readCursor += bytesWritten;
+        size -= bytesWritten;
+    }
+    return true;
+}
+
+void closeFile(FileWriter* file)
+{
+    CloseHandle((HANDLE)file->handle);
+    file->handle = 0;
+}
 
 ReadFileResult readEntireFile(wchar_t const* filename)
 {
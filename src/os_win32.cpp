@@ -11,12 +11,25 @@
 #include "fp_math.h"
 #include "fp_log.h"
 #include "fp_renderer.h"
+#include "fp_render_graph.h"
+#include "fp_frame_capture.h"
+#include "fp_profiler.h"
 
 #include <Windows.h>
 #include <gl/GL.h>
 
 Renderer g_renderer;
+RenderGraph g_renderGraph;
+GLRenderBackend g_renderBackend;
+JobSystem g_jobSystem;
+HDC g_deviceContext;
 Log g_log;
+// Uploaded once at startup, 0 if the model could not be read
+MeshHandle g_deer;
+
+static void renderUi(RenderGraph* graph, RenderGraphPass* pass, void* data) {
+    g_renderer.render();
+}
 
 static void render(int width, int height) {
     glViewport(0, 0, width, height);
@@ -27,21 +40,47 @@ static void render(int width, int height) {
         0.0f, 0.0f,                1.0f, 0.0f,
         0.0f, 0.0f,                0.0f, 1.0f,
     };
-    glUniformMatrix4fv(g_renderer.projectionLocation, 1, GL_TRUE, transformMatrix);
-
-    glViewport(0, 0, width, height);
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    g_renderer.setProjection(transformMatrix);
+
+    // Perspective camera at z = 3 looking down -z, meshes fit into a unit sphere at the origin
+    float aspect = (float)height / (float)width;
+    float nearPlane = 0.1f;
+    float farPlane = 10.0f;
+    float viewProjection[16] = {
+        2.0f * aspect, 0.0f, 0.0f, 0.0f,
+        0.0f, 2.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, -(farPlane + nearPlane) / (farPlane - nearPlane), 3.0f * (farPlane + nearPlane) / (farPlane - nearPlane) - 2.0f * farPlane * nearPlane / (farPlane - nearPlane),
+        0.0f, 0.0f, -1.0f, 3.0f,
+    };
+    g_renderer.setViewProjection(viewProjection);
 
-    glUseProgram(g_renderer.shaderProgram);
     //float timeInSeconds = 0.001f * ticks;
     //float green = sin(2 * timeInSeconds) / 2.0f + 0.5f;
     //glUniform4f(uniformColorIndex, 0.0, green, 0.0, 1.0);
 
-    g_renderer.render();
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
-    BOOL swapResult = SwapBuffers(g_renderer.deviceContext);
+    g_renderGraph.reset();
+    RenderResource backbuffer = g_renderGraph.importTarget("backbuffer", { width, height, RenderFormat_RGBA8 }, 0);
+    int uiPass = g_renderGraph.addPass("ui", &renderUi, nullptr);
+    // With damage tracking, the renderer clears the damaged regions of its cache itself
+    if (g_renderer.useDamageTracking) {
+        g_renderGraph.write(uiPass, backbuffer);
+    }
+    else {
+        g_renderGraph.clear(uiPass, backbuffer, BLACK);
+    }
+    if (g_renderGraph.compile()) {
+        g_renderGraph.execute(&g_renderBackend);
+    }
+
+    // Nothing changed since the last presented frame
+    if (g_renderer.frameSkipped) {
+        return;
+    }
+
+    PROFILE_ZONE("swap");
+    BOOL swapResult = SwapBuffers(g_deviceContext);
     if (!swapResult) {
         OutputDebugStringW(L"Failed to swap buffers\n");
     }
@@ -96,6 +135,20 @@ struct UserInput
 UserInput g_userInput = {};
 bool g_running = false;
 
+// F9 starts and stops capturing the rendered frames to CAPTURE_FILENAME
+static wchar_t const* CAPTURE_FILENAME = L"frames.fpcapture";
+FrameCapture g_capture;
+bool g_toggleCapture = false;
+
+// F8 starts and stops writing the profiler zones to TRACE_FILENAME
+static wchar_t const* TRACE_FILENAME = L"profile.json";
+Profiler g_frameProfiler;
+bool g_toggleTrace = false;
+
+// F7 turns damage tracking on and off. It is off by default, the rotating
+// deer and the frame stats change every frame of the demo.
+bool g_toggleDamageTracking = false;
+
 
 // This variable is expected by the linker if floats or doubles are used
 extern "C" int _fltused = 0;
@@ -111,6 +164,8 @@ void* __cdecl memset(void* destination, int value, size_t size) {
     return dest;
 }
 
+static void fillFrame(int height);
+
 // Window procedure handles messages send from the OS
 // We want to collect mouse and keyboard input events, so that they are available 
 // in an OS independent manner
@@ -133,11 +188,17 @@ static LRESULT CALLBACK MainWndProc(HWND window, UINT message, WPARAM wParam, LP
 
     case WM_SIZE:
         {
-            // We have to render the image here to get smooth resizing behaviour
+            // We have to render the image here to get smooth resizing behaviour.
+            // The main loop is blocked while resizing, so this is a whole frame with
+            // beginFrame() and endFrame(), which fence the streamed vertex data.
             int width = LOWORD(lParam);
-            int height = LOWORD(lParam);
-
-            render(width, height);
+            int height = HIWORD(lParam);
+            if (g_running && width > 0 && height > 0)
+            {
+                fillFrame(height);
+                render(width, height);
+                g_renderer.endFrame();
+            }
         }
         return 0;
 
@@ -195,6 +256,22 @@ static LRESULT CALLBACK MainWndProc(HWND window, UINT message, WPARAM wParam, LP
         g_userInput.mouseButtonState &= ~bitmask;
     } break;
 
+    case WM_KEYDOWN:
+        // Bit 30 is set for auto repeated key presses
+        if (wParam == VK_F9 && (lParam & (1 << 30)) == 0)
+        {
+            g_toggleCapture = true;
+        }
+        if (wParam == VK_F8 && (lParam & (1 << 30)) == 0)
+        {
+            g_toggleTrace = true;
+        }
+        if (wParam == VK_F7 && (lParam & (1 << 30)) == 0)
+        {
+            g_toggleDamageTracking = true;
+        }
+        break;
+
     case WM_MOUSEMOVE:
 
         g_userInput.mouseX = LOWORD(lParam);
@@ -249,6 +326,81 @@ static void fillCommands(RenderCommandBuffer* commands) {
     }
 }
 
+// The mesh rotates around the vertical axis, scaled to fit into a unit sphere
+static void fillMeshes(RenderCommandBuffer* commands, MeshHandle handle, ULONGLONG ticks) {
+    Mesh* mesh = g_renderer.meshes.get(handle);
+    if (!mesh || mesh->bounds.radius <= 0.0f) {
+        return;
+    }
+
+    // One turn every 8 seconds, wrapped to keep the angle precise
+    float angle = (float)(ticks % 8000) * (2.0f * (float)FP_PI / 8000.0f);
+    __m256 cosine;
+    __m256 sine = mm256_sincos_ps(_mm256_set1_ps(angle), &cosine);
+    float c = _mm256_cvtss_f32(cosine);
+    float s = _mm256_cvtss_f32(sine);
+    float scale = 1.0f / mesh->bounds.radius;
+    float* center = mesh->bounds.center;
+
+    // Rotation * scale * translation of the center to the origin
+    RenderCommandMesh command = {};
+    command.mesh = handle;
+    float transform[16] = {
+        c * scale,  0.0f,  s * scale, -(c * center[0] + s * center[2]) * scale,
+        0.0f,       scale, 0.0f,      -center[1] * scale,
+        -s * scale, 0.0f,  c * scale, (s * center[0] - c * center[2]) * scale,
+        0.0f,       0.0f,  0.0f,      1.0f,
+    };
+    for (int i = 0; i < 16; ++i) {
+        command.transform[i] = transform[i];
+    }
+    command.color = { 0.8f, 0.6f, 0.4f, 1.0f };
+    commands->push(&command);
+}
+
+// Frame times of the frame pacer in the top left corner, on a rounded panel
+static void fillText(RenderCommandBuffer* commands, FrameStats* stats, int height) {
+    // Averaged over the profiler history, the frame times alone jump around too much to read
+    ProfileZoneStats renderStats = {};
+    g_frameProfiler.findZoneStats("render", false, &renderStats);
+
+    char line[128];
+    char* end = print(line, "CPU: ", (int)(stats->cpuFrameMs * 1000.0), " us, GPU: ", (int)(stats->gpuFrameMs * 1000.0),
+        " us, render: ", (int)(renderStats.averageMs * 1000.0), " us");
+
+    RenderCommandRoundedRect panel = {};
+    panel.x = 4.0f;
+    panel.y = height - 32.0f;
+    panel.width = 460.0f;
+    panel.height = 28.0f;
+    panel.radius = 6.0f;
+    panel.color = { 0.1f, 0.1f, 0.1f, 0.8f };
+    commands->push(&panel);
+    panel.borderWidth = 1.0f;
+    panel.color = { 0.6f, 0.6f, 0.6f, 1.0f };
+    commands->push(&panel);
+
+    RenderCommandText text = {};
+    text.x = 10.0f;
+    text.y = height - 24.0f;
+    text.size = 18.0f;
+    text.color = WHITE;
+    commands->push(&text, line, (u32)(end - line - 1));
+}
+
+// Waits for the GPU to release the oldest frame and records the commands of the next one
+static void fillFrame(int height) {
+    {
+        PROFILE_ZONE("wait for GPU");
+        g_renderer.beginFrame();
+    }
+
+    PROFILE_ZONE("fill commands");
+    fillCommands(&g_renderer.commands);
+    fillMeshes(&g_renderer.commands, g_deer, GetTickCount64());
+    fillText(&g_renderer.commands, &g_renderer.framePacer.stats, height);
+}
+
 static int mainFunction()
 {
     char buffer[512] = {};
@@ -262,26 +414,6 @@ static int mainFunction()
     u64 arenaSize = 16 * KB;
     ArenaWithFallbackAllocator arenaAllocator = createArenaWithFallbackAllocator(&pageAllocator, arenaSize);
 
-#if 0
-    wchar_t const* filename = L"data/Deer.obj";
-
-    ReadFileResult fileResult = readEntireFile(filename);
-    defer{ freeReadFileResult(&fileResult); };
-
-    if (fileResult.error)
-    {
-        OutputDebugStringW(L"Could not read from file due to the following error:\n");
-        OutputDebugStringW(fileResult.errorText);
-        OutputDebugStringW(L"\n");
-        // TODO: Add error code and format the message according to the error code
-        return 1;
-    }
-
-    OutputDebugStringW(L"Read file content successfully!\n");
-
-    ObjModel model = parseObjModel(fileResult.data, fileResult.size, &arenaAllocator);
-    defer{ model.free(&arenaAllocator); }
-#endif 
 
 
     // Create a window
@@ -331,7 +463,62 @@ static int mainFunction()
     void* renderMemory = pageAllocator.allocate(renderMemorySize);
     defer{ pageAllocator.free(renderMemory, renderMemorySize); };
 
-    g_renderer.setup(deviceContext, renderMemory, renderMemorySize);
+    g_deviceContext = deviceContext;
+
+    // Linked programs are kept in the cache directory, later starts skip the compiles
+    CreateDirectoryW(L"cache", nullptr);
+    g_renderer.shaderCachePath = L"cache\\shader_";
+    g_renderer.setup(renderMemory, renderMemorySize);
+    g_renderGraph.create();
+    g_renderBackend = createGLRenderBackend();
+    defer{ g_renderBackend.destroy(); };
+
+    ShaderCache* shaderCache = &g_renderer.shaderCache;
+    for (int i = 0; i < shaderCache->count; ++i)
+    {
+        ShaderProgramEntry* entry = &shaderCache->entries[i];
+        int microseconds = (int)(entry->compileTicks * 1000000 / getPerformanceFrequency());
+        print(buffer, "Shader program ", entry->name, ": ", microseconds, entry->fromCache ? " us from cache\n" : " us\n");
+        OutputDebugStringA(buffer);
+    }
+
+    // The main thread takes part in every job, so one worker less than processors
+    g_jobSystem.create(getProcessorCount() - 1);
+    defer{ g_jobSystem.destroy(); };
+    g_renderer.jobSystem = &g_jobSystem;
+
+    int profileMemorySize = 1 * MB;
+    void* profileMemory = pageAllocator.allocate(profileMemorySize);
+    defer{ pageAllocator.free(profileMemory, profileMemorySize); };
+    g_frameProfiler.create(profileMemory, profileMemorySize);
+    defer{ g_frameProfiler.destroy(); };
+    g_profiler = &g_frameProfiler;
+
+    ReadFileResult fontResult = readEntireFile(L"C:\\Windows\\Fonts\\consola.ttf");
+    defer{ freeReadFileResult(&fontResult); };
+    TrueTypeFont font = {};
+    if (!fontResult.error && initTrueTypeFont(&font, fontResult.data, fontResult.size))
+    {
+        g_renderer.glyphCache.setFont(&font);
+    }
+    else
+    {
+        OutputDebugStringW(L"Could not load the font, text is not drawn\n");
+    }
+
+    // The model is uploaded once, the OBJ data is not needed afterwards
+    ReadFileResult modelResult = readEntireFile(L"data/Deer.obj");
+    defer{ freeReadFileResult(&modelResult); };
+    if (!modelResult.error)
+    {
+        ObjModel model = parseObjModel(modelResult.data, modelResult.size, &arenaAllocator);
+        g_deer = uploadObjModel(&g_renderer.meshes, &model, &arenaAllocator);
+        model.free(&arenaAllocator);
+    }
+    else
+    {
+        OutputDebugStringW(L"Could not read data/Deer.obj, no mesh is drawn\n");
+    }
 
     // TODO: Do only one allocation and partition the memory
     int logMemorySize = 4 * KB;
@@ -340,27 +527,10 @@ static int mainFunction()
 
     g_log = createLog(logMemory, logMemorySize);
 
-    
-    // TODO: Move this into the renderer
-    int vertexSize = sizeof(ColoredVertex);
-    // The binding index connects the attribute location (here 0) with a specific buffer
-    // They do not have to be the same
-    int positionBindingIndex = 12; 
-    glVertexArrayVertexBuffer(g_renderer.vertexArray, positionBindingIndex, g_renderer.vertexBuffer, 0, vertexSize);
-    int positionIndex = 0;
-    glVertexArrayAttribFormat(g_renderer.vertexArray, positionIndex, 3, GL_FLOAT, GL_FALSE, 0);
-    glVertexArrayAttribBinding(g_renderer.vertexArray, positionIndex, positionBindingIndex);
-
-    int colorBindingIndex = 13;
-    glVertexArrayVertexBuffer(g_renderer.vertexArray, colorBindingIndex, g_renderer.vertexBuffer, 3 * sizeof(float), vertexSize);
-    int colorIndex = 1;
-    glVertexArrayAttribFormat(g_renderer.vertexArray, positionIndex, 3, GL_FLOAT, GL_FALSE, 0);
-    glVertexArrayAttribBinding(g_renderer.vertexArray, colorIndex, colorBindingIndex);
-
-    glEnableVertexAttribArray(positionIndex);
-    glEnableVertexAttribArray(colorIndex);
-
-    glUseProgram(g_renderer.shaderProgram);
+    int captureMemorySize = 1 * MB;
+    void* captureMemory = pageAllocator.allocate(captureMemorySize);
+    defer{ pageAllocator.free(captureMemory, captureMemorySize); };
+    defer{ g_capture.stop(); };
 
     ShowWindow(window, SW_SHOW);
 
@@ -377,15 +547,18 @@ static int mainFunction()
     g_running = true;
     while (g_running)
     {
-        ULONGLONG ticks = GetTickCount64();
+        g_frameProfiler.beginFrame();
 
         g_userInput.mouseButtonClicked = 0;
 
         MSG msg = {};
-        while (PeekMessageW(&msg, window, 0, 0, PM_REMOVE))
         {
-            TranslateMessage(&msg);
-            DispatchMessageW(&msg);
+            PROFILE_ZONE("messages");
+            while (PeekMessageW(&msg, window, 0, 0, PM_REMOVE))
+            {
+                TranslateMessage(&msg);
+                DispatchMessageW(&msg);
+            }
         }
         if (!g_running) {
             break;
@@ -398,20 +571,60 @@ static int mainFunction()
             //OutputDebugStringW(L"Left button clicked\n");
         }
 
-        g_renderer.beginFrame();
+        if (g_toggleDamageTracking)
+        {
+            g_toggleDamageTracking = false;
+            g_renderer.useDamageTracking = !g_renderer.useDamageTracking;
+            // The cache was not updated while tracking was off
+            g_renderer.damage.invalidate();
+        }
 
-        fillCommands(&g_renderer.commands);
-        
         RECT rect;
         GetClientRect(window, &rect);
         int renderWidth = rect.right - rect.left;
         int renderHeight = rect.bottom - rect.top;
 
+        fillFrame(renderHeight);
         render(renderWidth, renderHeight);
 
+        if (g_toggleCapture)
+        {
+            g_toggleCapture = false;
+            if (g_capture.active)
+            {
+                g_capture.stop();
+            }
+            else
+            {
+                g_capture.start(CAPTURE_FILENAME, captureMemory, captureMemorySize);
+            }
+        }
+        if (g_capture.active)
+        {
+            RenderCommandBuffer* buffers[1 + MAX_THREAD_COMMAND_BUFFERS];
+            int bufferCount = g_renderer.collectCommandBuffers(buffers);
+            FrameStats* stats = &g_renderer.framePacer.stats;
+            g_capture.captureFrame(buffers, bufferCount, renderWidth, renderHeight, g_renderer.projection,
+                stats->cpuFrameMs, stats->gpuFrameMs);
+        }
+
         g_renderer.endFrame();
 
         flushLog();
+
+        if (g_toggleTrace)
+        {
+            g_toggleTrace = false;
+            if (g_frameProfiler.tracing)
+            {
+                g_frameProfiler.stopTrace();
+            }
+            else
+            {
+                g_frameProfiler.startTrace(TRACE_FILENAME);
+            }
+        }
+        g_frameProfiler.endFrame();
     }
 
     return 0;
@@ -0,0 +1,1109 @@
+/******************************************************************************
+* Headless renderer check
+*
+* Renders a test scene offscreen through the instanced and the expanded
+* rectangle path and compares the resulting images. Both paths are also run
+* with the scene split across command buffers recorded on worker threads,
+* and the expanded path once more with the AVX2 vertex expansion.
+* The software renderer has to produce the same image as the GPU. Textured
+* rectangles sample images from the texture atlas between colored ones,
+* rounded rectangles and lines are drawn as antialiased shapes, and text is
+* drawn with glyphs from a TrueType font if one is found. Static meshes are
+* checked separately for depth testing, drawn with one multi-draw call and with
+* one draw call each, and with frustum culling on the CPU and on the GPU. The
+* software renderer does not draw them. Clipped panels are drawn once with
+* rectangles trimmed on the CPU and once with the scissor for everything,
+* which has to give the same pixels with fewer batches. Overlapping opaque
+* and translucent rectangles of one layer have to keep their submission
+* order. An image wider than the atlas has to be rejected. With damage
+* tracking, an unchanged frame is skipped and a small change only redraws a
+* small part.
+* A render graph of post processing passes is compiled and run on the null
+* backend, which has to cull the unused pass, order the passes by their
+* dependencies and let targets with disjoint lifetimes share textures.
+* Runs without a window or GPU, e.g. on Mesa llvmpipe.
+*
+* Build: g++ -O2 -mavx2 -pthread tools/render_headless.cpp -lEGL -lGL -o render_headless
+* Usage: render_headless [output.ppm] [font.ttf]
+*
+* Exits with 0 if both paths, the threaded recording, the retained cache and
+* the culling produce exactly the same pixels, the software renderer is at
+* most one step off on the antialiased edges of shapes, and the nearer of two
+* overlapping meshes is visible with the same pixels in both mesh paths. Both
+* culling paths have to keep the same meshes and must not change the image,
+* the GPU counts also when the streaming buffer grew after the culled frame.
+* Trimming and the scissor have to clip to exactly the same pixels. The later
+* of two overlapping rectangles in one layer has to end up on top, and clip
+* rects beyond the scissor rects have to be trimmed. Damaged frames have to
+* look exactly like full redraws. The render graph schedule and memory plan
+* have to be valid, a transient output must keep its own texture and a cycle
+* has to be rejected.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#include "../src/fp_core.h"
+#include "../src/fp_allocator.h"
+#include "../src/fp_egl.h"
+#include "../src/fp_renderer.h"
+#include "../src/fp_render_graph.h"
+#include "../src/fp_software_renderer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int WIDTH = 640;
+static const int HEIGHT = 480;
+// Both paths upload RGBA8 colors and rasterize the same triangles
+static const int COLOR_TOLERANCE = 0;
+// The shape coverage is computed in float on both sides, coverages that round
+// to exactly half a step can end up one step apart
+static const int SOFTWARE_COLOR_TOLERANCE = 1;
+static const int THREAD_COUNT = 4;
+static const int MAX_SCENE_RECTS = 1024;
+
+struct Scene {
+    AnyRectCommand rects[MAX_SCENE_RECTS];
+    int count;
+
+    void push(RenderCommandRectangle* rect) {
+        rects[count] = {};
+        rects[count++].rect = *rect;
+    }
+
+    void push(RenderCommandTexturedRect* rect) {
+        rects[count++].textured = *rect;
+    }
+
+    void push(RenderCommandRoundedRect* rect) {
+        rects[count++].shape = makeShape(rect);
+    }
+
+    void push(RenderCommandLine* line) {
+        rects[count++].shape = makeShape(line);
+    }
+};
+
+static const int CHECKER_SIZE = 16;
+static const int GRADIENT_SIZE = 24;
+
+/**
+ * Inserts an opaque checker board and a gradient with translucent texels into the atlas.
+ * The atlas keeps a shadow copy of its texels for the software renderer.
+ */
+static void fillAtlas(TextureAtlas* atlas, AtlasRegion* checker, AtlasRegion* gradient) {
+    u32 checkerPixels[CHECKER_SIZE * CHECKER_SIZE];
+    for (int y = 0; y < CHECKER_SIZE; ++y) {
+        for (int x = 0; x < CHECKER_SIZE; ++x) {
+            checkerPixels[y * CHECKER_SIZE + x] = ((x ^ y) & 1) ? 0xFFFFFFFF : 0xFF0080FF;
+        }
+    }
+
+    u32 gradientPixels[GRADIENT_SIZE * GRADIENT_SIZE];
+    for (int y = 0; y < GRADIENT_SIZE; ++y) {
+        for (int x = 0; x < GRADIENT_SIZE; ++x) {
+            u32 alpha = 255 * x / (GRADIENT_SIZE - 1);
+            gradientPixels[y * GRADIENT_SIZE + x] = (alpha << 24) | ((u32)(10 * y) << 16) | (u32)(10 * x);
+        }
+    }
+
+    AtlasHandle checkerHandle = atlas->insert(CHECKER_SIZE, CHECKER_SIZE, checkerPixels);
+    AtlasHandle gradientHandle = atlas->insert(GRADIENT_SIZE, GRADIENT_SIZE, gradientPixels);
+    atlas->lookup(checkerHandle, checker);
+    atlas->lookup(gradientHandle, gradient);
+}
+
+static void fillScene(Scene* commands, AtlasRegion* checker, AtlasRegion* gradient) {
+    RenderCommandRectangle rect = {};
+    rect.type = Render_Rectangle;
+
+    // Completely outside of the viewport, removed by the viewport culling
+    for (int i = 0; i < 8; ++i) {
+        rect.x = (i & 1) ? -200.0f + 10.0f * i : WIDTH + 10.0f * i;
+        rect.y = (i & 2) ? -150.0f : HEIGHT - 100.0f;
+        rect.width = (i & 4) ? 100.0f : 150.0f;
+        rect.height = 100.0f;
+        rect.color = { 1.0f, 0.0f, 1.0f, 1.0f };
+        commands->push(&rect);
+    }
+
+    // Opaque and inside the cells of the grid below, removed by the occlusion culling
+    rect.width = 40.0f;
+    rect.height = 40.0f;
+    for (int i = 0; i < 8; ++i) {
+        rect.x = 100.0f * (i % 4) + 20.0f;
+        rect.y = 100.0f * (i / 4) + 20.0f;
+        rect.color = { 1.0f, 1.0f, 0.0f, 1.0f };
+        commands->push(&rect);
+    }
+
+    // Opaque grid like the one drawn by the application
+    Color colors[] = { RED, GREEN, BLUE };
+    rect.width = 80.0f;
+    rect.height = 80.0f;
+    for (int y = 0; y < 3; ++y) {
+        rect.y = 100.0f * y;
+        rect.color = colors[y];
+        for (int x = 0; x < 4; ++x) {
+            rect.x = 100.0f * x;
+            commands->push(&rect);
+        }
+    }
+
+    // Small opaque rectangles, so the scene spans several retained cache segments
+    for (int y = 0; y < 20; ++y) {
+        for (int x = 0; x < 30; ++x) {
+            rect.x = 400.0f + 8.0f * x;
+            rect.y = 300.0f + 8.0f * y;
+            rect.width = 6.0f;
+            rect.height = 6.0f;
+            rect.color = { x / 29.0f, y / 19.0f, 0.5f, 1.0f };
+            commands->push(&rect);
+        }
+    }
+
+    // Overlapping translucent rectangles to check blending and ordering
+    for (int i = 0; i < 64; ++i) {
+        rect.x = 7.5f * i;
+        rect.y = 3.25f * i + 20.0f;
+        rect.width = 120.0f;
+        rect.height = 60.0f;
+        rect.color = { (i % 3) / 2.0f, (i % 5) / 4.0f, (i % 7) / 6.0f, 0.25f + (i % 4) * 0.2f };
+        commands->push(&rect);
+    }
+
+    // Textured rectangles at 1:1 and scaled, plain and tinted, batched with the colored ones
+    RenderCommandTexturedRect textured = {};
+    textured.type = Render_TexturedRect;
+    for (int i = 0; i < 8; ++i) {
+        bool scaled = i & 1;
+        bool tinted = i & 2;
+        AtlasRegion* region = (i & 4) ? gradient : checker;
+        int size = region == gradient ? GRADIENT_SIZE : CHECKER_SIZE;
+
+        textured.x = 20.0f + 70.0f * i;
+        textured.y = 290.0f + (i & 4 ? 40.0f : 0.0f);
+        textured.width = (float)(scaled ? 2 * size : size);
+        textured.height = (float)(scaled ? 2 * size : size);
+        textured.color = tinted ? Color{ 1.0f, 0.5f, 0.25f, 1.0f } : WHITE;
+        setAtlasRegion(&textured, region);
+        commands->push(&textured);
+    }
+
+    // Translucent texels on top of the grid
+    textured.x = 70.0f;
+    textured.y = 70.0f;
+    textured.width = (float)GRADIENT_SIZE;
+    textured.height = (float)GRADIENT_SIZE;
+    textured.color = WHITE;
+    setAtlasRegion(&textured, gradient);
+    commands->push(&textured);
+
+    // Antialiased shapes: filled and bordered rounded rectangles, lines in all directions
+    RenderCommandRoundedRect rounded = {};
+    for (int i = 0; i < 6; ++i) {
+        rounded.x = 20.0f + 75.0f * i + 0.25f * i;
+        rounded.y = 380.0f;
+        rounded.width = 60.0f;
+        rounded.height = 40.0f - 2.0f * i;
+        rounded.radius = 3.0f * i;
+        rounded.borderWidth = (i & 1) ? 1.5f + i : 0.0f;
+        rounded.color = (i & 2) ? Color{ 0.2f, 0.8f, 1.0f, 0.8f } : Color{ 1.0f, 1.0f, 1.0f, 1.0f };
+        commands->push(&rounded);
+    }
+
+    RenderCommandLine line = {};
+    for (int i = 0; i < 8; ++i) {
+        // Eight directions around the start point
+        float dx = i == 2 || i == 6 ? 0.0f : (i < 2 || i > 6 ? 1.0f : -1.0f);
+        float dy = i == 0 || i == 4 ? 0.0f : (i < 4 ? 1.0f : -1.0f);
+        line.x0 = 560.0f;
+        line.y0 = 200.0f;
+        line.x1 = 560.0f + 50.0f * dx;
+        line.y1 = 200.0f + 35.0f * dy;
+        line.width = 0.75f + 0.5f * i;
+        line.color = { 1.0f, 0.5f + 0.06f * i, 0.2f, 1.0f };
+        commands->push(&line);
+    }
+}
+
+static const char* DEFAULT_FONT = "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf";
+
+static char const* const TEXT_LINES[] = {
+    "The quick brown fox jumps over the lazy dog 0123456789",
+    "Glyphs are cached in the atlas: \xC3\xA4\xC3\xB6\xC3\xBC \xC3\x9F \xE2\x82\xAC\nand drawn with the rectangles",
+};
+
+// Text on top of the scene, recorded into the last command buffer
+static void recordText(RenderCommandBuffer* commands) {
+    RenderCommandText text = {};
+    text.layer = 1;
+    for (int i = 0; i < 2; ++i) {
+        text.x = 10.5f;
+        text.y = 450.0f - 40.0f * i;
+        text.size = 14.0f + 8.0f * i;
+        text.color = i == 0 ? WHITE : Color{ 1.0f, 0.8f, 0.2f, 0.9f };
+        commands->push(&text, TEXT_LINES[i], (u32)strlen(TEXT_LINES[i]));
+    }
+}
+
+/**
+ * Scrolled list panels with a nested clip rect each. Rows cross the panel
+ * edges, so rectangles and glyphs are trimmed and the rounded row
+ * backgrounds need the scissor.
+ */
+static void recordClippedScene(RenderCommandBuffer* commands, AtlasRegion* checker) {
+    for (int panel = 0; panel < 3; ++panel) {
+        float panelX = panel == 1 ? 380.0f : 40.0f;
+        float panelY = panel == 1 ? 60.0f : 40.0f + 200.0f * (panel / 2);
+        commands->pushClip(panelX, panelY, 220.0f, 170.0f);
+
+        for (int row = 0; row < 8; ++row) {
+            float rowY = panelY - 13.0f + 27.0f * row;
+
+            RenderCommandRoundedRect background = {};
+            background.type = Render_Rectangle;
+            background.x = panelX - 10.0f;
+            background.y = rowY;
+            background.width = 240.0f;
+            background.height = 24.0f;
+            background.radius = 6.0f;
+            background.color = { 0.2f, 0.25f + 0.05f * row, 0.3f, 1.0f };
+            commands->push(&background);
+
+            // Drawn 1:1, so the trimmed texture coordinates still sample the centers of the texels
+            RenderCommandTexturedRect icon = {};
+            icon.type = Render_TexturedRect;
+            icon.layer = 1;
+            icon.x = panelX - 8.0f + 4.0f * row;
+            icon.y = rowY + 4.0f;
+            icon.width = (float)CHECKER_SIZE;
+            icon.height = (float)CHECKER_SIZE;
+            icon.color = WHITE;
+            setAtlasRegion(&icon, checker);
+            commands->push(&icon);
+
+            RenderCommandRectangle bar = {};
+            bar.type = Render_Rectangle;
+            bar.layer = 1;
+            bar.x = panelX + 40.0f;
+            bar.y = rowY + 8.0f;
+            bar.width = 60.0f + 25.0f * row;
+            bar.height = 8.0f;
+            bar.color = { 0.9f, 0.6f, 0.1f, row % 2 ? 0.6f : 1.0f };
+            commands->push(&bar);
+        }
+
+        // Clipped to the intersection with the panel
+        commands->pushClip(panelX + 150.0f, panelY + 100.0f, 200.0f, 200.0f);
+        RenderCommandText label = {};
+        label.layer = 2;
+        label.x = panelX + 120.0f;
+        label.y = panelY + 110.0f;
+        label.size = 20.0f;
+        label.color = WHITE;
+        commands->push(&label, TEXT_LINES[0], (u32)strlen(TEXT_LINES[0]));
+        commands->popClip();
+
+        // Outside of the panel, never drawn
+        RenderCommandRectangle hidden = {};
+        hidden.type = Render_Rectangle;
+        hidden.layer = 2;
+        hidden.x = panelX + 300.0f;
+        hidden.y = panelY;
+        hidden.width = 50.0f;
+        hidden.height = 50.0f;
+        hidden.color = RED;
+        commands->push(&hidden);
+
+        commands->popClip();
+    }
+}
+
+/**
+ * Uploads a unit cube with a normal per face, so its faces get different shades.
+ */
+static MeshHandle uploadCube(MeshStore* meshes) {
+    MeshVertex vertices[24];
+    u32 indices[36];
+    for (int face = 0; face < 6; ++face) {
+        int axis = face / 2;
+        float sign = face % 2 == 0 ? 1.0f : -1.0f;
+        int u = (axis + 1) % 3;
+        int v = (axis + 2) % 3;
+        float corners[4][2] = { { -1.0f, -1.0f }, { 1.0f, -1.0f }, { 1.0f, 1.0f }, { -1.0f, 1.0f } };
+        for (int i = 0; i < 4; ++i) {
+            MeshVertex* vertex = &vertices[4 * face + i];
+            *vertex = {};
+            vertex->position[axis] = sign;
+            vertex->position[u] = corners[i][0];
+            vertex->position[v] = corners[i][1] * sign;
+            vertex->normal[axis] = sign;
+        }
+        u32 quad[6] = { 0, 1, 2, 0, 2, 3 };
+        for (int i = 0; i < 6; ++i) {
+            indices[6 * face + i] = 4 * face + quad[i];
+        }
+    }
+    return meshes->upload(vertices, 24, indices, 36);
+}
+
+static void pushCube(RenderCommandBuffer* commands, MeshHandle cube, float x, float y, float z, float scale, Color color) {
+    RenderCommandMesh mesh = {};
+    mesh.mesh = cube;
+    float transform[16] = {
+        scale, 0.0f,  0.0f,  x,
+        0.0f,  scale, 0.0f,  y,
+        0.0f,  0.0f,  scale, z,
+        0.0f,  0.0f,  0.0f,  1.0f,
+    };
+    memcpy(mesh.transform, transform, sizeof(transform));
+    mesh.color = color;
+    commands->push(&mesh);
+}
+
+/**
+ * Draws a near red cube before a far green one that it partially covers, the
+ * depth test has to keep the red one in front.
+ */
+static void renderMeshScene(Renderer* renderer, MeshHandle cube, bool multiDraw, bool grid, u8* pixels) {
+    // Orthographic, larger z is nearer
+    float aspect = (float)HEIGHT / (float)WIDTH;
+    float viewProjection[16] = {
+        0.25f * aspect, 0.0f,  0.0f,   0.0f,
+        0.0f,           0.25f, 0.0f,   0.0f,
+        0.0f,           0.0f,  -0.1f,  0.0f,
+        0.0f,           0.0f,  0.0f,   1.0f,
+    };
+
+    renderer->beginFrame();
+    if (grid) {
+        // Reaches beyond the view on all sides, so the outer cubes are culled
+        for (int y = 0; y < 9; ++y) {
+            for (int x = 0; x < 13; ++x) {
+                float z = (float)((x * 7 + y * 3) % 24) - 12.0f;
+                Color color = { (float)(x % 4) / 3.0f, (float)(y % 3) / 2.0f, 0.5f, 1.0f };
+                pushCube(&renderer->commands, cube, 1.5f * x - 9.0f, 1.3f * y - 5.2f, z, 0.5f, color);
+            }
+        }
+    }
+    else {
+        pushCube(&renderer->commands, cube, 0.0f, 0.0f, 2.0f, 1.0f, { 1.0f, 0.0f, 0.0f, 1.0f });
+        pushCube(&renderer->commands, cube, 1.0f, 1.0f, -2.0f, 1.5f, { 0.0f, 1.0f, 0.0f, 1.0f });
+    }
+
+    glViewport(0, 0, WIDTH, HEIGHT);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    renderer->useMeshMultiDraw = multiDraw;
+    renderer->setViewProjection(viewProjection);
+    renderer->render();
+    renderer->endFrame();
+
+    glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+}
+
+struct RecordJob {
+    Renderer* renderer;
+    Scene* scene;
+};
+
+/**
+ * Records the scene either into the main command buffer or split into
+ * consecutive parts, one per thread command buffer.
+ */
+static void recordScene(Renderer* renderer, Scene* scene, JobSystem* jobs, bool threaded) {
+    if (!threaded) {
+        for (int i = 0; i < scene->count; ++i) {
+            renderer->commands.push(&scene->rects[i]);
+        }
+        recordText(&renderer->commands);
+        return;
+    }
+
+    RecordJob job = { renderer, scene };
+    jobs->run(+[](void* data, int index) {
+        RecordJob* job = (RecordJob*)data;
+        int first = job->scene->count * index / THREAD_COUNT;
+        int onePastLast = job->scene->count * (index + 1) / THREAD_COUNT;
+        for (int i = first; i < onePastLast; ++i) {
+            job->renderer->threadCommands[index].push(&job->scene->rects[i]);
+        }
+        if (index == THREAD_COUNT - 1) {
+            recordText(&job->renderer->threadCommands[index]);
+        }
+    }, &job, THREAD_COUNT);
+}
+
+static void renderScene(Renderer* renderer, Scene* scene, JobSystem* jobs, bool instanced, bool threaded, u8* pixels) {
+    float projection[16] = {
+        2.0f / WIDTH, 0.0f,  0.0f, -1.0f,
+        0.0f, 2.0f / HEIGHT, 0.0f, -1.0f,
+        0.0f, 0.0f,                1.0f, 0.0f,
+        0.0f, 0.0f,                0.0f, 1.0f,
+    };
+
+    renderer->beginFrame();
+    recordScene(renderer, scene, jobs, threaded);
+
+    glViewport(0, 0, WIDTH, HEIGHT);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    renderer->useInstancedRects = instanced;
+    renderer->setProjection(projection);
+    renderer->render();
+    renderer->endFrame();
+
+    glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+}
+
+static void renderSceneSoftware(Renderer* renderer, SoftwareRenderer* software, Scene* scene, JobSystem* jobs, u8* pixels) {
+    float projection[16] = {
+        2.0f / WIDTH, 0.0f,  0.0f, -1.0f,
+        0.0f, 2.0f / HEIGHT, 0.0f, -1.0f,
+        0.0f, 0.0f,                1.0f, 0.0f,
+        0.0f, 0.0f,                0.0f, 1.0f,
+    };
+
+    // Only the command buffers of the renderer are used
+    renderer->beginFrame();
+    recordScene(renderer, scene, jobs, true);
+
+    RenderCommandBuffer* buffers[1 + MAX_THREAD_COMMAND_BUFFERS];
+    int bufferCount = renderer->collectCommandBuffers(buffers);
+
+    SoftwareFramebuffer framebuffer = { (u32*)pixels, WIDTH, HEIGHT };
+    clearFramebuffer(&framebuffer, { 0.0f, 0.0f, 0.0f, 1.0f });
+    software->setProjection(projection);
+    software->render(buffers, bufferCount, &framebuffer);
+    renderer->endFrame();
+}
+
+static void renderClippedScene(Renderer* renderer, SoftwareRenderer* software, AtlasRegion* checker, bool trim, u8* pixels) {
+    float projection[16] = {
+        2.0f / WIDTH, 0.0f,  0.0f, -1.0f,
+        0.0f, 2.0f / HEIGHT, 0.0f, -1.0f,
+        0.0f, 0.0f,                1.0f, 0.0f,
+        0.0f, 0.0f,                0.0f, 1.0f,
+    };
+
+    renderer->beginFrame();
+    renderer->commands.useClipTrimming = trim;
+    recordClippedScene(&renderer->commands, checker);
+
+    if (software) {
+        RenderCommandBuffer* buffers[] = { &renderer->commands };
+        SoftwareFramebuffer framebuffer = { (u32*)pixels, WIDTH, HEIGHT };
+        clearFramebuffer(&framebuffer, { 0.0f, 0.0f, 0.0f, 1.0f });
+        software->setProjection(projection);
+        software->render(buffers, 1, &framebuffer);
+    }
+    else {
+        glViewport(0, 0, WIDTH, HEIGHT);
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        renderer->useInstancedRects = true;
+        renderer->setProjection(projection);
+        renderer->render();
+        glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    }
+    renderer->endFrame();
+    renderer->commands.useClipTrimming = true;
+}
+
+/**
+ * Rectangles of one layer that overlap the one before them: an opaque one on
+ * a translucent one, an opaque one on a scissored opaque one and a
+ * translucent one on an opaque one. They have to be drawn in submission
+ * order, which the software renderer does for a single layer.
+ */
+static void recordOverlapScene(RenderCommandBuffer* commands) {
+    RenderCommandRectangle rect = {};
+    rect.type = Render_Rectangle;
+
+    rect.x = 100.0f, rect.y = 100.0f, rect.width = 200.0f, rect.height = 200.0f;
+    rect.color = { 0.0f, 0.0f, 1.0f, 0.5f };
+    commands->push(&rect);
+    rect.x = 150.0f, rect.y = 150.0f, rect.width = 100.0f, rect.height = 100.0f;
+    rect.color = RED;
+    commands->push(&rect);
+
+    // Without trimming, the opaque rectangle inside the clip rect gets the scissor
+    commands->useClipTrimming = false;
+    commands->pushClip(340.0f, 100.0f, 200.0f, 200.0f);
+    rect.x = 360.0f, rect.y = 120.0f, rect.width = 160.0f, rect.height = 160.0f;
+    rect.color = GREEN;
+    commands->push(&rect);
+    commands->popClip();
+    commands->useClipTrimming = true;
+    rect.x = 400.0f, rect.y = 160.0f, rect.width = 80.0f, rect.height = 80.0f;
+    rect.color = WHITE;
+    commands->push(&rect);
+
+    rect.x = 200.0f, rect.y = 200.0f, rect.width = 200.0f, rect.height = 60.0f;
+    rect.color = { 1.0f, 1.0f, 0.0f, 0.5f };
+    commands->push(&rect);
+}
+
+static void renderOverlapScene(Renderer* renderer, SoftwareRenderer* software, bool instanced, u8* pixels) {
+    float projection[16] = {
+        2.0f / WIDTH, 0.0f,  0.0f, -1.0f,
+        0.0f, 2.0f / HEIGHT, 0.0f, -1.0f,
+        0.0f, 0.0f,                1.0f, 0.0f,
+        0.0f, 0.0f,                0.0f, 1.0f,
+    };
+
+    renderer->beginFrame();
+    recordOverlapScene(&renderer->commands);
+    if (software) {
+        RenderCommandBuffer* buffers[] = { &renderer->commands };
+        SoftwareFramebuffer framebuffer = { (u32*)pixels, WIDTH, HEIGHT };
+        clearFramebuffer(&framebuffer, { 0.0f, 0.0f, 0.0f, 1.0f });
+        software->setProjection(projection);
+        software->render(buffers, 1, &framebuffer);
+    }
+    else {
+        glViewport(0, 0, WIDTH, HEIGHT);
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        renderer->useInstancedRects = instanced;
+        renderer->setProjection(projection);
+        renderer->render();
+        glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    }
+    renderer->endFrame();
+    renderer->useInstancedRects = true;
+}
+
+/**
+ * Records a crossing rectangle and shape in more clip rects than there are
+ * scissor rects, with trimming off so each one needs the scissor. The ones
+ * without a scissor rect have to be trimmed to their clip rect instead.
+ */
+static bool checkScissorOverflow(void* memory, u64 size) {
+    RenderCommandBuffer commands = {};
+    commands.create(memory, size, nullptr);
+    commands.useClipTrimming = false;
+    u32 clipCount = MAX_SCISSOR_RECTS + 2;
+    for (u32 i = 0; i < clipCount; ++i) {
+        commands.pushClip(2.0f * i, 0.0f, 10.0f, 10.0f);
+        RenderCommandRectangle rect = {};
+        rect.type = Render_Rectangle;
+        rect.x = 2.0f * i - 5.0f, rect.y = -5.0f, rect.width = 20.0f, rect.height = 20.0f;
+        rect.color = WHITE;
+        commands.push(&rect);
+        RenderCommandRoundedRect rounded = {};
+        rounded.type = Render_Rectangle;
+        rounded.x = rect.x, rounded.y = rect.y, rounded.width = rect.width, rounded.height = rect.height;
+        rounded.radius = 4.0f;
+        rounded.color = WHITE;
+        commands.push(&rounded);
+        commands.popClip();
+    }
+
+    u32 index = 0;
+    u32 unclipped = 0;
+    for (RenderCommandChunk* chunk = commands.chunks; chunk; chunk = chunk->next) {
+        for (RenderCommand* command = chunk->first(); command < chunk->onePastLast(); command = nextRenderCommand(command)) {
+            RenderCommandRectangle* rect = (RenderCommandRectangle*)command;
+            ClipRect clip = { 2.0f * (index / 2), 0.0f, 2.0f * (index / 2) + 10.0f, 10.0f };
+            if (rect->scissor == 0 && clipOverlap(rect, clip) != Clip_Inside) {
+                unclipped += 1;
+            }
+            index += 1;
+        }
+    }
+    return index == 2 * clipCount && unclipped == 0 && commands.clipStats.scissorOverflow == 2 * (clipCount - MAX_SCISSOR_RECTS);
+}
+
+static bool isPixel(u8* pixels, int x, int y, u8 red, u8 green, u8 blue) {
+    u8* pixel = pixels + 4 * (y * WIDTH + x);
+    return pixel[0] == red && pixel[1] == green && pixel[2] == blue;
+}
+
+static void emptyPass(RenderGraph* graph, RenderGraphPass* pass, void* data) {
+}
+
+/**
+ * Every pass has to run after the producers of what it reads, and targets
+ * sharing a texture must not be alive at the same time. The backend has to
+ * have seen the same schedule and memory plan as the graph.
+ */
+static bool isValidRenderPlan(RenderGraph* graph, NullRenderBackend* backend) {
+    bool valid = backend->passCount == graph->scheduleCount && backend->targetBytes == graph->stats.allocatedBytes;
+    for (int index = 0; index < graph->passCount; ++index) {
+        RenderGraphPass* pass = &graph->passes[index];
+        int position = backend->positionOf(index);
+        valid = valid && (position < 0) == pass->culled;
+        for (int i = 0; i < pass->readCount && position >= 0; ++i) {
+            int producer = graph->versions[pass->reads[i]].producer;
+            valid = valid && (producer < 0 || backend->positionOf(producer) < position);
+        }
+    }
+    for (int a = 0; a < graph->targetCount; ++a) {
+        for (int b = a + 1; b < graph->targetCount; ++b) {
+            RenderGraphTarget* first = &graph->targets[a];
+            RenderGraphTarget* second = &graph->targets[b];
+            bool shared = first->physical >= 0 && first->physical == second->physical;
+            valid = valid && (!shared || first->lastUse < second->firstUse || second->lastUse < first->firstUse);
+        }
+    }
+    return valid;
+}
+
+/**
+ * Bloom and glow chains on a scene, with the passes added in a different order
+ * than they have to run in. The debug view is never read, so it is culled.
+ */
+static void buildPostProcessingGraph(RenderGraph* graph) {
+    graph->reset();
+    RenderResource backbuffer = graph->importTarget("backbuffer", { WIDTH, HEIGHT, RenderFormat_RGBA8 }, 0);
+    RenderResource shadow = graph->createTarget("shadow", { 1024, 1024, RenderFormat_Depth24Stencil8 });
+    RenderResource scene = graph->createTarget("scene", { WIDTH, HEIGHT, RenderFormat_RGBA16F });
+    RenderResource depth = graph->createTarget("depth", { WIDTH, HEIGHT, RenderFormat_Depth24Stencil8 });
+    RenderResource bloomHalf = graph->createTarget("bloom half", { WIDTH / 2, HEIGHT / 2, RenderFormat_RGBA16F });
+    RenderResource bloomQuarter = graph->createTarget("bloom quarter", { WIDTH / 4, HEIGHT / 4, RenderFormat_RGBA16F });
+    RenderResource glowQuarter = graph->createTarget("glow quarter", { WIDTH / 4, HEIGHT / 4, RenderFormat_RGBA16F });
+    RenderResource blurred = graph->createTarget("blurred", { WIDTH / 2, HEIGHT / 2, RenderFormat_RGBA16F });
+    RenderResource debug = graph->createTarget("debug", { WIDTH, HEIGHT, RenderFormat_RGBA8 });
+
+    int compositePass = graph->addPass("composite", &emptyPass, nullptr);
+    int glowUpPass = graph->addPass("glow up", &emptyPass, nullptr);
+    int bloomUpPass = graph->addPass("bloom up", &emptyPass, nullptr);
+    int debugPass = graph->addPass("debug", &emptyPass, nullptr);
+    int bloomQuarterPass = graph->addPass("bloom quarter", &emptyPass, nullptr);
+    int bloomHalfPass = graph->addPass("bloom half", &emptyPass, nullptr);
+    int glowDownPass = graph->addPass("glow down", &emptyPass, nullptr);
+    int scenePass = graph->addPass("scene", &emptyPass, nullptr);
+    int shadowPass = graph->addPass("shadow", &emptyPass, nullptr);
+
+    shadow = graph->clear(shadowPass, shadow, {});
+    graph->read(scenePass, shadow);
+    scene = graph->clear(scenePass, scene, BLACK);
+    depth = graph->clear(scenePass, depth, {});
+
+    graph->read(debugPass, depth);
+    graph->clear(debugPass, debug, {});
+
+    graph->read(bloomHalfPass, scene);
+    bloomHalf = graph->clear(bloomHalfPass, bloomHalf, {});
+    graph->read(bloomQuarterPass, bloomHalf);
+    bloomQuarter = graph->clear(bloomQuarterPass, bloomQuarter, {});
+    graph->read(bloomUpPass, bloomQuarter);
+    blurred = graph->clear(bloomUpPass, blurred, {});
+
+    graph->read(glowDownPass, scene);
+    glowQuarter = graph->clear(glowDownPass, glowQuarter, {});
+    graph->read(glowUpPass, glowQuarter);
+    blurred = graph->write(glowUpPass, blurred);
+
+    graph->read(compositePass, scene);
+    graph->read(compositePass, blurred);
+    graph->write(compositePass, backbuffer);
+}
+
+static bool checkRenderGraph(RenderGraph* graph, RenderGraphStats* aliasedStats, RenderGraphStats* separateStats) {
+    NullRenderBackend backend = createNullRenderBackend();
+    buildPostProcessingGraph(graph);
+    bool valid = graph->compile();
+    graph->execute(&backend);
+    valid = valid && isValidRenderPlan(graph, &backend);
+    *aliasedStats = graph->stats;
+
+    graph->useAliasing = false;
+    backend.reset();
+    buildPostProcessingGraph(graph);
+    valid = valid && graph->compile();
+    graph->execute(&backend);
+    valid = valid && isValidRenderPlan(graph, &backend);
+    *separateStats = graph->stats;
+    graph->useAliasing = true;
+
+    // A transient output is read after the graph ran, the later blur target must not take its texture
+    graph->reset();
+    RenderResource backbuffer = graph->importTarget("backbuffer", { 64, 64, RenderFormat_RGBA8 }, 0);
+    RenderResource history = graph->createTarget("history", { 64, 64, RenderFormat_RGBA8 });
+    RenderResource blur = graph->createTarget("blur", { 64, 64, RenderFormat_RGBA8 });
+    int historyPass = graph->addPass("history", &emptyPass, nullptr);
+    int blurPass = graph->addPass("blur", &emptyPass, nullptr);
+    int presentPass = graph->addPass("present", &emptyPass, nullptr);
+    history = graph->clear(historyPass, history, {});
+    graph->markOutput(history);
+    blur = graph->clear(blurPass, blur, {});
+    graph->read(presentPass, blur);
+    graph->write(presentPass, backbuffer);
+    backend.reset();
+    bool outputKept = graph->compile();
+    graph->execute(&backend);
+    outputKept = outputKept && isValidRenderPlan(graph, &backend);
+    RenderGraphTarget* historyTarget = &graph->targets[graph->versions[history].target];
+    for (int i = 0; i < graph->targetCount; ++i) {
+        RenderGraphTarget* target = &graph->targets[i];
+        outputKept = outputKept && (target == historyTarget || target->physical != historyTarget->physical);
+    }
+
+    // The second pass reads what the first one writes, and the other way around
+    graph->reset();
+    RenderResource a = graph->createTarget("a", { 64, 64, RenderFormat_RGBA8 });
+    RenderResource b = graph->createTarget("b", { 64, 64, RenderFormat_RGBA8 });
+    int first = graph->addPass("first", &emptyPass, nullptr);
+    int second = graph->addPass("second", &emptyPass, nullptr);
+    a = graph->clear(first, a, {});
+    graph->read(second, a);
+    b = graph->clear(second, b, {});
+    graph->read(first, b);
+    graph->markOutput(b);
+    bool cycleRejected = !graph->compile();
+
+    // The quarter sized bloom and glow targets and the half sized ones alias
+    return valid && outputKept && cycleRejected && aliasedStats->culledPasses == 1
+        && aliasedStats->allocatedBytes < separateStats->allocatedBytes
+        && separateStats->physicalTargets == separateStats->transientTargets;
+}
+
+static u64 countMismatches(u8* expected, u8* actual, u64 pixelBytes, int tolerance, int* maxDifference) {
+    u64 mismatches = 0;
+    for (u64 i = 0; i < pixelBytes; i += 4) {
+        bool mismatch = false;
+        for (u64 c = 0; c < 4; ++c) {
+            int difference = abs((int)expected[i + c] - (int)actual[i + c]);
+            *maxDifference = difference > *maxDifference ? difference : *maxDifference;
+            mismatch = mismatch || difference > tolerance;
+        }
+        mismatches += mismatch ? 1 : 0;
+    }
+    return mismatches;
+}
+
+static u64 countExactMismatches(u8* expected, u8* actual, u64 pixelBytes) {
+    u64 mismatches = 0;
+    for (u64 i = 0; i < pixelBytes; i += 4) {
+        mismatches += memcmp(expected + i, actual + i, 4) != 0 ? 1 : 0;
+    }
+    return mismatches;
+}
+
+static void writePpm(const char* filename, u8* pixels) {
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        fprintf(stderr, "Could not open %s for writing\n", filename);
+        return;
+    }
+    defer{ fclose(file); };
+
+    fprintf(file, "P6\n%d %d\n255\n", WIDTH, HEIGHT);
+    // OpenGL returns the bottom row first
+    for (int y = HEIGHT - 1; y >= 0; --y) {
+        for (int x = 0; x < WIDTH; ++x) {
+            fwrite(pixels + 4 * (y * WIDTH + x), 1, 3, file);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    HeadlessContext headless = {};
+    if (!gl_createHeadlessContext(&headless)) {
+        return 1;
+    }
+    defer{ gl_destroyHeadlessContext(&headless); };
+
+    printf("OpenGL renderer: %s\n", (const char*)glGetString(GL_RENDERER));
+
+    OffscreenTarget target = {};
+    if (!gl_createOffscreenTarget(&target, WIDTH, HEIGHT)) {
+        fprintf(stderr, "Offscreen framebuffer is incomplete\n");
+        return 1;
+    }
+
+    Allocator pageAllocator = createPageAllocator();
+    int renderMemorySize = 1 * MB;
+    void* renderMemory = pageAllocator.allocate(renderMemorySize);
+    defer{ pageAllocator.free(renderMemory, renderMemorySize); };
+
+    int threadMemorySize = 256 * KB;
+    void* threadMemory = pageAllocator.allocate(threadMemorySize);
+    defer{ pageAllocator.free(threadMemory, threadMemorySize); };
+
+    // Workers record the split scene and upload the command buffers in parallel
+    JobSystem jobs = {};
+    jobs.create(THREAD_COUNT - 1);
+    defer{ jobs.destroy(); };
+
+    Renderer renderer = {};
+    renderer.setup(renderMemory, renderMemorySize);
+    renderer.setupThreadCommands(THREAD_COUNT, threadMemory, threadMemorySize);
+    renderer.jobSystem = &jobs;
+
+    // Recreate the atlas with a shadow copy, so the software renderer can sample it
+    u64 atlasBytes = 4ULL * DEFAULT_ATLAS_SIZE * DEFAULT_ATLAS_SIZE;
+    u32* atlasShadow = (u32*)pageAllocator.allocate(atlasBytes);
+    defer{ pageAllocator.free(atlasShadow, atlasBytes); };
+    renderer.atlas.destroy();
+    renderer.atlas.create(DEFAULT_ATLAS_SIZE, DEFAULT_ATLAS_SIZE, atlasShadow);
+
+    AtlasRegion checker = {};
+    AtlasRegion gradient = {};
+    fillAtlas(&renderer.atlas, &checker, &gradient);
+
+    // An image as wide as the atlas does not fit with its padding, it must neither be uploaded nor evict anything
+    AtlasStats atlasBefore = renderer.atlas.stats;
+    AtlasHandle wideHandle = renderer.atlas.insert(DEFAULT_ATLAS_SIZE, 1, atlasShadow);
+    bool wideRejected = wideHandle.generation == 0 && renderer.atlas.stats.failedInserts == atlasBefore.failedInserts + 1
+        && renderer.atlas.stats.uploads == atlasBefore.uploads && renderer.atlas.stats.evictedShelves == atlasBefore.evictedShelves;
+
+    static Scene scene;
+    fillScene(&scene, &checker, &gradient);
+
+    // Without the font, the text commands draw nothing
+    const char* fontPath = argc > 2 ? argv[2] : DEFAULT_FONT;
+    u8* fontData = nullptr;
+    TrueTypeFont font = {};
+    FILE* fontFile = fopen(fontPath, "rb");
+    if (fontFile) {
+        fseek(fontFile, 0, SEEK_END);
+        long fontSize = ftell(fontFile);
+        fseek(fontFile, 0, SEEK_SET);
+        fontData = (u8*)malloc(fontSize);
+        if (fread(fontData, 1, fontSize, fontFile) == (size_t)fontSize && initTrueTypeFont(&font, fontData, fontSize)) {
+            renderer.glyphCache.setFont(&font);
+        }
+        fclose(fontFile);
+    }
+    else {
+        printf("font %s not found, skipping text\n", fontPath);
+    }
+    defer{ free(fontData); };
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+
+    u64 pixelBytes = 4ULL * WIDTH * HEIGHT;
+    u8* instancedPixels = (u8*)malloc(pixelBytes);
+    u8* expandedPixels = (u8*)malloc(pixelBytes);
+    u8* threadedPixels = (u8*)malloc(pixelBytes);
+    u8* referencePixels = (u8*)malloc(pixelBytes);
+    u8* cachedPixels = (u8*)malloc(pixelBytes);
+    u8* unculledPixels = (u8*)malloc(pixelBytes);
+    u8* softwarePixels = (u8*)malloc(pixelBytes);
+    u8* meshPixels = (u8*)malloc(pixelBytes);
+    u8* singleMeshPixels = (u8*)malloc(pixelBytes);
+    defer{
+        free(instancedPixels); free(expandedPixels); free(threadedPixels); free(referencePixels);
+        free(cachedPixels); free(unculledPixels); free(softwarePixels); free(meshPixels); free(singleMeshPixels);
+    };
+
+    // Render a few frames per path, so every region of the streaming buffer is reused
+    for (int frame = 0; frame <= STREAMING_BUFFER_REGIONS; ++frame) {
+        renderScene(&renderer, &scene, &jobs, true, false, instancedPixels);
+    }
+    for (int frame = 0; frame <= STREAMING_BUFFER_REGIONS; ++frame) {
+        renderScene(&renderer, &scene, &jobs, false, false, expandedPixels);
+    }
+
+    int maxDifference = 0;
+    u64 mismatches = countMismatches(instancedPixels, expandedPixels, pixelBytes, COLOR_TOLERANCE, &maxDifference);
+    CullStats cullStats = renderer.cullStats;
+
+    // Culled rectangles must not have been visible
+    renderer.useViewportCulling = false;
+    renderer.useOcclusionCulling = false;
+    renderScene(&renderer, &scene, &jobs, true, false, unculledPixels);
+    renderer.useViewportCulling = true;
+    renderer.useOcclusionCulling = true;
+    u64 cullMismatches = countExactMismatches(instancedPixels, unculledPixels, pixelBytes);
+    bool culledHidden = cullStats.viewportCulled == 8 && cullStats.occlusionCulled >= 8;
+
+    // Splitting the scene across threads must not change the draw order
+    renderScene(&renderer, &scene, &jobs, true, true, threadedPixels);
+    u64 threadedMismatches = countExactMismatches(instancedPixels, threadedPixels, pixelBytes);
+    renderScene(&renderer, &scene, &jobs, false, true, threadedPixels);
+    threadedMismatches += countExactMismatches(expandedPixels, threadedPixels, pixelBytes);
+
+    // The AVX2 expansion writes the same vertices as the scalar loop
+    renderer.useAvx2Expansion = true;
+    renderScene(&renderer, &scene, &jobs, false, false, threadedPixels);
+    renderer.useAvx2Expansion = false;
+    u64 avx2Mismatches = countExactMismatches(expandedPixels, threadedPixels, pixelBytes);
+
+    u64 softwareMemorySize = 16 * MB;
+    void* softwareMemory = pageAllocator.allocate(softwareMemorySize);
+    defer{ pageAllocator.free(softwareMemory, softwareMemorySize); };
+
+    SoftwareRenderer software = {};
+    software.setup(softwareMemory, softwareMemorySize);
+    software.jobSystem = &jobs;
+    software.texture = { atlasShadow, DEFAULT_ATLAS_SIZE, DEFAULT_ATLAS_SIZE };
+    software.glyphCache = &renderer.glyphCache;
+    renderSceneSoftware(&renderer, &software, &scene, &jobs, softwarePixels);
+    int softwareMaxDifference = 0;
+    u64 softwareMismatches = countMismatches(instancedPixels, softwarePixels, pixelBytes, SOFTWARE_COLOR_TOLERANCE, &softwareMaxDifference);
+
+    // The retained cache must give the same result as a full upload, also after a partial change.
+    // The changed rectangle is opaque, so it stays in the second segment of the sorted and culled commands.
+    static Scene changedScene;
+    changedScene = scene;
+    changedScene.rects[300].rect.color = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+    renderer.useRetainedCache = false;
+    renderScene(&renderer, &changedScene, &jobs, true, false, referencePixels);
+    renderer.useRetainedCache = true;
+    renderScene(&renderer, &scene, &jobs, true, false, cachedPixels);
+    renderScene(&renderer, &changedScene, &jobs, true, false, cachedPixels);
+    RetainedStats changeStats = renderer.retainedCache.frameStats;
+    u64 cacheMismatches = countExactMismatches(referencePixels, cachedPixels, pixelBytes);
+    bool onlyChangedSegment = changeStats.segmentMisses == 1;
+
+    u32 batchCount = renderer.batchCount;
+
+    // Redrawing only the damage must give the same pixels as the full redraws above
+    u8* damagedPixels = unculledPixels;
+    renderer.useDamageTracking = true;
+    renderScene(&renderer, &scene, &jobs, true, false, damagedPixels);
+    u64 damageMismatches = countExactMismatches(instancedPixels, damagedPixels, pixelBytes);
+    renderScene(&renderer, &scene, &jobs, true, false, damagedPixels);
+    bool unchangedSkipped = renderer.frameSkipped;
+    DamageStats damageBefore = renderer.damage.stats;
+    renderScene(&renderer, &changedScene, &jobs, true, false, damagedPixels);
+    damageMismatches += countExactMismatches(referencePixels, damagedPixels, pixelBytes);
+    double redrawnFraction = (double)(renderer.damage.stats.redrawnPixels - damageBefore.redrawnPixels) / ((double)WIDTH * HEIGHT);
+    int damageRectCount = renderer.damage.rectCount;
+    renderer.useDamageTracking = false;
+    bool partialRedraw = !renderer.frameSkipped && redrawnFraction > 0.0 && redrawnFraction < 0.1;
+
+    // Trimming must clip to the same pixels as the scissor, with fewer batches
+    u8* scissorPixels = referencePixels;
+    u8* trimmedPixels = cachedPixels;
+    renderClippedScene(&renderer, nullptr, &checker, false, scissorPixels);
+    u32 scissorOnlyBatches = renderer.batchCount;
+    renderClippedScene(&renderer, nullptr, &checker, true, trimmedPixels);
+    u32 trimmedBatches = renderer.batchCount;
+    u32 scissorBatches = renderer.scissorBatchCount;
+    ClipStats clipStats = renderer.commands.clipStats;
+    u64 clipMismatches = countExactMismatches(scissorPixels, trimmedPixels, pixelBytes);
+    renderClippedScene(&renderer, &software, &checker, true, softwarePixels);
+    int clipMaxDifference = 0;
+    u64 softwareClipMismatches = countMismatches(trimmedPixels, softwarePixels, pixelBytes, SOFTWARE_COLOR_TOLERANCE, &clipMaxDifference);
+    bool batchesSaved = trimmedBatches < scissorOnlyBatches && scissorBatches > 0 && clipStats.culled >= 3;
+
+    // The later rectangle of an overlapping pair has to be on top in both paths
+    u8* overlapPixels = scissorPixels;
+    u8* expandedOverlapPixels = trimmedPixels;
+    renderOverlapScene(&renderer, nullptr, true, overlapPixels);
+    renderOverlapScene(&renderer, nullptr, false, expandedOverlapPixels);
+    u64 overlapMismatches = countExactMismatches(overlapPixels, expandedOverlapPixels, pixelBytes);
+    renderOverlapScene(&renderer, &software, true, softwarePixels);
+    int overlapMaxDifference = 0;
+    overlapMismatches += countMismatches(overlapPixels, softwarePixels, pixelBytes, SOFTWARE_COLOR_TOLERANCE, &overlapMaxDifference);
+    bool submissionOrderKept = isPixel(overlapPixels, 170, 170, 255, 0, 0) && isPixel(overlapPixels, 440, 180, 255, 255, 255);
+    bool overflowClipped = checkScissorOverflow(softwarePixels, pixelBytes);
+
+    // The center is only covered by the near cube, the top right corner of the far cube is not
+    MeshHandle cube = uploadCube(&renderer.meshes);
+    renderer.meshCulling = MeshCulling_None;
+    renderMeshScene(&renderer, cube, false, false, singleMeshPixels);
+    renderMeshScene(&renderer, cube, true, false, meshPixels);
+    u32 meshDrawCount = renderer.meshDrawCount;
+    u32 meshDrawCalls = renderer.meshDrawCalls;
+    u64 meshMismatches = countExactMismatches(singleMeshPixels, meshPixels, pixelBytes);
+
+    // Culling on the CPU and on the GPU must draw the same meshes as no culling at all
+    u8* culledMeshPixels = referencePixels;
+    renderMeshScene(&renderer, cube, true, true, singleMeshPixels);
+    renderer.meshCulling = MeshCulling_Cpu;
+    renderMeshScene(&renderer, cube, true, true, culledMeshPixels);
+    u32 gridMeshes = renderer.meshDrawCount;
+    u32 cpuVisibleMeshes = gridMeshes - renderer.meshCulledCount;
+    u64 cullMeshMismatches = countExactMismatches(singleMeshPixels, culledMeshPixels, pixelBytes);
+    u32 gpuVisibleMeshes = cpuVisibleMeshes;
+    if (renderer.gpuMeshCullingSupported) {
+        renderer.meshCulling = MeshCulling_Gpu;
+        renderMeshScene(&renderer, cube, true, true, culledMeshPixels);
+        // Replacing the streaming buffer must not lose the counts of the culled frame
+        renderer.streamingBuffer.allocate(2 * renderer.streamingBuffer.regionSize, 16);
+        gpuVisibleMeshes = renderer.readGpuVisibleMeshes();
+        cullMeshMismatches += countExactMismatches(singleMeshPixels, culledMeshPixels, pixelBytes);
+    }
+    else {
+        printf("GPU mesh culling is not supported, only the CPU fallback is checked\n");
+    }
+    bool meshesCulled = cpuVisibleMeshes < gridMeshes && cpuVisibleMeshes == gpuVisibleMeshes;
+    u8* center = meshPixels + 4 * (HEIGHT / 2 * WIDTH + WIDTH / 2);
+    int farX = WIDTH / 2 + (int)(2.4f * 0.125f * HEIGHT);
+    int farY = HEIGHT / 2 + (int)(2.4f * 0.125f * HEIGHT);
+    u8* far = meshPixels + 4 * (farY * WIDTH + farX);
+    bool nearMeshInFront = center[0] > 0 && center[1] == 0 && far[0] == 0 && far[1] > 0;
+
+    RenderGraph* graph = (RenderGraph*)malloc(sizeof(RenderGraph));
+    graph->create();
+    RenderGraphStats aliasedStats = {};
+    RenderGraphStats separateStats = {};
+    bool validRenderGraph = checkRenderGraph(graph, &aliasedStats, &separateStats);
+    free(graph);
+
+    int rectCount = scene.count;
+    printf("rects: %d, instanced upload: %llu bytes, expanded upload: %llu bytes\n", rectCount,
+        (unsigned long long)(rectCount * sizeof(RectInstance)),
+        (unsigned long long)(rectCount * sizeof(ExpandedRect)));
+    printf("state batches: %u\n", batchCount);
+    GlyphCacheStats glyphStats = renderer.glyphCache.stats;
+    printf("glyphs: %llu lookups, %llu rasterized with %llu pixels\n", (unsigned long long)glyphStats.lookups,
+        (unsigned long long)glyphStats.rasterizedGlyphs, (unsigned long long)glyphStats.rasterizedPixels);
+    AtlasStats atlasStats = renderer.atlas.stats;
+    printf("atlas: %llu uploads, %llu bytes, %llu evicted shelves\n", (unsigned long long)atlasStats.uploads,
+        (unsigned long long)atlasStats.uploadedBytes, (unsigned long long)atlasStats.evictedShelves);
+    printf("image wider than the atlas rejected: %s\n", wideRejected ? "yes" : "no");
+    printf("culled: %llu of %llu outside the viewport, %llu occluded\n", (unsigned long long)cullStats.viewportCulled,
+        (unsigned long long)cullStats.inputCommands, (unsigned long long)cullStats.occlusionCulled);
+    printf("mismatching pixels without culling: %llu\n", (unsigned long long)cullMismatches);
+    printf("mismatching pixels: %llu, max channel difference: %d\n", (unsigned long long)mismatches, maxDifference);
+    printf("mismatching pixels with %d thread command buffers: %llu\n", THREAD_COUNT, (unsigned long long)threadedMismatches);
+    printf("mismatching pixels with the AVX2 expansion: %llu\n", (unsigned long long)avx2Mismatches);
+    printf("retained cache after one change: %llu hits, %llu misses, %llu bytes uploaded, %llu bytes reused\n",
+        (unsigned long long)changeStats.segmentHits, (unsigned long long)changeStats.segmentMisses,
+        (unsigned long long)changeStats.bytesUploaded, (unsigned long long)changeStats.bytesReused);
+    printf("retained cache hit rate over all frames: %.2f\n", renderer.retainedCache.stats.hitRate());
+    printf("mismatching pixels with retained cache: %llu\n", (unsigned long long)cacheMismatches);
+    printf("mismatching pixels with software renderer: %llu, max channel difference: %d\n",
+        (unsigned long long)softwareMismatches, softwareMaxDifference);
+    printf("clipping: %u trimmed, %u culled, %u scissored, %u batches (%u scissored) instead of %u with the scissor only\n",
+        clipStats.trimmed, clipStats.culled, clipStats.scissored, trimmedBatches, scissorBatches, scissorOnlyBatches);
+    printf("mismatching pixels between trimming and scissor: %llu, with software renderer: %llu\n",
+        (unsigned long long)clipMismatches, (unsigned long long)softwareClipMismatches);
+    printf("overlapping rectangles in submission order: %s, mismatching pixels between the paths and the software renderer: %llu\n",
+        submissionOrderKept ? "yes" : "no", (unsigned long long)overlapMismatches);
+    printf("clip rects beyond the scissor rects trimmed: %s\n", overflowClipped ? "yes" : "no");
+    printf("damage tracking: unchanged frame skipped: %s, %.4f of the pixels redrawn in %d rects after one change\n",
+        unchangedSkipped ? "yes" : "no", redrawnFraction, damageRectCount);
+    printf("mismatching pixels with damage tracking: %llu\n", (unsigned long long)damageMismatches);
+    printf("render graph: %u of %u passes culled, %u transient targets in %u textures, %llu bytes instead of %llu, valid: %s\n",
+        aliasedStats.culledPasses, aliasedStats.passes, aliasedStats.transientTargets, aliasedStats.physicalTargets,
+        (unsigned long long)aliasedStats.allocatedBytes, (unsigned long long)separateStats.allocatedBytes,
+        validRenderGraph ? "yes" : "no");
+    MeshStats meshStats = renderer.meshes.stats;
+    printf("meshes: %llu uploads, %llu bytes, %u draws in %u multi-draw calls, near mesh in front: %s\n",
+        (unsigned long long)meshStats.uploads, (unsigned long long)meshStats.uploadedBytes,
+        meshDrawCount, meshDrawCalls, nearMeshInFront ? "yes" : "no");
+    printf("mismatching mesh pixels between multi-draw and single draws: %llu\n", (unsigned long long)meshMismatches);
+    printf("mesh frustum culling: %u of %u visible on the CPU, %u on the GPU, mismatching pixels: %llu\n",
+        cpuVisibleMeshes, gridMeshes, gpuVisibleMeshes, (unsigned long long)cullMeshMismatches);
+
+    if (argc > 1) {
+        writePpm(argv[1], instancedPixels);
+    }
+
+    bool passed = mismatches == 0 && threadedMismatches == 0 && avx2Mismatches == 0 && cacheMismatches == 0 && onlyChangedSegment
+        && cullMismatches == 0 && culledHidden && softwareMismatches == 0 && nearMeshInFront
+        && meshMismatches == 0 && meshesCulled && cullMeshMismatches == 0
+        && clipMismatches == 0 && softwareClipMismatches == 0 && batchesSaved
+        && overlapMismatches == 0 && submissionOrderKept && overflowClipped && wideRejected
+        && damageMismatches == 0 && unchangedSkipped && partialRedraw && validRenderGraph;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,347 @@
+/******************************************************************************
+* Capture replay
+*
+* Replays a frame capture (see fp_frame_capture.h) offscreen through one of the
+* renderer backends and reports percentiles of the CPU time per frame for each
+* phase. This allows to compare renderer changes on captured workloads.
+*
+* Build: g++ -O2 -mavx2 -pthread tools/replay_capture.cpp -lEGL -lGL -o replay_capture
+* Usage: replay_capture <capture> [--backend instanced|expanded|software] [--repeat N]
+*        replay_capture --generate <capture> [frames]
+*
+* --generate writes a synthetic capture with animated rectangles, e.g. to test
+* the tool without a Windows machine.
+*
+* Every result is printed as a single JSON object per line to stdout.
+*
+* Author: Fabian Paus
+*
+******************************************************************************/
+
+#include "../src/fp_core.h"
+#include "../src/fp_allocator.h"
+#include "../src/fp_egl.h"
+#include "../src/fp_frame_capture.h"
+#include "../src/fp_renderer.h"
+#include "../src/fp_software_renderer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum ReplayBackend {
+    Backend_Instanced,
+    Backend_Expanded,
+    Backend_Software,
+};
+
+// CPU time per replayed frame of each phase in milliseconds
+enum ReplayPhase {
+    Phase_Record,
+    Phase_Prepare,
+    Phase_Upload,
+    Phase_Submit,
+    Phase_Total,
+    Phase_Count,
+};
+
+static const char* PHASE_NAMES[Phase_Count] = { "record", "prepare", "upload", "submit", "total" };
+
+static int compareDouble(const void* a, const void* b) {
+    double left = *(const double*)a;
+    double right = *(const double*)b;
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+// Nearest rank percentile of sorted values
+static double percentile(double* sorted, u64 count, double p) {
+    u64 rank = (u64)(p / 100.0 * count + 0.5);
+    rank = rank < 1 ? 1 : (rank > count ? count : rank);
+    return sorted[rank - 1];
+}
+
+static void printPercentiles(const char* backend, const char* phase, double* samples, u64 count) {
+    qsort(samples, count, sizeof(double), compareDouble);
+    printf("{\"tool\":\"replay_capture\",\"backend\":\"%s\",\"phase\":\"%s\",\"frames\":%llu,"
+        "\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f}\n",
+        backend, phase, (unsigned long long)count, percentile(samples, count, 50.0),
+        percentile(samples, count, 90.0), percentile(samples, count, 99.0), samples[count - 1]);
+    fflush(stdout);
+}
+
+static double ticksToMs(u64 ticks) {
+    return (double)ticks * 1000.0 / (double)getPerformanceFrequency();
+}
+
+static int generateCapture(const char* filename, int frameCount) {
+    const int WIDTH = 1280;
+    const int HEIGHT = 720;
+    const int RECTS_PER_FRAME = 20000;
+
+    wchar_t path[1024];
+    if (mbstowcs(path, filename, 1024) >= 1024) {
+        fprintf(stderr, "Capture filename is too long\n");
+        return 1;
+    }
+
+    Allocator pageAllocator = createPageAllocator();
+    u64 commandMemorySize = RECTS_PER_FRAME * sizeof(RenderCommandRectangle);
+    u64 stagingMemorySize = 1 * MB;
+    void* commandMemory = pageAllocator.allocate(commandMemorySize);
+    void* stagingMemory = pageAllocator.allocate(stagingMemorySize);
+    defer{ pageAllocator.free(commandMemory, commandMemorySize); pageAllocator.free(stagingMemory, stagingMemorySize); };
+
+    RenderCommandBuffer commands = {};
+    commands.create(commandMemory, commandMemorySize, &pageAllocator);
+    defer{ commands.destroy(); };
+    RenderCommandBuffer* buffers[] = { &commands };
+
+    float projection[16] = {
+        2.0f / WIDTH, 0.0f,  0.0f, -1.0f,
+        0.0f, 2.0f / HEIGHT, 0.0f, -1.0f,
+        0.0f, 0.0f,                1.0f, 0.0f,
+        0.0f, 0.0f,                0.0f, 1.0f,
+    };
+
+    FrameCapture capture = {};
+    if (!capture.start(path, stagingMemory, stagingMemorySize)) {
+        return 1;
+    }
+
+    RenderCommandRectangle rect = {};
+    rect.type = Render_Rectangle;
+    for (int frame = 0; frame < frameCount; ++frame) {
+        commands.reset();
+
+        // Every rectangle moves a bit per frame, some are translucent
+        u64 state = 0x2545F4914F6CDD1DULL;
+        for (int i = 0; i < RECTS_PER_FRAME; ++i) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+
+            rect.x = (float)((state + frame * (1 + i % 5)) % WIDTH);
+            rect.y = (float)((state >> 16) % HEIGHT);
+            rect.width = (float)(4 + (state >> 32) % 60);
+            rect.height = (float)(4 + (state >> 40) % 60);
+            rect.color = {
+                (state & 0xFF) / 255.0f, ((state >> 8) & 0xFF) / 255.0f, ((state >> 24) & 0xFF) / 255.0f,
+                (state >> 48) % 4 == 0 ? 0.5f : 1.0f
+            };
+            commands.push(&rect);
+        }
+
+        capture.captureFrame(buffers, 1, WIDTH, HEIGHT, projection, 16.6, 0.0);
+    }
+    capture.stop();
+
+    printf("{\"tool\":\"replay_capture\",\"generated\":\"%s\",\"frames\":%d,\"rects_per_frame\":%d}\n",
+        filename, frameCount, RECTS_PER_FRAME);
+    return capture.failed ? 1 : 0;
+}
+
+static u8* readFile(const char* filename, u64* size) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        return nullptr;
+    }
+    defer{ fclose(file); };
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (length <= 0) {
+        return nullptr;
+    }
+
+    u8* data = (u8*)malloc(length);
+    if (data && fread(data, 1, length, file) != (size_t)length) {
+        free(data);
+        return nullptr;
+    }
+    *size = (u64)length;
+    return data;
+}
+
+int main(int argc, char** argv) {
+    if (argc >= 3 && strcmp(argv[1], "--generate") == 0) {
+        int frameCount = argc >= 4 ? atoi(argv[3]) : 120;
+        return generateCapture(argv[2], frameCount > 0 ? frameCount : 1);
+    }
+    if (argc < 2) {
+        fprintf(stderr, "Usage: replay_capture <capture> [--backend instanced|expanded|software] [--repeat N]\n");
+        fprintf(stderr, "       replay_capture --generate <capture> [frames]\n");
+        return 1;
+    }
+
+    ReplayBackend backend = Backend_Instanced;
+    const char* backendName = "instanced";
+    int repeat = 1;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--backend") == 0) {
+            backendName = argv[i + 1];
+            if (strcmp(backendName, "instanced") == 0) {
+                backend = Backend_Instanced;
+            }
+            else if (strcmp(backendName, "expanded") == 0) {
+                backend = Backend_Expanded;
+            }
+            else if (strcmp(backendName, "software") == 0) {
+                backend = Backend_Software;
+            }
+            else {
+                fprintf(stderr, "Unknown backend %s\n", backendName);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--repeat") == 0) {
+            repeat = atoi(argv[i + 1]);
+            repeat = repeat > 0 ? repeat : 1;
+        }
+    }
+
+    u64 fileSize = 0;
+    u8* fileData = readFile(argv[1], &fileSize);
+    if (!fileData) {
+        fprintf(stderr, "Could not read %s\n", argv[1]);
+        return 1;
+    }
+    defer{ free(fileData); };
+
+    // The first pass finds the sizes needed for the render targets and the command memory
+    CaptureReader reader = {};
+    if (!reader.open(fileData, fileSize)) {
+        fprintf(stderr, "%s is not a supported capture file\n", argv[1]);
+        return 1;
+    }
+    CaptureFrameHeader header = {};
+    u8* records = nullptr;
+    u64 frameCount = 0;
+    u32 maxRects = 0;
+    u32 maxWidth = 1;
+    u32 maxHeight = 1;
+    while (reader.nextFrame(&header, &records)) {
+        frameCount += 1;
+        maxRects = header.rectCount > maxRects ? header.rectCount : maxRects;
+        maxWidth = header.width > maxWidth ? header.width : maxWidth;
+        maxHeight = header.height > maxHeight ? header.height : maxHeight;
+    }
+    if (frameCount == 0) {
+        fprintf(stderr, "%s contains no frames\n", argv[1]);
+        return 1;
+    }
+    if (reader.offset != fileSize) {
+        fprintf(stderr, "Ignoring truncated data after frame %llu\n", (unsigned long long)frameCount);
+    }
+
+    HeadlessContext headless = {};
+    if (!gl_createHeadlessContext(&headless)) {
+        return 1;
+    }
+    defer{ gl_destroyHeadlessContext(&headless); };
+
+    OffscreenTarget target = {};
+    if (!gl_createOffscreenTarget(&target, maxWidth, maxHeight)) {
+        fprintf(stderr, "Offscreen framebuffer is incomplete\n");
+        return 1;
+    }
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+
+    // Half is used for the commands, the other half for temporary render data
+    Allocator pageAllocator = createPageAllocator();
+    u64 renderMemorySize = 2 * (u64)maxRects * 256 + 1 * MB;
+    void* renderMemory = pageAllocator.allocate(renderMemorySize);
+    defer{ pageAllocator.free(renderMemory, renderMemorySize); };
+
+    u64 pixelBytes = 4ULL * maxWidth * maxHeight;
+    u32* pixels = (u32*)pageAllocator.allocate(pixelBytes);
+    defer{ pageAllocator.free(pixels, pixelBytes); };
+
+    JobSystem jobs = {};
+    jobs.create(getProcessorCount() - 1);
+    defer{ jobs.destroy(); };
+
+    Renderer renderer = {};
+    renderer.setup(renderMemory, (int)renderMemorySize);
+    renderer.jobSystem = &jobs;
+    renderer.useInstancedRects = backend == Backend_Instanced;
+
+    SoftwareRenderer software = {};
+    software.setup((u8*)renderMemory + renderMemorySize / 2, renderMemorySize / 2);
+    software.jobSystem = &jobs;
+
+    u64 sampleCount = frameCount * repeat;
+    double* samples = (double*)malloc(Phase_Count * sampleCount * sizeof(double));
+    double* capturedCpuMs = (double*)malloc(frameCount * sizeof(double));
+    defer{ free(samples); free(capturedCpuMs); };
+
+    u64 sample = 0;
+    for (int iteration = 0; iteration < repeat; ++iteration) {
+        reader.open(fileData, fileSize);
+        u64 frame = 0;
+        while (frame < frameCount && reader.nextFrame(&header, &records)) {
+            capturedCpuMs[frame++] = header.cpuFrameMs;
+
+            renderer.beginFrame();
+
+            u64 startTicks = getPerformanceCounter();
+            AnyRectCommand rect;
+            ClipRect scissor;
+            u8* record = records;
+            for (u32 i = 0; i < header.rectCount; ++i) {
+                record += decodeCaptureRect(record, &rect, &scissor);
+                if (rect.rect.scissor) {
+                    renderer.commands.pushClip(scissor.minX, scissor.minY, scissor.maxX - scissor.minX, scissor.maxY - scissor.minY);
+                    renderer.commands.push(&rect);
+                    renderer.commands.popClip();
+                }
+                else {
+                    renderer.commands.push(&rect);
+                }
+            }
+            u64 recordTicks = getPerformanceCounter() - startTicks;
+
+            u64 renderStartTicks = getPerformanceCounter();
+            RenderTimings timings = {};
+            if (backend == Backend_Software) {
+                // Only the total render time is known for the software renderer, it is reported as submit
+                RenderCommandBuffer* buffers[] = { &renderer.commands };
+                SoftwareFramebuffer framebuffer = { pixels, (int)header.width, (int)header.height };
+                clearFramebuffer(&framebuffer, { 0.0f, 0.0f, 0.0f, 1.0f });
+                software.setProjection(header.projection);
+                software.render(buffers, 1, &framebuffer);
+                timings.submitTicks = getPerformanceCounter() - renderStartTicks;
+            }
+            else {
+                glViewport(0, 0, header.width, header.height);
+                glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+                glClear(GL_COLOR_BUFFER_BIT);
+                renderer.setProjection(header.projection);
+                renderer.render();
+                timings = renderer.timings;
+            }
+            u64 endTicks = getPerformanceCounter();
+
+            renderer.endFrame();
+
+            double* frameSamples = samples + sample;
+            frameSamples[Phase_Record * sampleCount] = ticksToMs(recordTicks);
+            frameSamples[Phase_Prepare * sampleCount] = ticksToMs(timings.prepareTicks);
+            frameSamples[Phase_Upload * sampleCount] = ticksToMs(timings.uploadTicks);
+            frameSamples[Phase_Submit * sampleCount] = ticksToMs(timings.submitTicks);
+            frameSamples[Phase_Total * sampleCount] = ticksToMs(endTicks - startTicks);
+            sample += 1;
+        }
+    }
+
+    for (int phase = 0; phase < Phase_Count; ++phase) {
+        printPercentiles(backendName, PHASE_NAMES[phase], samples + phase * sampleCount, sample);
+    }
+    printPercentiles("capture", "captured_cpu_frame", capturedCpuMs, frameCount);
+
+    return 0;
+}